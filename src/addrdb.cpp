@@ -19,7 +19,7 @@
 namespace {
 
 template <typename Stream, typename Data>
-bool SerializeDB(Stream& stream, const Data& data)
+bool SerializeDB(Stream& stream, const Data& data, uint256* phash = nullptr)
 {
     // Write and commit header, data
     try {
@@ -27,6 +27,8 @@ bool SerializeDB(Stream& stream, const Data& data)
         stream << FLATDATA(Params().MessageStart()) << data;
         hasher << FLATDATA(Params().MessageStart()) << data;
         stream << hasher.GetHash();
+        if (phash)
+            *phash = hasher.GetHash();
     } catch (const std::exception& e) {
         return error("%s: Serialize or I/O error - %s", __func__, e.what());
     }
@@ -35,7 +37,7 @@ bool SerializeDB(Stream& stream, const Data& data)
 }
 
 template <typename Data>
-bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data& data)
+bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data& data, uint256* phash = nullptr)
 {
     // Generate random temporary filename
     unsigned short randv = 0;
@@ -50,7 +52,7 @@ bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data
         return error("%s: Failed to open file %s", __func__, pathTmp.string());
 
     // Serialize
-    if (!SerializeDB(fileout, data)) return false;
+    if (!SerializeDB(fileout, data, phash)) return false;
     FileCommit(fileout.Get());
     fileout.fclose();
 
@@ -62,7 +64,7 @@ bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data
 }
 
 template <typename Stream, typename Data>
-bool DeserializeDB(Stream& stream, Data& data, bool fCheckSum = true)
+bool DeserializeDB(Stream& stream, Data& data, bool fCheckSum = true, uint256* phash = nullptr)
 {
     try {
         CHashVerifier<Stream> verifier(&stream);
@@ -83,6 +85,8 @@ bool DeserializeDB(Stream& stream, Data& data, bool fCheckSum = true)
             if (hashTmp != verifier.GetHash()) {
                 return error("%s: Checksum mismatch, data corrupted", __func__);
             }
+            if (phash)
+                *phash = hashTmp;
         }
     }
     catch (const std::exception& e) {
@@ -93,7 +97,7 @@ bool DeserializeDB(Stream& stream, Data& data, bool fCheckSum = true)
 }
 
 template <typename Data>
-bool DeserializeFileDB(const fs::path& path, Data& data)
+bool DeserializeFileDB(const fs::path& path, Data& data, uint256* phash = nullptr)
 {
     // open input file, and associate with CAutoFile
     FILE *file = fsbridge::fopen(path, "rb");
@@ -101,7 +105,7 @@ bool DeserializeFileDB(const fs::path& path, Data& data)
     if (filein.IsNull())
         return error("%s: Failed to open file %s", __func__, path.string());
 
-    return DeserializeDB(filein, data);
+    return DeserializeDB(filein, data, true, phash);
 }
 
 }
@@ -124,16 +128,110 @@ bool CBanDB::Read(banmap_t& banSet)
 CAddrDB::CAddrDB()
 {
     pathAddr = GetDataDir() / "peers.dat";
+    pathJournal = GetDataDir() / "peers.journal";
 }
 
-bool CAddrDB::Write(const CAddrMan& addr)
+bool CAddrDB::AppendJournal(const std::vector<CAddrJournalEntry>& vChanges)
 {
-    return SerializeFileDB("peers", pathAddr, addr);
+    try {
+        // Compact once replaying the journal costs more than reading the snapshot
+        if (fs::file_size(pathJournal) > fs::file_size(pathAddr) / 2)
+            return false;
+    } catch (const fs::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+
+    FILE *file = fsbridge::fopen(pathJournal, "ab");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: Failed to open file %s", __func__, pathJournal.string());
+
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        hasher << vChanges;
+        fileout << vChanges << hasher.GetHash();
+    } catch (const std::exception& e) {
+        return error("%s: Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+
+    return true;
+}
+
+void CAddrDB::ReadJournal(CAddrMan& addr, const uint256& hashSnapshot)
+{
+    // Until the journal is known to follow this snapshot, the next write compacts
+    addr.SetSnapshotHash(uint256());
+
+    FILE *file = fsbridge::fopen(pathJournal, "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return;
+
+    uint256 hashHeader;
+    if (!DeserializeDB(filein, hashHeader) || hashHeader != hashSnapshot) {
+        LogPrint(BCLog::ADDRMAN, "%s: Journal does not belong to peers.dat, ignoring it\n", __func__);
+        return;
+    }
+
+    int nBatches = 0;
+    size_t nChanges = 0;
+    try {
+        uintmax_t nSize = fs::file_size(pathJournal);
+        while ((uintmax_t)ftell(filein.Get()) < nSize) {
+            CHashVerifier<CAutoFile> verifier(&filein);
+            std::vector<CAddrJournalEntry> vChanges;
+            verifier >> vChanges;
+            uint256 hashTmp;
+            filein >> hashTmp;
+            if (hashTmp != verifier.GetHash()) {
+                // A batch cut short by a crash, keep what was read up to here
+                LogPrintf("%s: Checksum mismatch after %d batches, ignoring the rest of the journal\n", __func__, nBatches);
+                return;
+            }
+            addr.ApplyChanges(vChanges);
+            nBatches++;
+            nChanges += vChanges.size();
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Deserialize or I/O error after %d batches, ignoring the rest of the journal - %s\n", __func__, nBatches, e.what());
+        return;
+    }
+
+    addr.SetSnapshotHash(hashSnapshot);
+    LogPrint(BCLog::ADDRMAN, "%s: Replayed %u changes in %d batches\n", __func__, nChanges, nBatches);
+}
+
+bool CAddrDB::Write(CAddrMan& addr)
+{
+    std::vector<CAddrJournalEntry> vChanges;
+    addr.TakeChanges(vChanges);
+
+    if (!addr.GetSnapshotHash().IsNull()) {
+        if (vChanges.empty() || AppendJournal(vChanges))
+            return true;
+    }
+
+    // Write a full snapshot and start a new journal for it. A journal left behind
+    // by a crash in between still names the previous snapshot and is ignored.
+    uint256 hashSnapshot;
+    addr.SetSnapshotHash(uint256());
+    if (!SerializeFileDB("peers", pathAddr, addr, &hashSnapshot))
+        return false;
+    if (!SerializeFileDB("peers.journal", pathJournal, hashSnapshot))
+        return false;
+    addr.SetSnapshotHash(hashSnapshot);
+
+    return true;
 }
 
 bool CAddrDB::Read(CAddrMan& addr)
 {
-    return DeserializeFileDB(pathAddr, addr);
+    uint256 hashSnapshot;
+    if (!DeserializeFileDB(pathAddr, addr, &hashSnapshot))
+        return false;
+    ReadJournal(addr, hashSnapshot);
+    return true;
 }
 
 bool CAddrDB::Read(CAddrMan& addr, CDataStream& ssPeers)
@@ -12,10 +12,13 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 class CSubNet;
+class CAddrJournalEntry;
 class CAddrMan;
 class CDataStream;
+class uint256;
 
 typedef enum BanReason
 {
@@ -77,14 +80,27 @@ public:
 
 typedef std::map<CSubNet, CBanEntry> banmap_t;
 
-/** Access to the (IP) address database (peers.dat) */
+/**
+ * Access to the (IP) address database (peers.dat)
+ *
+ * peers.dat holds a full snapshot of the address manager, in the same format as
+ * always. Changes made after it was written are appended to peers.journal in
+ * checksummed batches, so a flush does not rewrite the whole table. The journal
+ * starts with the checksum of the snapshot it belongs to and is ignored for any
+ * other snapshot. Once the journal grows past half the size of the snapshot, or
+ * a batch cannot be appended, a full snapshot is written again.
+ */
 class CAddrDB
 {
 private:
     fs::path pathAddr;
+    fs::path pathJournal;
+
+    bool AppendJournal(const std::vector<CAddrJournalEntry>& vChanges);
+    void ReadJournal(CAddrMan& addr, const uint256& hashSnapshot);
 public:
     CAddrDB();
-    bool Write(const CAddrMan& addr);
+    bool Write(CAddrMan& addr);
     bool Read(CAddrMan& addr);
     static bool Read(CAddrMan& addr, CDataStream& ssPeers);
 };
@@ -93,11 +93,30 @@ CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, in
     mapAddr[addr] = nId;
     mapInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
+    MarkChanged(nId, true);
     if (pnId)
         *pnId = nId;
     return &mapInfo[nId];
 }
 
+void CAddrMan::SetNew(int nUBucket, int nUBucketPos, int nId)
+{
+    vvNew[nUBucket][nUBucketPos] = nId;
+    slotsNew.Set(nUBucket, nUBucketPos, nId != -1);
+}
+
+void CAddrMan::SetTried(int nKBucket, int nKBucketPos, int nId)
+{
+    vvTried[nKBucket][nKBucketPos] = nId;
+    slotsTried.Set(nKBucket, nKBucketPos, nId != -1);
+}
+
+void CAddrMan::MarkChanged(int nId, bool fAdded)
+{
+    // An entry added since the changes were taken stays marked as added
+    mapChanged.emplace(nId, fAdded);
+}
+
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
 {
     if (nRndPos1 == nRndPos2)
@@ -127,6 +146,12 @@ void CAddrMan::Delete(int nId)
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
+    // Entries added since the changes were taken never made it to disk
+    auto it = mapChanged.find(nId);
+    if (it == mapChanged.end() || !it->second)
+        vDeleted.push_back(info);
+    if (it != mapChanged.end())
+        mapChanged.erase(it);
     mapAddr.erase(info);
     mapInfo.erase(nId);
     nNew--;
@@ -140,9 +165,11 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
         CAddrInfo& infoDelete = mapInfo[nIdDelete];
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
-        vvNew[nUBucket][nUBucketPos] = -1;
+        SetNew(nUBucket, nUBucketPos, -1);
         if (infoDelete.nRefCount == 0) {
             Delete(nIdDelete);
+        } else {
+            MarkChanged(nIdDelete);
         }
     }
 }
@@ -153,7 +180,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
         int pos = info.GetBucketPosition(nKey, true, bucket);
         if (vvNew[bucket][pos] == nId) {
-            vvNew[bucket][pos] = -1;
+            SetNew(bucket, pos, -1);
             info.nRefCount--;
         }
     }
@@ -174,8 +201,9 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
-        vvTried[nKBucket][nKBucketPos] = -1;
+        SetTried(nKBucket, nKBucketPos, -1);
         nTried--;
+        MarkChanged(nIdEvict);
 
         // find which new bucket it belongs to
         int nUBucket = infoOld.GetNewBucket(nKey);
@@ -185,14 +213,15 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Enter it into the new set again.
         infoOld.nRefCount = 1;
-        vvNew[nUBucket][nUBucketPos] = nIdEvict;
+        SetNew(nUBucket, nUBucketPos, nIdEvict);
         nNew++;
     }
     assert(vvTried[nKBucket][nKBucketPos] == -1);
 
-    vvTried[nKBucket][nKBucketPos] = nId;
+    SetTried(nKBucket, nKBucketPos, nId);
     nTried++;
     info.fInTried = true;
+    MarkChanged(nId);
 }
 
 void CAddrMan::Good_(const CService& addr, int64_t nTime)
@@ -217,6 +246,7 @@ void CAddrMan::Good_(const CService& addr, int64_t nTime)
     info.nLastSuccess = nTime;
     info.nLastTry = nTime;
     info.nAttempts = 0;
+    MarkChanged(nId);
     // nTime is not updated here, to avoid leaking information about
     // currently-connected peers.
 
@@ -265,11 +295,16 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         // periodically update nTime
         bool fCurrentlyOnline = (GetAdjustedTime() - addr.nTime < 24 * 60 * 60);
         int64_t nUpdateInterval = (fCurrentlyOnline ? 60 * 60 : 24 * 60 * 60);
-        if (addr.nTime && (!pinfo->nTime || pinfo->nTime < addr.nTime - nUpdateInterval - nTimePenalty))
+        if (addr.nTime && (!pinfo->nTime || pinfo->nTime < addr.nTime - nUpdateInterval - nTimePenalty)) {
             pinfo->nTime = std::max((int64_t)0, addr.nTime - nTimePenalty);
+            MarkChanged(nId);
+        }
 
         // add services
-        pinfo->nServices = ServiceFlags(pinfo->nServices | addr.nServices);
+        if ((pinfo->nServices | addr.nServices) != pinfo->nServices) {
+            pinfo->nServices = ServiceFlags(pinfo->nServices | addr.nServices);
+            MarkChanged(nId);
+        }
 
         // do not update if no new information is present
         if (!addr.nTime || (pinfo->nTime && addr.nTime <= pinfo->nTime))
@@ -310,7 +345,8 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         if (fInsert) {
             ClearNew(nUBucket, nUBucketPos);
             pinfo->nRefCount++;
-            vvNew[nUBucket][nUBucketPos] = nId;
+            SetNew(nUBucket, nUBucketPos, nId);
+            MarkChanged(nId);
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -322,7 +358,8 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
 
 void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
 {
-    CAddrInfo* pinfo = Find(addr);
+    int nId;
+    CAddrInfo* pinfo = Find(addr, &nId);
 
     // if not found, bail out
     if (!pinfo)
@@ -339,6 +376,7 @@ void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
     if (fCountFailure && info.nLastCountAttempt < nLastGood) {
         info.nLastCountAttempt = nTime;
         info.nAttempts++;
+        MarkChanged(nId);
     }
 }
 
@@ -353,16 +391,11 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
     // Use a 50% chance for choosing between tried and new table entries.
     if (!newOnly &&
        (nTried > 0 && (nNew == 0 || RandomInt(2) == 0))) { 
-        // use a tried node
+        // use a tried node, picked among the occupied positions of the table
         double fChanceFactor = 1.0;
         while (1) {
-            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand.randbits(ADDRMAN_TRIED_BUCKET_COUNT_LOG2)) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
-            }
-            int nId = vvTried[nKBucket][nKBucketPos];
+            int nSlot = RandomInt(slotsTried.size());
+            int nId = vvTried[slotsTried.GetBucket(nSlot)][slotsTried.GetBucketPos(nSlot)];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
@@ -370,16 +403,11 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
             fChanceFactor *= 1.2;
         }
     } else {
-        // use a new node
+        // use a new node, picked among the occupied positions of the table
         double fChanceFactor = 1.0;
         while (1) {
-            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand.randbits(ADDRMAN_NEW_BUCKET_COUNT_LOG2)) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
-            }
-            int nId = vvNew[nUBucket][nUBucketPos];
+            int nSlot = RandomInt(slotsNew.size());
+            int nId = vvNew[slotsNew.GetBucket(nSlot)][slotsNew.GetBucketPos(nSlot)];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
@@ -429,9 +457,11 @@ int CAddrMan::Check_()
     if (mapNew.size() != nNew)
         return -10;
 
+    int nTriedSlots = 0;
     for (int n = 0; n < ADDRMAN_TRIED_BUCKET_COUNT; n++) {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
              if (vvTried[n][i] != -1) {
+                 nTriedSlots++;
                  if (!setTried.count(vvTried[n][i]))
                      return -11;
                  if (mapInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
@@ -443,9 +473,11 @@ int CAddrMan::Check_()
         }
     }
 
+    int nNewSlots = 0;
     for (int n = 0; n < ADDRMAN_NEW_BUCKET_COUNT; n++) {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
             if (vvNew[n][i] != -1) {
+                nNewSlots++;
                 if (!mapNew.count(vvNew[n][i]))
                     return -12;
                 if (mapInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
@@ -462,6 +494,16 @@ int CAddrMan::Check_()
         return -15;
     if (nKey.IsNull())
         return -16;
+    if (nTriedSlots != slotsTried.size() || nNewSlots != slotsNew.size())
+        return -20;
+    for (int n = 0; n < slotsTried.size(); n++) {
+        if (vvTried[slotsTried.GetBucket(n)][slotsTried.GetBucketPos(n)] == -1)
+            return -21;
+    }
+    for (int n = 0; n < slotsNew.size(); n++) {
+        if (vvNew[slotsNew.GetBucket(n)][slotsNew.GetBucketPos(n)] == -1)
+            return -22;
+    }
 
     return 0;
 }
@@ -490,7 +532,8 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
 
 void CAddrMan::Connected_(const CService& addr, int64_t nTime)
 {
-    CAddrInfo* pinfo = Find(addr);
+    int nId;
+    CAddrInfo* pinfo = Find(addr, &nId);
 
     // if not found, bail out
     if (!pinfo)
@@ -504,13 +547,16 @@ void CAddrMan::Connected_(const CService& addr, int64_t nTime)
 
     // update info
     int64_t nUpdateInterval = 20 * 60;
-    if (nTime - info.nTime > nUpdateInterval)
+    if (nTime - info.nTime > nUpdateInterval) {
         info.nTime = nTime;
+        MarkChanged(nId);
+    }
 }
 
 void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
 {
-    CAddrInfo* pinfo = Find(addr);
+    int nId;
+    CAddrInfo* pinfo = Find(addr, &nId);
 
     // if not found, bail out
     if (!pinfo)
@@ -523,7 +569,113 @@ void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
         return;
 
     // update info
-    info.nServices = nServices;
+    if (info.nServices != nServices) {
+        info.nServices = nServices;
+        MarkChanged(nId);
+    }
+}
+
+void CAddrMan::TakeChanges(std::vector<CAddrJournalEntry>& vChanges)
+{
+    LOCK(cs);
+    vChanges.clear();
+    vChanges.reserve(vDeleted.size() + mapChanged.size());
+    for (const CAddrInfo& info : vDeleted)
+        vChanges.emplace_back(CAddrJournalEntry::DELETED, info);
+    for (const auto& entry : mapChanged) {
+        const CAddrInfo& info = mapInfo[entry.first];
+        vChanges.emplace_back(info.fInTried ? CAddrJournalEntry::TRIED : CAddrJournalEntry::NEW, info);
+        if (info.fInTried)
+            continue;
+        std::vector<int>& vNewBuckets = vChanges.back().vNewBuckets;
+        for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT && (int)vNewBuckets.size() < info.nRefCount; bucket++) {
+            if (vvNew[bucket][info.GetBucketPosition(nKey, true, bucket)] == entry.first)
+                vNewBuckets.push_back(bucket);
+        }
+    }
+    vDeleted.clear();
+    mapChanged.clear();
+}
+
+void CAddrMan::ApplyChange_(const CAddrJournalEntry& change)
+{
+    const CAddrInfo& infoIn = change.info;
+    int nId;
+    CAddrInfo* pinfo = Find(infoIn, &nId);
+
+    // check whether we are talking about the exact same CService (including same port)
+    if (pinfo && (CService)*pinfo != (CService)infoIn)
+        return;
+
+    if (change.nTable == CAddrJournalEntry::DELETED) {
+        if (!pinfo || pinfo->fInTried)
+            return;
+        for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT && pinfo->nRefCount > 0; bucket++) {
+            int pos = pinfo->GetBucketPosition(nKey, true, bucket);
+            if (vvNew[bucket][pos] == nId) {
+                SetNew(bucket, pos, -1);
+                pinfo->nRefCount--;
+            }
+        }
+        Delete(nId);
+        return;
+    }
+
+    if (!pinfo) {
+        // Place it the way entries are placed when the table is read, dropping it on a collision
+        if (change.nTable == CAddrJournalEntry::TRIED) {
+            int nKBucket = infoIn.GetTriedBucket(nKey);
+            int nKBucketPos = infoIn.GetBucketPosition(nKey, false, nKBucket);
+            if (vvTried[nKBucket][nKBucketPos] != -1)
+                return;
+            pinfo = Create(infoIn, infoIn.source, &nId);
+            pinfo->fInTried = true;
+            SetTried(nKBucket, nKBucketPos, nId);
+            nTried++;
+        } else {
+            pinfo = Create(infoIn, infoIn.source, &nId);
+            nNew++;
+        }
+    }
+
+    if (change.nTable == CAddrJournalEntry::NEW && !pinfo->fInTried) {
+        // Reference it from the buckets it was in when journaled, those are newer than what they hold now
+        std::set<int> setBuckets;
+        for (int bucket : change.vNewBuckets) {
+            if (bucket >= 0 && bucket < ADDRMAN_NEW_BUCKET_COUNT && (int)setBuckets.size() < ADDRMAN_NEW_BUCKETS_PER_ADDRESS)
+                setBuckets.insert(bucket);
+        }
+        if (setBuckets.empty())
+            setBuckets.insert(infoIn.GetNewBucket(nKey));
+        for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT && pinfo->nRefCount > 0; bucket++) {
+            int pos = pinfo->GetBucketPosition(nKey, true, bucket);
+            if (vvNew[bucket][pos] == nId && !setBuckets.count(bucket)) {
+                SetNew(bucket, pos, -1);
+                pinfo->nRefCount--;
+            }
+        }
+        for (int bucket : setBuckets) {
+            int pos = pinfo->GetBucketPosition(nKey, true, bucket);
+            if (vvNew[bucket][pos] == nId)
+                continue;
+            ClearNew(bucket, pos);
+            SetNew(bucket, pos, nId);
+            pinfo->nRefCount++;
+        }
+        if (pinfo->nRefCount == 0) {
+            Delete(nId);
+            return;
+        }
+    }
+
+    pinfo->nTime = infoIn.nTime;
+    pinfo->nServices = infoIn.nServices;
+    pinfo->nLastSuccess = infoIn.nLastSuccess;
+    pinfo->nAttempts = infoIn.nAttempts;
+
+    // Entries only go back to "new" when evicted from "tried", which the journal replays as well
+    if (change.nTable == CAddrJournalEntry::TRIED && !pinfo->fInTried)
+        MakeTried(*pinfo, nId);
 }
 
 int CAddrMan::RandomInt(int nMax){
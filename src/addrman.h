@@ -14,6 +14,7 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -134,6 +135,10 @@ public:
  *      be observable by adversaries.
  *    * Several indexes are kept for high performance. Defining DEBUG_ADDRMAN will introduce frequent (and expensive)
  *      consistency checks for the entire data structure.
+ *  * The occupied positions of both tables are indexed, so an address to connect to is picked in constant time
+ *    however sparse the tables are.
+ *  * Changes since the table was last written are tracked, so they can be appended to a journal next to peers.dat
+ *    instead of rewriting the whole table each time (see CAddrDB).
  */
 
 //! total number of buckets for tried addresses
@@ -177,6 +182,82 @@ public:
 #define ADDRMAN_NEW_BUCKET_COUNT (1 << ADDRMAN_NEW_BUCKET_COUNT_LOG2)
 #define ADDRMAN_BUCKET_SIZE (1 << ADDRMAN_BUCKET_SIZE_LOG2)
 
+/**
+ * The occupied positions of a "new" or "tried" table, so that one of them can be
+ * picked at random in constant time. Positions are numbered bucket * ADDRMAN_BUCKET_SIZE + position.
+ */
+class CAddrManSlots
+{
+private:
+    //! all occupied positions, in no particular order
+    std::vector<int> vSlots;
+
+    //! index of each position in vSlots, -1 if it isn't occupied
+    std::vector<int> vIndex;
+
+public:
+    explicit CAddrManSlots(int nBuckets) : vIndex(nBuckets * ADDRMAN_BUCKET_SIZE, -1) {}
+
+    void Set(int nBucket, int nBucketPos, bool fOccupied)
+    {
+        int nSlot = nBucket * ADDRMAN_BUCKET_SIZE + nBucketPos;
+        if (fOccupied == (vIndex[nSlot] != -1))
+            return;
+        if (fOccupied) {
+            vIndex[nSlot] = vSlots.size();
+            vSlots.push_back(nSlot);
+        } else {
+            int nLast = vSlots.back();
+            vSlots[vIndex[nSlot]] = nLast;
+            vIndex[nLast] = vIndex[nSlot];
+            vSlots.pop_back();
+            vIndex[nSlot] = -1;
+        }
+    }
+
+    void Clear()
+    {
+        vSlots.clear();
+        std::fill(vIndex.begin(), vIndex.end(), -1);
+    }
+
+    int size() const { return vSlots.size(); }
+    int GetBucket(int n) const { return vSlots[n] >> ADDRMAN_BUCKET_SIZE_LOG2; }
+    int GetBucketPos(int n) const { return vSlots[n] & (ADDRMAN_BUCKET_SIZE - 1); }
+};
+
+/**
+ * An address that changed since the tables were last written, as it is recorded in the journal.
+ * Replaying it brings the address up to date and moves it to the table it is in now. For the
+ * "new" table it also records every bucket referencing the address, so replaying restores them.
+ */
+class CAddrJournalEntry
+{
+public:
+    enum : unsigned char {
+        NEW = 0,
+        TRIED = 1,
+        DELETED = 2,
+    };
+
+    unsigned char nTable;
+    CAddrInfo info;
+    //! The "new" buckets referencing the address, the position within them follows from the address
+    std::vector<int> vNewBuckets;
+
+    CAddrJournalEntry() : nTable(NEW) {}
+    CAddrJournalEntry(unsigned char nTableIn, const CAddrInfo& infoIn) : nTable(nTableIn), info(infoIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nTable);
+        READWRITE(info);
+        READWRITE(vNewBuckets);
+    }
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -213,6 +294,19 @@ private:
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
+    //! occupied positions in vvNew and vvTried
+    CAddrManSlots slotsNew{ADDRMAN_NEW_BUCKET_COUNT};
+    CAddrManSlots slotsTried{ADDRMAN_TRIED_BUCKET_COUNT};
+
+    //! nIds changed since the changes were last taken, mapped to whether they were added since then
+    std::map<int, bool> mapChanged;
+
+    //! entries deleted since the changes were last taken
+    std::vector<CAddrInfo> vDeleted;
+
+    //! checksum of the peers.dat the taken changes apply to, null if they don't apply to any
+    uint256 hashSnapshot;
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -230,6 +324,16 @@ protected:
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    //! Set a position in the "new" or "tried" table, -1 to clear it.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
+    //! Record that an entry changed, for the journal.
+    void MarkChanged(int nId, bool fAdded = false);
+
+    //! Replay an entry read from the journal.
+    void ApplyChange_(const CAddrJournalEntry& change);
+
     //! Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId);
 
@@ -390,7 +494,7 @@ public:
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
@@ -410,7 +514,7 @@ public:
                 vRandom.push_back(nIdCount);
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
+                SetTried(nKBucket, nKBucketPos, nIdCount);
                 nIdCount++;
             } else {
                 nLost++;
@@ -430,7 +534,7 @@ public:
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -451,6 +555,10 @@ public:
             LogPrint(BCLog::ADDRMAN, "addrman lost %i new and %i tried addresses due to collisions\n", nLostUnk, nLost);
         }
 
+        // Nothing changed yet, the caller sets the snapshot hash if this was read from peers.dat
+        mapChanged.clear();
+        vDeleted.clear();
+
         Check();
     }
 
@@ -468,6 +576,11 @@ public:
                 vvTried[bucket][entry] = -1;
             }
         }
+        slotsNew.Clear();
+        slotsTried.Clear();
+        mapChanged.clear();
+        vDeleted.clear();
+        hashSnapshot.SetNull();
 
         nIdCount = 0;
         nTried = 0;
@@ -601,6 +714,34 @@ public:
         Check();
     }
 
+    //! Take the changes since they were last taken, deleted entries first.
+    void TakeChanges(std::vector<CAddrJournalEntry> &vChanges);
+
+    //! Replay changes read from the journal. They don't count as changes themselves.
+    void ApplyChanges(const std::vector<CAddrJournalEntry> &vChanges)
+    {
+        LOCK(cs);
+        Check();
+        for (const CAddrJournalEntry& change : vChanges)
+            ApplyChange_(change);
+        mapChanged.clear();
+        vDeleted.clear();
+        Check();
+    }
+
+    //! The checksum of the peers.dat the changes are taken against, null if none.
+    uint256 GetSnapshotHash() const
+    {
+        LOCK(cs);
+        return hashSnapshot;
+    }
+
+    void SetSnapshotHash(const uint256 &hash)
+    {
+        LOCK(cs);
+        hashSnapshot = hash;
+    }
+
 };
 
 #endif // RAVEN_ADDRMAN_H
@@ -10,13 +10,18 @@
 #include "assets.h"
 #include "validation.h"
 
+#include <algorithm>
+
 #include <boost/thread.hpp>
 
 static const char ASSET_FLAG = 'A';
 static const char ASSET_ADDRESS_QUANTITY_FLAG = 'B';
 static const char MY_ASSET_FLAG = 'M';
 static const char BLOCK_ASSET_UNDO_DATA = 'U';
-static const char MEMPOOL_REISSUED_TX = 'Z';
+static const char ASSET_STATS_FLAG = 'S';
+static const char ASSET_BALANCE_INDEX_FLAG = 'O';
+static const char ASSET_BALANCE_INDEX_BUILT = 'I';
+static const char ASSET_SNAPSHOT_REQUEST_FLAG = 'Q';
 
 CAssetsDB::CAssetsDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "assets", nCacheSize, fMemory, fWipe) {
 }
@@ -32,9 +37,29 @@ bool CAssetsDB::WriteMyAssetsData(const std::string &strName, const std::set<COu
     return Write(std::make_pair(MY_ASSET_FLAG, strName), setOuts);
 }
 
-bool CAssetsDB::WriteAssetAddressQuantity(const std::string &assetName, const std::string &address, const CAmount &quantity)
+bool CAssetsDB::WriteAssetAddressQuantity(const std::string &assetName, const std::string &address, const CAmount &nPrevQuantity, const CAmount &quantity)
 {
-    return Write(std::make_pair(ASSET_ADDRESS_QUANTITY_FLAG, std::make_pair(assetName, address)), quantity);
+    CDBBatch batch(*this);
+
+    // Move the balance index entry of the address to its new balance
+    batch.Erase(std::make_pair(ASSET_BALANCE_INDEX_FLAG, CAssetBalanceIndexKey(assetName, nPrevQuantity, address)));
+
+    batch.Write(std::make_pair(ASSET_ADDRESS_QUANTITY_FLAG, std::make_pair(assetName, address)), quantity);
+    // Emptied addresses don't hold the asset
+    if (quantity > 0)
+        batch.Write(std::make_pair(ASSET_BALANCE_INDEX_FLAG, CAssetBalanceIndexKey(assetName, quantity, address)), 0);
+
+    return WriteBatch(batch);
+}
+
+bool CAssetsDB::WriteAssetStats(const std::string& assetName, const CAssetStats& stats)
+{
+    return Write(std::make_pair(ASSET_STATS_FLAG, assetName), stats);
+}
+
+bool CAssetsDB::WriteSnapshotRequest(const std::string& assetName, const int nHeight, const bool fFailed)
+{
+    return Write(std::make_pair(ASSET_SNAPSHOT_REQUEST_FLAG, std::make_pair(assetName, nHeight)), (int)fFailed);
 }
 
 bool CAssetsDB::ReadAssetData(const std::string& strName, CNewAsset& asset, int& nHeight, uint256& blockHash)
@@ -62,6 +87,11 @@ bool CAssetsDB::ReadAssetAddressQuantity(const std::string& assetName, const std
     return Read(std::make_pair(ASSET_ADDRESS_QUANTITY_FLAG, std::make_pair(assetName, address)), quantity);
 }
 
+bool CAssetsDB::ReadAssetStats(const std::string& assetName, CAssetStats& stats)
+{
+    return Read(std::make_pair(ASSET_STATS_FLAG, assetName), stats);
+}
+
 bool CAssetsDB::EraseAssetData(const std::string& assetName)
 {
     return Erase(std::make_pair(ASSET_FLAG, assetName));
@@ -72,8 +102,24 @@ bool CAssetsDB::EraseMyAssetData(const std::string& assetName)
     return Erase(std::make_pair(MY_ASSET_FLAG, assetName));
 }
 
-bool CAssetsDB::EraseAssetAddressQuantity(const std::string &assetName, const std::string &address) {
-    return Erase(std::make_pair(ASSET_ADDRESS_QUANTITY_FLAG, std::make_pair(assetName, address)));
+bool CAssetsDB::EraseAssetAddressQuantity(const std::string &assetName, const std::string &address, const CAmount &nPrevQuantity) {
+    CDBBatch batch(*this);
+
+    batch.Erase(std::make_pair(ASSET_BALANCE_INDEX_FLAG, CAssetBalanceIndexKey(assetName, nPrevQuantity, address)));
+
+    batch.Erase(std::make_pair(ASSET_ADDRESS_QUANTITY_FLAG, std::make_pair(assetName, address)));
+
+    return WriteBatch(batch);
+}
+
+bool CAssetsDB::EraseAssetStats(const std::string& assetName)
+{
+    return Erase(std::make_pair(ASSET_STATS_FLAG, assetName));
+}
+
+bool CAssetsDB::EraseSnapshotRequest(const std::string& assetName, const int nHeight)
+{
+    return Erase(std::make_pair(ASSET_SNAPSHOT_REQUEST_FLAG, std::make_pair(assetName, nHeight)));
 }
 
 bool CAssetsDB::EraseMyOutPoints(const std::string& assetName)
@@ -99,24 +145,6 @@ bool CAssetsDB::ReadBlockUndoAssetData(const uint256 &blockhash, std::vector<std
     return true;
 }
 
-bool CAssetsDB::WriteReissuedMempoolState()
-{
-    return Write(MEMPOOL_REISSUED_TX, mapReissuedAssets);
-}
-
-bool CAssetsDB::ReadReissuedMempoolState()
-{
-    mapReissuedAssets.clear();
-    mapReissuedTx.clear();
-    // If it exists, return the read value.
-    bool rv = Read(MEMPOOL_REISSUED_TX, mapReissuedAssets);
-    if (rv) {
-        for (auto pair : mapReissuedAssets)
-            mapReissuedTx.insert(std::make_pair(pair.second, pair.first));
-    }
-    return rv;
-}
-
 bool CAssetsDB::LoadAssets()
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
@@ -161,6 +189,11 @@ bool CAssetsDB::LoadAssets()
 
     std::unique_ptr<CDBIterator> pcursor3(NewIterator());
     pcursor3->Seek(std::make_pair(ASSET_ADDRESS_QUANTITY_FLAG, std::make_pair(std::string(), std::string())));
+    // Aggregates computed from the balances, used for databases that were written before asset stats existed
+    std::map<std::string, CAssetStats> mapBalanceStats;
+    // Databases written before the balance index existed get it built while the balances are loaded
+    bool fBuildBalanceIndex = !Exists(ASSET_BALANCE_INDEX_BUILT);
+    CDBBatch indexBatch(*this);
     // Load mapMyUnspentAssets
     while (pcursor3->Valid()) {
         boost::this_thread::interruption_point();
@@ -175,6 +208,18 @@ bool CAssetsDB::LoadAssets()
                 if (!passets->mapAssetsAddresses[key.second.first].insert(key.second.second).second)
                     return error("%s: failed to read my address quantity from database", __func__);
                 passets->mapAssetsAddressAmount.insert(std::make_pair(std::make_pair(key.second.first, key.second.second), value));
+                if (value > 0) {
+                    mapBalanceStats[key.second.first].nHolders++;
+                    mapBalanceStats[key.second.first].nCirculating += value;
+                }
+                if (fBuildBalanceIndex && value > 0) {
+                    indexBatch.Write(std::make_pair(ASSET_BALANCE_INDEX_FLAG, CAssetBalanceIndexKey(key.second.first, value, key.second.second)), 0);
+                    if (indexBatch.SizeEstimate() > (size_t)(16 << 20)) {
+                        if (!WriteBatch(indexBatch))
+                            return error("%s: failed to write the asset balance index to database", __func__);
+                        indexBatch.Clear();
+                    }
+                }
                 pcursor3->Next();
             } else {
                 return error("%s: failed to read my address quantity from database", __func__);
@@ -184,6 +229,32 @@ bool CAssetsDB::LoadAssets()
         }
     }
 
+    if (fBuildBalanceIndex) {
+        indexBatch.Write(ASSET_BALANCE_INDEX_BUILT, true);
+        if (!WriteBatch(indexBatch))
+            return error("%s: failed to write the asset balance index to database", __func__);
+    }
+
+    // Rebuild the stats of any asset that doesn't have them yet. Only the issuance burn and height can be recovered
+    for (auto& balanceStats : mapBalanceStats) {
+        CAssetStats stats;
+        if (ReadAssetStats(balanceStats.first, stats))
+            continue;
+
+        AssetType assetType;
+        if (IsAssetNameValid(balanceStats.first, assetType))
+            balanceStats.second.nBurned = GetBurnAmount(assetType);
+
+        CNewAsset asset;
+        int nHeight;
+        uint256 blockHash;
+        if (ReadAssetData(balanceStats.first, asset, nHeight, blockHash))
+            balanceStats.second.nLastActivityHeight = nHeight;
+
+        if (!WriteAssetStats(balanceStats.first, balanceStats.second))
+            return error("%s: failed to write rebuilt asset stats to database", __func__);
+    }
+
     return true;
 }
 
@@ -258,6 +329,111 @@ bool CAssetsDB::AssetDir(std::vector<CDatabasedAssetData>& assets, const std::st
     return true;
 }
 
+bool CAssetsDB::LoadSnapshotRequests(std::set<std::pair<std::string, int> >& setRequests, std::set<std::pair<std::string, int> >& setFailed)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(ASSET_SNAPSHOT_REQUEST_FLAG, std::make_pair(std::string(), 0)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+
+        std::pair<char, std::pair<std::string, int> > key; // <Asset Name, Height>
+        if (pcursor->GetKey(key) && key.first == ASSET_SNAPSHOT_REQUEST_FLAG) {
+            int nFailed;
+            if (!pcursor->GetValue(nFailed))
+                return error("%s: failed to read snapshot request", __func__);
+            setRequests.insert(key.second);
+            if (nFailed)
+                setFailed.insert(key.second);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+//! Whether holder a comes before holder b in the balance index
+static bool CompareAssetHolders(const std::pair<std::string, CAmount>& a, const std::pair<std::string, CAmount>& b)
+{
+    // Largest balance first, then the addresses as they serialize: shorter first, then byte by byte
+    if (a.second != b.second)
+        return a.second > b.second;
+    if (a.first.size() != b.first.size())
+        return a.first.size() < b.first.size();
+    return a.first < b.first;
+}
+
+CAssetHoldersReader::CAssetHoldersReader(CDBIterator& cursorIn, const std::string& assetNameIn, const std::map<std::string, CAmount>& mapUnflushedIn,
+                                         const CAmount& nMinBalanceIn, const CAmount& nMaxBalance)
+    : cursor(cursorIn), assetName(assetNameIn), nMinBalance(nMinBalanceIn), mapUnflushed(mapUnflushedIn), nNextUnflushed(0), fHaveDatabaseHolder(false)
+{
+    // The empty address sorts before every other address with the same balance
+    cursor.Seek(std::make_pair(ASSET_BALANCE_INDEX_FLAG, CAssetBalanceIndexKey(assetName, nMaxBalance, "")));
+
+    for (const auto& balance : mapUnflushed) {
+        if (balance.second > 0 && balance.second >= nMinBalance && balance.second <= nMaxBalance)
+            vUnflushed.emplace_back(balance);
+    }
+    std::sort(vUnflushed.begin(), vUnflushed.end(), CompareAssetHolders);
+}
+
+bool CAssetHoldersReader::ReadDatabaseHolder()
+{
+    while (cursor.Valid()) {
+        std::pair<char, CAssetBalanceIndexKey> key;
+        // Entries of emptied addresses sort last, older databases can still have them
+        if (!cursor.GetKey(key) || key.first != ASSET_BALANCE_INDEX_FLAG || key.second.assetName != assetName ||
+                key.second.nBalance < nMinBalance || key.second.nBalance <= 0)
+            return false;
+
+        cursor.Next();
+
+        // The database balance of an address that changed since the last flush is outdated
+        if (mapUnflushed.count(key.second.address))
+            continue;
+
+        databaseHolder = std::make_pair(key.second.address, key.second.nBalance);
+        return true;
+    }
+
+    return false;
+}
+
+bool CAssetHoldersReader::Next(std::vector<std::pair<std::string, CAmount> >& holders, const size_t count, const size_t skip)
+{
+    size_t offset = 0;
+    size_t nAdded = 0;
+    while (nAdded < count) {
+        boost::this_thread::interruption_point();
+
+        if (!fHaveDatabaseHolder)
+            fHaveDatabaseHolder = ReadDatabaseHolder();
+
+        bool fHaveUnflushed = nNextUnflushed < vUnflushed.size();
+        if (!fHaveDatabaseHolder && !fHaveUnflushed)
+            return false;
+
+        std::pair<std::string, CAmount> holder;
+        if (fHaveUnflushed && (!fHaveDatabaseHolder || CompareAssetHolders(vUnflushed[nNextUnflushed], databaseHolder))) {
+            holder = vUnflushed[nNextUnflushed++];
+        } else {
+            holder = databaseHolder;
+            fHaveDatabaseHolder = false;
+        }
+
+        if (offset < skip) {
+            offset += 1;
+        } else {
+            holders.emplace_back(holder);
+            nAdded++;
+        }
+    }
+
+    return true;
+}
+
 bool CAssetsDB::AssetDir(std::vector<CDatabasedAssetData>& assets)
 {
     return CAssetsDB::AssetDir(assets, "*", MAX_SIZE, 0);
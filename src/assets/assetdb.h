@@ -10,12 +10,15 @@
 
 #include <string>
 #include <map>
+#include <limits>
+#include <vector>
 #include <dbwrapper.h>
 
 class CNewAsset;
 class uint256;
 class COutPoint;
 class CDatabasedAssetData;
+class CAssetStats;
 
 struct CBlockAssetUndo
 {
@@ -35,6 +38,48 @@ struct CBlockAssetUndo
     }
 };
 
+/** Key of the asset balance index, ordered by asset name, then balance (largest first), then address */
+struct CAssetBalanceIndexKey
+{
+    std::string assetName;
+    CAmount nBalance;
+    std::string address;
+
+    CAssetBalanceIndexKey(const std::string& assetName, const CAmount& nBalance, const std::string& address)
+    {
+        this->assetName = assetName;
+        this->nBalance = nBalance;
+        this->address = address;
+    }
+
+    CAssetBalanceIndexKey()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        assetName.clear();
+        nBalance = 0;
+        address.clear();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ::Serialize(s, assetName);
+        // Inverted and big endian, so iterating forward walks the balances from largest to smallest
+        ser_writedata64be(s, std::numeric_limits<uint64_t>::max() - (uint64_t)nBalance);
+        ::Serialize(s, address);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        ::Unserialize(s, assetName);
+        nBalance = (CAmount)(std::numeric_limits<uint64_t>::max() - ser_readdata64be(s));
+        ::Unserialize(s, address);
+    }
+};
+
 /** Access to the block database (blocks/index/) */
 class CAssetsDB : public CDBWrapper
 {
@@ -47,28 +92,60 @@ public:
     // Write to database functions
     bool WriteAssetData(const CNewAsset& asset, const int nHeight, const uint256& blockHash);
     bool WriteMyAssetsData(const std::string &strName, const std::set<COutPoint>& setOuts);
-    bool WriteAssetAddressQuantity(const std::string& assetName, const std::string& address, const CAmount& quantity);
+    //! nPrevQuantity is the balance the database holds for the address, or 0 if none, its balance index entry is moved
+    bool WriteAssetAddressQuantity(const std::string& assetName, const std::string& address, const CAmount& nPrevQuantity, const CAmount& quantity);
     bool WriteBlockUndoAssetData(const uint256& blockhash, const std::vector<std::pair<std::string, CBlockAssetUndo> >& assetUndoData);
-    bool WriteReissuedMempoolState();
+    bool WriteAssetStats(const std::string& assetName, const CAssetStats& stats);
+    //! fFailed marks a request whose block was connected without its snapshot being written
+    bool WriteSnapshotRequest(const std::string& assetName, const int nHeight, const bool fFailed = false);
 
     // Read from database functions
     bool ReadAssetData(const std::string& strName, CNewAsset& asset, int& nHeight, uint256& blockHash);
     bool ReadMyAssetsData(const std::string &strName, std::set<COutPoint>& setOuts);
     bool ReadAssetAddressQuantity(const std::string& assetName, const std::string& address, CAmount& quantity);
     bool ReadBlockUndoAssetData(const uint256& blockhash, std::vector<std::pair<std::string, CBlockAssetUndo> >& assetUndoData);
-    bool ReadReissuedMempoolState();
+    bool ReadAssetStats(const std::string& assetName, CAssetStats& stats);
 
     // Erase from database functions
     bool EraseAssetData(const std::string& assetName);
     bool EraseMyAssetData(const std::string& assetName);
-    bool EraseAssetAddressQuantity(const std::string &assetName, const std::string &address);
+    bool EraseAssetAddressQuantity(const std::string &assetName, const std::string &address, const CAmount &nPrevQuantity);
+    bool EraseAssetStats(const std::string& assetName);
+    bool EraseSnapshotRequest(const std::string& assetName, const int nHeight);
 
     // Helper functions
     bool EraseMyOutPoints(const std::string& assetName);
     bool LoadAssets();
     bool AssetDir(std::vector<CDatabasedAssetData>& assets, const std::string filter, const size_t count, const long start);
     bool AssetDir(std::vector<CDatabasedAssetData>& assets);
+    bool LoadSnapshotRequests(std::set<std::pair<std::string, int> >& setRequests, std::set<std::pair<std::string, int> >& setFailed);
 };
 
+/**
+ * Reads the holders of an asset from the balance index, largest balance first, with the balances that
+ * weren't flushed to the database yet merged in. The cursor must read the database as it was when the
+ * unflushed balances were captured, either by holding cs_main or by using a database snapshot.
+ */
+class CAssetHoldersReader
+{
+private:
+    CDBIterator& cursor;
+    const std::string assetName;
+    const CAmount nMinBalance;
+    const std::map<std::string, CAmount> mapUnflushed; // Address -> Balance, replaces the balance in the database
+    std::vector<std::pair<std::string, CAmount> > vUnflushed; // The unflushed holders in the order of the index
+    size_t nNextUnflushed;
+    bool fHaveDatabaseHolder;
+    std::pair<std::string, CAmount> databaseHolder;
+
+    bool ReadDatabaseHolder();
+
+public:
+    CAssetHoldersReader(CDBIterator& cursorIn, const std::string& assetNameIn, const std::map<std::string, CAmount>& mapUnflushedIn,
+                        const CAmount& nMinBalanceIn = 0, const CAmount& nMaxBalance = std::numeric_limits<CAmount>::max());
+
+    //! Append the next count holders to holders after skipping skip of them, returns false once there are none left
+    bool Next(std::vector<std::pair<std::string, CAmount> >& holders, const size_t count, const size_t skip = 0);
+};
 
 #endif //RAVEN_ASSETDB_H
@@ -29,8 +29,6 @@
 #include "coins.h"
 #include "wallet/wallet.h"
 
-std::map<uint256, std::string> mapReissuedTx;
-std::map<std::string, uint256> mapReissuedAssets;
 
 // excluding owner tag ('!')
 static const auto MAX_NAME_LENGTH = 31;
@@ -281,7 +279,8 @@ bool CNewAsset::IsValid(std::string& strError, CAssetsCache& assetCache, bool fC
     }
 
     if (fCheckMempool) {
-        if (mempool.mapAssetToHash.count(strName)) {
+        uint256 hashIssueTx;
+        if (mempool.getAssetIssueTx(strName, hashIssueTx)) {
             strError = _("Asset with this name is already in the mempool");
             return false;
         }
@@ -1044,13 +1043,13 @@ bool CAssetsCache::GetAssetsOutPoints(const std::string& strName, std::set<COutP
     return false;
 }
 
-bool CAssetsCache::AddTransferAsset(const CAssetTransfer& transferAsset, const std::string& address, const COutPoint& out, const CTxOut& txOut)
+bool CAssetsCache::AddTransferAsset(const CAssetTransfer& transferAsset, const std::string& address, const COutPoint& out, const CTxOut& txOut, const int nHeight)
 {
     CAssetCachePossibleMine possibleMine(transferAsset.strName, out, txOut);
     if (!AddPossibleOutPoint(possibleMine))
         return false;
 
-    AddToAssetBalance(transferAsset.strName, address, transferAsset.nAmount);
+    AddToAssetBalance(transferAsset.strName, address, transferAsset.nAmount, nHeight);
 
     // Add to cache so we can save to database
     CAssetCacheNewTransfer newTransfer(CAssetTransfer(transferAsset.strName, transferAsset.nAmount), address, out);
@@ -1063,7 +1062,7 @@ bool CAssetsCache::AddTransferAsset(const CAssetTransfer& transferAsset, const s
     return true;
 }
 
-void CAssetsCache::AddToAssetBalance(const std::string& strName, const std::string& address, const CAmount& nAmount)
+void CAssetsCache::AddToAssetBalance(const std::string& strName, const std::string& address, const CAmount& nAmount, const int nHeight)
 {
     auto pair = std::make_pair(strName, address);
     // Add to map address -> amount map
@@ -1072,12 +1071,17 @@ void CAssetsCache::AddToAssetBalance(const std::string& strName, const std::stri
     if (!GetBestAssetAddressAmount(*this, strName, address))
         mapAssetsAddressAmount.insert(make_pair(pair, 0));
 
+    RecordDatabaseBalance(pair.first, pair.second);
+    CAmount nPrevBalance = mapAssetsAddressAmount.at(pair);
+
     // Add the new amount to the balance
     if (IsAssetNameAnOwner(strName))
         mapAssetsAddressAmount.at(pair) = OWNER_ASSET_AMOUNT;
     else
         mapAssetsAddressAmount.at(pair) += nAmount;
 
+    UpdateAssetStats(strName, nPrevBalance, mapAssetsAddressAmount.at(pair), 0, nHeight);
+
     // Add to map of addresses
     if (!mapAssetsAddresses.count(strName)) {
         mapAssetsAddresses.insert(std::make_pair(strName, std::set<std::string>()));
@@ -1138,6 +1142,8 @@ bool CAssetsCache::TrySpendCoin(const COutPoint& out, const CTxOut& txOut)
         CAssetCacheSpendAsset spend(assetName, address, nAmount);
         if (GetBestAssetAddressAmount(*this, assetName, address)) {
             auto pair = make_pair(assetName, address);
+            RecordDatabaseBalance(pair.first, pair.second);
+            CAmount nPrevBalance = mapAssetsAddressAmount.at(pair);
             mapAssetsAddressAmount.at(pair) -= nAmount;
 
             if (mapAssetsAddressAmount.at(pair) < 0)
@@ -1146,6 +1152,8 @@ bool CAssetsCache::TrySpendCoin(const COutPoint& out, const CTxOut& txOut)
                 mapAssetsAddresses.count(assetName))
                 mapAssetsAddresses.at(assetName).erase(address);
 
+            UpdateAssetStats(assetName, nPrevBalance, mapAssetsAddressAmount.at(pair));
+
             // Update the cache so we can save to database
             vSpentAssets.push_back(spend);
         }
@@ -1284,7 +1292,10 @@ bool CAssetsCache::AddBackSpentAsset(const Coin& coin, const std::string& assetN
     if (!GetBestAssetAddressAmount(*this, assetName, address))
         mapAssetsAddressAmount.insert(std::make_pair(pair, 0));
 
+    RecordDatabaseBalance(pair.first, pair.second);
+    CAmount nPrevBalance = mapAssetsAddressAmount.at(pair);
     mapAssetsAddressAmount.at(pair) += nAmount;
+    UpdateAssetStats(assetName, nPrevBalance, mapAssetsAddressAmount.at(pair));
 
     // Add the undoAmount to the vector so we know what changes are dirty and what needs to be saved to database
     CAssetCacheUndoAssetAmount undoAmount(assetName, address, nAmount);
@@ -1318,7 +1329,10 @@ bool CAssetsCache::UndoTransfer(const CAssetTransfer& transfer, const std::strin
         return error("%s : Map of asset address didn't have the address we are trying to undo. Asset : %s Address : %s" , __func__, transfer.strName, address);
 
     // Change the in memory balance of the asset at the address
+    RecordDatabaseBalance(pair.first, pair.second);
+    CAmount nPrevBalance = mapAssetsAddressAmount.at(pair);
     mapAssetsAddressAmount[pair] -= transfer.nAmount;
+    UpdateAssetStats(transfer.strName, nPrevBalance, mapAssetsAddressAmount.at(pair));
 
     // If the balance is now 0, remove it from the list
     if (mapAssetsAddressAmount.at(pair) == 0) {
@@ -1350,8 +1364,13 @@ bool CAssetsCache::RemoveNewAsset(const CNewAsset& asset, const std::string addr
     if (mapAssetsAddresses.count(asset.strName))
         mapAssetsAddresses[asset.strName].erase(address);
 
+    RecordDatabaseBalance(asset.strName, address);
     mapAssetsAddressAmount[std::make_pair(asset.strName, address)] = 0;
 
+    // The asset no longer exists, so neither do its aggregates
+    mapAssetStats[asset.strName].SetNull();
+    setChangedAssetStats.insert(asset.strName);
+
     CAssetCacheNewAsset newAsset(asset, address, 0 , uint256());
 
     if (setNewAssetsToAdd.count(newAsset))
@@ -1381,8 +1400,16 @@ bool CAssetsCache::AddNewAsset(const CNewAsset& asset, const std::string address
     }
 
     // Insert the asset into the assests address amount map
+    RecordDatabaseBalance(asset.strName, address);
     mapAssetsAddressAmount[std::make_pair(asset.strName, address)] = asset.nAmount;
 
+    // Start the aggregates of the asset from scratch
+    AssetType assetType;
+    IsAssetNameValid(asset.strName, assetType);
+    mapAssetStats[asset.strName].SetNull();
+    setChangedAssetStats.insert(asset.strName);
+    UpdateAssetStats(asset.strName, 0, asset.nAmount, GetBurnAmount(assetType), nHeight);
+
     CAssetCacheNewAsset newAsset(asset, address, nHeight, blockHash);
 
     if (setNewAssetsToRemove.count(newAsset))
@@ -1394,7 +1421,7 @@ bool CAssetsCache::AddNewAsset(const CNewAsset& asset, const std::string address
 }
 
 //! Changes Memory Only
-bool CAssetsCache::AddReissueAsset(const CReissueAsset& reissue, const std::string address, const COutPoint& out)
+bool CAssetsCache::AddReissueAsset(const CReissueAsset& reissue, const std::string address, const COutPoint& out, const int nHeight)
 {
     auto pair = std::make_pair(reissue.strName, address);
 
@@ -1420,7 +1447,10 @@ bool CAssetsCache::AddReissueAsset(const CReissueAsset& reissue, const std::stri
         mapAssetsAddressAmount.insert(make_pair(pair, 0));
 
     // Add the reissued amount to the amount in the map
+    RecordDatabaseBalance(pair.first, pair.second);
+    CAmount nPrevBalance = mapAssetsAddressAmount.at(pair);
     mapAssetsAddressAmount[pair] += reissue.nAmount;
+    UpdateAssetStats(reissue.strName, nPrevBalance, mapAssetsAddressAmount.at(pair), GetReissueAssetBurnAmount(), nHeight);
 
     // Insert the reissue information into the reissue map
     if (!mapReissuedAssetData.count(reissue.strName)) {
@@ -1476,11 +1506,15 @@ bool CAssetsCache::RemoveReissueAsset(const CReissueAsset& reissue, const std::s
     if (!GetBestAssetAddressAmount(*this, reissue.strName, address))
         return error("%s : Trying to undo reissue of an asset but the assets amount isn't in the database", __func__);
 
+    RecordDatabaseBalance(pair.first, pair.second);
+    CAmount nPrevBalance = mapAssetsAddressAmount.at(pair);
     mapAssetsAddressAmount[pair] -= reissue.nAmount;
 
     if (mapAssetsAddressAmount[pair] < 0)
         return error("%s : Tried undoing reissue of an asset, but the assets amount went negative: %s", __func__, reissue.strName);
 
+    UpdateAssetStats(reissue.strName, nPrevBalance, mapAssetsAddressAmount.at(pair), -GetReissueAssetBurnAmount());
+
     // If the undid amount is now 0. Remove the address from the set of addresses
     if (mapAssetsAddresses.count(reissue.strName) && mapAssetsAddressAmount[pair] == 0) {
         mapAssetsAddresses.at(reissue.strName).erase(address);
@@ -1516,7 +1550,7 @@ bool CAssetsCache::RemoveReissueAsset(const CReissueAsset& reissue, const std::s
 }
 
 //! Changes Memory Only
-bool CAssetsCache::AddOwnerAsset(const std::string& assetsName, const std::string address)
+bool CAssetsCache::AddOwnerAsset(const std::string& assetsName, const std::string address, const int nHeight)
 {
     if (mapAssetsAddresses.count(assetsName)) {
         if (mapAssetsAddresses[assetsName].count(address))
@@ -1532,8 +1566,13 @@ bool CAssetsCache::AddOwnerAsset(const std::string& assetsName, const std::strin
     }
 
     // Insert the asset into the assests address amount map
+    RecordDatabaseBalance(assetsName, address);
     mapAssetsAddressAmount[std::make_pair(assetsName, address)] = OWNER_ASSET_AMOUNT;
 
+    // Start the aggregates of the owner asset from scratch, the burn is accounted for on the asset itself
+    mapAssetStats[assetsName].SetNull();
+    setChangedAssetStats.insert(assetsName);
+    UpdateAssetStats(assetsName, 0, OWNER_ASSET_AMOUNT, 0, nHeight);
 
     // Update the cache
     CAssetCacheNewOwner newOwner(assetsName, address);
@@ -1557,8 +1596,13 @@ bool CAssetsCache::RemoveOwnerAsset(const std::string& assetsName, const std::st
 
     auto pair = std::make_pair(assetsName, address);
 
+    RecordDatabaseBalance(assetsName, address);
     mapAssetsAddressAmount[pair] = 0;
 
+    // The owner asset no longer exists, so neither do its aggregates
+    mapAssetStats[assetsName].SetNull();
+    setChangedAssetStats.insert(assetsName);
+
     // Update the cache
     CAssetCacheNewOwner newOwner(assetsName, address);
     if (setNewOwnerAssetsToAdd.count(newOwner))
@@ -1569,6 +1613,67 @@ bool CAssetsCache::RemoveOwnerAsset(const std::string& assetsName, const std::st
     return true;
 }
 
+//! Changes Memory Only
+void CAssetsCache::RecordDatabaseBalance(const std::string& assetName, const std::string& address)
+{
+    auto pair = std::make_pair(assetName, address);
+    if (mapDatabaseAddressAmount.count(pair))
+        return;
+
+    // Until its first change the balance in the map is the one from the database
+    CAmount nBalance = 0;
+    if (GetBestAssetAddressAmount(*this, assetName, address))
+        nBalance = mapAssetsAddressAmount.at(pair);
+    mapDatabaseAddressAmount.insert(std::make_pair(pair, nBalance));
+}
+
+bool CAssetsCache::WriteDatabaseBalance(const std::string& assetName, const std::string& address, const CAmount& nBalance)
+{
+    auto pair = std::make_pair(assetName, address);
+    auto it = mapDatabaseAddressAmount.find(pair);
+    CAmount nPrevBalance = it != mapDatabaseAddressAmount.end() ? it->second : nBalance;
+    if (!passetsdb->WriteAssetAddressQuantity(assetName, address, nPrevBalance, nBalance))
+        return false;
+
+    // A balance can be written more than once per flush
+    mapDatabaseAddressAmount[pair] = nBalance;
+    return true;
+}
+
+bool CAssetsCache::EraseDatabaseBalance(const std::string& assetName, const std::string& address)
+{
+    auto pair = std::make_pair(assetName, address);
+    auto it = mapDatabaseAddressAmount.find(pair);
+    CAmount nPrevBalance = it != mapDatabaseAddressAmount.end() ? it->second : 0;
+    if (!passetsdb->EraseAssetAddressQuantity(assetName, address, nPrevBalance))
+        return false;
+
+    mapDatabaseAddressAmount[pair] = 0;
+    return true;
+}
+
+//! Changes Memory Only
+void CAssetsCache::UpdateAssetStats(const std::string& assetName, const CAmount& nPrevBalance, const CAmount& nNewBalance, const CAmount& nBurned, const int nHeight)
+{
+    if (!GetBestAssetStats(*this, assetName))
+        mapAssetStats.insert(std::make_pair(assetName, CAssetStats()));
+
+    CAssetStats& stats = mapAssetStats.at(assetName);
+    setChangedAssetStats.insert(assetName);
+
+    // Only a balance moving to or from zero changes the number of holders
+    if (nPrevBalance <= 0 && nNewBalance > 0)
+        stats.nHolders++;
+    else if (nPrevBalance > 0 && nNewBalance <= 0)
+        stats.nHolders--;
+
+    stats.nCirculating += nNewBalance - nPrevBalance;
+    stats.nBurned += nBurned;
+
+    if (nHeight > stats.nLastActivityHeight)
+        stats.nLastActivityHeight = nHeight;
+}
+
 //! Changes Memory Only
 bool CAssetsCache::RemoveTransfer(const CAssetTransfer &transfer, const std::string &address, const COutPoint &out)
 {
@@ -1606,7 +1711,7 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                     return error("%s : %s", __func__, message);
                 }
 
-                if (!passetsdb->EraseAssetAddressQuantity(newAsset.asset.strName, newAsset.address)) {
+                if (!EraseDatabaseBalance(newAsset.asset.strName, newAsset.address)) {
                     dirty = true;
                     message = "_Failed Erasing Address Balance from database";
                 }
@@ -1629,8 +1734,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                     return error("%s : %s", __func__, message);
                 }
 
-                if (!passetsdb->WriteAssetAddressQuantity(newAsset.asset.strName, newAsset.address,
-                                                          newAsset.asset.nAmount)) {
+                if (!WriteDatabaseBalance(newAsset.asset.strName, newAsset.address,
+                                          newAsset.asset.nAmount)) {
                     dirty = true;
                     message = "_Failed Writing Address Balance to database";
                 }
@@ -1642,7 +1747,7 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
 
             // Remove the new owners from database
             for (auto ownerAsset : setNewOwnerAssetsToRemove) {
-                if (!passetsdb->EraseAssetAddressQuantity(ownerAsset.assetName, ownerAsset.address)) {
+                if (!EraseDatabaseBalance(ownerAsset.assetName, ownerAsset.address)) {
                     dirty = true;
                     message = "_Failed Erasing Owner Address Balance from database";
                 }
@@ -1656,8 +1761,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
             for (auto ownerAsset : setNewOwnerAssetsToAdd) {
                 auto pair = std::make_pair(ownerAsset.assetName, ownerAsset.address);
                 if (mapAssetsAddressAmount.count(pair) && mapAssetsAddressAmount.at(pair) > 0) {
-                    if (!passetsdb->WriteAssetAddressQuantity(ownerAsset.assetName, ownerAsset.address,
-                                                              mapAssetsAddressAmount.at(pair))) {
+                    if (!WriteDatabaseBalance(ownerAsset.assetName, ownerAsset.address,
+                                              mapAssetsAddressAmount.at(pair))) {
                         dirty = true;
                         message = "_Failed Writing Owner Address Balance to database";
                     }
@@ -1673,8 +1778,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                 auto pair = std::make_pair(undoTransfer.transfer.strName, undoTransfer.address);
                 if (mapAssetsAddressAmount.count(pair)) {
                     if (mapAssetsAddressAmount.at(pair) == 0) {
-                        if (!passetsdb->EraseAssetAddressQuantity(undoTransfer.transfer.strName,
-                                                                  undoTransfer.address)) {
+                        if (!EraseDatabaseBalance(undoTransfer.transfer.strName,
+                                                  undoTransfer.address)) {
                             dirty = true;
                             message = "_Failed Erasing Address Quantity from database";
                         }
@@ -1683,8 +1788,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                             return error("%s : %s", __func__, message);
                         }
                     } else {
-                        if (!passetsdb->WriteAssetAddressQuantity(undoTransfer.transfer.strName, undoTransfer.address,
-                                                                  mapAssetsAddressAmount.at(pair))) {
+                        if (!WriteDatabaseBalance(undoTransfer.transfer.strName, undoTransfer.address,
+                                                  mapAssetsAddressAmount.at(pair))) {
                             dirty = true;
                             message = "_Failed Writing updated Address Quantity to database when undoing transfers";
                         }
@@ -1701,8 +1806,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                 auto pair = std::make_pair(newTransfer.transfer.strName, newTransfer.address);
                 // During init and reindex it disconnects and verifies blocks, can create a state where vNewTransfer will contain transfers that have already been spent. So if they aren't in the map, we can skip them.
                 if (mapAssetsAddressAmount.count(pair)) {
-                    if (!passetsdb->WriteAssetAddressQuantity(newTransfer.transfer.strName, newTransfer.address,
-                                                              mapAssetsAddressAmount.at(pair))) {
+                    if (!WriteDatabaseBalance(newTransfer.transfer.strName, newTransfer.address,
+                                              mapAssetsAddressAmount.at(pair))) {
                         dirty = true;
                         message = "_Failed Writing new address quantity to database";
                     }
@@ -1729,8 +1834,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                     passetsCache->Erase(reissue_name);
 
                     if (mapAssetsAddressAmount.count(pair)) {
-                        if (!passetsdb->WriteAssetAddressQuantity(pair.first, pair.second,
-                                                                  mapAssetsAddressAmount.at(pair))) {
+                        if (!WriteDatabaseBalance(pair.first, pair.second,
+                                                  mapAssetsAddressAmount.at(pair))) {
                             dirty = true;
                             message = "_Failed Writing reissue asset quantity to the address quantity database";
                         }
@@ -1762,12 +1867,12 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                     auto pair = make_pair(undoReissue.reissue.strName, undoReissue.address);
                     if (mapAssetsAddressAmount.count(pair)) {
                         if (mapAssetsAddressAmount.at(pair) == 0) {
-                            if (!passetsdb->EraseAssetAddressQuantity(reissue_name, undoReissue.address)) {
+                            if (!EraseDatabaseBalance(reissue_name, undoReissue.address)) {
                                 dirty = true;
                                 message = "_Failed Erasing Address Balance from database";
                             }
                         } else {
-                            if (!passetsdb->WriteAssetAddressQuantity(reissue_name, undoReissue.address, mapAssetsAddressAmount.at(pair))) {
+                            if (!WriteDatabaseBalance(reissue_name, undoReissue.address, mapAssetsAddressAmount.at(pair))) {
                                 dirty = true;
                                 message = "_Failed Writing the undo of reissue of asset from database";
                             }
@@ -1786,8 +1891,8 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
             for (auto undoSpend : vUndoAssetAmount) {
                 auto pair = std::make_pair(undoSpend.assetName, undoSpend.address);
                 if (mapAssetsAddressAmount.count(pair)) {
-                    if (!passetsdb->WriteAssetAddressQuantity(undoSpend.assetName, undoSpend.address,
-                                                              mapAssetsAddressAmount.at(pair))) {
+                    if (!WriteDatabaseBalance(undoSpend.assetName, undoSpend.address,
+                                              mapAssetsAddressAmount.at(pair))) {
                         dirty = true;
                         message = "_Failed Writing updated Address Quantity to database when undoing spends";
                     }
@@ -1817,7 +1922,7 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                 auto pair = make_pair(spentAsset.assetName, spentAsset.address);
                 if (mapAssetsAddressAmount.count(pair)) {
                     if (mapAssetsAddressAmount.at(make_pair(spentAsset.assetName, spentAsset.address)) == 0) {
-                        if (!passetsdb->EraseAssetAddressQuantity(spentAsset.assetName, spentAsset.address)) {
+                        if (!EraseDatabaseBalance(spentAsset.assetName, spentAsset.address)) {
                             dirty = true;
                             message = "_Failed Erasing a Spent Asset, from database";
                         }
@@ -1826,7 +1931,7 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                             return error("%s : %s", __func__, message);
                         }
                     } else  {
-                        if (!passetsdb->WriteAssetAddressQuantity(spentAsset.assetName, spentAsset.address, mapAssetsAddressAmount.at(pair))) {
+                        if (!WriteDatabaseBalance(spentAsset.assetName, spentAsset.address, mapAssetsAddressAmount.at(pair))) {
                             dirty = true;
                             message = "_Failed Erasing a Spent Asset, from database";
                         }
@@ -1838,6 +1943,29 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
                 }
             }
 
+            // Save the asset aggregates that changed, assets that were removed have null stats
+            for (const auto& assetName : setChangedAssetStats) {
+                if (!mapAssetStats.count(assetName))
+                    continue;
+
+                const CAssetStats& stats = mapAssetStats.at(assetName);
+                if (stats.IsNull()) {
+                    if (!passetsdb->EraseAssetStats(assetName)) {
+                        dirty = true;
+                        message = "_Failed Erasing asset stats from database";
+                    }
+                } else {
+                    if (!passetsdb->WriteAssetStats(assetName, stats)) {
+                        dirty = true;
+                        message = "_Failed Writing asset stats to database";
+                    }
+                }
+
+                if (dirty) {
+                    return error("%s : %s", __func__, message);
+                }
+            }
+
             ClearDirtyCache();
         }
 
@@ -1855,7 +1983,7 @@ bool CAssetsCache::Flush(bool fSoftCopy, bool fFlushDB)
 size_t CAssetsCache::DynamicMemoryUsage() const
 {
     // TODO make sure this is accurate
-    return memusage::DynamicUsage(mapAssetsAddresses) + memusage::DynamicUsage(mapAssetsAddressAmount) + memusage::DynamicUsage(mapMyUnspentAssets) + memusage::DynamicUsage(mapReissuedAssetData) ;
+    return memusage::DynamicUsage(mapAssetsAddresses) + memusage::DynamicUsage(mapAssetsAddressAmount) + memusage::DynamicUsage(mapDatabaseAddressAmount) + memusage::DynamicUsage(mapMyUnspentAssets) + memusage::DynamicUsage(mapReissuedAssetData) + memusage::DynamicUsage(mapAssetStats);
 }
 
 //! Get an estimated size of the cache in bytes that will be needed inorder to save to database
@@ -1893,6 +2021,8 @@ size_t CAssetsCache::GetCacheSize() const
     size += (32 + 113) * setPossiblyMineAdd.size(); // Asset Name, COutPoint, CTxOut
     size += (32 + 113) * setPossiblyMineRemove.size(); // Asset Name, COutPoint, CTxOut
 
+    size += (32 + 8 + 8 + 8 + sizeof(int)) * setChangedAssetStats.size(); // Asset Name, Holders, CAmount, CAmount, int
+
     return size;
 }
 
@@ -2446,7 +2576,7 @@ bool GetBestAssetAddressAmount(CAssetsCache& cache, const std::string& assetName
 
     // If the database contains the assets address amount, insert it into the database and return true
     CAmount nDBAmount;
-    if (passetsdb->ReadAssetAddressQuantity(pair.first, pair.second, nDBAmount)) {
+    if (passetsdb && passetsdb->ReadAssetAddressQuantity(pair.first, pair.second, nDBAmount)) {
         cache.mapAssetsAddressAmount.insert(make_pair(pair, nDBAmount));
         return true;
     }
@@ -2455,6 +2585,34 @@ bool GetBestAssetAddressAmount(CAssetsCache& cache, const std::string& assetName
     return false;
 }
 
+void GetUnflushedAssetBalances(const CAssetsCache& cache, const std::string& assetName, std::map<std::string, CAmount>& mapBalances)
+{
+    // Every balance changed since the last flush has its database balance recorded, the ones only read through are skipped
+    auto changed = cache.mapDatabaseAddressAmount.lower_bound(std::make_pair(assetName, std::string()));
+    for (; changed != cache.mapDatabaseAddressAmount.end() && changed->first.first == assetName; ++changed) {
+        auto balance = cache.mapAssetsAddressAmount.find(changed->first);
+        mapBalances.insert(std::make_pair(changed->first.second, balance != cache.mapAssetsAddressAmount.end() ? balance->second : 0));
+    }
+}
+
+//! This will get the aggregates of an asset from the database if the cache doesn't already have them
+bool GetBestAssetStats(CAssetsCache& cache, const std::string& assetName)
+{
+    // If the caches map has the asset, return true because the map already contains the best dirty stats
+    if (cache.mapAssetStats.count(assetName))
+        return true;
+
+    // If the database contains the asset stats, insert them into the cache and return true
+    CAssetStats stats;
+    if (passetsdb && passetsdb->ReadAssetStats(assetName, stats)) {
+        cache.mapAssetStats.insert(make_pair(assetName, stats));
+        return true;
+    }
+
+    // The stats weren't found return false
+    return false;
+}
+
 //! sets _assetNames_ to the set of names of owned assets
 bool GetMyOwnedAssets(CAssetsCache& cache, std::vector<std::string>& assetNames) {
     for (auto const& entry : cache.mapMyUnspentAssets) {
@@ -55,11 +55,6 @@ struct CBlockAssetUndo;
 // 2500 * 82 Bytes == 205 KB (kilobytes) of memory
 #define MAX_CACHE_ASSETS_SIZE 2500
 
-// Create map that store that state of current reissued transaction that the mempool as accepted.
-// If an asset name is in this map, any other reissue transactions wont be accepted into the mempool
-extern std::map<uint256, std::string> mapReissuedTx;
-extern std::map<std::string, uint256> mapReissuedAssets;
-
 class CAssets {
 public:
 
@@ -71,12 +66,14 @@ public:
 
     // Dirty, Gets wiped once flushed to database
     std::map<std::string, CNewAsset> mapReissuedAssetData; // Asset Name -> New Asset Data
+    std::map<std::string, CAssetStats> mapAssetStats; // Asset Name -> Holder count, supply and burn aggregates
 
     CAssets(const CAssets& assets) {
         this->mapMyUnspentAssets = assets.mapMyUnspentAssets;
         this->mapAssetsAddressAmount = assets.mapAssetsAddressAmount;
         this->mapAssetsAddresses = assets.mapAssetsAddresses;
         this->mapReissuedAssetData = assets.mapReissuedAssetData;
+        this->mapAssetStats = assets.mapAssetStats;
     }
 
     CAssets& operator=(const CAssets& other) {
@@ -84,6 +81,7 @@ public:
         mapAssetsAddressAmount = other.mapAssetsAddressAmount;
         mapAssetsAddresses = other.mapAssetsAddresses;
         mapReissuedAssetData = other.mapReissuedAssetData;
+        mapAssetStats = other.mapAssetStats;
         return *this;
     }
 
@@ -96,6 +94,7 @@ public:
         mapAssetsAddresses.clear();
         mapAssetsAddressAmount.clear();
         mapReissuedAssetData.clear();
+        mapAssetStats.clear();
     }
 };
 
@@ -103,13 +102,23 @@ class CAssetsCache : public CAssets
 {
 private:
     bool AddBackSpentAsset(const Coin& coin, const std::string& assetName, const std::string& address, const CAmount& nAmount, const COutPoint& out);
-    void AddToAssetBalance(const std::string& strName, const std::string& address, const CAmount& nAmount);
+    void AddToAssetBalance(const std::string& strName, const std::string& address, const CAmount& nAmount, const int nHeight = -1);
     bool UndoTransfer(const CAssetTransfer& transfer, const std::string& address, const COutPoint& outToRemove);
+    void UpdateAssetStats(const std::string& assetName, const CAmount& nPrevBalance, const CAmount& nNewBalance, const CAmount& nBurned = 0, const int nHeight = -1);
+    //! Remember the database balance of an address before it is changed for the first time since the last flush
+    void RecordDatabaseBalance(const std::string& assetName, const std::string& address);
+    //! Write or erase the balance of an address, moving its balance index entry from the recorded database balance
+    bool WriteDatabaseBalance(const std::string& assetName, const std::string& address, const CAmount& nBalance);
+    bool EraseDatabaseBalance(const std::string& assetName, const std::string& address);
 public :
     //! These are memory only containers that show dirty entries that will be databased when flushed
     std::vector<CAssetCacheUndoAssetAmount> vUndoAssetAmount;
     std::vector<CAssetCacheSpendAsset> vSpentAssets;
     std::set<std::string> setChangeOwnedOutPoints;
+    //! The balances the database holds for the addresses changed since the last flush, 0 if it holds none
+    std::map<std::pair<std::string, std::string>, CAmount> mapDatabaseAddressAmount;
+    //! The assets whose aggregates changed since the last flush
+    std::set<std::string> setChangedAssetStats;
 
     // New Assets Caches
     std::set<CAssetCacheNewAsset> setNewAssetsToRemove;
@@ -143,10 +152,13 @@ public :
         this->mapAssetsAddressAmount = cache.mapAssetsAddressAmount;
         this->mapAssetsAddresses = cache.mapAssetsAddresses;
         this->mapReissuedAssetData = cache.mapReissuedAssetData;
+        this->mapAssetStats = cache.mapAssetStats;
 
         // Copy dirty cache also
         this->vSpentAssets = cache.vSpentAssets;
         this->vUndoAssetAmount = cache.vUndoAssetAmount;
+        this->mapDatabaseAddressAmount = cache.mapDatabaseAddressAmount;
+        this->setChangedAssetStats = cache.setChangedAssetStats;
 
         // Transfer Caches
         this->setNewTransferAssetsToAdd = cache.setNewTransferAssetsToAdd;
@@ -174,10 +186,13 @@ public :
         this->mapAssetsAddressAmount = cache.mapAssetsAddressAmount;
         this->mapAssetsAddresses = cache.mapAssetsAddresses;
         this->mapReissuedAssetData = cache.mapReissuedAssetData;
+        this->mapAssetStats = cache.mapAssetStats;
 
         // Copy dirty cache also
         this->vSpentAssets = cache.vSpentAssets;
         this->vUndoAssetAmount = cache.vUndoAssetAmount;
+        this->mapDatabaseAddressAmount = cache.mapDatabaseAddressAmount;
+        this->setChangedAssetStats = cache.setChangedAssetStats;
 
         // Transfer Caches
         this->setNewTransferAssetsToAdd = cache.setNewTransferAssetsToAdd;
@@ -207,10 +222,13 @@ public :
         this->mapAssetsAddressAmount = cache.mapAssetsAddressAmount;
         this->mapAssetsAddresses = cache.mapAssetsAddresses;
         this->mapReissuedAssetData = cache.mapReissuedAssetData;
+        this->mapAssetStats = cache.mapAssetStats;
 
         // Copy dirty cache also
         this->vSpentAssets = cache.vSpentAssets;
         this->vUndoAssetAmount = cache.vUndoAssetAmount;
+        this->mapDatabaseAddressAmount = cache.mapDatabaseAddressAmount;
+        this->setChangedAssetStats = cache.setChangedAssetStats;
 
         // Transfer Caches
         this->setNewTransferAssetsToAdd = cache.setNewTransferAssetsToAdd;
@@ -245,10 +263,10 @@ public :
 
     // Cache only add asset functions
     bool AddNewAsset(const CNewAsset& asset, const std::string address, const int& nHeight, const uint256& blockHash);
-    bool AddTransferAsset(const CAssetTransfer& transferAsset, const std::string& address, const COutPoint& out, const CTxOut& txOut);
-    bool AddOwnerAsset(const std::string& assetsName, const std::string address);
+    bool AddTransferAsset(const CAssetTransfer& transferAsset, const std::string& address, const COutPoint& out, const CTxOut& txOut, const int nHeight = -1);
+    bool AddOwnerAsset(const std::string& assetsName, const std::string address, const int nHeight = -1);
     bool AddToMyUnspentOutPoints(const std::string& strName, const COutPoint& out);
-    bool AddReissueAsset(const CReissueAsset& reissue, const std::string address, const COutPoint& out);
+    bool AddReissueAsset(const CReissueAsset& reissue, const std::string address, const COutPoint& out, const int nHeight = -1);
 
     // Cache only validation functions
     bool TrySpendCoin(const COutPoint& out, const CTxOut& coin);
@@ -276,6 +294,8 @@ public :
 
         vUndoAssetAmount.clear();
         vSpentAssets.clear();
+        mapDatabaseAddressAmount.clear();
+        setChangedAssetStats.clear();
 
         setNewAssetsToRemove.clear();
         setNewAssetsToAdd.clear();
@@ -293,6 +313,7 @@ public :
 
         mapReissuedAssetData.clear();
         mapAssetsAddressAmount.clear();
+        mapAssetStats.clear();
 
         // Copy sets of possibilymine
         setPossiblyMineAdd.clear();
@@ -379,6 +400,10 @@ bool GetAssetInfoFromScript(const CScript& scriptPubKey, std::string& strName, C
 bool GetAssetData(const CScript& script, CAssetOutputEntry& data);
 
 bool GetBestAssetAddressAmount(CAssetsCache& cache, const std::string& assetName, const std::string& address);
+bool GetBestAssetStats(CAssetsCache& cache, const std::string& assetName);
+//! Get the balances of an asset that changed in the cache since it was last flushed to the database (Address -> Balance).
+//! Only the changed addresses are visited, not every balance the cache holds
+void GetUnflushedAssetBalances(const CAssetsCache& cache, const std::string& assetName, std::map<std::string, CAmount>& mapBalances);
 
 bool GetMyOwnedAssets(CAssetsCache& cache, std::vector<std::string>& assets);
 bool GetMyOwnedAssets(CAssetsCache& cache, const std::string prefix, std::vector<std::string>& assetNames);
@@ -0,0 +1,378 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "assetsnapshot.h"
+#include "assetdb.h"
+#include "assets.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "dbwrapper.h"
+#include "fs.h"
+#include "streams.h"
+#include "sync.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Requests are kept until the block they were taken at is buried this deep, so a reorg gets a new snapshot
+static const int SNAPSHOT_REQUEST_KEEP_DEPTH = 100;
+// Holders are read from the database and written to the file this many at a time
+static const size_t SNAPSHOT_HOLDERS_CHUNK = 10000;
+
+/** Everything needed to write one snapshot without reading the live asset state */
+struct CAssetSnapshotJob
+{
+    CAssetSnapshot snapshot;
+    std::map<std::string, CAmount> mapDirtyBalances; // Address -> Balance that wasn't flushed to the database yet
+    std::unique_ptr<CDBIterator> pcursor; // Reads the asset database as it was when the block was connected
+};
+
+// Guarded by cs_main
+static std::set<std::pair<std::string, int> > setSnapshotRequests; // <Asset Name, Height>
+static std::set<std::pair<std::string, int> > setFailedSnapshotRequests; // The requests whose snapshot couldn't be written
+static bool fSnapshotRequestsLoaded = false;
+
+static std::mutex cs_snapshotJobs;
+static std::condition_variable condSnapshotJobs;
+static std::deque<std::unique_ptr<CAssetSnapshotJob> > queueSnapshotJobs;
+static std::thread threadSnapshots;
+static bool fStopSnapshots = false;
+static bool fWritingSnapshot = false;
+
+static fs::path GetAssetSnapshotPath(const std::string& assetName, const int nHeight)
+{
+    // Asset names can contain characters that aren't safe in file names
+    return GetDataDir() / "snapshots" / strprintf("%s_%d.dat", HexStr(assetName.begin(), assetName.end()), nHeight);
+}
+
+static void LoadSnapshotRequests()
+{
+    AssertLockHeld(cs_main);
+
+    if (fSnapshotRequestsLoaded || !passetsdb)
+        return;
+
+    if (!passetsdb->LoadSnapshotRequests(setSnapshotRequests, setFailedSnapshotRequests))
+        LogPrintf("%s : Failed to load the asset snapshot requests from database\n", __func__);
+
+    fSnapshotRequestsLoaded = true;
+}
+
+//! Read the holders of a job in chunks, returns the number of them
+static size_t ReadSnapshotHolders(CAssetSnapshotJob& job, const std::function<void(const std::pair<std::string, CAmount>&)>& func)
+{
+    // The balances that were still dirty in memory replace the ones from the database
+    CAssetHoldersReader reader(*job.pcursor, job.snapshot.assetName, job.mapDirtyBalances);
+    std::vector<std::pair<std::string, CAmount> > vChunk;
+    size_t nHolders = 0;
+    bool fMore = true;
+    while (fMore) {
+        vChunk.clear();
+        fMore = reader.Next(vChunk, SNAPSHOT_HOLDERS_CHUNK);
+        for (const auto& holder : vChunk)
+            func(holder);
+        nHolders += vChunk.size();
+    }
+    return nHolders;
+}
+
+static void WriteAssetSnapshot(CAssetSnapshotJob& job)
+{
+    const CAssetSnapshot& snapshot = job.snapshot;
+
+    // The holder count comes before the holders, so they are counted first instead of being held in memory
+    size_t nHolders = ReadSnapshotHolders(job, [](const std::pair<std::string, CAmount>&) {});
+
+    fs::path path = GetAssetSnapshotPath(snapshot.assetName, snapshot.nHeight);
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+
+    try {
+        TryCreateDirectories(path.parent_path());
+
+        FILE* filestr = fsbridge::fopen(pathTmp, "wb");
+        if (!filestr) {
+            LogPrintf("%s : Failed to open %s\n", __func__, pathTmp.string());
+            return;
+        }
+
+        // Same layout as CAssetSnapshot's serialization
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        file << snapshot.assetName;
+        file << snapshot.nHeight;
+        file << snapshot.blockHash;
+        WriteCompactSize(file, nHolders);
+        size_t nWritten = ReadSnapshotHolders(job, [&file](const std::pair<std::string, CAmount>& holder) { file << holder; });
+
+        // Release the database snapshot as soon as we are done with it
+        job.pcursor.reset();
+
+        if (nWritten != nHolders) {
+            file.fclose();
+            fs::remove(pathTmp);
+            LogPrintf("%s : The holders of %s changed while writing its snapshot at height %d\n", __func__, snapshot.assetName, snapshot.nHeight);
+            return;
+        }
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(pathTmp, path);
+    } catch (const std::exception& e) {
+        LogPrintf("%s : Failed to write the snapshot of %s at height %d: %s\n", __func__, snapshot.assetName, snapshot.nHeight, e.what());
+        return;
+    }
+
+    LogPrintf("Wrote asset snapshot of %s at height %d with %u holders\n", snapshot.assetName, snapshot.nHeight, nHolders);
+}
+
+//! Write the queued snapshots on their own thread, so a large asset doesn't hold up the scheduler. Once stopped the
+//! snapshots still queued are written before it exits
+static void ThreadAssetSnapshots()
+{
+    while (true) {
+        std::unique_ptr<CAssetSnapshotJob> job;
+        {
+            std::unique_lock<std::mutex> lock(cs_snapshotJobs);
+            condSnapshotJobs.wait(lock, [] { return fStopSnapshots || !queueSnapshotJobs.empty(); });
+            if (queueSnapshotJobs.empty())
+                return;
+
+            job = std::move(queueSnapshotJobs.front());
+            queueSnapshotJobs.pop_front();
+            fWritingSnapshot = true;
+        }
+
+        WriteAssetSnapshot(*job);
+
+        {
+            std::lock_guard<std::mutex> lock(cs_snapshotJobs);
+            fWritingSnapshot = false;
+        }
+        condSnapshotJobs.notify_all();
+    }
+}
+
+//! Queue the snapshot of a requested asset at the block that was just connected, requires cs_main
+static void QueueAssetSnapshot(const std::string& assetName, const CBlockIndex* pindex)
+{
+    std::unique_ptr<CAssetSnapshotJob> job(new CAssetSnapshotJob());
+    job->snapshot.assetName = assetName;
+    job->snapshot.nHeight = pindex->nHeight;
+    job->snapshot.blockHash = pindex->GetBlockHash();
+
+    // Balances that changed since the last flush only live in memory, everything else is read from a database snapshot
+    GetUnflushedAssetBalances(*passets, assetName, job->mapDirtyBalances);
+
+    job->pcursor.reset(passetsdb->NewSnapshotIterator());
+
+    // A request that failed before gets another chance if its block is connected again
+    auto request = std::make_pair(assetName, pindex->nHeight);
+    if (setFailedSnapshotRequests.erase(request))
+        passetsdb->WriteSnapshotRequest(assetName, pindex->nHeight);
+
+    {
+        std::lock_guard<std::mutex> lock(cs_snapshotJobs);
+        if (!threadSnapshots.joinable() || fStopSnapshots) {
+            LogPrintf("%s : Snapshots aren't started, skipping the snapshot of %s at height %d\n", __func__, assetName, pindex->nHeight);
+            return;
+        }
+        queueSnapshotJobs.push_back(std::move(job));
+    }
+    condSnapshotJobs.notify_all();
+}
+
+//! Whether the snapshot of a request was written for the block of the active chain at its height, requires cs_main
+static bool HaveAssetSnapshot(const std::string& assetName, const int nHeight)
+{
+    CAssetSnapshot snapshot;
+    size_t nTotalHolders;
+    return ReadAssetSnapshot(assetName, nHeight, snapshot, nTotalHolders, 0) && chainActive[nHeight] &&
+           chainActive[nHeight]->GetBlockHash() == snapshot.blockHash;
+}
+
+void StartAssetSnapshots()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs_snapshotJobs);
+        if (!threadSnapshots.joinable()) {
+            fStopSnapshots = false;
+            threadSnapshots = std::thread(&TraceThread<std::function<void()> >, "assetsnap", std::function<void()>(ThreadAssetSnapshots));
+        }
+    }
+
+    LOCK(cs_main);
+    LoadSnapshotRequests();
+
+    // Requests whose block was connected before the node went down without its snapshot being written. The tip can
+    // still be captured, older blocks can't be, so those requests are marked failed
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (!pindexTip || !passets || !passetsdb)
+        return;
+
+    for (const auto& request : setSnapshotRequests) {
+        if (request.second > pindexTip->nHeight || setFailedSnapshotRequests.count(request) || HaveAssetSnapshot(request.first, request.second))
+            continue;
+
+        if (request.second == pindexTip->nHeight) {
+            LogPrintf("%s : Taking the missing snapshot of %s at height %d\n", __func__, request.first, request.second);
+            QueueAssetSnapshot(request.first, pindexTip);
+        } else {
+            LogPrintf("%s : The snapshot of %s at height %d wasn't written and can't be taken anymore\n", __func__, request.first, request.second);
+            setFailedSnapshotRequests.insert(request);
+            passetsdb->WriteSnapshotRequest(request.first, request.second, true);
+        }
+    }
+}
+
+void StopAssetSnapshots()
+{
+    // The thread writes the snapshots that are still queued before it exits, their requests would fail on the next start otherwise
+    {
+        std::lock_guard<std::mutex> lock(cs_snapshotJobs);
+        fStopSnapshots = true;
+    }
+    condSnapshotJobs.notify_all();
+    if (threadSnapshots.joinable())
+        threadSnapshots.join();
+
+    // The requests are loaded again from the next asset database
+    LOCK(cs_main);
+    setSnapshotRequests.clear();
+    setFailedSnapshotRequests.clear();
+    fSnapshotRequestsLoaded = false;
+}
+
+void SyncWithAssetSnapshots()
+{
+    std::unique_lock<std::mutex> lock(cs_snapshotJobs);
+    condSnapshotJobs.wait(lock, [] { return queueSnapshotJobs.empty() && !fWritingSnapshot; });
+}
+
+bool AddAssetSnapshotRequest(const std::string& assetName, const int nHeight, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+
+    if (!passetsdb) {
+        strError = "Asset database isn't available";
+        return false;
+    }
+
+    if (nHeight <= chainActive.Height()) {
+        strError = strprintf("Snapshots can only be requested above the current height (%d)", chainActive.Height());
+        return false;
+    }
+
+    LoadSnapshotRequests();
+
+    if (!passetsdb->WriteSnapshotRequest(assetName, nHeight)) {
+        strError = "Failed to write the snapshot request to database";
+        return false;
+    }
+
+    setSnapshotRequests.insert(std::make_pair(assetName, nHeight));
+
+    return true;
+}
+
+bool RemoveAssetSnapshotRequest(const std::string& assetName, const int nHeight)
+{
+    AssertLockHeld(cs_main);
+
+    LoadSnapshotRequests();
+
+    if (!setSnapshotRequests.erase(std::make_pair(assetName, nHeight)))
+        return false;
+    setFailedSnapshotRequests.erase(std::make_pair(assetName, nHeight));
+
+    if (passetsdb)
+        passetsdb->EraseSnapshotRequest(assetName, nHeight);
+
+    return true;
+}
+
+void GetAssetSnapshotRequests(std::set<std::pair<std::string, int> >& setRequests, std::set<std::pair<std::string, int> >& setFailed)
+{
+    AssertLockHeld(cs_main);
+
+    LoadSnapshotRequests();
+
+    setRequests = setSnapshotRequests;
+    setFailed = setFailedSnapshotRequests;
+}
+
+void CaptureAssetSnapshots(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+
+    if (!passets || !passetsdb)
+        return;
+
+    LoadSnapshotRequests();
+
+    for (auto it = setSnapshotRequests.begin(); it != setSnapshotRequests.end();) {
+        const std::string& assetName = it->first;
+        const int nHeight = it->second;
+
+        // Forget requests that are buried deep enough to not get reorganized
+        if (nHeight + SNAPSHOT_REQUEST_KEEP_DEPTH < pindex->nHeight) {
+            passetsdb->EraseSnapshotRequest(assetName, nHeight);
+            setFailedSnapshotRequests.erase(*it);
+            it = setSnapshotRequests.erase(it);
+            continue;
+        }
+
+        if (nHeight == pindex->nHeight)
+            QueueAssetSnapshot(assetName, pindex);
+
+        ++it;
+    }
+}
+
+bool ReadAssetSnapshot(const std::string& assetName, const int nHeight, CAssetSnapshot& snapshot, size_t& nTotalHolders,
+                       const size_t nCount, const size_t nStart)
+{
+    fs::path path = GetAssetSnapshotPath(assetName, nHeight);
+
+    FILE* filestr = fsbridge::fopen(path, "rb");
+    if (!filestr)
+        return false;
+
+    snapshot.SetNull();
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    try {
+        // Same layout as CAssetSnapshot's serialization, but the holders are streamed instead of read as one vector
+        file >> snapshot.assetName;
+        file >> snapshot.nHeight;
+        file >> snapshot.blockHash;
+        nTotalHolders = ReadCompactSize(file);
+
+        size_t nSkip = std::min<size_t>(nStart, nTotalHolders);
+        for (size_t i = 0; i < nSkip; i++) {
+            // Address, then balance
+            file.ignore(ReadCompactSize(file));
+            file.ignore(sizeof(CAmount));
+        }
+
+        for (size_t i = nSkip; i < nTotalHolders && snapshot.vHolders.size() < nCount; i++) {
+            std::pair<std::string, CAmount> holder;
+            file >> holder;
+            snapshot.vHolders.push_back(holder);
+        }
+    } catch (const std::exception& e) {
+        return error("%s : Failed to read the snapshot of %s at height %d: %s", __func__, assetName, nHeight, e.what());
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef RAVEN_ASSETSNAPSHOT_H
+#define RAVEN_ASSETSNAPSHOT_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+
+class CBlockIndex;
+
+/** The holders of an asset as they were right after a block was connected */
+class CAssetSnapshot
+{
+public:
+    std::string assetName;
+    int nHeight;
+    uint256 blockHash;
+    std::vector<std::pair<std::string, CAmount> > vHolders; // Address -> Balance, largest balance first
+
+    CAssetSnapshot()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        assetName = "";
+        nHeight = -1;
+        blockHash.SetNull();
+        vHolders.clear();
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(assetName);
+        READWRITE(nHeight);
+        READWRITE(blockHash);
+        READWRITE(vHolders);
+    }
+};
+
+/**
+ * Start the thread writing snapshots, and load the requests saved in the asset database. A request at the tip
+ * height whose snapshot is missing is taken again, older ones are marked failed. Requires the chain to be loaded
+ */
+void StartAssetSnapshots();
+/** Write the snapshots that are still queued, stop the thread and forget the requests. Must be called before the asset database is deleted */
+void StopAssetSnapshots();
+/** Wait until the queued snapshots were written, used by the tests */
+void SyncWithAssetSnapshots();
+
+/** Request a snapshot of the holders of an asset at a future block height. Requires cs_main */
+bool AddAssetSnapshotRequest(const std::string& assetName, const int nHeight, std::string& strError);
+/** Cancel a snapshot request. Requires cs_main */
+bool RemoveAssetSnapshotRequest(const std::string& assetName, const int nHeight);
+/** Get the snapshot requests, setFailed is set to those whose snapshot couldn't be written. Requires cs_main */
+void GetAssetSnapshotRequests(std::set<std::pair<std::string, int> >& setRequests, std::set<std::pair<std::string, int> >& setFailed);
+
+/**
+ * Capture the state needed to write the requested snapshots of the block that was just connected.
+ * Must be called with cs_main held, after passets was updated and before the asset database is flushed.
+ * The snapshots themselves are written on their own thread so block connection isn't blocked.
+ */
+void CaptureAssetSnapshots(const CBlockIndex* pindex);
+
+/**
+ * Read a snapshot that was written to disk. The holders are read one at a time, only the nCount
+ * holders after the first nStart are kept in vHolders. nTotalHolders is set to the number of holders in the snapshot.
+ */
+bool ReadAssetSnapshot(const std::string& assetName, const int nHeight, CAssetSnapshot& snapshot, size_t& nTotalHolders,
+                       const size_t nCount = std::numeric_limits<size_t>::max(), const size_t nStart = 0);
+
+#endif //RAVEN_ASSETSNAPSHOT_H
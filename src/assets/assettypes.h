@@ -156,6 +156,45 @@ public:
     }
 };
 
+/** Aggregates that are kept per asset so they can be served without walking every holder */
+class CAssetStats
+{
+public:
+    int64_t nHolders;           // Number of addresses that hold a non zero balance
+    CAmount nCirculating;       // Sum of all address balances
+    CAmount nBurned;            // RVN burned by the issue and reissue transactions of this asset
+    int nLastActivityHeight;    // Height of the last block that created an output of this asset (not rewound on disconnect)
+
+    CAssetStats()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nHolders = 0;
+        nCirculating = 0;
+        nBurned = 0;
+        nLastActivityHeight = -1;
+    }
+
+    bool IsNull() const
+    {
+        return nHolders == 0 && nCirculating == 0 && nBurned == 0 && nLastActivityHeight == -1;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nHolders);
+        READWRITE(nCirculating);
+        READWRITE(nBurned);
+        READWRITE(nLastActivityHeight);
+    }
+};
+
 class CAssetTransfer
 {
 public:
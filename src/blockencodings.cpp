@@ -14,7 +14,34 @@
 #include "validation.h"
 #include "util.h"
 
-#include <unordered_map>
+ShortIDIndex::ShortIDIndex(size_t count) : salt(FastRandomContext().rand64())
+{
+    // At most half of the slots are used, and the bitmap has 16 bits per short ID
+    int slot_bits = 4;
+    while ((size_t(1) << slot_bits) < 2 * count)
+        slot_bits++;
+    slot_shift = 64 - slot_bits;
+    bit_shift = slot_shift - 3;
+    slots.assign(size_t(1) << slot_bits, Slot{0, -1});
+    bitmap.assign((size_t(1) << (slot_bits + 3)) / 64, 0);
+}
+
+bool ShortIDIndex::Insert(uint64_t shortid, uint16_t index)
+{
+    uint64_t mixed = Mix(shortid);
+    size_t i = mixed >> slot_shift;
+    for (int probes = 0; probes < MAX_PROBES; probes++, i = (i + 1) & (slots.size() - 1)) {
+        if (slots[i].index < 0) {
+            slots[i] = Slot{shortid, index};
+            uint64_t bit = mixed >> bit_shift;
+            bitmap[bit >> 6] |= uint64_t(1) << (bit & 63);
+            return true;
+        }
+        if (slots[i].shortid == shortid)
+            return false;
+    }
+    return false;
+}
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
@@ -74,52 +101,37 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     }
     prefilled_count = cmpctblock.prefilledtxn.size();
 
-    // Calculate map of txids -> positions and check mempool to see what we have (or don't)
-    // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
-    // of short IDs, any highly-uneven distribution of elements can be safely treated as a
-    // READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    // Index the short IDs by their positions and check mempool to see what we have (or don't)
+    // Well-formed cmpctblock messages can't collide in the index, as it is salted, so a short ID
+    // that doesn't find a slot is treated as READ_STATUS_FAILED.
+    ShortIDIndex shorttxids(cmpctblock.shorttxids.size());
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
-        // To determine the chance that the number of entries in a bucket exceeds N,
-        // we use the fact that the number of elements in a single bucket is
-        // binomially distributed (with n = the number of shorttxids S, and p =
-        // 1 / the number of buckets), that in the worst case the number of buckets is
-        // equal to S (due to std::unordered_map having a default load factor of 1.0),
-        // and that the chance for any bucket to exceed N elements is at most
-        // buckets * (the chance that any given bucket is above N elements).
-        // Thus: P(max_elements_per_bucket > N) <= S * (1 - cdf(binomial(n=S,p=1/S), N)).
-        // If we assume blocks of up to 16000, allowing 12 elements per bucket should
-        // only fail once per ~1 million block transfers (per peer and connection).
-        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
-            return READ_STATUS_FAILED;
+        // TODO: in the shortid-collision case, we should instead request both transactions
+        // which collided. Falling back to full-block-request here is overkill.
+        if (!shorttxids.Insert(cmpctblock.shorttxids[i], i + index_offset))
+            return READ_STATUS_FAILED; // Short ID collision
     }
-    // TODO: in the shortid-collision case, we should instead request both transactions
-    // which collided. Falling back to full-block-request here is overkill.
-    if (shorttxids.size() != cmpctblock.shorttxids.size())
-        return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
     for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
+        int index = shorttxids.Find(cmpctblock.GetShortID(vTxHashes[i].first));
+        if (index >= 0) {
+            if (!have_txn[index]) {
+                txn_available[index] = vTxHashes[i].second->GetSharedTx();
+                have_txn[index]  = true;
                 mempool_count++;
             } else {
                 // If we find two mempool txn that match the short id, just request it.
                 // This should be rare enough that the extra bandwidth doesn't matter,
                 // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
+                if (txn_available[index]) {
+                    txn_available[index].reset();
                     mempool_count--;
                 }
             }
@@ -127,18 +139,20 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk.
-        if (mempool_count == shorttxids.size())
+        if (mempool_count == cmpctblock.shorttxids.size())
             break;
     }
     }
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
+        // Slots that were never filled or whose transaction was dropped to stay within the memory limit
+        if (!extra_txn[i].second)
+            continue;
+        int index = shorttxids.Find(cmpctblock.GetShortID(extra_txn[i].first));
+        if (index >= 0) {
+            if (!have_txn[index]) {
+                txn_available[index] = extra_txn[i].second;
+                have_txn[index]  = true;
                 mempool_count++;
                 extra_count++;
             } else {
@@ -148,9 +162,9 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
                 // but eating a round-trip due to FillBlock failure would be annoying
                 // Note that we don't want duplication between extra_txn and mempool to
                 // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
+                if (txn_available[index] &&
+                        txn_available[index]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
+                    txn_available[index].reset();
                     mempool_count--;
                     extra_count--;
                 }
@@ -159,7 +173,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk.
-        if (mempool_count == shorttxids.size())
+        if (mempool_count == cmpctblock.shorttxids.size())
             break;
     }
 
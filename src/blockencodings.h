@@ -193,6 +193,51 @@ public:
     }
 };
 
+/**
+ * The short IDs of a compact block, indexed for looking up each mempool transaction.
+ * Almost none of those are in the block, so a lookup first checks a bitmap small
+ * enough to stay in the CPU cache, and only probes the table if its bit is set.
+ * Slots are derived with a salt the sender of the block doesn't know, so the short
+ * IDs it picked can't be made to pile up in one place.
+ */
+class ShortIDIndex {
+private:
+    struct Slot {
+        uint64_t shortid;
+        int32_t index; //!< -1 for an empty slot
+    };
+
+    uint64_t salt;
+    int slot_shift, bit_shift;
+    std::vector<Slot> slots;
+    std::vector<uint64_t> bitmap;
+
+    uint64_t Mix(uint64_t shortid) const { return (shortid ^ salt) * 0x9e3779b97f4a7c15ULL; }
+
+public:
+    //! Longest run of slots an insert may walk, longer runs are treated like a collision
+    static const int MAX_PROBES = 64;
+
+    explicit ShortIDIndex(size_t count);
+
+    /** Returns false if the short ID is there already, or no slot close to where it belongs is free */
+    bool Insert(uint64_t shortid, uint16_t index);
+
+    /** The position of a short ID in the block, -1 if it isn't in there */
+    int Find(uint64_t shortid) const {
+        uint64_t mixed = Mix(shortid);
+        uint64_t bit = mixed >> bit_shift;
+        if (!((bitmap[bit >> 6] >> (bit & 63)) & 1))
+            return -1;
+        for (size_t i = mixed >> slot_shift; ; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].index < 0)
+                return -1;
+            if (slots[i].shortid == shortid)
+                return slots[i].index;
+        }
+    }
+};
+
 class PartiallyDownloadedBlock {
 protected:
     std::vector<CTransactionRef> txn_available;
@@ -0,0 +1,105 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "chain.h"
+#include "fs.h"
+#include "util.h"
+#include "validation.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::unique_ptr<CMappedBlockFiles> pmappedblockfiles;
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap((void*)data, size);
+#endif
+}
+
+static std::shared_ptr<const CMappedBlockFile> MapBlockFile(const fs::path& path)
+{
+#ifdef WIN32
+    // Windows keeps reading through stdio
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (data == MAP_FAILED) {
+        LogPrint(BCLog::DB, "Failed to map %s\n", path.string());
+        return nullptr;
+    }
+
+    return std::make_shared<const CMappedBlockFile>((const unsigned char*)data, st.st_size);
+#endif
+}
+
+CMappedBlockFiles::CMappedBlockFiles(size_t nMaxFilesIn) : nMaxFiles(std::max<size_t>(nMaxFilesIn, 1))
+{
+}
+
+void CMappedBlockFiles::Erase(const FileKey& key)
+{
+    auto it = mapFiles.find(key);
+    if (it == mapFiles.end())
+        return;
+
+    // Readers that still hold the mapping keep it alive until they are done
+    listRecentlyUsed.erase(it->second.second);
+    mapFiles.erase(it);
+}
+
+std::shared_ptr<const CMappedBlockFile> CMappedBlockFiles::Get(const CDiskBlockPos& pos, const char* prefix)
+{
+    LOCK(cs);
+
+    FileKey key = std::make_pair(std::string(prefix), pos.nFile);
+    auto it = mapFiles.find(key);
+    if (it != mapFiles.end()) {
+        // Undo data can still be appended to a file after it was mapped
+        if (pos.nPos < it->second.first->size) {
+            listRecentlyUsed.splice(listRecentlyUsed.begin(), listRecentlyUsed, it->second.second);
+            return it->second.first;
+        }
+        Erase(key);
+    }
+
+    std::shared_ptr<const CMappedBlockFile> mapped = MapBlockFile(GetBlockPosFilename(pos, prefix));
+    if (!mapped || pos.nPos >= mapped->size)
+        return nullptr;
+
+    while (mapFiles.size() >= nMaxFiles)
+        Erase(listRecentlyUsed.back());
+
+    listRecentlyUsed.push_front(key);
+    mapFiles.emplace(key, std::make_pair(mapped, listRecentlyUsed.begin()));
+
+    return mapped;
+}
+
+void CMappedBlockFiles::Remove(int nFile)
+{
+    LOCK(cs);
+
+    Erase(std::make_pair(std::string("blk"), nFile));
+    Erase(std::make_pair(std::string("rev"), nFile));
+}
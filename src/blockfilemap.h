@@ -0,0 +1,65 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef RAVEN_BLOCKFILEMAP_H
+#define RAVEN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+struct CDiskBlockPos;
+
+/** Default for -mmapblockfiles */
+static const bool DEFAULT_MMAP_BLOCK_FILES = false;
+/** Default for -mmapblockfilesmax, the number of blk/rev files kept mapped at the same time */
+static const int DEFAULT_MMAP_BLOCK_FILES_MAX = 16;
+
+/** A read-only mapping of a whole block or undo file, unmapped when the last user lets go of it */
+class CMappedBlockFile
+{
+public:
+    const unsigned char* data;
+    size_t size;
+
+    CMappedBlockFile(const unsigned char* dataIn, size_t sizeIn) : data(dataIn), size(sizeIn) {}
+    ~CMappedBlockFile();
+
+    CMappedBlockFile(const CMappedBlockFile&) = delete;
+    CMappedBlockFile& operator=(const CMappedBlockFile&) = delete;
+};
+
+/**
+ * Keeps the most recently read blk*.dat and rev*.dat files mapped, so blocks and
+ * undo data are deserialized straight from the page cache instead of through stdio.
+ * Only files that are no longer written to should be read through it.
+ */
+class CMappedBlockFiles
+{
+private:
+    typedef std::pair<std::string, int> FileKey; // <Prefix, File number>
+
+    CCriticalSection cs;
+    const size_t nMaxFiles;
+    std::list<FileKey> listRecentlyUsed; // Most recently used first
+    std::map<FileKey, std::pair<std::shared_ptr<const CMappedBlockFile>, std::list<FileKey>::iterator> > mapFiles;
+
+    void Erase(const FileKey& key);
+
+public:
+    explicit CMappedBlockFiles(size_t nMaxFilesIn);
+
+    /** Get the mapping of the file holding pos, or nullptr if it couldn't be mapped or pos is past its end */
+    std::shared_ptr<const CMappedBlockFile> Get(const CDiskBlockPos& pos, const char* prefix);
+    /** Forget the mappings of a file that is going to be deleted */
+    void Remove(int nFile);
+};
+
+/** The block file mappings, nullptr unless -mmapblockfiles is set */
+extern std::unique_ptr<CMappedBlockFiles> pmappedblockfiles;
+
+#endif // RAVEN_BLOCKFILEMAP_H
@@ -115,7 +115,7 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, uint2
                           asset.strName);
 
                 // Add the owner asset to cache
-                if (!assetsCache->AddOwnerAsset(ownerName, ownerAddress))
+                if (!assetsCache->AddOwnerAsset(ownerName, ownerAddress, nHeight))
                     error("%s : Failed at adding a new asset to our cache. asset: %s", __func__,
                           asset.strName);
 
@@ -147,7 +147,7 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, uint2
                     error("%s: Failed to get the original asset that is getting reissued. Asset Name : %s",
                           __func__, reissue.strName);
 
-                if (!assetsCache->AddReissueAsset(reissue, strAddress, COutPoint(txid, reissueIndex)))
+                if (!assetsCache->AddReissueAsset(reissue, strAddress, COutPoint(txid, reissueIndex), nHeight))
                     error("%s: Failed to reissue an asset. Asset Name : %s", __func__, reissue.strName);
 
                 // Set the old IPFSHash for the blockundo
@@ -206,7 +206,7 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, uint2
                                 "%s : ERROR - Received a coin that was a Transfer Asset but failed to get the transfer object from the scriptPubKey. CTxOut: %s\n",
                                 __func__, tx.vout[i].ToString());
 
-                    if (!assetsCache->AddTransferAsset(assetTransfer, address, COutPoint(txid, i), tx.vout[i]))
+                    if (!assetsCache->AddTransferAsset(assetTransfer, address, COutPoint(txid, i), tx.vout[i], nHeight))
                         LogPrintf("%s : ERROR - Failed to add transfer asset CTxOut: %s\n", __func__,
                                   tx.vout[i].ToString());
                 }
@@ -344,6 +344,41 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+bool CCoinsViewCache::Sync(bool fKeepModified) {
+    CCoinsMap mapModified;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            ++it;
+            continue;
+        }
+        if (it->second.coin.IsSpent() || !fKeepModified) {
+            // The base is the only one left with this entry
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            mapModified.emplace(it->first, std::move(it->second));
+            it = cacheCoins.erase(it);
+        } else {
+            // Once written, the base has the same coin, so it is neither dirty nor fresh here anymore
+            CCoinsCacheEntry& entry = mapModified[it->first];
+            entry.coin = it->second.coin;
+            entry.flags = it->second.flags;
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return base->BatchWrite(mapModified, hashBlock);
+}
+
+void CCoinsViewCache::Trim(size_t nMaxUsage) {
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end() && DynamicMemoryUsage() > nMaxUsage;) {
+        if (it->second.flags == 0) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
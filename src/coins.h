@@ -275,6 +275,21 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(), but
+     * without emptying the cache. Spent entries are dropped, and if fKeepModified
+     * is set the unspent ones stay cached as unmodified copies of the base.
+     * Entries that were not modified are always kept.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync(bool fKeepModified = true);
+
+    /**
+     * Removes unmodified entries until the cache uses no more than nMaxUsage bytes,
+     * or only modified entries are left.
+     */
+    void Trim(size_t nMaxUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -0,0 +1,184 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "primitives/block.h"
+#include "util.h"
+#include "validation.h"
+
+#include <unordered_set>
+
+CCoinsViewPrefetch* pcoinsprefetch = nullptr;
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* viewIn, int nThreads, size_t nMaxCoinsIn) :
+    CCoinsViewBacked(viewIn), nMaxCoins(std::max<size_t>(nMaxCoinsIn, 1)), fStop(false), nGeneration(0), fWriting(false),
+    nPrefetched(0), nHits(0), nMisses(0), nEvicted(0), nDropped(0)
+{
+    for (int i = 0; i < std::max(nThreads, 1); i++)
+        vThreads.emplace_back(&TraceThread<std::function<void()> >, "prefetch", std::function<void()>(std::bind(&CCoinsViewPrefetch::ThreadPrefetch, this)));
+}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+
+    for (std::thread& thread : vThreads)
+        thread.join();
+}
+
+void CCoinsViewPrefetch::Stage(const COutPoint& outpoint, Coin&& coin)
+{
+    if (!mapStaged.emplace(outpoint, std::move(coin)).second)
+        return;
+    queueStagedOrder.push_back(outpoint);
+    nPrefetched++;
+
+    // Evict the oldest coins, they belong to blocks that are connected by now or won't be soon
+    while (mapStaged.size() > nMaxCoins) {
+        nEvicted += mapStaged.erase(queueStagedOrder.front());
+        queueStagedOrder.pop_front();
+    }
+
+    // Forget coins that were taken out of the staging cache in the meantime
+    if (queueStagedOrder.size() > 2 * nMaxCoins) {
+        std::deque<COutPoint> queueStillStaged;
+        for (const COutPoint& staged : queueStagedOrder) {
+            if (mapStaged.count(staged))
+                queueStillStaged.push_back(staged);
+        }
+        queueStagedOrder.swap(queueStillStaged);
+    }
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return fStop || !queueBlocks.empty(); });
+        if (fStop)
+            return;
+
+        std::vector<COutPoint> vOutPoints = std::move(queueBlocks.front());
+        queueBlocks.pop_front();
+
+        for (const COutPoint& outpoint : vOutPoints) {
+            if (fStop)
+                return;
+            if (mapStaged.count(outpoint))
+                continue;
+
+            uint64_t nGenerationRead = nGeneration;
+            bool fWritingRead = fWriting;
+            lock.unlock();
+
+            Coin coin;
+            bool fFound = false;
+            try {
+                fFound = base->GetCoin(outpoint, coin);
+            } catch (const std::exception& e) {
+                // The read is done again when the block is connected, and reported there
+                LogPrint(BCLog::COINDB, "%s: Failed to read %s: %s\n", __func__, outpoint.ToString(), e.what());
+            }
+
+            lock.lock();
+            // Anything read while the database was being written may be outdated already
+            if (fFound && !fWritingRead && nGenerationRead == nGeneration)
+                Stage(outpoint, std::move(coin));
+        }
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        auto it = mapStaged.find(outpoint);
+        if (it != mapStaged.end()) {
+            // The coin moves into the cache above, which keeps it until it is written back
+            coin = std::move(it->second);
+            mapStaged.erase(it);
+            nHits++;
+            return true;
+        }
+        nMisses++;
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPrefetch::HaveCoin(const COutPoint& outpoint) const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (mapStaged.count(outpoint))
+            return true;
+    }
+    return base->HaveCoin(outpoint);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fWriting = true;
+        nGeneration++;
+        for (const auto& entry : mapCoins)
+            mapStaged.erase(entry.first);
+    }
+
+    bool ret = base->BatchWrite(mapCoins, hashBlock);
+
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fWriting = false;
+        nGeneration++;
+    }
+
+    return ret;
+}
+
+void CCoinsViewPrefetch::Prefetch(const CBlock& block)
+{
+    std::vector<COutPoint> vOutPoints;
+    std::unordered_set<uint256, BlockHasher> setBlockTxids;
+    for (const auto& tx : block.vtx) {
+        setBlockTxids.insert(tx->GetHash());
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash))
+                vOutPoints.push_back(txin.prevout);
+        }
+    }
+
+    if (vOutPoints.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (queueBlocks.size() >= MAX_UTXO_PREFETCH_BLOCKS) {
+            nDropped++;
+            return;
+        }
+        queueBlocks.push_back(std::move(vOutPoints));
+    }
+    cond.notify_one();
+}
+
+void CCoinsViewPrefetch::GetStats(CCoinsPrefetchStats& stats) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    stats.nThreads = vThreads.size();
+    stats.nStaged = mapStaged.size();
+    stats.nQueued = queueBlocks.size();
+    stats.nPrefetched = nPrefetched;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nEvicted = nEvicted;
+    stats.nDropped = nDropped;
+}
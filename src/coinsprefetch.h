@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef RAVEN_COINSPREFETCH_H
+#define RAVEN_COINSPREFETCH_H
+
+#include "coins.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class CBlock;
+
+/** Default for -utxoprefetch, the number of threads loading the inputs of stored blocks ahead of connecting them */
+static const int DEFAULT_UTXO_PREFETCH_THREADS = 2;
+/** Maximum for -utxoprefetch */
+static const int MAX_UTXO_PREFETCH_THREADS = 16;
+/** Maximum number of coins waiting in the staging cache, older ones are evicted first */
+static const size_t MAX_UTXO_PREFETCH_COINS = 500000;
+/** Maximum number of blocks waiting to have their inputs loaded */
+static const size_t MAX_UTXO_PREFETCH_BLOCKS = 1024;
+
+struct CCoinsPrefetchStats
+{
+    int nThreads;
+    size_t nStaged;      //!< Coins currently in the staging cache
+    size_t nQueued;      //!< Blocks waiting to be prefetched
+    uint64_t nPrefetched; //!< Coins loaded into the staging cache
+    uint64_t nHits;      //!< Lookups served from the staging cache
+    uint64_t nMisses;    //!< Lookups that had to read the database
+    uint64_t nEvicted;   //!< Staged coins evicted before they were used
+    uint64_t nDropped;   //!< Blocks not prefetched because the queue was full
+};
+
+/**
+ * Sits between the coins cache and the database. Blocks that are stored but not
+ * connected yet are handed to Prefetch(), and a pool of threads reads the coins
+ * they spend from the database into a staging cache. When connecting the block
+ * misses the coins cache, the coin is then taken from the staging cache instead
+ * of being read from disk on the validation thread.
+ *
+ * Only coins that exist in the database are staged. Every write to the database
+ * evicts the coins it touches, and reads that overlap with a write are dropped,
+ * so the staging cache never returns a state the database no longer has.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    const size_t nMaxCoins;
+
+    mutable std::mutex cs;
+    std::condition_variable cond;
+    bool fStop;
+
+    std::deque<std::vector<COutPoint> > queueBlocks;
+    mutable std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> mapStaged;
+    std::deque<COutPoint> queueStagedOrder; //!< Insertion order of mapStaged, may contain coins that were used already
+    uint64_t nGeneration; //!< Incremented before and after each write to the database
+    bool fWriting;
+
+    uint64_t nPrefetched;
+    mutable uint64_t nHits;
+    mutable uint64_t nMisses;
+    uint64_t nEvicted;
+    uint64_t nDropped;
+
+    std::vector<std::thread> vThreads;
+
+    void ThreadPrefetch();
+    void Stage(const COutPoint& outpoint, Coin&& coin);
+
+public:
+    CCoinsViewPrefetch(CCoinsView* viewIn, int nThreads, size_t nMaxCoinsIn = MAX_UTXO_PREFETCH_COINS);
+    ~CCoinsViewPrefetch();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+
+    /** Queue the coins spent by a block for loading. Inputs created in the block itself are skipped */
+    void Prefetch(const CBlock& block);
+    void GetStats(CCoinsPrefetchStats& stats) const;
+};
+
+/** The prefetch layer below pcoinsTip, nullptr when -utxoprefetch=0 */
+extern CCoinsViewPrefetch* pcoinsprefetch;
+
+#endif // RAVEN_COINSPREFETCH_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinswriter.h"
+
+#include "txdb.h"
+#include "util.h"
+
+CCoinsViewWriter* pcoinswriter = nullptr;
+
+CCoinsViewWriter::CCoinsViewWriter(CCoinsViewDB* dbIn) :
+    CCoinsViewBacked(dbIn), db(dbIn), fStop(false), fPending(false), fFailed(false)
+{
+    thread = std::thread(&TraceThread<std::function<void()> >, "coinswriter", std::function<void()>(std::bind(&CCoinsViewWriter::ThreadWrite, this)));
+}
+
+CCoinsViewWriter::~CCoinsViewWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void CCoinsViewWriter::ThreadWrite()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        // A batch that was handed over is always written, also when shutting down
+        cond.wait(lock, [this] { return fStop || fPending; });
+        if (!fPending)
+            return;
+
+        std::shared_ptr<const CCoinsMap> pmap = pmapWriting;
+        uint256 hashBlock = hashWriting;
+        lock.unlock();
+
+        int64_t nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = db->WriteCoins(*pmap, hashBlock);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Failed to write coins for block %s: %s\n", __func__, hashBlock.ToString(), e.what());
+        }
+        LogPrint(BCLog::COINDB, "Wrote %u coins in the background in %.2fms\n", (unsigned int)pmap->size(), (GetTimeMicros() - nStart) * 0.001);
+
+        lock.lock();
+        if (fOk) {
+            pmapWriting.reset();
+        } else {
+            // Keep answering from the batch, the node is shutting down anyway
+            error("%s: Failed to write coins for block %s", __func__, hashBlock.ToString());
+            fFailed = true;
+        }
+        fPending = false;
+        cond.notify_all();
+    }
+}
+
+bool CCoinsViewWriter::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    std::shared_ptr<const CCoinsMap> pmap;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        pmap = pmapWriting;
+    }
+    if (pmap) {
+        CCoinsMap::const_iterator it = pmap->find(outpoint);
+        if (it != pmap->end()) {
+            if (it->second.coin.IsSpent())
+                return false;
+            coin = it->second.coin;
+            return true;
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewWriter::HaveCoin(const COutPoint& outpoint) const
+{
+    std::shared_ptr<const CCoinsMap> pmap;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        pmap = pmapWriting;
+    }
+    if (pmap) {
+        CCoinsMap::const_iterator it = pmap->find(outpoint);
+        if (it != pmap->end())
+            return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewWriter::GetBestBlock() const
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pmapWriting)
+            return hashWriting;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewWriter::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    // Freeze the batch before waiting, so it overlaps with the previous write
+    std::shared_ptr<CCoinsMap> pmap = std::make_shared<CCoinsMap>();
+    pmap->reserve(mapCoins.size());
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            pmap->emplace(it->first, std::move(it->second));
+    }
+    mapCoins.clear();
+
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !fPending; });
+    if (fFailed)
+        return false;
+
+    // Anything written on top of this flush, like the asset database, may rely on
+    // the coins being replayed up to hashBlock after a crash
+    if (!db->BeginWrite(hashBlock)) {
+        fFailed = true;
+        return false;
+    }
+
+    pmapWriting = pmap;
+    hashWriting = hashBlock;
+    fPending = true;
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewWriter::Wait()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !fPending; });
+    return !fFailed;
+}
+
+bool CCoinsViewWriter::Failed() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return fFailed;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef RAVEN_COINSWRITER_H
+#define RAVEN_COINSWRITER_H
+
+#include "coins.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class CCoinsViewDB;
+
+/** Default for -asyncflush */
+static const bool DEFAULT_ASYNC_FLUSH = true;
+
+/**
+ * Sits directly above the coins database and writes to it on a background thread.
+ * BatchWrite() freezes the modified entries into an immutable batch, hands it to
+ * the writer thread and returns, so validation continues while the batch is on
+ * its way to disk. Until the batch is written, lookups are answered from it
+ * first, and GetBestBlock() already reports the block it belongs to.
+ *
+ * Only one batch is written at a time; the next BatchWrite() waits for the
+ * previous one. Before a batch is handed over, the head blocks marker is synced
+ * to disk, so from then on a crash is replayed on startup up to the block of the
+ * batch. The best block itself is only written, in a synced final batch, once all
+ * coins of the batch are.
+ */
+class CCoinsViewWriter : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* db;
+
+    mutable std::mutex cs;
+    std::condition_variable cond;
+    bool fStop;
+    bool fPending; //!< A batch was handed over and is not written yet
+    bool fFailed;  //!< A write failed, the database no longer follows the cache above
+
+    std::shared_ptr<const CCoinsMap> pmapWriting; //!< The batch being written, kept if writing it failed
+    uint256 hashWriting;
+
+    std::thread thread;
+
+    void ThreadWrite();
+
+public:
+    explicit CCoinsViewWriter(CCoinsViewDB* dbIn);
+    ~CCoinsViewWriter();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+
+    /** Wait until the batch being written, if any, is on disk. Returns false if a write failed */
+    bool Wait();
+    /** Whether a write failed */
+    bool Failed() const;
+};
+
+/** The background writer below pcoinsTip, nullptr when -asyncflush=0 */
+extern CCoinsViewWriter* pcoinswriter;
+
+#endif // RAVEN_COINSWRITER_H
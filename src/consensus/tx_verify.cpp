@@ -7,6 +7,7 @@
 #include <script/standard.h>
 #include <util.h>
 #include <validation.h>
+#include <txmempool.h>
 #include "tx_verify.h"
 
 #include "consensus.h"
@@ -458,8 +459,9 @@ bool Consensus::CheckTxAssets(const CTransaction& tx, CValidationState& state, c
                 }
             }
 
-            if (mapReissuedAssets.count(reissue.strName)) {
-                if (mapReissuedAssets.at(reissue.strName) != tx.GetHash())
+            uint256 hashReissueTx;
+            if (mempool.getAssetReissueTx(reissue.strName, hashReissueTx)) {
+                if (hashReissueTx != tx.GetHash())
                     return state.DoS(100, false, REJECT_INVALID, "bad-tx-reissue-chaining-not-allowed");
             } else {
                 vPairReissueAssets.emplace_back(std::make_pair(reissue.strName, tx.GetHash()));
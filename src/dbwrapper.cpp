@@ -216,7 +216,12 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
-CDBIterator::~CDBIterator() { delete piter; }
+CDBIterator::~CDBIterator()
+{
+    delete piter;
+    if (psnapshot)
+        psnapshotdb->ReleaseSnapshot(psnapshot);
+}
 bool CDBIterator::Valid() const { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
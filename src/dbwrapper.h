@@ -120,15 +120,19 @@ class CDBIterator
 private:
     const CDBWrapper &parent;
     leveldb::Iterator *piter;
+    leveldb::DB *psnapshotdb;
+    const leveldb::Snapshot *psnapshot;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
      * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _psnapshotdb     The database that owns _psnapshot.
+     * @param[in] _psnapshot       Snapshot the iterator reads from, released with the iterator.
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
-        parent(_parent), piter(_piter) { };
+    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter, leveldb::DB *_psnapshotdb = nullptr, const leveldb::Snapshot *_psnapshot = nullptr) :
+        parent(_parent), piter(_piter), psnapshotdb(_psnapshotdb), psnapshot(_psnapshot) { };
     ~CDBIterator();
 
     bool Valid() const;
@@ -302,6 +306,18 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /**
+     * Return an iterator over the database as it is now. Writes made after this
+     * call are not seen by the iterator.
+     */
+    CDBIterator *NewSnapshotIterator()
+    {
+        const leveldb::Snapshot *psnapshot = pdb->GetSnapshot();
+        leveldb::ReadOptions snapshotoptions = iteroptions;
+        snapshotoptions.snapshot = psnapshot;
+        return new CDBIterator(*this, pdb->NewIterator(snapshotoptions), pdb, psnapshot);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "net.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -143,14 +144,9 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
-static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+/** Check the credentials of a request, replying to it if they are missing or wrong */
+static bool HTTPAuthorized(HTTPRequest* req, std::string& strAuthUsernameOut)
 {
-    // JSONRPC handles only POST
-    if (req->GetRequestMethod() != HTTPRequest::POST) {
-        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
-        return false;
-    }
-    // Check authorization
     std::pair<bool, std::string> authHeader = req->GetHeader("authorization");
     if (!authHeader.first) {
         req->WriteHeader("WWW-Authenticate", WWW_AUTH_HEADER_DATA);
@@ -158,8 +154,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         return false;
     }
 
-    JSONRPCRequest jreq;
-    if (!RPCAuthorized(authHeader.second, jreq.authUser)) {
+    if (!RPCAuthorized(authHeader.second, strAuthUsernameOut)) {
         LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", req->GetPeer().ToString());
 
         /* Deter brute-forcing
@@ -171,6 +166,20 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
+    return true;
+}
+
+static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+{
+    // JSONRPC handles only POST
+    if (req->GetRequestMethod() != HTTPRequest::POST) {
+        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
+        return false;
+    }
+    // Check authorization
+    JSONRPCRequest jreq;
+    if (!HTTPAuthorized(req, jreq.authUser))
+        return false;
 
     try {
         // Parse request
@@ -209,6 +218,59 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+static void WriteTimingHistogram(std::string& strOut, const char* pszName, const std::string& strCommand, const uint64_t* vBuckets, uint64_t nCount, int64_t nSumMicros)
+{
+    uint64_t nCumulative = 0;
+    for (int i = 0; i < MSG_TIMING_BUCKETS - 1; i++) {
+        nCumulative += vBuckets[i];
+        strOut += strprintf("%s_bucket{command=\"%s\",le=\"%g\"} %u\n", pszName, strCommand, (double)(int64_t(1) << i) / 1000000, nCumulative);
+    }
+    strOut += strprintf("%s_bucket{command=\"%s\",le=\"+Inf\"} %u\n", pszName, strCommand, nCount);
+    strOut += strprintf("%s_sum{command=\"%s\"} %f\n", pszName, strCommand, nSumMicros / 1000000.0);
+    strOut += strprintf("%s_count{command=\"%s\"} %u\n", pszName, strCommand, nCount);
+}
+
+/** Message timings in the Prometheus text exposition format */
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string &)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Metrics are only served to GET requests");
+        return false;
+    }
+    std::string strAuthUser;
+    if (!HTTPAuthorized(req, strAuthUser))
+        return false;
+    if (!g_connman) {
+        req->WriteReply(HTTP_SERVICE_UNAVAILABLE, "Peer-to-peer functionality missing or disabled");
+        return false;
+    }
+
+    mapMsgCmdTiming mapTiming;
+    g_connman->GetMessageTimingStats(mapTiming);
+
+    std::string strOut;
+    strOut += "# HELP raven_p2p_message_process_seconds Time spent processing P2P messages.\n";
+    strOut += "# TYPE raven_p2p_message_process_seconds histogram\n";
+    for (const auto& timing : mapTiming)
+        WriteTimingHistogram(strOut, "raven_p2p_message_process_seconds", timing.first, timing.second.vProcessBuckets, timing.second.nCount, timing.second.nProcessMicros);
+    strOut += "# HELP raven_p2p_message_queue_seconds Time P2P messages waited between being received and processed.\n";
+    strOut += "# TYPE raven_p2p_message_queue_seconds histogram\n";
+    for (const auto& timing : mapTiming)
+        WriteTimingHistogram(strOut, "raven_p2p_message_queue_seconds", timing.first, timing.second.vQueueBuckets, timing.second.nCount, timing.second.nQueueMicros);
+    strOut += "# HELP raven_p2p_message_lock_wait_seconds_total Time processing P2P messages waited for contended locks.\n";
+    strOut += "# TYPE raven_p2p_message_lock_wait_seconds_total counter\n";
+    for (const auto& timing : mapTiming)
+        strOut += strprintf("raven_p2p_message_lock_wait_seconds_total{command=\"%s\"} %f\n", timing.first, timing.second.nLockWaitMicros / 1000000.0);
+    strOut += "# HELP raven_p2p_message_hash_seconds_total Time processing P2P messages spent hashing block headers.\n";
+    strOut += "# TYPE raven_p2p_message_hash_seconds_total counter\n";
+    for (const auto& timing : mapTiming)
+        strOut += strprintf("raven_p2p_message_hash_seconds_total{command=\"%s\"} %f\n", timing.first, timing.second.nHashMicros / 1000000.0);
+
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, strOut);
+    return true;
+}
+
 static bool InitRPCAuthentication()
 {
     if (gArgs.GetArg("-rpcpassword", "") == "")
@@ -234,6 +296,8 @@ bool StartHTTPRPC()
         return false;
 
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    if (gArgs.GetBoolArg("-metrics", DEFAULT_HTTP_METRICS))
+        RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
 #ifdef ENABLE_WALLET
     // ifdef can be removed once we switch to better endpoint support and API versioning
     RegisterHTTPHandler("/wallet/", false, HTTPReq_JSONRPC);
@@ -253,6 +317,7 @@ void StopHTTPRPC()
 {
     LogPrint(BCLog::RPC, "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    UnregisterHTTPHandler("/metrics", true);
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
@@ -9,6 +9,9 @@
 #include <string>
 #include <map>
 
+/** Default for -metrics */
+static const bool DEFAULT_HTTP_METRICS = false;
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
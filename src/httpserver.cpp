@@ -21,10 +21,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -176,6 +181,8 @@ static WorkQueue<HTTPClosure>* workQueue = nullptr;
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Set once the server is shutting down, stops workers waiting for slow clients
+static std::atomic<bool> fHTTPInterrupted(false);
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -445,6 +452,7 @@ bool StartHTTPServer()
     LogPrint(BCLog::HTTP, "Starting HTTP server\n");
     int rpcThreads = std::max((long)gArgs.GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
     LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
+    fHTTPInterrupted = false;
     std::packaged_task<bool(event_base*, evhttp*)> task(ThreadHTTP);
     threadResult = task.get_future();
     threadHTTP = std::thread(std::move(task), eventBase, eventHTTP);
@@ -467,6 +475,7 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, nullptr);
     }
+    fHTTPInterrupted = true;
     if (workQueue)
         workQueue->Interrupt();
 }
@@ -538,13 +547,116 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
+/**
+ * Progress of a chunked reply, shared by the worker producing it and the http thread sending it.
+ * The http thread watches the connection and wakes the worker as the reply drains or the client goes away.
+ */
+struct HTTPChunkedReply
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    //! Bytes of chunks that weren't handed to libevent yet
+    size_t nQueued;
+    //! Bytes waiting in the output buffer of the connection
+    size_t nBuffered;
+    //! The client went away
+    bool fClosed;
+
+    //! Output buffer of the connection and our callback on it, only used by the http thread
+    struct evbuffer* output;
+    struct evbuffer_cb_entry* outputCallback;
+
+    HTTPChunkedReply() : nQueued(0), nBuffered(0), fClosed(false), output(nullptr), outputCallback(nullptr) {}
+
+    void Queue(size_t nSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nQueued += nSize;
+    }
+
+    //! The following are only called from the http thread
+    void Sent(size_t nSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nQueued -= nSize;
+        cond.notify_all();
+    }
+
+    void Buffered(size_t nSize, bool fDrained)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nBuffered = nSize;
+        if (fDrained)
+            cond.notify_all();
+    }
+
+    void Close()
+    {
+        StopWatching();
+        std::lock_guard<std::mutex> lock(mutex);
+        fClosed = true;
+        cond.notify_all();
+    }
+
+    void Watch(struct evhttp_request* req);
+    void Unwatch(struct evhttp_request* req);
+
+    void StopWatching()
+    {
+        if (output) {
+            evbuffer_remove_cb_entry(output, outputCallback);
+            output = nullptr;
+            outputCallback = nullptr;
+        }
+    }
+};
+
+static void http_chunked_output_cb(struct evbuffer* buffer, const struct evbuffer_cb_info* info, void* arg)
+{
+    ((HTTPChunkedReply*)arg)->Buffered(evbuffer_get_length(buffer), info->n_deleted > 0);
+}
+
+static void http_chunked_close_cb(struct evhttp_connection* con, void* arg)
+{
+    // Called before libevent frees the connection and its buffers
+    ((HTTPChunkedReply*)arg)->Close();
+}
+
+//! Follow the connection of req until Unwatch or until it closes, the reply must stay alive until then
+void HTTPChunkedReply::Watch(struct evhttp_request* req)
+{
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    if (!con) {
+        Close();
+        return;
+    }
+    evhttp_connection_set_closecb(con, http_chunked_close_cb, this);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    output = bufferevent_get_output(evhttp_connection_get_bufferevent(con));
+    outputCallback = evbuffer_add_cb(output, http_chunked_output_cb, this);
+#endif
+}
+
+void HTTPChunkedReply::Unwatch(struct evhttp_request* req)
+{
+    StopWatching();
+    evhttp_connection* con = evhttp_request_get_connection(req);
+    if (con)
+        evhttp_connection_set_closecb(con, nullptr, nullptr);
+}
+
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyChunked(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyChunked) {
+        // The handler gave up halfway, end the reply so the request is released
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -596,12 +708,22 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  * this cannot be done from worker threads.
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
+{
+    WriteReply(nStatus, (const unsigned char*)strReply.data(), strReply.size());
+}
+
+void HTTPRequest::WriteReply(int nStatus, const std::vector<unsigned char>& vchReply)
+{
+    WriteReply(nStatus, vchReply.data(), vchReply.size());
+}
+
+void HTTPRequest::WriteReply(int nStatus, const unsigned char* data, size_t size)
 {
     assert(!replySent && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
-    evbuffer_add(evb, strReply.data(), strReply.size());
+    evbuffer_add(evb, data, size);
     HTTPEvent* ev = new HTTPEvent(eventBase, true,
         std::bind(evhttp_send_reply, req, nStatus, (const char*)nullptr, (struct evbuffer *)nullptr));
     ev->trigger(nullptr);
@@ -609,6 +731,73 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = nullptr; // transferred back to main thread
 }
 
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && !replyChunked && req);
+    struct evhttp_request* reqStart = req;
+    std::shared_ptr<HTTPChunkedReply> reply = std::make_shared<HTTPChunkedReply>();
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqStart, nStatus, reply]() {
+        evhttp_send_reply_start(reqStart, nStatus, nullptr);
+        reply->Watch(reqStart);
+    });
+    ev->trigger(nullptr);
+    replyChunked = true;
+    chunkedReply = reply;
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(replyChunked && req);
+    if (strChunk.empty())
+        return;
+    // Events are run in the order they were triggered, so the pieces go out in order.
+    // libevent ignores the pieces once the connection is closed.
+    struct evhttp_request* reqChunk = req;
+    std::shared_ptr<const std::string> chunk = std::make_shared<const std::string>(strChunk);
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    reply->Queue(chunk->size());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqChunk, chunk, reply]() {
+        struct evbuffer* evb = evbuffer_new();
+        if (evb) {
+            evbuffer_add(evb, chunk->data(), chunk->size());
+            evhttp_send_reply_chunk(reqChunk, evb);
+            evbuffer_free(evb);
+        }
+        reply->Sent(chunk->size());
+    });
+    ev->trigger(nullptr);
+}
+
+bool HTTPRequest::WaitReplyChunks(size_t nMaxPending)
+{
+    assert(replyChunked && req);
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    std::unique_lock<std::mutex> lock(reply->mutex);
+    while (!reply->fClosed && reply->nQueued + reply->nBuffered > nMaxPending) {
+        if (fHTTPInterrupted)
+            return false;
+        // The http thread wakes us as the reply drains, the timeout is only there to notice an interrupt
+        reply->cond.wait_for(lock, std::chrono::milliseconds(500));
+    }
+    return !reply->fClosed;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(replyChunked && req);
+    struct evhttp_request* reqEnd = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqEnd, reply]() {
+        reply->Unwatch(reqEnd);
+        evhttp_send_reply_end(reqEnd);
+    });
+    ev->trigger(nullptr);
+    replyChunked = false;
+    replySent = true;
+    chunkedReply.reset();
+    req = nullptr; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -9,6 +9,8 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
+#include <vector>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -18,6 +20,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -60,6 +63,10 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyChunked;
+    std::shared_ptr<HTTPChunkedReply> chunkedReply;
+
+    void WriteReply(int nStatus, const unsigned char* data, size_t size);
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -115,6 +122,33 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+    void WriteReply(int nStatus, const std::vector<unsigned char>& vchReply);
+
+    /**
+     * Start a chunked HTTP reply, for bodies that are produced piece by piece.
+     * Send the body with WriteReplyChunk and finish it with EndChunkedReply.
+     *
+     * @note Call this instead of WriteReply, after writing the headers.
+     */
+    void StartChunkedReply(int nStatus);
+
+    /**
+     * Send one piece of a chunked reply. Pieces of a client that went away are dropped.
+     */
+    void WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Wait until at most nMaxPending bytes of the chunked reply are still to be sent, so a
+     * slow client doesn't make the reply pile up in memory. Returns false if the client went
+     * away or the server is shutting down, producing the rest of the reply is pointless then.
+     */
+    bool WaitReplyChunks(size_t nMaxPending);
+
+    /**
+     * Finish a chunked reply. As with WriteReply, do not call any other
+     * HTTPRequest methods afterwards.
+     */
+    void EndChunkedReply();
 };
 
 /** Event handler closure.
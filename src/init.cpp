@@ -12,7 +12,10 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockfilemap.h"
 #include "chain.h"
+#include "coinsprefetch.h"
+#include "coinswriter.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
@@ -47,6 +50,7 @@
 #include "validationinterface.h"
 #include "assets/assets.h"
 #include "assets/assetdb.h"
+#include "assets/assetsnapshot.h"
 #ifdef ENABLE_WALLET
 #include "wallet/init.h"
 #endif
@@ -195,9 +199,15 @@ void Shutdown()
     FlushWallets();
 #endif
     GenerateRavens(false, 0, Params());
+    StopBlockTemplateUpdates();
 
     MapPort(false);
 
+    // Orphans are dropped as their peers disconnect, so save them first
+    if (fDumpMempoolLater && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpOrphans();
+    }
+
     // Because these depend on each-other, we make sure that neither can be
     // using the other before destroying them.
     UnregisterValidationInterface(peerLogic.get());
@@ -246,12 +256,18 @@ void Shutdown()
         pcoinsTip = nullptr;
         delete pcoinscatcher;
         pcoinscatcher = nullptr;
+        delete pcoinsprefetch;
+        pcoinsprefetch = nullptr;
+        delete pcoinswriter;
+        pcoinswriter = nullptr;
         delete pcoinsdbview;
         pcoinsdbview = nullptr;
         delete pblocktree;
         pblocktree = nullptr;
+        pmappedblockfiles.reset();
         delete passets;
         passets = nullptr;
+        StopAssetSnapshots();
         delete passetsdb;
         passetsdb = nullptr;
         delete passetsCache;
@@ -354,21 +370,28 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     }
+    strUsage += HelpMessageOpt("-asyncflush", strprintf(_("Write the chainstate to disk in the background while blocks keep being connected (default: %u)"), DEFAULT_ASYNC_FLUSH));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
+    strUsage += HelpMessageOpt("-importthreads=<n>", strprintf(_("Set the number of threads deserializing and hashing blocks during -reindex and -loadblock (1 to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        MAX_IMPORT_THREADS, DEFAULT_IMPORT_THREADS));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-mmapblockfiles", strprintf(_("Read blocks and undo data from finished block files through memory mappings (default: %u)"), DEFAULT_MMAP_BLOCK_FILES));
+    strUsage += HelpMessageOpt("-mmapblockfilesmax=<n>", strprintf(_("Keep at most <n> block and undo files mapped when -mmapblockfiles is set (default: %u)"), DEFAULT_MMAP_BLOCK_FILES_MAX));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), defaultChainParams->MaxReorganizationDepth()));
     strUsage += HelpMessageOpt("-minreorgpeers=<n>", strprintf(_("Set the Minimum amount of peers required to disallow reorg of chains of depth >= maxreorg. Peers must be greater than. (default: %u)"), defaultChainParams->MinReorganizationPeers()));
     strUsage += HelpMessageOpt("-minreorgage=<n>", strprintf(_("Set the Minimum tip age (in seconds) required to allow reorg of a chain of depth >= maxreorg on a node with more than minreorgpeers peers. (default: %u)"), defaultChainParams->MinReorganizationAge()));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphansize=<n>", strprintf(_("Keep unconnectable transactions below <n> megabytes of memory, each peer may fill %u%% of this and of -maxorphantx (default: %u)"), MAX_ORPHAN_TX_PEER_PERCENT, DEFAULT_MAX_ORPHAN_SIZE));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     if (showDebug) {
         strUsage += HelpMessageOpt("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()));
     }
-    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool and the orphan transactions on shutdown and load them on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
+    strUsage += HelpMessageOpt("-blockreconstructionextratxnsize=<n>", strprintf(_("Keep the extra transactions for compact block reconstructions below <n> megabytes of memory, the oldest are dropped first (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN_SIZE));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
@@ -378,6 +401,8 @@ std::string HelpMessage(HelpMessageMode mode)
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
+    strUsage += HelpMessageOpt("-utxoprefetch=<n>", strprintf(_("Set the number of threads loading the coins spent by stored blocks before they are connected during initial block download (0 to %d, 0 = disable, default: %d)"),
+        MAX_UTXO_PREFETCH_THREADS, DEFAULT_UTXO_PREFETCH_THREADS));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
@@ -401,8 +426,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), DEFAULT_FORCEDNSSEED));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
+#ifdef USE_EPOLL
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Wait for socket events with 'select' or 'epoll'. Only 'epoll' allows more than %d connections (default: %s)"), FD_SETSIZE, DEFAULT_SOCKET_EVENTS));
+#else
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Wait for socket events with 'select' (default: %s)"), DEFAULT_SOCKET_EVENTS));
+#endif
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Set the number of threads processing messages from peers, the messages of one peer are always processed in order (1 to %d, default: %d)"), MAX_MSG_HANDLER_THREADS, DEFAULT_MSG_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
@@ -438,6 +469,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubassetissue=<address>", _("Enable publish asset issues in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubassetreissue=<address>", _("Enable publish asset reissues in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubassettransfer=<address>", _("Enable publish asset transfers in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubassetowner=<address>", _("Enable publish asset ownership changes in <address>"));
+    strUsage += HelpMessageOpt("-zmqqueuesize=<n>", strprintf(_("Keep at most <n> megabytes of messages waiting to be sent on each ZeroMQ socket, newer ones are dropped (default: %u)"), DEFAULT_ZMQ_QUEUE_SIZE));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -506,12 +542,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), MAX_BLOCK_WEIGHT - 4000));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", _("Set maximum BIP141 block weight to this * 4. Deprecated, use blockmaxweight"));
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt("-blockmaxassetops=<n>", strprintf(_("Set the maximum number of asset outputs, including transfers, in a block (default: %u)"), DEFAULT_BLOCK_MAX_ASSET_OPS));
+    strUsage += HelpMessageOpt("-blocktemplaterefresh=<n>", strprintf(_("Minimum time in milliseconds between rebuilds of the getblocktemplate template as transactions arrive (default and minimum: %d)"), DEFAULT_BLOCK_TEMPLATE_REFRESH));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve P2P message timings to authenticated requests for /metrics in the Prometheus text format, and time block header hashing for them (default: %u)"), DEFAULT_HTTP_METRICS));
     strUsage += HelpMessageOpt("-rpcbind=<addr>[:port]", _("Bind to given address to listen for JSON-RPC connections. This option is ignored unless -rpcallowip is also passed. Port is optional and overrides -rpcport. Use [host]:port notation for IPv6. This option can be specified multiple times (default: 127.0.0.1 and ::1 i.e., localhost, or if -rpcallowip has been specified, 0.0.0.0 and :: i.e., all addresses)"));
     strUsage += HelpMessageOpt("-rpccookiefile=<loc>", _("Location of the auth cookie (default: data dir)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
@@ -591,6 +630,18 @@ struct CImportingNow
     }
 };
 
+// Connects imported blocks in the background while it is in scope
+struct CImportConnectorNow
+{
+    explicit CImportConnectorNow(const CChainParams& chainparams) {
+        StartImportConnector(chainparams);
+    }
+
+    ~CImportConnectorNow() {
+        StopImportConnector();
+    }
+};
+
 
 // If we're using -prune with -reindex, then delete block files that will be ignored by the
 // reindex.  Since reindexing works by starting at block file 0 and looping until a blockfile
@@ -640,6 +691,7 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
 
     {
     CImportingNow imp;
+    CImportConnectorNow connector(chainparams);
 
     // -reindex
     if (fReindex) {
@@ -701,6 +753,7 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
     } // End scope of CImportingNow
     if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool();
+        LoadOrphans();
         fDumpMempoolLater = !fRequestShutdown;
     }
 }
@@ -828,6 +881,7 @@ void InitLogging()
     fLogTimestamps = gArgs.GetBoolArg("-logtimestamps", DEFAULT_LOGTIMESTAMPS);
     fLogTimeMicros = gArgs.GetBoolArg("-logtimemicros", DEFAULT_LOGTIMEMICROS);
     fLogIPs = gArgs.GetBoolArg("-logips", DEFAULT_LOGIPS);
+    SetBlockHashTiming(gArgs.GetBoolArg("-metrics", DEFAULT_HTTP_METRICS));
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Raven version %s\n", FormatFullVersion());
@@ -836,6 +890,7 @@ void InitLogging()
 namespace { // Variables internal to initialization process only
 
 int nMaxConnections;
+static SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
 int nUserMaxConnections;
 int nFD;
 ServiceFlags nLocalServices = NODE_NETWORK;
@@ -927,8 +982,20 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    std::string strSocketEvents = gArgs.GetArg("-socketevents", DEFAULT_SOCKET_EVENTS);
+    if (strSocketEvents == "select") {
+        socketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef USE_EPOLL
+    } else if (strSocketEvents == "epoll") {
+        socketEventsMode = SOCKETEVENTS_EPOLL;
+#endif
+    } else {
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified"), strSocketEvents));
+    }
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    if (socketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1035,6 +1102,12 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -importthreads=0 means autodetect, at least one worker is always used
+    nImportThreads = gArgs.GetArg("-importthreads", DEFAULT_IMPORT_THREADS);
+    if (nImportThreads <= 0)
+        nImportThreads += GetNumCores();
+    nImportThreads = std::max(1, std::min(nImportThreads, MAX_IMPORT_THREADS));
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1261,6 +1334,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
 
+    StartBlockTemplateUpdates();
+
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
      * that the server is there and will be ready later).  Warmup mode will
@@ -1406,6 +1481,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     // block tree db settings
     size_t dbMaxFileSize = gArgs.GetArg("-dbmaxfilesize", DEFAULT_DB_MAX_FILE_SIZE) << 20;
 
+    if (gArgs.GetBoolArg("-mmapblockfiles", DEFAULT_MMAP_BLOCK_FILES)) {
+        int nMaxMappedFiles = std::max(1, (int)gArgs.GetArg("-mmapblockfilesmax", DEFAULT_MMAP_BLOCK_FILES_MAX));
+        pmappedblockfiles.reset(new CMappedBlockFiles(nMaxMappedFiles));
+        LogPrintf("Reading finished block files through memory mappings (up to %d files)\n", nMaxMappedFiles);
+    }
+
     LogPrintf("Block index database configuration:\n");
     LogPrintf("* Using %d MB files\n", (dbMaxFileSize / 1024 / 1024));
 
@@ -1438,8 +1519,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsprefetch;
+                pcoinsprefetch = nullptr;
+                delete pcoinswriter;
+                pcoinswriter = nullptr;
+                delete pcoinsdbview;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReset, dbMaxFileSize);
@@ -1459,9 +1544,6 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                if (!passetsdb->ReadReissuedMempoolState())
-                    LogPrintf("Database failed to load last Reissued Mempool State. Will have to start from empty state");
-
                 LogPrintf("Loaded Assets from database without error\nCache of assets size: %d\nNumber of assets I have: %d\n", passetsCache->Size(), passets->mapMyUnspentAssets.size());
 
                 if (fReset) {
@@ -1532,7 +1614,17 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 // block tree into mapBlockIndex!
 
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                CCoinsView* pcoinsbase = pcoinsdbview;
+                if (gArgs.GetBoolArg("-asyncflush", DEFAULT_ASYNC_FLUSH)) {
+                    pcoinswriter = new CCoinsViewWriter(pcoinsdbview);
+                    pcoinsbase = pcoinswriter;
+                }
+                int nPrefetchThreads = std::min((int)gArgs.GetArg("-utxoprefetch", DEFAULT_UTXO_PREFETCH_THREADS), MAX_UTXO_PREFETCH_THREADS);
+                if (nPrefetchThreads > 0) {
+                    pcoinsprefetch = new CCoinsViewPrefetch(pcoinsbase, nPrefetchThreads);
+                    pcoinsbase = pcoinsprefetch;
+                }
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsbase);
 
                 // If necessary, upgrade from older database format.
                 // This is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
@@ -1673,6 +1765,11 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (!CheckDiskSpace())
         return false;
 
+    /** RVN START */
+    // Asset snapshots are written on their own thread, start them before any block gets connected
+    StartAssetSnapshots();
+    /** RVN END */
+
     // Either install a handler to notify us when genesis activates, or set fHaveGenesis directly.
     // No locking, as this happens before any background thread is started.
     if (chainActive.Tip() == nullptr) {
@@ -1732,6 +1829,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
+    connOptions.socketEventsMode = socketEventsMode;
+    connOptions.nMsgHandlerThreads = std::max(1, std::min((int)gArgs.GetArg("-msghandlerthreads", DEFAULT_MSG_HANDLER_THREADS), MAX_MSG_HANDLER_THREADS));
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
@@ -34,7 +34,12 @@
 
 #include <boost/thread.hpp>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <utility>
 
 
@@ -52,9 +57,6 @@ extern std::vector<CWalletRef> vpwallets;
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
-uint64_t nMiningTimeStart = 0;
-uint64_t nHashesPerSec = 0;
-uint64_t nHashesDone = 0;
 
 
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
@@ -75,6 +77,7 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = GetMaxBlockWeight() - 4000;
+    nBlockMaxAssetOps = DEFAULT_BLOCK_MAX_ASSET_OPS;
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
@@ -82,6 +85,7 @@ BlockAssembler::BlockAssembler(const CChainParams& params, const Options& option
     blockMinFeeRate = options.blockMinFeeRate;
     // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
     nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(GetMaxBlockWeight() - 4000, options.nBlockMaxWeight));
+    nBlockMaxAssetOps = std::max<int64_t>(0, options.nBlockMaxAssetOps);
 }
 
 static BlockAssembler::Options DefaultOptions(const CChainParams& params)
@@ -99,6 +103,7 @@ static BlockAssembler::Options DefaultOptions(const CChainParams& params)
     } else {
         options.blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     }
+    options.nBlockMaxAssetOps = gArgs.GetArg("-blockmaxassetops", DEFAULT_BLOCK_MAX_ASSET_OPS);
     return options;
 }
 
@@ -111,6 +116,7 @@ void BlockAssembler::resetBlock()
     // Reserve space for coinbase tx
     nBlockWeight = 4000;
     nBlockSigOpsCost = 400;
+    nBlockAssetOps = 0;
     fIncludeWitness = false;
 
     // These counters do not include coinbase tx
@@ -170,6 +176,87 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockTx = nBlockTx;
     nLastBlockWeight = nBlockWeight;
 
+    FinishBlock(scriptPubKeyIn, pindexPrev);
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+
+    return std::move(pblocktemplate);
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::ExtendBlock(const CBlockTemplate& prev, const CScript& scriptPubKeyIn, bool fMineWitnessTx)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    resetBlock();
+
+    pblocktemplate.reset(new CBlockTemplate());
+
+    if(!pblocktemplate.get())
+        return nullptr;
+    pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Add dummy coinbase tx as first transaction
+    pblock->vtx.emplace_back();
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
+
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    assert(pindexPrev != nullptr);
+    if (prev.block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return nullptr;
+    nHeight = pindexPrev->nHeight + 1;
+
+    pblock->nVersion = prev.block.nVersion;
+    pblock->nTime = GetAdjustedTime();
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : pblock->GetBlockTime();
+    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
+
+    // Keep the transactions of the previous template that are still in the mempool, in
+    // their order. One that was replaced, evicted or conflicted left together with its
+    // descendants, so whatever is kept still has its parents in front of it.
+    int nDropped = 0;
+    for (size_t i = 1; i < prev.block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(prev.block.vtx[i]->GetHash());
+        if (it == mempool.mapTx.end()) {
+            nDropped++;
+            continue;
+        }
+        AddToBlock(it);
+    }
+
+    // The kept transactions were picked by fee rate before the new ones arrived. Once
+    // they fill the block, only a full rebuild can swap them for better paying ones.
+    if (nBlockWeight > nBlockMaxWeight - 4000)
+        return nullptr;
+
+    // Append the best packages that still fit, the kept transactions count as included ancestors
+    int nPackagesSelected = 0;
+    int nDescendantsUpdated = 0;
+    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockWeight = nBlockWeight;
+
+    FinishBlock(scriptPubKeyIn, pindexPrev);
+
+    // No TestBlockValidity: the kept transactions were checked with the previous template
+    // against the same tip, and the appended ones were accepted to the mempool on top of them.
+    LogPrint(BCLog::BENCH, "%s: %.2fms (%d dropped, %d packages, %d updated descendants)\n", __func__, 0.001 * (GetTimeMicros() - nTimeStart), nDropped, nPackagesSelected, nDescendantsUpdated);
+
+    return std::move(pblocktemplate);
+}
+
+void BlockAssembler::FinishBlock(const CScript& scriptPubKeyIn, const CBlockIndex* pindexPrev)
+{
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
     coinbaseTx.vin.resize(1);
@@ -182,7 +269,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
     pblocktemplate->vTxFees[0] = -nFees;
 
-    LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
+    LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d asset ops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost, nBlockAssetOps);
 
     // Fill in header
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
@@ -190,16 +277,6 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
-    }
-    int64_t nTime2 = GetTimeMicros();
-
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
-
-    return std::move(pblocktemplate);
 }
 
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
@@ -215,13 +292,18 @@ void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
     }
 }
 
-bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const
+bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost, int64_t packageAssetOps) const
 {
     // TODO: switch to weight-based accounting for packages instead of vsize-based accounting.
     if (nBlockWeight + WITNESS_SCALE_FACTOR * packageSize >= nBlockMaxWeight)
         return false;
     if (nBlockSigOpsCost + packageSigOpsCost >= MAX_BLOCK_SIGOPS_COST)
         return false;
+    /** RVN START */
+    // Asset operations make the block slower to validate, keep them within budget like sigops
+    if (nBlockAssetOps + packageAssetOps > nBlockMaxAssetOps)
+        return false;
+    /** RVN END */
     return true;
 }
 
@@ -248,14 +330,15 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     nBlockWeight += iter->GetTxWeight();
     ++nBlockTx;
     nBlockSigOpsCost += iter->GetSigOpCost();
+    nBlockAssetOps += iter->GetAssetOps();
     nFees += iter->GetFee();
     inBlock.insert(iter);
 
     bool fPrintPriority = gArgs.GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
     if (fPrintPriority) {
-        LogPrintf("fee %s txid %s\n",
+        LogPrintf("fee %s txid %s asset ops %d (block %d/%d)\n",
                   CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
-                  iter->GetTx().GetHash().ToString());
+                  iter->GetTx().GetHash().ToString(), iter->GetAssetOps(), nBlockAssetOps, nBlockMaxAssetOps);
     }
 }
 
@@ -277,6 +360,7 @@ int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& already
                 modEntry.nSizeWithAncestors -= it->GetTxSize();
                 modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
                 modEntry.nSigOpCostWithAncestors -= it->GetSigOpCost();
+                modEntry.nAssetOpsWithAncestors -= it->GetAssetOps();
                 mapModifiedTx.insert(modEntry);
             } else {
                 mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
@@ -385,10 +469,12 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         uint64_t packageSize = iter->GetSizeWithAncestors();
         CAmount packageFees = iter->GetModFeesWithAncestors();
         int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
+        int64_t packageAssetOps = iter->GetAssetOpsWithAncestors();
         if (fUsingModified) {
             packageSize = modit->nSizeWithAncestors;
             packageFees = modit->nModFeesWithAncestors;
             packageSigOpsCost = modit->nSigOpCostWithAncestors;
+            packageAssetOps = modit->nAssetOpsWithAncestors;
         }
 
         if (packageFees < blockMinFeeRate.GetFee(packageSize)) {
@@ -396,7 +482,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             return;
         }
 
-        if (!TestPackage(packageSize, packageSigOpsCost)) {
+        if (!TestPackage(packageSize, packageSigOpsCost, packageAssetOps)) {
             if (fUsingModified) {
                 // Since we always look at the best entry in mapModifiedTx,
                 // we must erase failed entries so that we can consider the
@@ -452,16 +538,268 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+namespace {
+
+/** Rebuilds the getblocktemplate template on its own thread so polls can be answered without building one */
+class CBlockTemplateUpdater : public CValidationInterface
 {
-    // Update nExtraNonce
-    static uint256 hashPrevBlock;
-    if (hashPrevBlock != pblock->hashPrevBlock)
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    bool fStop;
+    bool fPending; //!< A rebuild is due at nUpdateTime
+    bool fBuilding;
+    int64_t nUpdateTime;
+    int64_t nLastRequest; //!< When a template was last asked for, in seconds
+    int64_t nLastUpdate;
+    uint64_t nUpdates;
+
+    std::shared_ptr<const CBlockTemplate> ptemplate;
+    uint256 hashPrevBlock;
+    bool fMineWitnessTx;
+    unsigned int nTransactionsUpdated;
+    CAmount nFeesNotified;
+
+    std::atomic<unsigned int> nFeeSequence;
+
+    //! Whether nobody asked for a template recently, requires mutex
+    bool IsIdle() const
     {
-        nExtraNonce = 0;
-        hashPrevBlock = pblock->hashPrevBlock;
+        return GetTime() - nLastRequest > BLOCK_TEMPLATE_IDLE_TIMEOUT;
     }
-    ++nExtraNonce;
+
+    //! Rebuild right away on a new tip or request, new transactions are only picked up every -blocktemplaterefresh ms
+    void ScheduleUpdate(bool fNow)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!thread.joinable() || fStop || IsIdle())
+                return;
+
+            int64_t nRefresh = std::max(gArgs.GetArg("-blocktemplaterefresh", DEFAULT_BLOCK_TEMPLATE_REFRESH), DEFAULT_BLOCK_TEMPLATE_REFRESH);
+            int64_t nTime = fNow ? GetTimeMillis() : std::max(GetTimeMillis(), nLastUpdate + nRefresh);
+            if (fPending && nUpdateTime <= nTime)
+                return;
+            fPending = true;
+            nUpdateTime = nTime;
+        }
+        cond.notify_all();
+    }
+
+    void ThreadUpdate()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!fStop) {
+                    if (!fPending) {
+                        cond.wait(lock);
+                        continue;
+                    }
+                    int64_t nWait = nUpdateTime - GetTimeMillis();
+                    if (nWait <= 0)
+                        break;
+                    cond.wait_for(lock, std::chrono::milliseconds(nWait));
+                }
+                if (fStop)
+                    return;
+
+                fPending = false;
+                fBuilding = true;
+                nLastUpdate = GetTimeMillis();
+            }
+
+            Update();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                fBuilding = false;
+            }
+            cond.notify_all();
+        }
+    }
+
+    void Update()
+    {
+        bool fWitness = Params().GetConsensus().nSegwitEnabled;
+        std::unique_ptr<CBlockTemplate> pnew;
+        unsigned int nTransactionsUpdatedNew;
+        int64_t nTimeStart = GetTimeMicros();
+        {
+            LOCK(cs_main);
+            if (IsInitialBlockDownload() || !chainActive.Tip())
+                return;
+
+            nTransactionsUpdatedNew = mempool.GetTransactionsUpdated();
+            std::shared_ptr<const CBlockTemplate> pprev;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ptemplate && hashPrevBlock == chainActive.Tip()->GetBlockHash() && fMineWitnessTx == fWitness) {
+                    // Nothing to do if neither the tip nor the mempool changed since the last build
+                    if (nTransactionsUpdated == nTransactionsUpdatedNew)
+                        return;
+                    pprev = ptemplate;
+                }
+            }
+            try {
+                // Only the mempool changed, so extend the template instead of selecting everything again
+                CScript scriptDummy = CScript() << OP_TRUE;
+                if (pprev)
+                    pnew = BlockAssembler(Params()).ExtendBlock(*pprev, scriptDummy, fWitness);
+                if (!pnew)
+                    pnew = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fWitness);
+            } catch (const std::runtime_error& e) {
+                LogPrintf("%s: Failed to update the block template: %s\n", __func__, e.what());
+                return;
+            }
+        }
+        if (!pnew)
+            return;
+
+        CAmount nFees = -pnew->vTxFees[0];
+        bool fWake = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (hashPrevBlock != pnew->block.hashPrevBlock) {
+                // Long polls are woken up by the new tip already
+                nFeesNotified = nFees;
+            } else if (nFees > nFeesNotified + nFeesNotified * BLOCK_TEMPLATE_FEE_WAKE_PERCENT / 100) {
+                nFeesNotified = nFees;
+                fWake = true;
+            }
+
+            hashPrevBlock = pnew->block.hashPrevBlock;
+            fMineWitnessTx = fWitness;
+            nTransactionsUpdated = nTransactionsUpdatedNew;
+            ptemplate = std::move(pnew);
+            nUpdates++;
+        }
+
+        LogPrint(BCLog::BENCH, "%s: updated block template in %.2fms, fees: %s\n", __func__, 0.001 * (GetTimeMicros() - nTimeStart), FormatMoney(nFees));
+
+        if (fWake) {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            nFeeSequence++;
+            cvBlockChange.notify_all();
+        }
+    }
+
+public:
+    CBlockTemplateUpdater() : fStop(false), fPending(false), fBuilding(false), nUpdateTime(0), nLastRequest(0), nLastUpdate(0), nUpdates(0), fMineWitnessTx(false), nTransactionsUpdated(0), nFeesNotified(0), nFeeSequence(0) {}
+
+    void Start()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (thread.joinable())
+            return;
+        fStop = false;
+        thread = std::thread(&TraceThread<std::function<void()> >, "tmplupdate", std::function<void()>(std::bind(&CBlockTemplateUpdater::ThreadUpdate, this)));
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        if (thread.joinable())
+            thread.join();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        fPending = false;
+        ptemplate.reset();
+    }
+
+    //! Wait until no rebuild is due or running
+    void Sync()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return fStop || (!fPending && !fBuilding); });
+    }
+
+    std::unique_ptr<CBlockTemplate> GetTemplate(const CBlockIndex* pindexPrev, bool fMineWitnessTxIn, unsigned int& nTransactionsUpdatedOut)
+    {
+        std::unique_ptr<CBlockTemplate> pcopy;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // The template wasn't kept up to date while nobody asked for one
+            bool fWasIdle = IsIdle();
+            nLastRequest = GetTime();
+            if (!fWasIdle && ptemplate && hashPrevBlock == pindexPrev->GetBlockHash() && fMineWitnessTx == fMineWitnessTxIn) {
+                pcopy.reset(new CBlockTemplate(*ptemplate));
+                nTransactionsUpdatedOut = nTransactionsUpdated;
+                return pcopy;
+            }
+        }
+
+        ScheduleUpdate(true);
+        return pcopy;
+    }
+
+    unsigned int GetFeeSequence() const
+    {
+        return nFeeSequence;
+    }
+
+    uint64_t GetUpdateCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nUpdates;
+    }
+
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override
+    {
+        if (!fInitialDownload)
+            ScheduleUpdate(true);
+    }
+
+    void TransactionAddedToMempool(const CTransactionRef &ptxn) override
+    {
+        ScheduleUpdate(false);
+    }
+};
+
+CBlockTemplateUpdater blockTemplateUpdater;
+
+} // namespace
+
+void StartBlockTemplateUpdates()
+{
+    blockTemplateUpdater.Start();
+    RegisterValidationInterface(&blockTemplateUpdater);
+}
+
+void StopBlockTemplateUpdates()
+{
+    UnregisterValidationInterface(&blockTemplateUpdater);
+    blockTemplateUpdater.Stop();
+}
+
+void SyncWithBlockTemplateUpdates()
+{
+    blockTemplateUpdater.Sync();
+}
+
+std::unique_ptr<CBlockTemplate> GetUpdatedBlockTemplate(const CBlockIndex* pindexPrev, bool fMineWitnessTx, unsigned int& nTransactionsUpdated)
+{
+    return blockTemplateUpdater.GetTemplate(pindexPrev, fMineWitnessTx, nTransactionsUpdated);
+}
+
+unsigned int GetBlockTemplateFeeSequence()
+{
+    return blockTemplateUpdater.GetFeeSequence();
+}
+
+uint64_t GetBlockTemplateUpdateCount()
+{
+    return blockTemplateUpdater.GetUpdateCount();
+}
+
+static void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nExtraNonce)
+{
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
@@ -471,6 +809,19 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
 
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+{
+    // Update nExtraNonce
+    static uint256 hashPrevBlock;
+    if (hashPrevBlock != pblock->hashPrevBlock)
+    {
+        nExtraNonce = 0;
+        hashPrevBlock = pblock->hashPrevBlock;
+    }
+    ++nExtraNonce;
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+}
+
 
 static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams)
 {
@@ -507,15 +858,79 @@ CWallet *GetFirstWallet() {
     return(vpwallets[0]);
 }
 
-void static RavenMiner(const CChainParams& chainparams)
+/** Hashes done by one miner thread. Only that thread writes them */
+struct CMinerThreadStats
+{
+    std::atomic<uint64_t> nHashesDone;
+    int64_t nTimeStart;
+
+    CMinerThreadStats() : nHashesDone(0), nTimeStart(GetTimeMicros()) {}
+};
+
+static CCriticalSection cs_minerStats;
+static std::vector<std::shared_ptr<CMinerThreadStats> > vMinerStats;
+
+bool GetSharedTemplate(CMinerSharedTemplate& shared, CWallet* pWallet, std::shared_ptr<const CBlockTemplate>& ptemplate, const CBlockIndex*& pindexPrev, uint64_t& nGeneration)
+{
+    LOCK(shared.cs);
+
+    if (!shared.coinbaseScript)
+        pWallet->GetScriptForMining(shared.coinbaseScript);
+
+    // Throw an error if no script was provided.  This can happen
+    // due to some internal error but also if the keypool is empty.
+    // In the latter case, already the pointer is NULL.
+    if (!shared.coinbaseScript || shared.coinbaseScript->reserveScript.empty())
+        throw std::runtime_error("No coinbase script available (mining requires a wallet)");
+
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    if (!pindexTip)
+        return false;
+
+    if (!shared.ptemplate || shared.pindexPrev != pindexTip ||
+            (mempool.GetTransactionsUpdated() != shared.nTransactionsUpdated && GetTime() - shared.nTimeCreated > 60)) {
+        unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        std::unique_ptr<CBlockTemplate> pnew(BlockAssembler(Params()).CreateNewBlock(shared.coinbaseScript->reserveScript));
+        if (!pnew)
+            return false;
+
+        shared.ptemplate = std::move(pnew);
+        shared.pindexPrev = pindexTip;
+        shared.nTransactionsUpdated = nTransactionsUpdated;
+        shared.nTimeCreated = GetTime();
+        shared.nGeneration++;
+
+        LogPrintf("RavenMiner -- Running miner with %u transactions in block (%u bytes)\n", shared.ptemplate->block.vtx.size(),
+            ::GetSerializeSize(shared.ptemplate->block, SER_NETWORK, PROTOCOL_VERSION));
+    }
+
+    ptemplate = shared.ptemplate;
+    pindexPrev = shared.pindexPrev;
+    nGeneration = shared.nGeneration;
+    return true;
+}
+
+unsigned int GetMinerExtraNonce(unsigned int nExtraNonce, uint64_t& nLastGeneration, uint64_t nGeneration, int nThread, int nThreads)
+{
+    // Every thread searches its own extranonces, so they never hash the same header.
+    // On the same generation it moves on to the next one it hasn't searched yet
+    if (nGeneration != nLastGeneration) {
+        nLastGeneration = nGeneration;
+        return nThread + 1;
+    }
+    return nExtraNonce + nThreads;
+}
+
+void static RavenMiner(const CChainParams& chainparams, std::shared_ptr<CMinerSharedTemplate> shared, std::shared_ptr<CMinerThreadStats> stats, int nThread, int nThreads)
 {
     LogPrintf("RavenMiner -- started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
     RenameThread("raven-miner");
 
-    unsigned int nExtraNonce = 0;
-
-
     CWallet * pWallet = NULL;
 
     #ifdef ENABLE_WALLET
@@ -532,29 +947,11 @@ void static RavenMiner(const CChainParams& chainparams)
         return;
     }
 
-
-    std::shared_ptr<CReserveScript> coinbaseScript;
-
-    pWallet->GetScriptForMining(coinbaseScript);
-
-    //GetMainSignals().ScriptForMining(coinbaseScript);
-
-    if (!coinbaseScript)
-        LogPrintf("coinbaseScript is NULL\n");
-
-    if (coinbaseScript->reserveScript.empty())
-        LogPrintf("coinbaseScript is empty\n");
+    // Extranonces this thread searched on the current template generation, so a restart doesn't cover them again
+    unsigned int nExtraNonce = 0;
+    uint64_t nLastGeneration = 0;
 
     try {
-        // Throw an error if no script was provided.  This can happen
-        // due to some internal error but also if the keypool is empty.
-        // In the latter case, already the pointer is NULL.
-        if (!coinbaseScript || coinbaseScript->reserveScript.empty())
-        {
-            throw std::runtime_error("No coinbase script available (mining requires a wallet)");
-        }
-
-
         while (true) {
 
             if (chainparams.MiningRequiresPeers()) {
@@ -571,75 +968,82 @@ void static RavenMiner(const CChainParams& chainparams)
 
 
             //
-            // Create new block
+            // Get the shared block
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrev = chainActive.Tip();
-            if(!pindexPrev) break;
-
-
-
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
-
-            if (!pblocktemplate.get())
+            std::shared_ptr<const CBlockTemplate> ptemplate;
+            const CBlockIndex* pindexPrev;
+            uint64_t nGeneration;
+            if (!GetSharedTemplate(*shared, pWallet, ptemplate, pindexPrev, nGeneration))
             {
                 LogPrintf("RavenMiner -- Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
                 return;
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
-            LogPrintf("RavenMiner -- Running miner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
-                ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+            CBlock block = ptemplate->block;
+            CBlock *pblock = &block;
+
+            nExtraNonce = GetMinerExtraNonce(nExtraNonce, nLastGeneration, nGeneration, nThread, nThreads);
+            SetExtraNonce(pblock, pindexPrev, nExtraNonce);
 
             //
             // Search
             //
-            int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
             while (true)
             {
-
                 uint256 hash;
+                uint64_t nHashes = 0;
+                bool fFound = false;
                 while (true)
                 {
                     hash = pblock->GetHash();
+                    ++nHashes;
                     if (UintToArith256(hash) <= hashTarget)
                     {
-                        // Found a solution
-                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                        LogPrintf("RavenMiner:\n  proof-of-work found\n  hash: %s\n  target: %s\n", hash.GetHex(), hashTarget.GetHex());
-                        ProcessBlockFound(pblock, chainparams);
-                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                        coinbaseScript->KeepScript();
-
-                        // In regression test mode, stop mining after a block is found. This
-                        // allows developers to controllably generate a block on demand.
-                        if (chainparams.MineBlocksOnDemand())
-                            throw boost::thread_interrupted();
-
+                        fFound = true;
                         break;
                     }
                     pblock->nNonce += 1;
-                    nHashesDone += 1;
-                    if (nHashesDone % 500000 == 0) {   //Calculate hashing speed
-                        nHashesPerSec = nHashesDone / (((GetTimeMicros() - nMiningTimeStart) / 1000000) + 1);
-                    } 
                     if ((pblock->nNonce & 0xFF) == 0)
                         break;
                 }
+                stats->nHashesDone.fetch_add(nHashes, std::memory_order_relaxed);
+
+                if (fFound)
+                {
+                    // Found a solution
+                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                    LogPrintf("RavenMiner:\n  proof-of-work found\n  hash: %s\n  target: %s\n", hash.GetHex(), hashTarget.GetHex());
+                    ProcessBlockFound(pblock, chainparams);
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                    {
+                        LOCK(shared->cs);
+                        shared->coinbaseScript->KeepScript();
+                    }
+
+                    // In regression test mode, stop mining after a block is found. This
+                    // allows developers to controllably generate a block on demand.
+                    if (chainparams.MineBlocksOnDemand())
+                        throw boost::thread_interrupted();
+
+                    break;
+                }
 
                 // Check for stop or if block needs to be rebuilt
                 boost::this_thread::interruption_point();
-                // Regtest mode doesn't require peers
-                //if (vNodes.empty() && chainparams.MiningRequiresPeers())
-                //    break;
-                if (pblock->nNonce >= 0xffff0000)
-                    break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
+                if (pblock->nNonce >= 0xffff0000) {
+                    // Move on to this thread's next extranonce
+                    nExtraNonce += nThreads;
+                    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+                    pblock->nNonce = 0;
+                }
                 if (pindexPrev != chainActive.Tip())
                     break;
+                {
+                    LOCK(shared->cs);
+                    if (shared->nGeneration != nGeneration || (mempool.GetTransactionsUpdated() != shared->nTransactionsUpdated && GetTime() - shared->nTimeCreated > 60))
+                        break;
+                }
 
                 // Update nTime every few seconds
                 if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
@@ -681,19 +1085,41 @@ int GenerateRavens(bool fGenerate, int nThreads, const CChainParams& chainparams
         minerThreads = NULL;
     }
 
+    {
+        LOCK(cs_minerStats);
+        vMinerStats.clear();
+    }
+
     if (nThreads == 0 || !fGenerate)
         return numCores;
 
     minerThreads = new boost::thread_group();
-    
-    //Reset metrics
-    nMiningTimeStart = GetTimeMicros();
-    nHashesDone = 0;
-    nHashesPerSec = 0;
 
+    std::shared_ptr<CMinerSharedTemplate> shared = std::make_shared<CMinerSharedTemplate>();
     for (int i = 0; i < nThreads; i++){
-        minerThreads->create_thread(boost::bind(&RavenMiner, boost::cref(chainparams)));
+        std::shared_ptr<CMinerThreadStats> stats = std::make_shared<CMinerThreadStats>();
+        {
+            LOCK(cs_minerStats);
+            vMinerStats.push_back(stats);
+        }
+        minerThreads->create_thread(boost::bind(&RavenMiner, boost::cref(chainparams), shared, stats, i, nThreads));
     }
 
     return(numCores);
 }
+
+void GetMinerThreadInfo(std::vector<CMinerThreadInfo>& vInfo)
+{
+    vInfo.clear();
+
+    LOCK(cs_minerStats);
+    int64_t nNow = GetTimeMicros();
+    for (const auto& stats : vMinerStats) {
+        CMinerThreadInfo info;
+        info.nThread = vInfo.size();
+        info.nHashesDone = stats->nHashesDone.load(std::memory_order_relaxed);
+        int64_t nElapsed = nNow - stats->nTimeStart;
+        info.dHashesPerSec = nElapsed > 0 ? info.nHashesDone * 1000000.0 / nElapsed : 0;
+        vInfo.push_back(info);
+    }
+}
@@ -17,11 +17,23 @@
 
 class CBlockIndex;
 class CChainParams;
+class CReserveScript;
+class CScheduler;
 class CScript;
+class CWallet;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -blockmaxassetops, the maximum number of asset outputs in a block we create */
+static const unsigned int DEFAULT_BLOCK_MAX_ASSET_OPS = 10000;
+/** Default and lower bound for -blocktemplaterefresh, the minimum time in milliseconds between background template
+ *  rebuilds for new transactions */
+static const int64_t DEFAULT_BLOCK_TEMPLATE_REFRESH = 5000;
+/** Long polls are woken up when the fees of the background template grow by this many percent */
+static const int64_t BLOCK_TEMPLATE_FEE_WAKE_PERCENT = 5;
+/** The background template stops being rebuilt when nobody asked for one for this many seconds, longer than a long poll */
+static const int64_t BLOCK_TEMPLATE_IDLE_TIMEOUT = 120;
 
 struct CBlockTemplate
 {
@@ -40,12 +52,14 @@ struct CTxMemPoolModifiedEntry {
         nSizeWithAncestors = entry->GetSizeWithAncestors();
         nModFeesWithAncestors = entry->GetModFeesWithAncestors();
         nSigOpCostWithAncestors = entry->GetSigOpCostWithAncestors();
+        nAssetOpsWithAncestors = entry->GetAssetOpsWithAncestors();
     }
 
     CTxMemPool::txiter iter;
     uint64_t nSizeWithAncestors;
     CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
+    int64_t nAssetOpsWithAncestors;
 };
 
 /** Comparator for CTxMemPool::txiter objects.
@@ -124,6 +138,7 @@ struct update_for_parent_inclusion
         e.nModFeesWithAncestors -= iter->GetFee();
         e.nSizeWithAncestors -= iter->GetTxSize();
         e.nSigOpCostWithAncestors -= iter->GetSigOpCost();
+        e.nAssetOpsWithAncestors -= iter->GetAssetOps();
     }
 
     CTxMemPool::txiter iter;
@@ -142,11 +157,13 @@ private:
     bool fIncludeWitness;
     unsigned int nBlockMaxWeight;
     CFeeRate blockMinFeeRate;
+    int64_t nBlockMaxAssetOps;
 
     // Information on the current status of the block
     uint64_t nBlockWeight;
     uint64_t nBlockTx;
     uint64_t nBlockSigOpsCost;
+    int64_t nBlockAssetOps;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
 
@@ -160,6 +177,7 @@ public:
         Options();
         size_t nBlockMaxWeight;
         CFeeRate blockMinFeeRate;
+        int64_t nBlockMaxAssetOps;
     };
 
     explicit BlockAssembler(const CChainParams& params);
@@ -167,6 +185,10 @@ public:
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+    /** Construct a template from prev, which was built on the current tip with the same fMineWitnessTx:
+     *  its transactions that are still in the mempool are kept in order and the best new packages
+     *  appended. Returns nullptr if the tip changed or the kept transactions already fill the block */
+    std::unique_ptr<CBlockTemplate> ExtendBlock(const CBlockTemplate& prev, const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
 
 private:
     // utility functions
@@ -174,6 +196,8 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Add the coinbase paying scriptPubKeyIn the fees collected so far and fill in the header */
+    void FinishBlock(const CScript& scriptPubKeyIn, const CBlockIndex* pindexPrev);
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors
@@ -185,7 +209,7 @@ private:
     /** Remove confirmed (inBlock) entries from given set */
     void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
     /** Test if a new package would "fit" in the block */
-    bool TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const;
+    bool TestPackage(uint64_t packageSize, int64_t packageSigOpsCost, int64_t packageAssetOps) const;
     /** Perform checks on each transaction in a package:
       * locktime, premature-witness, serialized size (if necessary)
       * These checks should always succeed, and they're here
@@ -207,4 +231,52 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
 int GenerateRavens(bool fGenerate, int nThreads, const CChainParams& chainparams);
+
+/** The template shared by the miner threads. Whichever thread finds it stale first rebuilds it */
+struct CMinerSharedTemplate
+{
+    CCriticalSection cs;
+    std::shared_ptr<CReserveScript> coinbaseScript;
+    std::shared_ptr<const CBlockTemplate> ptemplate;
+    const CBlockIndex* pindexPrev = nullptr;
+    unsigned int nTransactionsUpdated = 0;
+    int64_t nTimeCreated = 0;
+    uint64_t nGeneration = 0; //!< Incremented on every rebuild, so threads can tell their copy is stale
+};
+
+/** Get the shared template, rebuilding it if the tip changed or the mempool changed over a minute ago.
+ *  The coinbase script is taken from pWallet the first time, unless shared already has one */
+bool GetSharedTemplate(CMinerSharedTemplate& shared, CWallet* pWallet, std::shared_ptr<const CBlockTemplate>& ptemplate, const CBlockIndex*& pindexPrev, uint64_t& nGeneration);
+
+/** The extranonce a miner thread starts the template of nGeneration with. nExtraNonce is the last one it searched,
+ *  which it continues after when the generation is still nLastGeneration */
+unsigned int GetMinerExtraNonce(unsigned int nExtraNonce, uint64_t& nLastGeneration, uint64_t nGeneration, int nThread, int nThreads);
+
+/** Hashing statistics of one internal miner thread */
+struct CMinerThreadInfo
+{
+    int nThread;
+    uint64_t nHashesDone;
+    double dHashesPerSec; //!< Average since the thread was started
+};
+
+/** Get the statistics of the running miner threads, empty when not generating */
+void GetMinerThreadInfo(std::vector<CMinerThreadInfo>& vInfo);
+
+/** Keep a getblocktemplate template up to date on its own thread as transactions arrive and blocks are connected.
+ *  It is only rebuilt while GetUpdatedBlockTemplate was called in the last BLOCK_TEMPLATE_IDLE_TIMEOUT seconds,
+ *  and only if the tip or the mempool changed since the last build, so nodes that aren't polled don't pay for it.
+ *  A new tip selects all transactions again, mempool changes only extend the template with BlockAssembler::ExtendBlock */
+void StartBlockTemplateUpdates();
+void StopBlockTemplateUpdates();
+/** Wait until the background template has caught up with the rebuilds that are due, used by the tests */
+void SyncWithBlockTemplateUpdates();
+/** Get a copy of the background template if it was built on top of pindexPrev, or nullptr if there isn't one yet
+ *  or it went stale while nobody asked for it.
+ *  nTransactionsUpdated is set to the mempool counter the template was built at */
+std::unique_ptr<CBlockTemplate> GetUpdatedBlockTemplate(const CBlockIndex* pindexPrev, bool fMineWitnessTx, unsigned int& nTransactionsUpdated);
+/** Incremented whenever the fees of the background template grow by BLOCK_TEMPLATE_FEE_WAKE_PERCENT, cvBlockChange is notified with it */
+unsigned int GetBlockTemplateFeeSequence();
+/** Number of times the background template was rebuilt */
+uint64_t GetBlockTemplateUpdateCount();
 #endif // RAVEN_MINER_H
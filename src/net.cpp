@@ -29,6 +29,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -81,6 +85,13 @@ const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+
+/** How far ahead of the received message data its buffer is grown */
+static const unsigned int MAX_RECV_AHEAD = 256 * 1024;
+/** Message data still missing from at least this many bytes is received straight into the message */
+static const unsigned int MIN_DIRECT_RECV_SIZE = 64 * 1024;
+/** Maximum total capacity of the receive buffers kept for reuse */
+static const size_t MAX_RECV_BUFFER_POOL_SIZE = 32 * 1024 * 1024;
 //
 // Global state variables
 //
@@ -438,7 +449,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         connected = ConnectThroughProxy(proxy, host, port, hSocket, nConnectTimeout, nullptr);
     }
     if (connected) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsServiceableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return nullptr;
@@ -701,6 +712,10 @@ void CNode::copyStats(CNodeStats &stats)
         X(mapRecvBytesPerMsgCmd);
         X(nRecvBytes);
     }
+    {
+        LOCK(cs_msgTiming);
+        X(mapTimingPerMsgCmd);
+    }
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -737,7 +752,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -777,6 +792,14 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+bool CNode::GetDirectRecvBuffer(char*& pch, unsigned int& nSize)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return false;
+    return vRecvMsg.back().GetDataBuffer(pch, nSize);
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -804,22 +827,80 @@ int CNode::GetSendVersion() const
 }
 
 
+namespace {
+/**
+ * Buffers of processed messages, kept for the messages received next. Relaying
+ * many messages then doesn't allocate, zero and free a buffer for each of them.
+ */
+class CRecvBufferPool
+{
+private:
+    std::mutex cs;
+    std::multimap<size_t, CSerializeData> mapBuffers; //!< By capacity
+    size_t nPooledSize;
+
+public:
+    CRecvBufferPool() : nPooledSize(0) {}
+
+    /** A buffer with room for nSize bytes if one is kept, otherwise an empty one */
+    CSerializeData Get(size_t nSize)
+    {
+        CSerializeData vch;
+        std::lock_guard<std::mutex> lock(cs);
+        auto it = mapBuffers.lower_bound(nSize);
+        // Don't tie up a large buffer with a small message
+        if (it == mapBuffers.end() || it->first > std::max<size_t>(8 * nSize, MIN_DIRECT_RECV_SIZE))
+            return vch;
+        vch.swap(it->second);
+        nPooledSize -= it->first;
+        mapBuffers.erase(it);
+        return vch;
+    }
+
+    void Put(CSerializeData& vch)
+    {
+        size_t nCapacity = vch.capacity();
+        if (nCapacity == 0)
+            return;
+        std::lock_guard<std::mutex> lock(cs);
+        if (nPooledSize + nCapacity > MAX_RECV_BUFFER_POOL_SIZE)
+            return;
+        vch.clear();
+        nPooledSize += nCapacity;
+        mapBuffers.emplace(nCapacity, std::move(vch));
+    }
+};
+
+CRecvBufferPool& GetRecvBufferPool()
+{
+    static CRecvBufferPool pool;
+    return pool;
+}
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    GetRecvBufferPool().Put(vch);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        CBufferReader(vRecv.GetType(), vRecv.GetVersion(), (const unsigned char*)hdrbuf, CMessageHeader::HEADER_SIZE, 0) >> hdr;
     }
     catch (const std::exception&) {
         return -1;
@@ -829,6 +910,12 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     if (hdr.nMessageSize > MAX_SIZE)
         return -1;
 
+    // receive the data into a recycled buffer if there is one
+    if (hdr.nMessageSize > 0) {
+        CSerializeData vch = GetRecvBufferPool().Get(std::min(hdr.nMessageSize, MAX_RECV_AHEAD));
+        vRecv.swap(vch);
+    }
+
     // switch state to reading message data
     in_data = true;
 
@@ -842,16 +929,32 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + MAX_RECV_AHEAD));
     }
 
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Data received through GetDataBuffer() is in place already
+    if (pch != vRecv.data() + nDataPos)
+        memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+bool CNetMessage::GetDataBuffer(char*& pch, unsigned int& nSize)
+{
+    // Small remainders are read together with the messages following them instead
+    unsigned int nRemaining = hdr.nMessageSize - nDataPos;
+    if (!in_data || nRemaining < MIN_DIRECT_RECV_SIZE)
+        return false;
+
+    nSize = std::min(nRemaining, MAX_RECV_AHEAD);
+    if (vRecv.size() < nDataPos + nSize)
+        vRecv.resize(nDataPos + nSize);
+    pch = vRecv.data() + nDataPos;
+    return true;
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -875,27 +978,52 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert((*it)->size() > pnode->nSendOffset);
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
+#ifdef WIN32
+            const auto &data = **it;
             nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Hand the kernel as much of the queue as possible in one call
+            struct iovec vIov[MAX_SEND_IOV];
+            int nIov = 0;
+            size_t nOffset = pnode->nSendOffset;
+            for (auto itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++itIov, ++nIov) {
+                vIov[nIov].iov_base = const_cast<unsigned char*>((*itIov)->data()) + nOffset;
+                vIov[nIov].iov_len = (*itIov)->size() - nOffset;
+                nOffset = 0;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = vIov;
+            msg.msg_iovlen = nIov;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the buffers that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRest = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRest) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRest;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if (pnode->nSendOffset != 0) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1103,7 +1231,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsServiceableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1145,6 +1273,130 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterNodeEvents(pnode);
+    }
+}
+
+bool CConnman::IsServiceableSocket(const SOCKET& hSocket) const
+{
+    // epoll takes any socket, select() only those below FD_SETSIZE
+    return socketEventsMode == SOCKETEVENTS_EPOLL || IsSelectableSocket(hSocket);
+}
+
+void CConnman::RegisterNodeEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+
+    // Edge-triggered, the socket thread keeps track of the nodes that have data left
+    // to read. Closing the socket removes it from the epoll set again.
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl for peer=%d failed: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+bool CConnman::ReceiveData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    // The rest of a large message goes straight into its buffer
+    char* pchRecv = pchBuf;
+    unsigned int nRecvSize = sizeof(pchBuf);
+    pnode->GetDirectRecvBuffer(pchRecv, nRecvSize);
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchRecv, nRecvSize, MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
+        }
+        return true;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed\n");
+        }
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+        return nErr == WSAEINTR;
+    }
+    return false;
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrintf("version handshake timeout from %d\n", pnode->GetId());
+            pnode->fDisconnect = true;
+        }
     }
 }
 
@@ -1166,6 +1418,7 @@ void CConnman::ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                    setReceivableNodes.erase(pnode);
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1214,6 +1467,13 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
+#ifdef USE_EPOLL
+        if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+            SocketEventsEpoll();
+            continue;
+        }
+#endif
+
         //
         // Find which sockets have data to receive
         //
@@ -1338,57 +1598,7 @@ void CConnman::ThreadSocketHandler()
             }
             if (recvSet || errorSet)
             {
-                // typical socket buffer is 8K-64K
-                char pchBuf[0x10000];
-                int nBytes = 0;
-                {
-                    LOCK(pnode->cs_hSocket);
-                    if (pnode->hSocket == INVALID_SOCKET)
-                        continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                }
-                if (nBytes > 0)
-                {
-                    bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                        pnode->CloseSocketDisconnect();
-                    RecordBytesRecv(nBytes);
-                    if (notify) {
-                        size_t nSizeAdded = 0;
-                        auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete())
-                                break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                        }
-                        {
-                            LOCK(pnode->cs_vProcessMsg);
-                            pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                            pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                        }
-                        WakeMessageHandler();
-                    }
-                }
-                else if (nBytes == 0)
-                {
-                    // socket closed gracefully
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket closed\n");
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-                else if (nBytes < 0)
-                {
-                    // error
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                    {
-                        if (!pnode->fDisconnect)
-                            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                        pnode->CloseSocketDisconnect();
-                    }
-                }
+                ReceiveData(pnode);
             }
 
             //
@@ -1406,36 +1616,120 @@ void CConnman::ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrintf("version handshake timeout from %d\n", pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
+            InactivityCheck(pnode);
+        }
+        {
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodesCopy)
+                pnode->Release();
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/** Whether the socket thread should read from a node now, see the comment in ThreadSocketHandler */
+static bool CanReceive(CNode* pnode)
+{
+    if (pnode->fPauseRecv)
+        return false;
+    LOCK(pnode->cs_vSend);
+    return pnode->vSendMsg.empty();
+}
+
+void CConnman::SocketEventsEpoll()
+{
+    // Don't block while some nodes still have data waiting to be read
+    bool fReceivable = false;
+    for (CNode* pnode : setReceivableNodes) {
+        if (CanReceive(pnode)) {
+            fReceivable = true;
+            break;
+        }
+    }
+
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_SOCKET_EVENTS, fReceivable ? 0 : 50);
+    if (interruptNet)
+        return;
+
+    if (nEvents < 0)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(50));
+        }
+        return;
+    }
+
+    //
+    // Accept new connections, and note which nodes became readable or writable.
+    // Nodes are only deleted by this thread, after their socket was closed, so
+    // the pointers in the events stay valid until the next round.
+    //
+    std::vector<CNode*> vSendable;
+    for (int i = 0; i < nEvents; i++)
+    {
+        const void* ptr = events[i].data.ptr;
+        bool fListenSocket = false;
+        for (const ListenSocket& hListenSocket : vhListenSocket)
+        {
+            if (ptr == &hListenSocket) {
+                AcceptConnection(hListenSocket);
+                fListenSocket = true;
+                break;
             }
         }
+        if (fListenSocket)
+            continue;
+
+        CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            setReceivableNodes.insert(pnode);
+        if (events[i].events & EPOLLOUT)
+            vSendable.push_back(pnode);
+    }
+
+    //
+    // Send, before receiving more from the same nodes
+    //
+    for (CNode* pnode : vSendable)
+    {
+        LOCK(pnode->cs_vSend);
+        size_t nBytes = SocketSendData(pnode);
+        if (nBytes) {
+            RecordBytesSent(nBytes);
+        }
+    }
+
+    //
+    // Receive, one read per node and round so busy nodes can't starve the others
+    //
+    std::vector<CNode*> vReceivable(setReceivableNodes.begin(), setReceivableNodes.end());
+    for (CNode* pnode : vReceivable)
+    {
+        if (interruptNet)
+            return;
+        if (CanReceive(pnode) && !ReceiveData(pnode))
+            setReceivableNodes.erase(pnode);
+    }
+
+    //
+    // Inactivity checking, which doesn't need to happen more than once a second
+    //
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime != nLastInactivityCheck)
+    {
+        nLastInactivityCheck = nTime;
+        std::vector<CNode*> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy = vNodes;
+            for (CNode* pnode : vNodesCopy)
+                pnode->AddRef();
+        }
+        for (CNode* pnode : vNodesCopy)
+            InactivityCheck(pnode);
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodesCopy)
@@ -1443,14 +1737,39 @@ void CConnman::ThreadSocketHandler()
         }
     }
 }
+#endif
+
+bool CConnman::StartSocketEvents()
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("Failed to create epoll instance: %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        // Listening sockets are level-triggered, one connection is accepted per event
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = (void*)&hListenSocket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                LogPrintf("Failed to add listening socket to epoll: %s\n", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+        }
+    }
+#endif
+    return true;
+}
 
 void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        nMsgProcWake++;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 
@@ -1983,13 +2302,15 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterNodeEvents(pnode);
     }
 
     return true;
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
+    uint64_t nWakeSeen = 0;
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
@@ -2003,11 +2324,21 @@ void CConnman::ThreadMessageHandler()
 
         bool fMoreWork = false;
 
-        for (CNode* pnode : vNodesCopy)
+        // With several handler threads, each starts its round at a different node and
+        // skips the nodes another thread is processing. A node's messages are thus still
+        // processed one at a time and in order, while different nodes are processed in
+        // parallel, serializing only on the locks the messages need (mostly cs_main).
+        size_t nOffset = vNodesCopy.size() * nThread / nMsgHandlerThreads;
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nOffset + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            bool fExpected = false;
+            if (!pnode->fProcessingMessages.compare_exchange_strong(fExpected, true))
+                continue;
+
             // Receive messages
             bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
@@ -2018,6 +2349,7 @@ void CConnman::ThreadMessageHandler()
                 LOCK(pnode->cs_sendProcessing);
                 m_msgproc->SendMessages(pnode, flagInterruptMsgProc);
             }
+            pnode->fProcessingMessages = false;
 
             if (flagInterruptMsgProc)
                 return;
@@ -2031,9 +2363,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nWakeSeen] { return nMsgProcWake != nWakeSeen; });
         }
-        fMsgProcWake = false;
+        nWakeSeen = nMsgProcWake;
     }
 }
 
@@ -2064,7 +2396,7 @@ bool CConnman::BindListenPort(const CService &addrBind, std::string& strError, b
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket))
+    if (!IsServiceableSocket(hListenSocket))
     {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
@@ -2224,6 +2556,10 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     semOutbound = nullptr;
     semAddnode = nullptr;
     flagInterruptMsgProc = false;
+#ifdef USE_EPOLL
+    epollfd = -1;
+#endif
+    nLastInactivityCheck = 0;
 
     Options connOptions;
     Init(connOptions);
@@ -2285,6 +2621,9 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         return false;
     }
 
+    if (!StartSocketEvents())
+        return false;
+
     LogPrintf("Connection Manager: Adding Seed Nodes\n");
 
     for (const auto& strDest : connOptions.vSeedNodes) {
@@ -2350,7 +2689,7 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        nMsgProcWake = 0;
     }
 
     // Send and receive from sockets, accept connections
@@ -2376,7 +2715,8 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMsgHandlerThreads; i++)
+        vThreadMessageHandler.emplace_back(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2425,8 +2765,9 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
+    for (std::thread& threadMessageHandler : vThreadMessageHandler)
         threadMessageHandler.join();
+    vThreadMessageHandler.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2460,6 +2801,13 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+    setReceivableNodes.clear();
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = nullptr;
     delete semAddnode;
@@ -2585,6 +2933,67 @@ void CConnman::RecordBytesRecv(uint64_t bytes)
     nTotalBytesRecv += bytes;
 }
 
+CMessageTimingStats::CMessageTimingStats() : nCount(0), nProcessMicros(0), nQueueMicros(0), nLockWaitMicros(0), nHashMicros(0)
+{
+    std::fill(vProcessBuckets, vProcessBuckets + MSG_TIMING_BUCKETS, 0);
+    std::fill(vQueueBuckets, vQueueBuckets + MSG_TIMING_BUCKETS, 0);
+}
+
+int CMessageTimingStats::GetBucket(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < MSG_TIMING_BUCKETS - 1 && nMicros > (int64_t(1) << nBucket))
+        nBucket++;
+    return nBucket;
+}
+
+void CMessageTimingStats::Add(int64_t nProcess, int64_t nQueue, int64_t nLockWait, int64_t nHash)
+{
+    nCount++;
+    nProcessMicros += nProcess;
+    nQueueMicros += nQueue;
+    nLockWaitMicros += nLockWait;
+    nHashMicros += nHash;
+    vProcessBuckets[GetBucket(nProcess)]++;
+    vQueueBuckets[GetBucket(nQueue)]++;
+}
+
+CMessageTimingStats& CMessageTimingStats::operator+=(const CMessageTimingStats& other)
+{
+    nCount += other.nCount;
+    nProcessMicros += other.nProcessMicros;
+    nQueueMicros += other.nQueueMicros;
+    nLockWaitMicros += other.nLockWaitMicros;
+    nHashMicros += other.nHashMicros;
+    for (int i = 0; i < MSG_TIMING_BUCKETS; i++) {
+        vProcessBuckets[i] += other.vProcessBuckets[i];
+        vQueueBuckets[i] += other.vQueueBuckets[i];
+    }
+    return *this;
+}
+
+void CConnman::RecordMessageTiming(CNode* pnode, const std::string& strCommand, int64_t nProcessMicros, int64_t nQueueMicros, int64_t nLockWaitMicros, int64_t nHashMicros)
+{
+    // Only known commands get an entry of their own, so peers can't grow the maps
+    static const std::set<std::string> setKnownCommands(getAllNetMessageTypes().begin(), getAllNetMessageTypes().end());
+    const std::string& strKey = setKnownCommands.count(strCommand) ? strCommand : NET_MESSAGE_COMMAND_OTHER;
+
+    nProcessMicros = std::max<int64_t>(nProcessMicros, 0);
+    nQueueMicros = std::max<int64_t>(nQueueMicros, 0);
+    {
+        LOCK(pnode->cs_msgTiming);
+        pnode->mapTimingPerMsgCmd[strKey].Add(nProcessMicros, nQueueMicros, nLockWaitMicros, nHashMicros);
+    }
+    LOCK(cs_msgTiming);
+    mapTimingPerMsgCmd[strKey].Add(nProcessMicros, nQueueMicros, nLockWaitMicros, nHashMicros);
+}
+
+void CConnman::GetMessageTimingStats(mapMsgCmdTiming& mapTiming)
+{
+    LOCK(cs_msgTiming);
+    mapTiming = mapTimingPerMsgCmd;
+}
+
 void CConnman::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
@@ -2763,6 +3172,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fProcessingMessages = false;
     nProcessQueueSize = 0;
 
     fGetAssetData = false;
@@ -2826,12 +3236,9 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+CSharedNetMsg CConnman::ShareMessage(CSerializedNetMsg&& msg)
 {
     size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
-
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
     uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
@@ -2840,6 +3247,25 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
+    CSharedNetMsg shared;
+    shared.header = std::make_shared<const std::vector<unsigned char> >(std::move(serializedHeader));
+    if (nMessageSize)
+        shared.data = std::make_shared<const std::vector<unsigned char> >(std::move(msg.data));
+    shared.command = std::move(msg.command);
+    return shared;
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, ShareMessage(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsg& msg)
+{
+    size_t nMessageSize = msg.data ? msg.data->size() : 0;
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
+
     size_t nBytesSent = 0;
     {
         LOCK(pnode->cs_vSend);
@@ -2851,9 +3277,9 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(msg.header);
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(msg.data);
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
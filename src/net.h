@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <set>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -54,6 +55,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Maximum number of queued buffers handed to the kernel in one send */
+static const int MAX_SEND_IOV = 64;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** Maximum number of automatic outgoing nodes */
@@ -68,6 +71,23 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** How sockets are waited on for data to send and receive */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+/** -socketevents default */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKET_EVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKET_EVENTS = "select";
+#endif
+/** -msghandlerthreads default, the number of threads processing peer messages */
+static const int DEFAULT_MSG_HANDLER_THREADS = 1;
+/** Maximum for -msghandlerthreads */
+static const int MAX_MSG_HANDLER_THREADS = 16;
+/** Maximum number of socket events handled per epoll_wait() call */
+static const int MAX_SOCKET_EVENTS = 256;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of entries in setAskFor (larger due to getdata latency)*/
@@ -114,6 +134,44 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/**
+ * A message with its header serialized, sharing both with every peer it is
+ * pushed to. Relaying one message to many peers then serializes, hashes and
+ * stores it only once.
+ */
+struct CSharedNetMsg
+{
+    std::shared_ptr<const std::vector<unsigned char> > header;
+    std::shared_ptr<const std::vector<unsigned char> > data; //!< nullptr for an empty message
+    std::string command;
+};
+
+/** Number of buckets in the CMessageTimingStats histograms */
+static const int MSG_TIMING_BUCKETS = 24;
+
+/**
+ * How long handling the messages of one command took. Bucket 0 of a histogram
+ * counts durations up to 1 microsecond, bucket i those up to 2^i microseconds
+ * that are longer than 2^(i-1), and the last bucket all longer ones.
+ */
+struct CMessageTimingStats
+{
+    uint64_t nCount;
+    int64_t nProcessMicros;  //!< Time spent processing
+    int64_t nQueueMicros;    //!< Time between receiving a message and starting to process it
+    int64_t nLockWaitMicros; //!< Time processing waited for contended locks
+    int64_t nHashMicros;     //!< Time processing spent hashing block headers
+    uint64_t vProcessBuckets[MSG_TIMING_BUCKETS];
+    uint64_t vQueueBuckets[MSG_TIMING_BUCKETS];
+
+    CMessageTimingStats();
+    void Add(int64_t nProcess, int64_t nQueue, int64_t nLockWait, int64_t nHash);
+    CMessageTimingStats& operator+=(const CMessageTimingStats& other);
+
+    static int GetBucket(int64_t nMicros);
+};
+typedef std::map<std::string, CMessageTimingStats> mapMsgCmdTiming; //command, timing
+
 class NetEventsInterface;
 class CConnman
 {
@@ -146,6 +204,8 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
+        int nMsgHandlerThreads = DEFAULT_MSG_HANDLER_THREADS;
     };
 
     void Init(const Options& connOptions) {
@@ -163,6 +223,8 @@ public:
         nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
         vWhitelistedRange = connOptions.vWhitelistedRange;
         vAddedNodes = connOptions.m_added_nodes;
+        socketEventsMode = connOptions.socketEventsMode;
+        nMsgHandlerThreads = std::max(connOptions.nMsgHandlerThreads, 1);
     }
 
     CConnman(uint64_t seed0, uint64_t seed1);
@@ -178,6 +240,9 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg);
+    /** Serialize the header of a message, so it can be pushed to any number of peers */
+    static CSharedNetMsg ShareMessage(CSerializedNetMsg&& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -287,6 +352,10 @@ public:
     uint64_t GetTotalBytesRecv();
     uint64_t GetTotalBytesSent();
 
+    /** Account the time processing a message took, for the peer and in total */
+    void RecordMessageTiming(CNode* pnode, const std::string& strCommand, int64_t nProcessMicros, int64_t nQueueMicros, int64_t nLockWaitMicros, int64_t nHashMicros);
+    void GetMessageTimingStats(mapMsgCmdTiming& mapTiming);
+
     void SetBestHeight(int height);
     int GetBestHeight() const;
 
@@ -311,9 +380,21 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
+#ifdef USE_EPOLL
+    void SocketEventsEpoll();
+#endif
+    /** Set up waiting for events with the selected socket events mode, after the listening sockets were bound */
+    bool StartSocketEvents();
+    /** Whether hSocket can be waited on with the selected socket events mode */
+    bool IsServiceableSocket(const SOCKET& hSocket) const;
+    /** Start waiting for events on the socket of a node that was just added to vNodes */
+    void RegisterNodeEvents(CNode* pnode);
+    /** Read once from the socket of a node. Returns false if there is nothing left to read for now */
+    bool ReceiveData(CNode* pnode);
+    void InactivityCheck(CNode* pnode);
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -355,6 +436,10 @@ private:
     uint64_t nTotalBytesRecv;
     uint64_t nTotalBytesSent;
 
+    // Message processing time totals
+    CCriticalSection cs_msgTiming;
+    mapMsgCmdTiming mapTimingPerMsgCmd;
+
     // outbound limit & stats
     uint64_t nMaxOutboundTotalBytesSentInCycle;
     uint64_t nMaxOutboundCycleStartTime;
@@ -369,6 +454,13 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    SocketEventsMode socketEventsMode;
+#ifdef USE_EPOLL
+    int epollfd;
+#endif
+    //! Nodes with data left to read, only used by the socket thread with epoll
+    std::set<CNode*> setReceivableNodes;
+    int64_t nLastInactivityCheck;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -400,8 +492,9 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** Incremented for waking the message processors. */
+    uint64_t nMsgProcWake;
+    int nMsgHandlerThreads;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -413,7 +506,9 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> vThreadMessageHandler;
+
+    friend struct CConnmanTest;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -513,6 +608,7 @@ public:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    mapMsgCmdTiming mapTimingPerMsgCmd;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -535,22 +631,24 @@ private:
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, in a recycled buffer when one was available
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -563,12 +661,17 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+    /**
+     * If a large part of the message data is still missing, make room for the next
+     * part of it and return where to receive it to. Passing that back to readData()
+     * then only hashes it, the bytes are already in place.
+     */
+    bool GetDataBuffer(char*& pch, unsigned int& nSize);
 };
 
 
@@ -583,7 +686,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<std::shared_ptr<const std::vector<unsigned char> > > vSendMsg; // headers and payloads, possibly shared with other peers
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -636,16 +739,22 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    //! Set while a message handler thread processes this node, so it is never processed by two at once
+    std::atomic_bool fProcessingMessages;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    CCriticalSection cs_msgTiming;
+    mapMsgCmdTiming mapTimingPerMsgCmd;
 
 public:
     uint256 hashContinue;
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    //! Protects vAddrToSend and addrKnown, which are also filled while processing other peers' messages
+    CCriticalSection cs_addrSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -667,6 +776,9 @@ public:
     std::vector<uint256> vInventoryBlockToSend;
     CCriticalSection cs_inventory;
     std::set<uint256> setAskFor;
+    // Orphans to retry because this peer sent one of their parents, only used
+    // by the thread processing the peer's messages and under cs_main.
+    std::set<uint256> setOrphanWork;
     std::multimap<int64_t, CInv> mapAskFor;
     int64_t nNextInvSend;
     // Used for headers announcements - unfiltered blocks to relay
@@ -740,6 +852,8 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /** Where to receive the next bytes to when they can go straight into the message being received, see CNetMessage::GetDataBuffer() */
+    bool GetDirectRecvBuffer(char*& pch, unsigned int& nSize);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -771,6 +885,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -779,6 +894,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
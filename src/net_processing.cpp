@@ -11,6 +11,7 @@
 #include "blockencodings.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
 #include "hash.h"
 #include "init.h"
 #include "validation.h"
@@ -36,6 +37,11 @@
 # error "Raven cannot be compiled without assertions."
 #endif
 
+#include <algorithm>
+#include <unordered_map>
+
+#include <boost/bind.hpp>
+
 std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
 
 struct IteratorComparator
@@ -52,13 +58,31 @@ struct COrphanTx {
     CTransactionRef tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    uint64_t nSequence; //!< Order in which the orphans were added
+    size_t nUsage;      //!< Memory used by the transaction
 };
 std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+std::unordered_map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>, SaltedOutpointHasher> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/** The orphans a peer gave us, oldest first, and the memory they use */
+struct COrphanPeer {
+    std::map<uint64_t, uint256> mapBySequence;
+    size_t nUsage = 0;
+};
+static std::map<NodeId, COrphanPeer> mapOrphanPeers GUARDED_BY(cs_main);
+static uint64_t nOrphanSequence GUARDED_BY(cs_main) = 0;
+static size_t nOrphanUsage GUARDED_BY(cs_main) = 0;
+//! Orphans whose parents were in connected blocks or restored from disk, waiting to be retried
+static std::set<uint256> setOrphanWorkFromBlocks GUARDED_BY(cs_main);
+//! How many orphans the message handler retries at a time, before it goes on with other messages and peers
+static const size_t MAX_ORPHAN_WORK_PER_CALL = 10;
+//! Orphans restored from disk are stored under this peer
+static const NodeId ORPHAN_PEER_RESTORED = -1;
+
 static size_t vExtraTxnForCompactIt = 0;
 static std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(cs_main);
+static size_t nExtraTxnForCompactUsage GUARDED_BY(cs_main) = 0;
 
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
 
@@ -113,6 +137,9 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested, in microseconds.
+        bool fSoleRequest;                                       //!< Whether nothing else was in flight from the peer when it was requested.
+        bool fRerequested;                                       //!< Whether the block was taken over from a slower peer.
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -133,6 +160,27 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /**
+     * A relayed transaction in the announcement queue. The transaction itself is looked up
+     * in the mempool when it is announced, so the queue doesn't keep evicted ones alive.
+     */
+    struct TxAnnouncement {
+        uint256 hash;
+        CAmount nFeePerK;
+    };
+    /**
+     * Transactions to announce, shared by all peers and protected by cs_main.
+     * RelayTransaction() collects them in vTxAnnouncePending. Once per trickle they are
+     * sorted topologically and by fee rate and appended to queueTxAnnounce, and each
+     * peer announces from that queue starting at its own cursor.
+     */
+    std::vector<uint256> vTxAnnouncePending;
+    std::deque<TxAnnouncement> queueTxAnnounce;
+    //! Sequence number of the front of queueTxAnnounce
+    uint64_t nTxAnnounceBase = 0;
+    //! Cursor of a peer that doesn't announce from the queue yet, because the handshake isn't done
+    const uint64_t TX_ANNOUNCE_CURSOR_NONE = std::numeric_limits<uint64_t>::max();
 } // namespace
 
 namespace {
@@ -183,6 +231,21 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! How many blocks to keep in flight from this peer, adapted to its latency and throughput.
+    int nBlocksInFlightMax;
+    //! Average time between requesting a block and receiving it, in microseconds, or 0.
+    int64_t nBlockLatency;
+    //! Average time to receive a block requested while nothing else was in flight from this peer, in microseconds, or 0.
+    //! Unlike nBlockLatency it doesn't grow with the number of blocks queued at the peer.
+    int64_t nBlockRoundTrip;
+    //! Average time between receiving blocks while more were in flight, in microseconds, or 0.
+    int64_t nBlockInterval;
+    //! When the last block requested from this peer was received.
+    int64_t nLastBlockReceived;
+    //! Sequence number of the next entry of queueTxAnnounce to announce to this peer.
+    uint64_t nTxAnnounceCursor;
+    //! How many transactions to announce per transmission, adapted to how fast the peer takes them.
+    int nTxAnnounceMax;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -247,6 +310,14 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksInFlightMax = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockLatency = 0;
+        nBlockRoundTrip = 0;
+        nBlockInterval = 0;
+        nLastBlockReceived = 0;
+        // Set once the handshake is done, transactions relayed before that aren't announced to it
+        nTxAnnounceCursor = TX_ANNOUNCE_CURSOR_NONE;
+        nTxAnnounceMax = INVENTORY_BROADCAST_MAX;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -346,7 +417,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr), GetTimeMicros(), state->nBlocksInFlight == 0, false});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -362,6 +433,63 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     return true;
 }
 
+// Round trip time of a peer, from its blocks requested alone or failing that its pings, in microseconds, or 0.
+int64_t GetBlockRoundTrip(const CNodeState* state, int64_t nPingUsec) {
+    if (nPingUsec <= 0 || nPingUsec == std::numeric_limits<int64_t>::max())
+        return state->nBlockRoundTrip;
+    return state->nBlockRoundTrip ? std::min(state->nBlockRoundTrip, nPingUsec) : nPingUsec;
+}
+
+// Requires cs_main.
+// Measure how fast a peer delivers the blocks requested from it, and size the number of blocks kept
+// in flight from it to cover the blocks it can deliver during one round trip, twice over.
+// nPingUsec is the peer's lowest ping time, used while no block was requested from it alone.
+void UpdateBlockDownloadSpeed(NodeId nodeid, const uint256& hash, int64_t nPingUsec) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+
+    int64_t nNow = GetTimeMicros();
+    const QueuedBlock& queuedBlock = *itInFlight->second.second;
+    int64_t nTimeRequested = queuedBlock.nTimeRequested;
+    int64_t nLatency = std::max<int64_t>(nNow - nTimeRequested, 1);
+    state->nBlockLatency = state->nBlockLatency ? (7 * state->nBlockLatency + nLatency) / 8 : nLatency;
+    // Blocks requested behind others wait for those first, so only a lone request measures the round trip
+    if (queuedBlock.fSoleRequest)
+        state->nBlockRoundTrip = state->nBlockRoundTrip ? (7 * state->nBlockRoundTrip + nLatency) / 8 : nLatency;
+
+    // Only blocks that were requested before the previous one arrived show how fast the peer can send
+    if (state->nLastBlockReceived && nTimeRequested <= state->nLastBlockReceived) {
+        int64_t nInterval = std::max<int64_t>(nNow - state->nLastBlockReceived, 1);
+        state->nBlockInterval = state->nBlockInterval ? (7 * state->nBlockInterval + nInterval) / 8 : nInterval;
+    }
+    state->nLastBlockReceived = nNow;
+
+    int64_t nRoundTrip = GetBlockRoundTrip(state, nPingUsec);
+    if (state->nBlockInterval && nRoundTrip)
+        state->nBlocksInFlightMax = GetBlocksInFlightMax(nRoundTrip, state->nBlockInterval);
+}
+
+// Requires cs_main.
+// Whether a block in flight from another peer is late enough, and this peer fast enough, to request it from this peer instead.
+bool CanRerequestBlock(NodeId nodeid, const uint256& hash) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first == nodeid || itInFlight->second.second->fRerequested)
+        return false;
+    CNodeState *state = State(nodeid);
+    CNodeState *stateOther = State(itInFlight->second.first);
+    assert(state != nullptr && stateOther != nullptr);
+
+    // This peer would send it after the blocks already queued at it
+    int64_t nExpected = state->nBlockLatency;
+    if (state->nBlockRoundTrip && state->nBlockInterval)
+        nExpected = state->nBlockRoundTrip + state->nBlocksInFlight * state->nBlockInterval;
+    int64_t nElapsed = GetTimeMicros() - itInFlight->second.second->nTimeRequested;
+    return IsBlockTakeoverDue(nElapsed, stateOther->nBlockLatency, nExpected);
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -445,7 +573,8 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
+ *  at most count entries. If the window can't move because of a block in flight from a slower peer,
+ *  that block is added instead. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
@@ -482,6 +611,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = nullptr;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -516,7 +646,11 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     // We reached the end of the window.
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
-                        nodeStaller = waitingfor;
+                        // Take the block holding up the window over if we can, otherwise it's the staller's.
+                        if (CanRerequestBlock(nodeid, pindexWaitingFor->GetBlockHash()))
+                            vBlocks.push_back(pindexWaitingFor);
+                        else
+                            nodeStaller = waitingfor;
                     }
                     return;
                 }
@@ -527,6 +661,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -534,6 +669,18 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
 } // namespace
 
+int GetBlocksInFlightMax(int64_t nRoundTrip, int64_t nBlockInterval)
+{
+    int64_t nMax = 2 * nRoundTrip / std::max<int64_t>(nBlockInterval, 1) + 1;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nMax, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+bool IsBlockTakeoverDue(int64_t nElapsed, int64_t nLatencyOther, int64_t nExpected)
+{
+    return nElapsed > BLOCK_REREQUEST_MIN_DELAY && nElapsed > 2 * nLatencyOther &&
+        nExpected != 0 && nExpected < nElapsed;
+}
+
 // Returns true for outbound peers, excluding manual connections, feelers, and
 // one-shots
 bool IsOutboundDisconnectionCandidate(const CNode *node)
@@ -600,6 +747,14 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightMax = state->nBlocksInFlightMax;
+    stats.nBlockLatency = state->nBlockLatency;
+    stats.nBlockRoundTrip = state->nBlockRoundTrip;
+    stats.nBlockInterval = state->nBlockInterval;
+    stats.nTxAnnounceMax = state->nTxAnnounceMax;
+    stats.nTxAnnounceBacklog = 0;
+    if (state->nTxAnnounceCursor != TX_ANNOUNCE_CURSOR_NONE)
+        stats.nTxAnnounceBacklog = nTxAnnounceBase + queueTxAnnounce.size() - std::max(state->nTxAnnounceCursor, nTxAnnounceBase);
     return true;
 }
 
@@ -613,9 +768,26 @@ void AddToCompactExtraTransactions(const CTransactionRef& tx)
     size_t max_extra_txn = gArgs.GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN);
     if (max_extra_txn <= 0)
         return;
+    size_t nMaxUsage = (size_t)std::max((int64_t)0, gArgs.GetArg("-blockreconstructionextratxnsize", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN_SIZE)) * 1000000;
+    size_t nUsage = RecursiveDynamicUsage(*tx);
+    if (nUsage > nMaxUsage)
+        return;
     if (!vExtraTxnForCompact.size())
         vExtraTxnForCompact.resize(max_extra_txn);
+
+    // Drop the transaction in the slot that is reused, and then the oldest ones until the new one fits
+    for (size_t i = 0; i < max_extra_txn; i++) {
+        if (i > 0 && nExtraTxnForCompactUsage + nUsage <= nMaxUsage)
+            break;
+        std::pair<uint256, CTransactionRef>& oldest = vExtraTxnForCompact[(vExtraTxnForCompactIt + i) % max_extra_txn];
+        if (oldest.second) {
+            nExtraTxnForCompactUsage -= RecursiveDynamicUsage(*oldest.second);
+            oldest = std::make_pair(uint256(), CTransactionRef());
+        }
+    }
+
     vExtraTxnForCompact[vExtraTxnForCompactIt] = std::make_pair(tx->GetWitnessHash(), tx);
+    nExtraTxnForCompactUsage += nUsage;
     vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
 }
 
@@ -630,8 +802,7 @@ bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRE
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 100 orphans, each of which is at most 99,999 bytes big is
-    // at most 10 megabytes of orphans and somewhat more byprev index (in the worst case):
+    // The memory the pool may use is limited by -maxorphansize on top of this.
     unsigned int sz = GetTransactionWeight(*tx);
     if (sz >= MAX_STANDARD_TX_WEIGHT)
     {
@@ -639,16 +810,21 @@ bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRE
         return false;
     }
 
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
+    size_t nUsage = RecursiveDynamicUsage(tx);
+    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, nOrphanSequence, nUsage});
     assert(ret.second);
     for (const CTxIn& txin : tx->vin) {
         mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
     }
+    COrphanPeer& orphanPeer = mapOrphanPeers[peer];
+    orphanPeer.mapBySequence.emplace(nOrphanSequence++, hash);
+    orphanPeer.nUsage += nUsage;
+    nOrphanUsage += nUsage;
 
     AddToCompactExtraTransactions(tx);
 
-    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u usage %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanUsage);
     return true;
 }
 
@@ -666,27 +842,45 @@ int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    auto itPeer = mapOrphanPeers.find(it->second.fromPeer);
+    assert(itPeer != mapOrphanPeers.end());
+    itPeer->second.mapBySequence.erase(it->second.nSequence);
+    itPeer->second.nUsage -= it->second.nUsage;
+    if (itPeer->second.mapBySequence.empty())
+        mapOrphanPeers.erase(itPeer);
+    nOrphanUsage -= it->second.nUsage;
     mapOrphanTransactions.erase(it);
     return 1;
 }
 
 void EraseOrphansFor(NodeId peer)
 {
+    auto itPeer = mapOrphanPeers.find(peer);
+    if (itPeer == mapOrphanPeers.end())
+        return;
+    std::vector<uint256> vErase;
+    for (const auto& entry : itPeer->second.mapBySequence)
+        vErase.push_back(entry.second);
     int nErased = 0;
-    std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        std::map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
-        }
-    }
+    for (const uint256& hash : vErase)
+        nErased += EraseOrphanTx(hash);
     if (nErased > 0) LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx from peer=%d\n", nErased, peer);
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+/** Queue the orphans spending the outputs of tx to be retried */
+static void AddOrphanWork(const CTransaction& tx, std::set<uint256>& setOrphanWork) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        auto itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(tx.GetHash(), i));
+        if (itByPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        for (const auto& mi : itByPrev->second)
+            setOrphanWork.insert(mi->first);
+    }
+}
+
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
     static int64_t nNextSweep;
@@ -709,7 +903,26 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
         nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
         if (nErased > 0) LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx due to expiration\n", nErased);
     }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    // A peer over its share of the pool makes room with its own oldest orphans,
+    // so a single peer can't push out the orphans of everyone else
+    const uint64_t nMaxPeerOrphans = (uint64_t)nMaxOrphans * MAX_ORPHAN_TX_PEER_PERCENT / 100;
+    const size_t nMaxPeerUsage = nMaxOrphanUsage / 100 * MAX_ORPHAN_TX_PEER_PERCENT;
+    std::vector<uint256> vEraseQueue;
+    for (const auto& entry : mapOrphanPeers) {
+        // Restored orphans came from many peers before the restart, only the global limits apply to them
+        if (entry.first == ORPHAN_PEER_RESTORED)
+            continue;
+        size_t nCount = entry.second.mapBySequence.size();
+        size_t nUsage = entry.second.nUsage;
+        for (auto it = entry.second.mapBySequence.begin(); it != entry.second.mapBySequence.end() && (nCount > nMaxPeerOrphans || nUsage > nMaxPeerUsage); ++it) {
+            nCount--;
+            nUsage -= mapOrphanTransactions.at(it->second).nUsage;
+            vEraseQueue.push_back(it->second);
+        }
+    }
+    for (const uint256& hash : vEraseQueue)
+        nEvicted += EraseOrphanTx(hash);
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanUsage > nMaxOrphanUsage)
     {
         // Evict a random orphan:
         uint256 randomhash = GetRandHash();
@@ -722,6 +935,18 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
     return nEvicted;
 }
 
+/** Apply -maxorphantx and -maxorphansize to the orphan pool */
+static void LimitOrphans() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+    unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    size_t nMaxOrphanUsage = (size_t)std::max((int64_t)0, gArgs.GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_SIZE)) * 1000000;
+    unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanUsage);
+    if (nEvicted > 0) {
+        LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
+    }
+}
+
 // Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch)
 {
@@ -768,6 +993,19 @@ static bool StaleBlockRequestAllowed(const CBlockIndex* pindex, const Consensus:
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn) : connman(connmanIn) {
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&PeerLogicValidation::TransactionRemovedFromMempool, this, _1, _2));
+}
+
+PeerLogicValidation::~PeerLogicValidation() {
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&PeerLogicValidation::TransactionRemovedFromMempool, this, _1, _2));
+}
+
+void PeerLogicValidation::TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason) {
+    // Replaced transactions are added by the message handling that replaced them
+    if (reason != MemPoolRemovalReason::EXPIRY && reason != MemPoolRemovalReason::SIZELIMIT)
+        return;
+    AssertLockHeld(cs_main);
+    AddToCompactExtraTransactions(tx);
 }
 
 void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted) {
@@ -788,6 +1026,9 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
                 vOrphanErase.push_back(orphanHash);
             }
         }
+
+        // Orphans spending the outputs of this transaction can be accepted now, see ProcessOrphanWorkFromBlocks()
+        AddOrphanWork(tx, setOrphanWorkFromBlocks);
     }
 
     // Erase orphan transactions include or precluded by this block
@@ -804,12 +1045,36 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
+static CSharedNetMsg most_recent_compact_block_msg; // most_recent_compact_block, serialized with witnesses
+static CSharedNetMsg most_recent_block_msg; // most_recent_block without witnesses, serialized when first requested
 static uint256 most_recent_block_hash;
 static bool fWitnessesPresentInMostRecentCompactBlock;
 
+/** Push a block, serializing it only once if it is the most recent block, which many peers ask for at the same time */
+static void PushBlockMessage(CConnman* connman, CNode* pfrom, const CNetMsgMaker& msgMaker, int nSendFlags, const std::shared_ptr<const CBlock>& pblock)
+{
+    if (nSendFlags == SERIALIZE_TRANSACTION_NO_WITNESS) {
+        CSharedNetMsg msg;
+        {
+            LOCK(cs_most_recent_block);
+            if (pblock == most_recent_block) {
+                if (!most_recent_block_msg.header)
+                    most_recent_block_msg = CConnman::ShareMessage(msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                msg = most_recent_block_msg;
+            }
+        }
+        if (msg.header) {
+            connman->PushMessage(pfrom, msg);
+            return;
+        }
+    }
+    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+}
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const CSharedNetMsg cmpctblockmsg = CConnman::ShareMessage(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
 
     LOCK(cs_main);
 
@@ -826,11 +1091,12 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_compact_block_msg = cmpctblockmsg;
+        most_recent_block_msg = CSharedNetMsg();
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    connman->ForEachNode([this, &cmpctblockmsg, pindex, fWitnessEnabled, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -842,7 +1108,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, cmpctblockmsg);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -950,13 +1216,233 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
-static void RelayTransaction(const CTransaction& tx, CConnman* connman)
+void RelayTransaction(const CTransaction& tx)
+{
+    AssertLockHeld(cs_main);
+    // Announced to every peer from the shared queue, see SealTxAnnouncements()
+    vTxAnnouncePending.push_back(tx.GetHash());
+}
+
+/**
+ * Retry up to nMaxWork of the orphans in setOrphanWork. An accepted orphan queues the orphans
+ * spending its own outputs, so a whole chain of orphans is resolved when its parent arrives,
+ * a slice per call so cs_main isn't held for all of it. Orphans that turn out invalid or
+ * non-standard are dropped as well. Returns whether work is left.
+ */
+static bool ProcessOrphanWork(std::set<uint256>& setOrphanWork, size_t nMaxWork, std::list<CTransactionRef>& lRemovedTxn) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    std::set<NodeId> setMisbehaving;
+    size_t nWork = 0;
+    while (!setOrphanWork.empty() && nWork < nMaxWork) {
+        const uint256 orphanHash = *setOrphanWork.begin();
+        setOrphanWork.erase(setOrphanWork.begin());
+        auto itOrphan = mapOrphanTransactions.find(orphanHash);
+        if (itOrphan == mapOrphanTransactions.end())
+            continue;
+
+        const CTransactionRef porphanTx = itOrphan->second.tx;
+        const CTransaction& orphanTx = *porphanTx;
+        NodeId fromPeer = itOrphan->second.fromPeer;
+        bool fMissingInputs2 = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (setMisbehaving.count(fromPeer))
+            continue;
+        nWork++;
+        if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, &fMissingInputs2, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+            LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx);
+            AddOrphanWork(orphanTx, setOrphanWork);
+            EraseOrphanTx(orphanHash);
+        }
+        else if (!fMissingInputs2)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(fromPeer, nDos);
+                setMisbehaving.insert(fromPeer);
+                LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee
+            LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
+            if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                // Do not use rejection cache for witness transactions or
+                // witness-stripped transactions, as they can have been malleated.
+                // See https://github.com/RavenProject/Ravencoin/issues/8279 for details.
+                assert(recentRejects);
+                recentRejects->insert(orphanHash);
+            }
+            EraseOrphanTx(orphanHash);
+        }
+        mempool.check(pcoinsTip);
+    }
+    return !setOrphanWork.empty();
+}
+
+/**
+ * Resolve some of the orphans whose parents were in connected blocks. This runs in the
+ * message handler once a peer's announcements are out, so the new blocks are relayed
+ * before the orphans are validated, and cs_main is only held for a slice of them at a time.
+ */
+static void ProcessOrphanWorkFromBlocks() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    CInv inv(MSG_TX, tx.GetHash());
-    connman->ForEachNode([&inv](CNode* pnode)
+    if (setOrphanWorkFromBlocks.empty())
+        return;
+
+    std::list<CTransactionRef> lRemovedTxn;
+    ProcessOrphanWork(setOrphanWorkFromBlocks, MAX_ORPHAN_WORK_PER_CALL, lRemovedTxn);
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+}
+
+static const uint64_t ORPHANS_DUMP_VERSION = 1;
+
+bool LoadOrphans()
+{
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "orphans.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open orphans file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t accepted = 0;
+    int64_t expired = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != ORPHANS_DUMP_VERSION) {
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransactionRef tx;
+            int64_t nTimeExpire;
+            file >> tx;
+            file >> nTimeExpire;
+
+            if (nTimeExpire > nNow) {
+                LOCK(cs_main);
+                bool fMissingInputs = false;
+                CValidationState state;
+                std::list<CTransactionRef> lRemovedTxn;
+                if (AcceptToMemoryPool(mempool, state, tx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+                    // The parents arrived while we were down
+                    ++accepted;
+                    RelayTransaction(*tx);
+                    AddOrphanWork(*tx, setOrphanWorkFromBlocks);
+                } else if (fMissingInputs && AddOrphanTx(tx, ORPHAN_PEER_RESTORED)) {
+                    mapOrphanTransactions.at(tx->GetHash()).nTimeExpire = nTimeExpire;
+                    ++count;
+                } else {
+                    ++failed;
+                }
+                for (const CTransactionRef& removedTx : lRemovedTxn)
+                    AddToCompactExtraTransactions(removedTx);
+            } else {
+                ++expired;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize orphans data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        LimitOrphans();
+    }
+    LogPrintf("Imported orphan transactions from disk: %i kept, %i accepted, %i failed, %i expired\n", count, accepted, failed, expired);
+    return true;
+}
+
+bool DumpOrphans()
+{
+    int64_t start = GetTimeMicros();
+
+    std::vector<COrphanTx> vOrphans;
     {
-        pnode->PushInventory(inv);
+        LOCK(cs_main);
+        vOrphans.reserve(mapOrphanTransactions.size());
+        for (const auto& entry : mapOrphanTransactions)
+            vOrphans.push_back(entry.second);
+    }
+    // Oldest first, so they are evicted in the same order after loading them
+    std::sort(vOrphans.begin(), vOrphans.end(), [](const COrphanTx& a, const COrphanTx& b) {
+        return a.nSequence < b.nSequence;
     });
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "orphans.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = ORPHANS_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vOrphans.size();
+        for (const COrphanTx& orphan : vOrphans) {
+            file << *orphan.tx;
+            file << orphan.nTimeExpire;
+        }
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "orphans.dat.new", GetDataDir() / "orphans.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped %u orphan transactions: %gs to copy, %gs to dump\n", vOrphans.size(), (mid-start) * 0.000001, (last-mid) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump orphans: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+/** Sort the transactions relayed since the last trickle into the announcement queue, and trim it */
+static void SealTxAnnouncements()
+{
+    AssertLockHeld(cs_main);
+    if (!vTxAnnouncePending.empty()) {
+        // Parents go before their children, so the announcements don't produce orphans
+        std::sort(vTxAnnouncePending.begin(), vTxAnnouncePending.end(), [](const uint256& a, const uint256& b) {
+            return mempool.CompareDepthAndScore(a, b);
+        });
+        for (const uint256& hash : vTxAnnouncePending) {
+            auto txinfo = mempool.info(hash);
+            if (txinfo.tx)
+                queueTxAnnounce.push_back(TxAnnouncement{hash, txinfo.feeRate.GetFeePerK()});
+        }
+        vTxAnnouncePending.clear();
+    }
+
+    // Drop what every peer is past, and the oldest entries if some peer falls too far behind.
+    // Peers still in the handshake have no cursor yet and don't hold anything back.
+    uint64_t nMinCursor = nTxAnnounceBase + queueTxAnnounce.size();
+    for (const auto& entry : mapNodeState)
+        nMinCursor = std::min(nMinCursor, entry.second.nTxAnnounceCursor);
+    const size_t nMaxEntries = MAX_TX_ANNOUNCE_QUEUE_SIZE / sizeof(TxAnnouncement);
+    while (!queueTxAnnounce.empty() && (nTxAnnounceBase < nMinCursor || queueTxAnnounce.size() > nMaxEntries)) {
+        queueTxAnnounce.pop_front();
+        nTxAnnounceBase++;
+    }
 }
 
 static void RelayAddress(const CAddress& addr, bool fReachable, CConnman* connman)
@@ -1000,6 +1486,34 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+
+    // Only the first block request is answered in this round. If we have it and all of
+    // its parents, but have not validated it yet, we might be in the middle of connecting
+    // it (ie in the unlock of cs_main before ActivateBestChain but after AcceptBlock).
+    // In this case, run ActivateBestChain prior to checking the relay conditions below.
+    // It can't be called with cs_main held, other handler threads may be running it.
+    auto itBlock = std::find_if(it, pfrom->vRecvGetData.end(), [](const CInv& inv) {
+        return inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK;
+    });
+    if (itBlock != pfrom->vRecvGetData.end()) {
+        bool fNeedActivateChain = false;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(itBlock->hash);
+            fNeedActivateChain = mi != mapBlockIndex.end() && mi->second->nChainTx &&
+                    !mi->second->IsValid(BLOCK_VALID_SCRIPTS) && mi->second->IsValid(BLOCK_VALID_TREE);
+        }
+        if (fNeedActivateChain) {
+            std::shared_ptr<const CBlock> a_recent_block;
+            {
+                LOCK(cs_most_recent_block);
+                a_recent_block = most_recent_block;
+            }
+            CValidationState dummy;
+            ActivateBestChain(dummy, Params(), a_recent_block);
+        }
+    }
+
     LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
@@ -1020,25 +1534,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 std::shared_ptr<const CBlock> a_recent_block;
                 std::shared_ptr<const CBlockHeaderAndShortTxIDs> a_recent_compact_block;
+                CSharedNetMsg a_recent_compact_block_msg;
                 bool fWitnessesPresentInARecentCompactBlock;
                 {
                     LOCK(cs_most_recent_block);
                     a_recent_block = most_recent_block;
                     a_recent_compact_block = most_recent_compact_block;
+                    a_recent_compact_block_msg = most_recent_compact_block_msg;
                     fWitnessesPresentInARecentCompactBlock = fWitnessesPresentInMostRecentCompactBlock;
                 }
                 if (mi != mapBlockIndex.end())
                 {
-                    if (mi->second->nChainTx && !mi->second->IsValid(BLOCK_VALID_SCRIPTS) &&
-                            mi->second->IsValid(BLOCK_VALID_TREE)) {
-                        // If we have the block and all of its parents, but have not yet validated it,
-                        // we might be in the middle of connecting it (ie in the unlock of cs_main
-                        // before ActivateBestChain but after AcceptBlock).
-                        // In this case, we need to run ActivateBestChain prior to checking the relay
-                        // conditions below.
-                        CValidationState dummy;
-                        ActivateBestChain(dummy, Params(), a_recent_block);
-                    }
                     if (chainActive.Contains(mi->second)) {
                         send = true;
                     } else {
@@ -1077,7 +1583,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         pblock = pblockRead;
                     }
                     if (inv.type == MSG_BLOCK)
-                        connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
+                        PushBlockMessage(connman, pfrom, msgMaker, SERIALIZE_TRANSACTION_NO_WITNESS, pblock);
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
                     else if (inv.type == MSG_FILTERED_BLOCK)
@@ -1116,13 +1622,13 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
                         if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
                             if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                                connman->PushMessage(pfrom, a_recent_compact_block_msg);
                             } else {
                                 CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
                                 connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                             }
                         } else {
-                            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                            PushBlockMessage(connman, pfrom, msgMaker, nSendFlags, pblock);
                         }
                     }
 
@@ -1831,7 +2337,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             inv.type = State(pfrom->GetId())->fWantsCmpctWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK;
             inv.hash = req.blockhash;
             pfrom->vRecvGetData.push_back(inv);
-            ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
+            // The message processing loop will go around again (without pausing) and we'll respond then (without cs_main)
             return true;
         }
 
@@ -1916,8 +2422,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
         const CTransaction& tx = *ptx;
@@ -1938,10 +2442,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         if (!AlreadyHave(inv) &&
             AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
             mempool.check(pcoinsTip);
-            RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
+            RelayTransaction(tx);
+            AddOrphanWork(tx, pfrom->setOrphanWork);
 
             pfrom->nLastTXTime = GetTime();
 
@@ -1950,66 +2452,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, &fMissingInputs2, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/RavenProject/Ravencoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
+            // Retry some of the orphan transactions that depended on this one
+            ProcessOrphanWork(pfrom->setOrphanWork, MAX_ORPHAN_WORK_PER_CALL, lRemovedTxn);
         }
         else if (fMissingInputs)
         {
@@ -2028,13 +2472,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
                 }
                 AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0) {
-                    LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
-                }
+                LimitOrphans();
             } else {
                 LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
                 // We will continue to reject this tx since it has rejected
@@ -2067,7 +2505,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 int nDoS = 0;
                 if (!state.IsInvalid(nDoS) || nDoS == 0) {
                     LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
-                    RelayTransaction(tx, connman);
+                    RelayTransaction(tx);
                 } else {
                     LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
                 }
@@ -2399,6 +2837,12 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
+        // Hash the headers before taking cs_main, so other peers' messages aren't held up by it
+        std::vector<uint256> vHashes;
+        vHashes.reserve(nCount);
+        for (const CBlockHeader& header : headers)
+            vHashes.push_back(header.GetHash());
+
         const CBlockIndex *pindexLast = nullptr;
         {
         LOCK(cs_main);
@@ -2423,7 +2867,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             // Set hashLastUnknownBlock for this peer, so that if we
             // eventually get the headers - even from a different peer -
             // we can use this peer to download.
-            UpdateBlockAvailability(pfrom->GetId(), headers.back().GetHash());
+            UpdateBlockAvailability(pfrom->GetId(), vHashes.back());
 
             if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
                 Misbehaving(pfrom->GetId(), 20);
@@ -2431,18 +2875,16 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        uint256 hashLastBlock;
-        for (const CBlockHeader& header : headers) {
-            if (!hashLastBlock.IsNull() && header.hashPrevBlock != hashLastBlock) {
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != vHashes[n - 1]) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            hashLastBlock = header.GetHash();
         }
         }
 
         CValidationState state;
-        if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast)) {
+        if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &vHashes)) {
             int nDoS;
             if (state.IsInvalid(nDoS)) {
                 if (nDoS > 0) {
@@ -2576,6 +3018,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            UpdateBlockDownloadSpeed(pfrom->GetId(), hash, pfrom->nMinPingUsecTime);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2612,7 +3055,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -2850,12 +3296,23 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
 
+    if (!pfrom->setOrphanWork.empty()) {
+        std::list<CTransactionRef> lRemovedTxn;
+        LOCK(cs_main);
+        ProcessOrphanWork(pfrom->setOrphanWork, MAX_ORPHAN_WORK_PER_CALL, lRemovedTxn);
+        for (const CTransactionRef& removedTx : lRemovedTxn)
+            AddToCompactExtraTransactions(removedTx);
+    }
+
     if (pfrom->fDisconnect)
         return false;
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return true;
 
+    // The peer's orphans are resolved before its next message
+    if (!pfrom->setOrphanWork.empty()) return true;
+
     // Don't bother if send buffer is too full to respond anyway
     if (pfrom->fPauseSend)
         return false;
@@ -2906,6 +3363,9 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     }
 
     // Process message
+    int64_t nProcessStart = GetTimeMicros();
+    int64_t nLockWaitStart = GetThreadLockWaitMicros();
+    int64_t nHashStart = GetThreadBlockHashMicros();
     bool fRet = false;
     try
     {
@@ -2944,6 +3404,9 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         PrintExceptionContinue(nullptr, "ProcessMessages()");
     }
 
+    connman->RecordMessageTiming(pfrom, strCommand, GetTimeMicros() - nProcessStart, nProcessStart - msg.nTime,
+        GetThreadLockWaitMicros() - nLockWaitStart, GetThreadBlockHashMicros() - nHashStart);
+
     if (!fRet) {
         LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->GetId());
     }
@@ -3083,28 +3546,30 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
-            std::vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            for (const CAddress& addr : pto->vAddrToSend)
+            std::vector<std::vector<CAddress> > vAddrMessages(1);
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                // Other peers' message processing may be pushing addresses meanwhile
+                LOCK(pto->cs_addrSend);
+                for (const CAddress& addr : pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        // receiver rejects addr messages larger than 1000
+                        if (vAddrMessages.back().size() >= 1000)
+                            vAddrMessages.emplace_back();
+                        vAddrMessages.back().push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+                // we only send the big addr message once
+                if (pto->vAddrToSend.capacity() > 40)
+                    pto->vAddrToSend.shrink_to_fit();
+            }
+            for (const std::vector<CAddress>& vAddr : vAddrMessages) {
+                if (!vAddr.empty())
+                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                connman->PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
         }
 
         //
@@ -3247,7 +3712,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
                             if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                                connman->PushMessage(pto, most_recent_compact_block_msg);
                             else {
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
                                 connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
@@ -3333,10 +3798,18 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
             }
 
+            // Start announcing from the queue now that the handshake is done
+            if (state.nTxAnnounceCursor == TX_ANNOUNCE_CURSOR_NONE)
+                state.nTxAnnounceCursor = nTxAnnounceBase + queueTxAnnounce.size();
+
             // Time to send but the peer has requested we not relay transactions.
             if (fSendTrickle) {
+                SealTxAnnouncements();
                 LOCK(pto->cs_filter);
-                if (!pto->fRelayTxes) pto->setInventoryTxToSend.clear();
+                if (!pto->fRelayTxes) {
+                    pto->setInventoryTxToSend.clear();
+                    state.nTxAnnounceCursor = nTxAnnounceBase + queueTxAnnounce.size();
+                }
             }
 
             // Respond to BIP35 mempool requests
@@ -3374,46 +3847,20 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                std::vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
-                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
-                // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
                 LOCK(pto->cs_filter);
-                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                    // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
-                    uint256 hash = *it;
-                    // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
-                    // Check if not in the filter already
-                    if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
-                    }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
-                    }
-                    if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
-                        continue;
+                auto announce = [&](const uint256& hash, CTransactionRef tx, CAmount nFeePerK) {
+                    if (filterrate && nFeePerK < filterrate) {
+                        return;
                     }
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*tx)) return;
                     // Send
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
@@ -3425,7 +3872,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(tx)));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -3435,6 +3882,67 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         vInv.clear();
                     }
                     pto->filterInventoryKnown.insert(hash);
+                };
+
+                // Transactions pushed to this peer only, such as wallet rebroadcasts, go first.
+                // Topologically and fee-rate sort them for privacy and priority reasons.
+                // A heap is used so that not all items need sorting if only a few are being sent.
+                std::vector<std::set<uint256>::iterator> vInvTx;
+                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
+                    vInvTx.push_back(it);
+                }
+                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
+                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                while (!vInvTx.empty() && nRelayedTransactions < (unsigned int)state.nTxAnnounceMax) {
+                    // Fetch the top element from the heap
+                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                    std::set<uint256>::iterator it = vInvTx.back();
+                    vInvTx.pop_back();
+                    uint256 hash = *it;
+                    // Remove it from the to-be-sent set
+                    pto->setInventoryTxToSend.erase(it);
+                    // Check if not in the filter already
+                    if (pto->filterInventoryKnown.contains(hash)) {
+                        continue;
+                    }
+                    // Not in the mempool anymore? don't bother sending it.
+                    auto txinfo = mempool.info(hash);
+                    if (!txinfo.tx) {
+                        continue;
+                    }
+                    announce(hash, std::move(txinfo.tx), txinfo.feeRate.GetFeePerK());
+                }
+
+                // Then relayed transactions, from where this peer left off in the shared queue,
+                // which is sorted already.
+                const uint64_t nTxAnnounceEnd = nTxAnnounceBase + queueTxAnnounce.size();
+                state.nTxAnnounceCursor = std::max(state.nTxAnnounceCursor, nTxAnnounceBase);
+                while (state.nTxAnnounceCursor < nTxAnnounceEnd && nRelayedTransactions < (unsigned int)state.nTxAnnounceMax) {
+                    const TxAnnouncement& announcement = queueTxAnnounce[state.nTxAnnounceCursor++ - nTxAnnounceBase];
+                    if (pto->filterInventoryKnown.contains(announcement.hash)) {
+                        continue;
+                    }
+                    if (filterrate && announcement.nFeePerK < filterrate) {
+                        continue;
+                    }
+                    // Not in the mempool anymore? don't bother sending it.
+                    auto txinfo = mempool.info(announcement.hash);
+                    if (!txinfo.tx) {
+                        continue;
+                    }
+                    announce(announcement.hash, std::move(txinfo.tx), announcement.nFeePerK);
+                }
+
+                // Drain a backlog faster while the peer takes what we send, and back off
+                // while its send buffer is full, as it can't keep up with us.
+                bool fBacklog = state.nTxAnnounceCursor < nTxAnnounceEnd || !pto->setInventoryTxToSend.empty();
+                if (pto->fPauseSend) {
+                    state.nTxAnnounceMax = std::max<int>(INVENTORY_BROADCAST_MIN, state.nTxAnnounceMax / 2);
+                } else if (fBacklog) {
+                    state.nTxAnnounceMax = std::min<int>(INVENTORY_BROADCAST_MAX_BURST, state.nTxAnnounceMax * 2);
+                } else {
+                    state.nTxAnnounceMax = std::max<int>(INVENTORY_BROADCAST_MAX, state.nTxAnnounceMax / 2);
                 }
             }
         }
@@ -3506,13 +4014,24 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlocksInFlightMax) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightMax - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
+                std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(pindex->GetBlockHash());
+                if (itInFlight != mapBlocksInFlight.end()) {
+                    // Taken over from a slower peer, which gets fewer blocks from now on
+                    CNodeState *stateSlow = State(itInFlight->second.first);
+                    stateSlow->nBlocksInFlightMax = std::max(stateSlow->nBlocksInFlightMax / 2, MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+                    LogPrint(BCLog::NET, "Requesting block %s (%d) peer=%d, it is late from peer=%d\n", pindex->GetBlockHash().ToString(),
+                        pindex->nHeight, pto->GetId(), itInFlight->second.first);
+                    MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
+                    mapBlocksInFlight[pindex->GetBlockHash()].second->fRerequested = true;
+                    continue;
+                }
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
                 LogPrint(BCLog::NET, "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->GetId());
@@ -3576,6 +4095,8 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 pto->nextSendTimeFeeFilter = timeNow + GetRandInt(MAX_FEEFILTER_CHANGE_DELAY) * 1000000;
             }
         }
+
+        ProcessOrphanWorkFromBlocks();
     }
     return true;
 }
@@ -10,14 +10,22 @@
 #include "net.h"
 #include "validationinterface.h"
 
+enum class MemPoolRemovalReason;
+
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
-static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 5000;
+/** Default for -maxorphansize, maximum memory used by orphan transactions in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_SIZE = 20;
+/** Share of the orphan pool, in percent of both limits, a single peer may fill */
+static const unsigned int MAX_ORPHAN_TX_PEER_PERCENT = 25;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
-/** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
-static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default number of orphan, recently replaced and recently evicted txn to keep around for block reconstruction */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 1000;
+/** Default for -blockreconstructionextratxnsize, maximum memory used by those transactions in megabytes */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN_SIZE = 5;
 /** Headers download timeout expressed in microseconds
  *  Timeout = base + per_header * (expected number of headers) */
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
@@ -35,6 +43,7 @@ private:
 
 public:
     explicit PeerLogicValidation(CConnman* connman);
+    ~PeerLogicValidation();
 
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexConnected, const std::vector<CTransactionRef>& vtxConflicted) override;
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
@@ -56,6 +65,8 @@ public:
     bool SendMessages(CNode* pto, std::atomic<bool>& interrupt) override;
 
     void ConsiderEviction(CNode *pto, int64_t time_in_seconds);
+    /** Keep transactions evicted from the mempool for compact block reconstruction, they may still be mined */
+    void TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason);
 };
 
 struct CNodeStateStats {
@@ -63,8 +74,25 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightMax;
+    int64_t nBlockLatency;
+    int64_t nBlockRoundTrip;
+    int64_t nBlockInterval;
+    int nTxAnnounceMax;
+    uint64_t nTxAnnounceBacklog;
 };
 
+/** Write the orphan pool to disk, next to the mempool */
+bool DumpOrphans();
+/** Load the orphan pool from disk, accepting the orphans whose parents arrived in the meantime */
+bool LoadOrphans();
+
+/** Number of blocks to keep in flight from a peer with the given round trip time and interval between blocks, in microseconds */
+int GetBlocksInFlightMax(int64_t nRoundTrip, int64_t nBlockInterval);
+/** Whether a block requested nElapsed microseconds ago from a peer with average block latency nLatencyOther
+ *  should be requested from a peer expected to deliver it in nExpected instead */
+bool IsBlockTakeoverDue(int64_t nElapsed, int64_t nLatencyOther, int64_t nExpected);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -11,9 +11,31 @@
 #include "utilstrencodings.h"
 #include "crypto/common.h"
 
+#include <atomic>
+#include <chrono>
+
+static std::atomic<bool> fBlockHashTiming(false);
+static thread_local int64_t nThreadHashNanos = 0;
+
 uint256 CBlockHeader::GetHash() const
 {
-    return HashX16R(BEGIN(nVersion), END(nNonce), hashPrevBlock);
+    if (!fBlockHashTiming.load(std::memory_order_relaxed))
+        return HashX16R(BEGIN(nVersion), END(nNonce), hashPrevBlock);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint256 hash = HashX16R(BEGIN(nVersion), END(nNonce), hashPrevBlock);
+    nThreadHashNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return hash;
+}
+
+void SetBlockHashTiming(bool fEnable)
+{
+    fBlockHashTiming = fEnable;
+}
+
+int64_t GetThreadBlockHashMicros()
+{
+    return nThreadHashNanos / 1000;
 }
 
 std::string CBlock::ToString() const
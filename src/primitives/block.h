@@ -158,4 +158,9 @@ struct CBlockLocator
     }
 };
 
+/** Have CBlockHeader::GetHash() time itself, it costs two clock reads per hash so it is only on with -metrics */
+void SetBlockHashTiming(bool fEnable);
+/** Time the calling thread spent hashing block headers so far, in microseconds, while hash timing was on */
+int64_t GetThreadBlockHashMicros();
+
 #endif // RAVEN_PRIMITIVES_BLOCK_H
@@ -4,6 +4,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
+#include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "core_io.h"
@@ -15,15 +17,22 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
+#include "assets/assets.h"
+#include "assets/assetdb.h"
 
 #include <boost/algorithm/string.hpp>
 
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t REST_CHUNK_SIZE = 64 * 1024; //bytes of a streamed list that are buffered before they are sent
+static const size_t REST_STREAM_HIGH_WATER = 16 * REST_CHUNK_SIZE; //bytes of a streamed list waiting to be sent before reading more of it stops
+static const size_t REST_ASSET_HOLDERS_PAGE = 1000; //holders read from the asset database at a time
+static const size_t REST_ADDRESS_DELTAS_PAGE = 1000; //entries read from the address index at a time
 
 enum RetFormat {
     RF_UNDEF,
@@ -122,6 +131,98 @@ static bool CheckWarmup(HTTPRequest* req)
     return true;
 }
 
+/**
+ * Sends a list as a chunked reply while it is being read, so large lists are
+ * never built in memory as a whole. The binary and hex formats are the
+ * serialized records one after the other, the json format is an array.
+ * Adding records waits while the client is slower than the list is read.
+ */
+class RESTListStream
+{
+private:
+    HTTPRequest* req;
+    const RetFormat rf;
+    std::string strBuffer;
+    bool fEmpty;
+    bool fClosed;
+
+    bool Flush()
+    {
+        if (strBuffer.size() < REST_CHUNK_SIZE)
+            return true;
+
+        if (!req->WaitReplyChunks(REST_STREAM_HIGH_WATER)) {
+            fClosed = true;
+            strBuffer.clear();
+            return false;
+        }
+        req->WriteReplyChunk(strBuffer);
+        strBuffer.clear();
+        return true;
+    }
+
+public:
+    RESTListStream(HTTPRequest* reqIn, const RetFormat rfIn) : req(reqIn), rf(rfIn), fEmpty(true), fClosed(false)
+    {
+        switch (rf) {
+        case RF_BINARY:
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            break;
+        case RF_HEX:
+            req->WriteHeader("Content-Type", "text/plain");
+            break;
+        default:
+            req->WriteHeader("Content-Type", "application/json");
+            strBuffer = "[";
+            break;
+        }
+        req->StartChunkedReply(HTTP_OK);
+    }
+
+    bool IsJSON() const { return rf == RF_JSON; }
+
+    //! Returns false once the client went away, stop reading the list then and call End
+    template <typename T>
+    bool AddRecord(const T& record)
+    {
+        if (fClosed)
+            return false;
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << record;
+        if (rf == RF_HEX)
+            strBuffer += HexStr(ss.begin(), ss.end());
+        else
+            strBuffer.append(ss.begin(), ss.end());
+        return Flush();
+    }
+
+    bool AddJSON(const UniValue& entry)
+    {
+        if (fClosed)
+            return false;
+
+        if (!fEmpty)
+            strBuffer += ",";
+        strBuffer += entry.write();
+        fEmpty = false;
+        return Flush();
+    }
+
+    void End()
+    {
+        if (!fClosed) {
+            if (rf == RF_JSON)
+                strBuffer += "]\n";
+            else if (rf == RF_HEX)
+                strBuffer += "\n";
+            req->WriteReplyChunk(strBuffer);
+            strBuffer.clear();
+        }
+        req->EndChunkedReply();
+    }
+};
+
 static bool rest_headers(HTTPRequest* req,
                          const std::string& strURIPart)
 {
@@ -206,7 +307,11 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // The binary and hex formats are the block as it is stored, unless witness data has to be stripped
+    const bool fRawBlock = (rf == RF_BINARY || rf == RF_HEX) && RPCSerializationFlags() == 0;
+
     CBlock block;
+    std::vector<unsigned char> vchBlock;
     CBlockIndex* pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -217,23 +322,30 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        if (fRawBlock) {
+            if (!ReadRawBlockFromDisk(vchBlock, pblockindex, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else {
+            if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        }
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    if (!fRawBlock && (rf == RF_BINARY || rf == RF_HEX)) {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssBlock << block;
+        vchBlock.assign(ssBlock.begin(), ssBlock.end());
+    }
 
     switch (rf) {
     case RF_BINARY: {
-        std::string binaryBlock = ssBlock.str();
         req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryBlock);
+        req->WriteReply(HTTP_OK, vchBlock);
         return true;
     }
 
     case RF_HEX: {
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex = HexStr(vchBlock.begin(), vchBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -564,6 +676,258 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     }
 }
 
+/** RVN START */
+static bool rest_asset(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    const std::string assetName = urlDecode(param);
+
+    if (!AreAssetsDeployed())
+        return RESTERR(req, HTTP_NOT_FOUND, "Assets aren't active");
+
+    CNewAsset asset;
+    CAssetStats stats;
+    {
+        LOCK(cs_main);
+        if (!passets || !passets->GetAssetMetaDataIfExists(assetName, asset))
+            return RESTERR(req, HTTP_NOT_FOUND, assetName + " not found");
+
+        if (GetBestAssetStats(*passets, asset.strName))
+            stats = passets->mapAssetStats.at(asset.strName);
+    }
+
+    CDataStream ssAsset(SER_NETWORK, PROTOCOL_VERSION);
+    ssAsset << asset << stats;
+
+    switch (rf) {
+    case RF_BINARY: {
+        std::string binaryAsset = ssAsset.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryAsset);
+        return true;
+    }
+
+    case RF_HEX: {
+        std::string strHex = HexStr(ssAsset.begin(), ssAsset.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue objAsset(UniValue::VOBJ);
+        objAsset.pushKV("name", asset.strName);
+        objAsset.pushKV("amount", ValueFromAmount(asset.nAmount));
+        objAsset.pushKV("units", asset.units);
+        objAsset.pushKV("reissuable", asset.nReissuable);
+        objAsset.pushKV("has_ipfs", asset.nHasIPFS);
+        if (asset.nHasIPFS)
+            objAsset.pushKV("ipfs_hash", EncodeIPFS(asset.strIPFSHash));
+        objAsset.pushKV("holders", stats.nHolders);
+        objAsset.pushKV("circulating", ValueFromAmount(stats.nCirculating));
+        objAsset.pushKV("burned", ValueFromAmount(stats.nBurned));
+        objAsset.pushKV("last_activity_height", stats.nLastActivityHeight);
+        std::string strJSON = objAsset.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool rest_asset_holders(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    const std::string assetName = urlDecode(param);
+
+    if (rf == RF_UNDEF)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    if (!AreAssetsDeployed())
+        return RESTERR(req, HTTP_NOT_FOUND, "Assets aren't active");
+
+    // The balances that changed since the last flush of the asset cache are merged into the balance
+    // index. Both are captured together, then the holders are read without holding cs_main.
+    std::map<std::string, CAmount> mapUnflushed;
+    std::unique_ptr<CDBIterator> pcursor;
+    {
+        LOCK(cs_main);
+        if (!passets || !passetsdb || !passets->CheckIfAssetExists(assetName))
+            return RESTERR(req, HTTP_NOT_FOUND, assetName + " not found");
+
+        GetUnflushedAssetBalances(*passets, assetName, mapUnflushed);
+        pcursor.reset(passetsdb->NewSnapshotIterator());
+    }
+
+    RESTListStream stream(req, rf);
+    CAssetHoldersReader reader(*pcursor, assetName, mapUnflushed);
+    std::vector<std::pair<std::string, CAmount> > holders;
+    bool fMore = true;
+    while (fMore) {
+        holders.clear();
+        fMore = reader.Next(holders, REST_ASSET_HOLDERS_PAGE);
+
+        std::vector<UniValue> entries;
+        if (stream.IsJSON()) {
+            try {
+                LOCK(cs_main);
+                for (const auto& holder : holders) {
+                    UniValue entry(UniValue::VOBJ);
+                    entry.pushKV("address", holder.first);
+                    entry.pushKV("balance", UnitValueFromAmount(holder.second, assetName));
+                    entries.push_back(entry);
+                }
+            } catch (const UniValue& objError) {
+                // The asset went away with a reorg, the reply was started already so it is cut short
+                LogPrintf("%s: %s\n", __func__, find_value(objError, "message").get_str());
+                break;
+            }
+        }
+
+        bool fSent = true;
+        for (size_t i = 0; i < holders.size() && fSent; i++)
+            fSent = stream.IsJSON() ? stream.AddJSON(entries[i]) : stream.AddRecord(holders[i]);
+        if (!fSent)
+            break;
+    }
+    stream.End();
+
+    return true;
+}
+
+static bool rest_address_assets(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string address;
+    const RetFormat rf = ParseDataFormat(address, strURIPart);
+
+    if (rf == RF_UNDEF)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    if (!AreAssetsDeployed())
+        return RESTERR(req, HTTP_NOT_FOUND, "Assets aren't active");
+
+    if (!IsValidDestination(DecodeDestination(address)))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + address);
+
+    std::vector<std::pair<std::string, CAmount> > balances;
+    std::vector<UniValue> entries;
+    {
+        LOCK(cs_main);
+        if (!passets)
+            return RESTERR(req, HTTP_NOT_FOUND, "Asset cache isn't available");
+
+        for (const auto& assetAddresses : passets->mapAssetsAddresses) {
+            if (assetAddresses.second.count(address) && GetBestAssetAddressAmount(*passets, assetAddresses.first, address))
+                balances.emplace_back(assetAddresses.first, passets->mapAssetsAddressAmount.at(std::make_pair(assetAddresses.first, address)));
+        }
+
+        if (rf == RF_JSON) {
+            try {
+                for (const auto& balance : balances) {
+                    UniValue entry(UniValue::VOBJ);
+                    entry.pushKV("name", balance.first);
+                    entry.pushKV("balance", UnitValueFromAmount(balance.second, balance.first));
+                    entries.push_back(entry);
+                }
+            } catch (const UniValue& objError) {
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, find_value(objError, "message").get_str());
+            }
+        }
+    }
+
+    RESTListStream stream(req, rf);
+    for (size_t i = 0; i < balances.size(); i++) {
+        if (!(stream.IsJSON() ? stream.AddJSON(entries[i]) : stream.AddRecord(balances[i])))
+            break;
+    }
+    stream.End();
+
+    return true;
+}
+
+static bool rest_address_deltas(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    if (rf == RF_UNDEF)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    if (!fAddressIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Address index is not enabled");
+
+    // <asset>/<address>[/<start>/<end>], sub asset names have their '/' url encoded
+    std::vector<std::string> uriParts;
+    boost::split(uriParts, param, boost::is_any_of("/"));
+    if (uriParts.size() != 2 && uriParts.size() != 4)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Expected <asset>/<address>[/<start>/<end>]");
+
+    const std::string assetName = urlDecode(uriParts[0]);
+    const std::string& address = uriParts[1];
+
+    if (assetName != RVN && !AreAssetsDeployed())
+        return RESTERR(req, HTTP_NOT_FOUND, "Assets aren't active");
+
+    uint160 hashBytes;
+    int type = 0;
+    if (!CRavenAddress(address).GetIndexKey(hashBytes, type))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + address);
+
+    int start = 0;
+    int end = 0;
+    if (uriParts.size() == 4) {
+        if (!ParseInt32(uriParts[2], &start) || !ParseInt32(uriParts[3], &end) || start <= 0 || end < start)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid block range: " + uriParts[2] + "/" + uriParts[3]);
+    }
+
+    // Read from a snapshot a page at a time, so the deltas of a busy address are never all in memory
+    std::unique_ptr<CDBIterator> pcursor(pblocktree->NewSnapshotIterator());
+    CAddressIndexReader reader(*pcursor, hashBytes, type, assetName, start, end);
+
+    RESTListStream stream(req, rf);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    bool fMore = true;
+    bool fSent = true;
+    while (fMore && fSent) {
+        addressIndex.clear();
+        fMore = reader.Next(addressIndex, REST_ADDRESS_DELTAS_PAGE);
+        for (size_t i = 0; i < addressIndex.size() && fSent; i++) {
+            const auto& delta = addressIndex[i];
+            if (stream.IsJSON()) {
+                UniValue entry(UniValue::VOBJ);
+                entry.pushKV("assetName", delta.first.asset);
+                entry.pushKV("satoshis", delta.second);
+                entry.pushKV("txid", delta.first.txhash.GetHex());
+                entry.pushKV("index", (int)delta.first.index);
+                entry.pushKV("blockindex", (int)delta.first.txindex);
+                entry.pushKV("height", delta.first.blockHeight);
+                entry.pushKV("address", address);
+                fSent = stream.AddJSON(entry);
+            } else {
+                fSent = stream.AddRecord(delta);
+            }
+        }
+    }
+    stream.End();
+
+    return true;
+}
+/** RVN END */
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -576,6 +940,10 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/asset/", rest_asset},
+      {"/rest/assetholders/", rest_asset_holders},
+      {"/rest/addressassets/", rest_address_assets},
+      {"/rest/addressdeltas/", rest_address_deltas},
 };
 
 bool StartREST()
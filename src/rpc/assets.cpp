@@ -6,6 +6,7 @@
 //#include <base58.h>
 #include "assets/assets.h"
 #include "assets/assetdb.h"
+#include "assets/assetsnapshot.h"
 #include <map>
 #include "tinyformat.h"
 //#include <rpc/server.h>
@@ -441,6 +442,10 @@ UniValue getassetdata(const JSONRPCRequest& request)
                 "  reissuable: (number),\n"
                 "  has_ipfs: (number),\n"
                 "  ipfs_hash: (hash) (only if has_ipfs = 1)\n"
+                "  holders: (number) number of addresses holding a non zero balance\n"
+                "  circulating: (number) sum of all address balances\n"
+                "  burned: (number) RVN burned by the issue and reissue transactions of the asset\n"
+                "  last_activity_height: (number) height of the last block that created an output of the asset\n"
                 "}\n"
 
                 "\nExamples:\n"
@@ -466,6 +471,14 @@ UniValue getassetdata(const JSONRPCRequest& request)
         if (asset.nHasIPFS)
             result.push_back(Pair("ipfs_hash", EncodeIPFS(asset.strIPFSHash)));
 
+        if (GetBestAssetStats(*passets, asset.strName)) {
+            const CAssetStats& stats = passets->mapAssetStats.at(asset.strName);
+            result.push_back(Pair("holders", stats.nHolders));
+            result.push_back(Pair("circulating", UnitValueFromAmount(stats.nCirculating, asset.strName)));
+            result.push_back(Pair("burned", ValueFromAmount(stats.nBurned)));
+            result.push_back(Pair("last_activity_height", stats.nLastActivityHeight));
+        }
+
         return result;
     }
 
@@ -693,7 +706,7 @@ UniValue listaddressesbyasset(const JSONRPCRequest &request)
 
     UniValue addresses(UniValue::VOBJ);
 
-    auto setAddresses = passets->mapAssetsAddresses.at(asset_name);
+    const auto& setAddresses = passets->mapAssetsAddresses.at(asset_name);
     for (auto it : setAddresses) {
         auto pair = std::make_pair(asset_name, it);
 
@@ -704,6 +717,299 @@ UniValue listaddressesbyasset(const JSONRPCRequest &request)
     return addresses;
 }
 
+UniValue listassetholders(const JSONRPCRequest &request)
+{
+    if (request.fHelp || !AreAssetsDeployed() || request.params.size() < 1 || request.params.size() > 5)
+        throw std::runtime_error(
+                "listassetholders \"asset_name\" ( count ) ( start ) ( min_amount ) ( max_amount )\n"
+                + AssetActivationWarning() +
+                "\nReturns the addresses that hold the given asset, ordered from the largest balance to the smallest\n"
+
+                "\nArguments:\n"
+                "1. \"asset_name\"               (string, required) name of asset\n"
+                "2. \"count\"                    (integer, optional, default=ALL) truncates results to include only the first _count_ holders\n"
+                "3. \"start\"                    (integer, optional, default=0) results skip over the first _start_ holders\n"
+                "4. \"min_amount\"               (numeric, optional, default=0) only include holders with at least this balance\n"
+                "5. \"max_amount\"               (numeric, optional, default=MAX) only include holders with at most this balance\n"
+
+                "\nResult:\n"
+                "[\n"
+                "  {\n"
+                "    \"address\": (string),\n"
+                "    \"balance\": (number)\n"
+                "  },\n"
+                "  ...\n"
+                "]\n"
+
+                "\nExamples:\n"
+                + HelpExampleCli("listassetholders", "\"ASSET_NAME\" 100")
+                + HelpExampleCli("listassetholders", "\"ASSET_NAME\" 100 100 10 1000")
+                + HelpExampleRpc("listassetholders", "\"ASSET_NAME\", 100")
+        );
+
+    ObserveSafeMode();
+
+    std::string asset_name = request.params[0].get_str();
+
+    if (!passetsdb)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "asset db unavailable.");
+
+    size_t count = INT_MAX;
+    if (request.params.size() > 1) {
+        if (request.params[1].get_int() < 1)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "count must be greater than 1.");
+        count = request.params[1].get_int();
+    }
+
+    size_t start = 0;
+    if (request.params.size() > 2) {
+        if (request.params[2].get_int() < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "start must not be negative.");
+        start = request.params[2].get_int();
+    }
+
+    CAmount nMinAmount = 0;
+    if (request.params.size() > 3)
+        nMinAmount = AmountFromValue(request.params[3]);
+
+    CAmount nMaxAmount = std::numeric_limits<CAmount>::max();
+    if (request.params.size() > 4)
+        nMaxAmount = AmountFromValue(request.params[4]);
+
+    // The database only has the balances as of the last flush, the ones that changed since are in the cache.
+    // Both are captured together, then the balance index is walked on a database snapshot without cs_main.
+    std::map<std::string, CAmount> mapUnflushed;
+    std::unique_ptr<CDBIterator> pcursor;
+    {
+        LOCK(cs_main);
+        if (passets)
+            GetUnflushedAssetBalances(*passets, asset_name, mapUnflushed);
+        pcursor.reset(passetsdb->NewSnapshotIterator());
+    }
+
+    std::vector<std::pair<std::string, CAmount> > holders;
+    CAssetHoldersReader reader(*pcursor, asset_name, mapUnflushed, nMinAmount, nMaxAmount);
+    reader.Next(holders, count, start);
+
+    LOCK(cs_main);
+    UniValue result(UniValue::VARR);
+    for (auto const& holder : holders) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", holder.first));
+        entry.push_back(Pair("balance", UnitValueFromAmount(holder.second, asset_name)));
+        result.push_back(entry);
+    }
+
+    return result;
+}
+
+UniValue requestsnapshot(const JSONRPCRequest& request)
+{
+    if (request.fHelp || !AreAssetsDeployed() || request.params.size() != 2)
+        throw std::runtime_error(
+                "requestsnapshot \"asset_name\" block_height\n"
+                + AssetActivationWarning() +
+                "\nRequests a snapshot of the holders of an asset, taken when the block at the given height is connected\n"
+
+                "\nArguments:\n"
+                "1. \"asset_name\"               (string, required) name of asset\n"
+                "2. \"block_height\"             (number, required) height of the block, must be above the current height\n"
+
+                "\nResult:\n"
+                "{\n"
+                "  \"asset_name\": (string),\n"
+                "  \"block_height\": (number)\n"
+                "}\n"
+
+                "\nExamples:\n"
+                + HelpExampleCli("requestsnapshot", "\"ASSET_NAME\" 50000")
+                + HelpExampleRpc("requestsnapshot", "\"ASSET_NAME\", 50000")
+        );
+
+    std::string asset_name = request.params[0].get_str();
+    int block_height = request.params[1].get_int();
+
+    if (!IsAssetNameValid(asset_name))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, std::string("Invalid asset name: ") + asset_name);
+
+    LOCK(cs_main);
+
+    std::string strError;
+    if (!AddAssetSnapshotRequest(asset_name, block_height, strError))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strError);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("asset_name", asset_name));
+    result.push_back(Pair("block_height", block_height));
+
+    return result;
+}
+
+UniValue cancelsnapshotrequest(const JSONRPCRequest& request)
+{
+    if (request.fHelp || !AreAssetsDeployed() || request.params.size() != 2)
+        throw std::runtime_error(
+                "cancelsnapshotrequest \"asset_name\" block_height\n"
+                + AssetActivationWarning() +
+                "\nCancels a snapshot request made with requestsnapshot\n"
+
+                "\nArguments:\n"
+                "1. \"asset_name\"               (string, required) name of asset\n"
+                "2. \"block_height\"             (number, required) height of the block\n"
+
+                "\nResult:\n"
+                "true|false                      (boolean) true if the request was found and removed\n"
+
+                "\nExamples:\n"
+                + HelpExampleCli("cancelsnapshotrequest", "\"ASSET_NAME\" 50000")
+                + HelpExampleRpc("cancelsnapshotrequest", "\"ASSET_NAME\", 50000")
+        );
+
+    std::string asset_name = request.params[0].get_str();
+    int block_height = request.params[1].get_int();
+
+    LOCK(cs_main);
+
+    return RemoveAssetSnapshotRequest(asset_name, block_height);
+}
+
+UniValue listsnapshotrequests(const JSONRPCRequest& request)
+{
+    if (request.fHelp || !AreAssetsDeployed() || request.params.size() > 1)
+        throw std::runtime_error(
+                "listsnapshotrequests ( \"asset_name\" )\n"
+                + AssetActivationWarning() +
+                "\nLists the snapshot requests\n"
+
+                "\nArguments:\n"
+                "1. \"asset_name\"               (string, optional) only list the requests of this asset\n"
+
+                "\nResult:\n"
+                "[\n"
+                "  {\n"
+                "    \"asset_name\": (string),\n"
+                "    \"block_height\": (number),\n"
+                "    \"status\": (string) \"pending\", or \"failed\" if the block was connected while the snapshot couldn't be written\n"
+                "  },\n"
+                "  ...\n"
+                "]\n"
+
+                "\nExamples:\n"
+                + HelpExampleCli("listsnapshotrequests", "")
+                + HelpExampleCli("listsnapshotrequests", "\"ASSET_NAME\"")
+                + HelpExampleRpc("listsnapshotrequests", "\"ASSET_NAME\"")
+        );
+
+    std::string asset_name = "";
+    if (request.params.size() > 0)
+        asset_name = request.params[0].get_str();
+
+    std::set<std::pair<std::string, int> > setRequests;
+    std::set<std::pair<std::string, int> > setFailed;
+    {
+        LOCK(cs_main);
+        GetAssetSnapshotRequests(setRequests, setFailed);
+    }
+
+    UniValue result(UniValue::VARR);
+    for (auto const& snapshotRequest : setRequests) {
+        if (!asset_name.empty() && snapshotRequest.first != asset_name)
+            continue;
+
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("asset_name", snapshotRequest.first));
+        entry.push_back(Pair("block_height", snapshotRequest.second));
+        entry.push_back(Pair("status", setFailed.count(snapshotRequest) ? "failed" : "pending"));
+        result.push_back(entry);
+    }
+
+    return result;
+}
+
+UniValue getsnapshot(const JSONRPCRequest& request)
+{
+    if (request.fHelp || !AreAssetsDeployed() || request.params.size() < 2 || request.params.size() > 4)
+        throw std::runtime_error(
+                "getsnapshot \"asset_name\" block_height ( count ) ( start )\n"
+                + AssetActivationWarning() +
+                "\nReturns a snapshot of the holders of an asset that was taken because of requestsnapshot\n"
+
+                "\nArguments:\n"
+                "1. \"asset_name\"               (string, required) name of asset\n"
+                "2. \"block_height\"             (number, required) height of the block the snapshot was taken at\n"
+                "3. \"count\"                    (integer, optional, default=ALL) truncates results to include only the first _count_ holders\n"
+                "4. \"start\"                    (integer, optional, default=0) results skip over the first _start_ holders\n"
+
+                "\nResult:\n"
+                "{\n"
+                "  \"asset_name\": (string),\n"
+                "  \"block_height\": (number),\n"
+                "  \"block_hash\": (string),\n"
+                "  \"in_active_chain\": (boolean) false if the block was reorganized out of the active chain,\n"
+                "  \"total_holders\": (number),\n"
+                "  \"holders\": [\n"
+                "    {\n"
+                "      \"address\": (string),\n"
+                "      \"balance\": (number)\n"
+                "    },\n"
+                "    ...\n"
+                "  ]\n"
+                "}\n"
+
+                "\nExamples:\n"
+                + HelpExampleCli("getsnapshot", "\"ASSET_NAME\" 50000")
+                + HelpExampleCli("getsnapshot", "\"ASSET_NAME\" 50000 100 100")
+                + HelpExampleRpc("getsnapshot", "\"ASSET_NAME\", 50000")
+        );
+
+    std::string asset_name = request.params[0].get_str();
+    int block_height = request.params[1].get_int();
+
+    size_t count = INT_MAX;
+    if (request.params.size() > 2) {
+        if (request.params[2].get_int() < 1)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "count must be greater than 1.");
+        count = request.params[2].get_int();
+    }
+
+    size_t start = 0;
+    if (request.params.size() > 3) {
+        if (request.params[3].get_int() < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "start must not be negative.");
+        start = request.params[3].get_int();
+    }
+
+    CAssetSnapshot snapshot;
+    size_t nTotalHolders;
+    if (!ReadAssetSnapshot(asset_name, block_height, snapshot, nTotalHolders, count, start))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No snapshot was taken of this asset at this height.");
+
+    bool fInActiveChain = false;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex = chainActive[block_height];
+        fInActiveChain = pindex && pindex->GetBlockHash() == snapshot.blockHash;
+    }
+
+    UniValue holders(UniValue::VARR);
+    for (auto const& holder : snapshot.vHolders) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", holder.first));
+        entry.push_back(Pair("balance", UnitValueFromAmount(holder.second, asset_name)));
+        holders.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("asset_name", snapshot.assetName));
+    result.push_back(Pair("block_height", snapshot.nHeight));
+    result.push_back(Pair("block_hash", snapshot.blockHash.GetHex()));
+    result.push_back(Pair("in_active_chain", fInActiveChain));
+    result.push_back(Pair("total_holders", (int64_t)nTotalHolders));
+    result.push_back(Pair("holders", holders));
+
+    return result;
+}
+
 UniValue transfer(const JSONRPCRequest& request)
 {
     if (request.fHelp || !AreAssetsDeployed() || request.params.size() != 3)
@@ -1026,6 +1332,11 @@ static const CRPCCommand commands[] =
     { "assets",   "getassetdata",               &getassetdata,               {"asset_name"}},
     { "assets",   "listmyassets",               &listmyassets,               {"asset", "verbose", "count", "start"}},
     { "assets",   "listaddressesbyasset",       &listaddressesbyasset,       {"asset_name"}},
+    { "assets",   "listassetholders",           &listassetholders,           {"asset_name", "count", "start", "min_amount", "max_amount"}},
+    { "assets",   "requestsnapshot",            &requestsnapshot,            {"asset_name", "block_height"}},
+    { "assets",   "cancelsnapshotrequest",      &cancelsnapshotrequest,      {"asset_name", "block_height"}},
+    { "assets",   "listsnapshotrequests",       &listsnapshotrequests,       {"asset_name"}},
+    { "assets",   "getsnapshot",                &getsnapshot,                {"asset_name", "block_height", "count", "start"}},
     { "assets",   "transfer",                   &transfer,                   {"asset_name", "qty", "to_address"}},
     { "assets",   "reissue",                    &reissue,                    {"asset_name", "qty", "to_address", "change_address", "reissuable", "new_unit", "new_ipfs"}},
     { "assets",   "listassets",                 &listassets,                 {"asset", "verbose", "count", "start"}},
@@ -12,6 +12,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinsprefetch.h"
 #include "consensus/validation.h"
 #include "validation.h"
 #include "core_io.h"
@@ -968,6 +969,15 @@ UniValue getblock(const JSONRPCRequest& request)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
+    if (verbosity <= 0 && RPCSerializationFlags() == 0)
+    {
+        // Hand out the block as it is stored, there is nothing to strip from it
+        std::vector<unsigned char> vchBlock;
+        if (!ReadRawBlockFromDisk(vchBlock, pblockindex, Params().MessageStart()))
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+        return HexStr(vchBlock.begin(), vchBlock.end());
+    }
+
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
@@ -1349,6 +1359,16 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "  \"automatic_pruning\": xx,  (boolean) whether automatic pruning is enabled (only present if pruning is enabled)\n"
             "  \"prune_target_size\": xxxxxx,  (numeric) the target size used by pruning (only present if automatic pruning is enabled)\n"
+            "  \"utxoprefetch\": {         (object) coins loaded ahead of connecting blocks (only present if -utxoprefetch is enabled)\n"
+            "     \"threads\": xx,          (numeric) number of prefetch threads\n"
+            "     \"queued\": xx,           (numeric) blocks waiting to have their coins loaded\n"
+            "     \"staged\": xx,           (numeric) coins loaded and not used yet\n"
+            "     \"prefetched\": xx,       (numeric) coins loaded since startup\n"
+            "     \"hits\": xx,             (numeric) coin lookups served from the loaded coins\n"
+            "     \"misses\": xx,           (numeric) coin lookups that read the database\n"
+            "     \"evicted\": xx,          (numeric) loaded coins evicted before they were used\n"
+            "     \"dropped\": xx           (numeric) blocks skipped because the queue was full\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1417,6 +1437,21 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
         }
     }
 
+    if (pcoinsprefetch) {
+        CCoinsPrefetchStats stats;
+        pcoinsprefetch->GetStats(stats);
+        UniValue prefetch(UniValue::VOBJ);
+        prefetch.push_back(Pair("threads",       stats.nThreads));
+        prefetch.push_back(Pair("queued",        (uint64_t)stats.nQueued));
+        prefetch.push_back(Pair("staged",        (uint64_t)stats.nStaged));
+        prefetch.push_back(Pair("prefetched",    stats.nPrefetched));
+        prefetch.push_back(Pair("hits",          stats.nHits));
+        prefetch.push_back(Pair("misses",        stats.nMisses));
+        prefetch.push_back(Pair("evicted",       stats.nEvicted));
+        prefetch.push_back(Pair("dropped",       stats.nDropped));
+        obj.push_back(Pair("utxoprefetch", prefetch));
+    }
+
     const Consensus::Params& consensusParams = Params().GetConsensus();
     //CBlockIndex* tip = chainActive.Tip();
 
@@ -45,6 +45,15 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listassets", 1, "verbose" },
     { "listassets", 2, "count" },
     { "listassets", 3, "start" },
+    { "listassetholders", 1, "count" },
+    { "listassetholders", 2, "start" },
+    { "listassetholders", 3, "min_amount" },
+    { "listassetholders", 4, "max_amount" },
+    { "requestsnapshot", 1, "block_height" },
+    { "cancelsnapshotrequest", 1, "block_height" },
+    { "getsnapshot", 1, "block_height" },
+    { "getsnapshot", 2, "count" },
+    { "getsnapshot", 3, "start" },
     { "setmocktime", 0, "timestamp" },
     { "generate", 0, "nblocks" },
     { "generate", 1, "maxtries" },
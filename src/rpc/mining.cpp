@@ -32,8 +32,6 @@
 
 #include <univalue.h>
 
-extern uint64_t nHashesPerSec;
-
 unsigned int ParseConfirmTarget(const UniValue& value)
 {
     int target = value.get_int();
@@ -203,7 +201,15 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"currentblocktx\": nnn,     (numeric) The last block transaction\n"
             "  \"difficulty\": xxx.xxxxx    (numeric) The current difficulty\n"
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
-            "  \"hashespersec\": nnn,       (numeric) The hashes per second of built-in miner\n"
+            "  \"hashespersec\": nnn,       (numeric) The hashes per second of built-in miner, summed over its threads\n"
+            "  \"threads\": [               (array) The built-in miner threads, empty when not generating\n"
+            "    {\n"
+            "      \"thread\": n,             (numeric) The thread number\n"
+            "      \"hashes\": nnn,           (numeric) The hashes done by this thread\n"
+            "      \"hashespersec\": nnn      (numeric) The hashes per second of this thread\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "  \"warnings\": \"...\"          (string) any network and blockchain warnings\n"
@@ -223,7 +229,20 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("currentblocktx",   (uint64_t)nLastBlockTx));
     obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
-    obj.push_back(Pair("hashespersec",     (uint64_t)nHashesPerSec));
+    std::vector<CMinerThreadInfo> vMinerInfo;
+    GetMinerThreadInfo(vMinerInfo);
+    double dHashesPerSec = 0;
+    UniValue threads(UniValue::VARR);
+    for (const CMinerThreadInfo& info : vMinerInfo) {
+        UniValue thread(UniValue::VOBJ);
+        thread.push_back(Pair("thread",        info.nThread));
+        thread.push_back(Pair("hashes",        info.nHashesDone));
+        thread.push_back(Pair("hashespersec",  (uint64_t)info.dHashesPerSec));
+        threads.push_back(thread);
+        dHashesPerSec += info.dHashesPerSec;
+    }
+    obj.push_back(Pair("hashespersec",     (uint64_t)dHashesPerSec));
+    obj.push_back(Pair("threads",          threads));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
     if (IsDeprecatedRPCEnabled("getmininginfo")) {
@@ -455,6 +474,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Raven is downloading blocks...");
 
     static unsigned int nTransactionsUpdatedLast;
+    static unsigned int nFeeSequenceLast;
 
     if (!lpval.isNull())
     {
@@ -484,7 +504,9 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
             checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
 
             boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+            // The background template also wakes us up when its fees grow enough to be worth switching to
+            unsigned int nFeeSequenceLP = GetBlockTemplateFeeSequence();
+            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && GetBlockTemplateFeeSequence() == nFeeSequenceLP && IsRPCRunning())
             {
                 if (!cvBlockChange.timed_wait(lock, checktxtime))
                 {
@@ -517,6 +539,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     static bool fLastTemplateSupportsSegwit = true;
     if (pindexPrev != chainActive.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
+        GetBlockTemplateFeeSequence() != nFeeSequenceLast ||
         fLastTemplateSupportsSegwit != fSupportsSegwit)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -527,10 +550,18 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         CBlockIndex* pindexPrevNew = chainActive.Tip();
         nStart = GetTime();
         fLastTemplateSupportsSegwit = fSupportsSegwit;
+        nFeeSequenceLast = GetBlockTemplateFeeSequence();
 
-        // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        // Use the template kept up to date in the background, only build one here if it isn't ready for this tip yet
+        unsigned int nTemplateTransactionsUpdated;
+        pblocktemplate = GetUpdatedBlockTemplate(pindexPrevNew, fSupportsSegwit, nTemplateTransactionsUpdated);
+        if (pblocktemplate) {
+            nTransactionsUpdatedLast = nTemplateTransactionsUpdated;
+        } else {
+            // Create new block
+            CScript scriptDummy = CScript() << OP_TRUE;
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        }
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -66,6 +66,27 @@ UniValue ping(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue MessageTimingToJSON(const CMessageTimingStats& timing, bool fHistograms)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", timing.nCount));
+    obj.push_back(Pair("process_us", timing.nProcessMicros));
+    obj.push_back(Pair("queue_us", timing.nQueueMicros));
+    obj.push_back(Pair("lockwait_us", timing.nLockWaitMicros));
+    obj.push_back(Pair("hash_us", timing.nHashMicros));
+    if (fHistograms) {
+        UniValue process(UniValue::VARR);
+        UniValue queue(UniValue::VARR);
+        for (int i = 0; i < MSG_TIMING_BUCKETS; i++) {
+            process.push_back(timing.vProcessBuckets[i]);
+            queue.push_back(timing.vQueueBuckets[i]);
+        }
+        obj.push_back(Pair("process_histogram", process));
+        obj.push_back(Pair("queue_histogram", queue));
+    }
+    return obj;
+}
+
 UniValue getpeerinfo(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -102,6 +123,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflight_max\": n,         (numeric) How many blocks we ask from this peer at once, adapted to its download speed\n"
+            "    \"block_latency\": n,        (numeric) Average time between asking the peer for a block and receiving it, in milliseconds\n"
+            "    \"block_rtt\": n,            (numeric) Average time to receive a block asked for while no other was in flight, in milliseconds\n"
+            "    \"block_interval\": n,       (numeric) Average time between blocks received from the peer while downloading, in milliseconds\n"
+            "    \"inv_tx_max\": n,           (numeric) How many transactions we announce to this peer at once, adapted to how fast it takes them\n"
+            "    \"inv_tx_backlog\": n,       (numeric) Relayed transactions not yet announced to this peer\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -110,6 +137,10 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"bytesrecv_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes received aggregated by message type\n"
             "       ...\n"
+            "    },\n"
+            "    \"timing_per_msg\": {\n"
+            "       \"addr\": {...},          (json object) Time spent on the messages of a type, see getmessagetimings\n"
+            "       ...\n"
             "    }\n"
             "  }\n"
             "  ,...\n"
@@ -168,6 +199,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflight_max", statestats.nBlocksInFlightMax));
+            obj.push_back(Pair("block_latency", statestats.nBlockLatency / 1000.0));
+            obj.push_back(Pair("block_rtt", statestats.nBlockRoundTrip / 1000.0));
+            obj.push_back(Pair("block_interval", statestats.nBlockInterval / 1000.0));
+            obj.push_back(Pair("inv_tx_max", statestats.nTxAnnounceMax));
+            obj.push_back(Pair("inv_tx_backlog", statestats.nTxAnnounceBacklog));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -185,6 +222,11 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
         }
         obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
 
+        UniValue timingPerMsgCmd(UniValue::VOBJ);
+        for (const mapMsgCmdTiming::value_type &i : stats.mapTimingPerMsgCmd)
+            timingPerMsgCmd.push_back(Pair(i.first, MessageTimingToJSON(i.second, false)));
+        obj.push_back(Pair("timing_per_msg", timingPerMsgCmd));
+
         ret.push_back(obj);
     }
 
@@ -393,6 +435,44 @@ UniValue getnettotals(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getmessagetimings(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getmessagetimings\n"
+            "\nReturns how long handling P2P messages took since startup, by message type and over all peers.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"type\": {                   (json object) A message type, \"*other*\" for unknown ones\n"
+            "    \"count\": n,               (numeric) Number of messages processed\n"
+            "    \"process_us\": n,          (numeric) Total time spent processing them, in microseconds\n"
+            "    \"queue_us\": n,            (numeric) Total time they waited between being received and processed\n"
+            "    \"lockwait_us\": n,         (numeric) Total time processing waited for contended locks, such as cs_main\n"
+            "    \"hash_us\": n,             (numeric) Total time processing spent hashing block headers. Only measured with -metrics\n"
+            "    \"process_histogram\": [    (json array) Messages by processing time. Element 0 counts those up to 1\n"
+            "       n,                      microsecond, element i those up to 2^i microseconds, the last one all longer ones\n"
+            "       ...\n"
+            "    ],\n"
+            "    \"queue_histogram\": [...]  (json array) Messages by time waited before processing, in the same buckets\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmessagetimings", "")
+            + HelpExampleRpc("getmessagetimings", "")
+       );
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    mapMsgCmdTiming mapTiming;
+    g_connman->GetMessageTimingStats(mapTiming);
+
+    UniValue obj(UniValue::VOBJ);
+    for (const mapMsgCmdTiming::value_type &i : mapTiming)
+        obj.push_back(Pair(i.first, MessageTimingToJSON(i.second, true)));
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -635,6 +715,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         {"address", "nodeid"} },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       {"node"} },
     { "network",            "getnettotals",           &getnettotals,           {} },
+    { "network",            "getmessagetimings",      &getmessagetimings,      {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         {} },
     { "network",            "setban",                 &setban,                 {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             {} },
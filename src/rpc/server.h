@@ -186,6 +186,8 @@ extern std::vector<unsigned char> ParseHexV(const UniValue& v, std::string strNa
 extern std::vector<unsigned char> ParseHexO(const UniValue& o, std::string strKey);
 
 extern CAmount AmountFromValue(const UniValue& value);
+//! The amount in the units of asset_name, the asset must exist. Requires cs_main.
+extern UniValue UnitValueFromAmount(const CAmount& amount, const std::string asset_name);
 extern std::string HelpExampleCli(const std::string& methodname, const std::string& args);
 extern std::string HelpExampleRpc(const std::string& methodname, const std::string& args);
 
@@ -139,6 +139,70 @@ private:
     size_t nPos;
 };
 
+/* Minimal stream for reading from a buffer the stream doesn't own, like a memory mapped file
+ *
+ * The buffer must stay valid for as long as the stream is used
+ */
+class CBufferReader
+{
+ public:
+
+/*
+ * @param[in]  nTypeIn Serialization Type
+ * @param[in]  nVersionIn Serialization Version (including any flags)
+ * @param[in]  dataIn  Referenced buffer to read from
+ * @param[in]  nSizeIn  Size of the buffer
+ * @param[in]  nPosIn Starting position. Index in the buffer where reads should start.
+*/
+    CBufferReader(int nTypeIn, int nVersionIn, const unsigned char* dataIn, size_t nSizeIn, size_t nPosIn) : nType(nTypeIn), nVersion(nVersionIn), data(dataIn), nSize(nSizeIn), nPos(nPosIn)
+    {
+        if (nPos > nSize)
+            throw std::ios_base::failure("CBufferReader(...): position past end of data");
+    }
+    void read(char* pch, size_t nRead)
+    {
+        if (nRead > nSize - nPos)
+            throw std::ios_base::failure("CBufferReader::read(): end of data");
+        memcpy(pch, data + nPos, nRead);
+        nPos += nRead;
+    }
+    void ignore(size_t nSkip)
+    {
+        if (nSkip > nSize - nPos)
+            throw std::ios_base::failure("CBufferReader::ignore(): end of data");
+        nPos += nSkip;
+    }
+    template<typename T>
+    CBufferReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const
+    {
+        return nVersion;
+    }
+    int GetType() const
+    {
+        return nType;
+    }
+    size_t size() const
+    {
+        return nSize - nPos;
+    }
+    bool empty() const
+    {
+        return nPos == nSize;
+    }
+private:
+    const int nType;
+    const int nVersion;
+    const unsigned char* data;
+    const size_t nSize;
+    size_t nPos;
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -242,6 +306,7 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    void swap(vector_type& vchOther)                 { vch.swap(vchOther); nReadPos = 0; }
     iterator insert(iterator it, const char& x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
     value_type* data()                               { return vch.data() + nReadPos; }
@@ -20,6 +20,18 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+static thread_local int64_t nThreadLockWaitMicros = 0;
+
+void AddLockWait(std::chrono::steady_clock::duration wait)
+{
+    nThreadLockWaitMicros += std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+}
+
+int64_t GetThreadLockWaitMicros()
+{
+    return nThreadLockWaitMicros;
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
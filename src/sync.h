@@ -9,6 +9,8 @@
 
 #include "threadsafety.h"
 
+#include <chrono>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/recursive_mutex.hpp>
@@ -107,6 +109,11 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Account time the calling thread waited for a contended lock */
+void AddLockWait(std::chrono::steady_clock::duration wait);
+/** Time the calling thread waited for contended locks so far, in microseconds */
+int64_t GetThreadLockWaitMicros();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -117,14 +124,15 @@ private:
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
-#ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            // Only contended locks are timed, so the uncontended path doesn't read the clock
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            AddLockWait(std::chrono::steady_clock::now() - start);
         }
-#endif
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
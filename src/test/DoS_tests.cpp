@@ -26,13 +26,17 @@ extern bool AddOrphanTx(const CTransactionRef &tx, NodeId peer);
 
 extern void EraseOrphansFor(NodeId peer);
 
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanUsage);
+
+extern void RelayTransaction(const CTransaction& tx);
 
 struct COrphanTx
 {
     CTransactionRef tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    uint64_t nSequence;
+    size_t nUsage;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
 
@@ -191,6 +195,90 @@ BOOST_FIXTURE_TEST_SUITE(DoS_tests, TestingSetup)
         peerLogic->FinalizeNode(dummyNode.GetId(), dummy);
     }
 
+    BOOST_AUTO_TEST_CASE(block_download_window_test)
+    {
+        BOOST_TEST_MESSAGE("Running Block Download Window Test");
+
+        // Enough blocks to cover two round trips at the peer's pace, plus the one being received
+        BOOST_CHECK_EQUAL(GetBlocksInFlightMax(100000, 10000), 21);
+        BOOST_CHECK_EQUAL(GetBlocksInFlightMax(100000, 100000), 3);
+        // A peer limited by its bandwidth rather than its latency gets the minimum
+        BOOST_CHECK_EQUAL(GetBlocksInFlightMax(10000, 1000000), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+        BOOST_CHECK_EQUAL(GetBlocksInFlightMax(0, 0), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+        // And a fast peer on a long link no more than the maximum
+        BOOST_CHECK_EQUAL(GetBlocksInFlightMax(10000000, 1000), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+
+        // Not before the minimum delay, however slow the block is
+        BOOST_CHECK(!IsBlockTakeoverDue(BLOCK_REREQUEST_MIN_DELAY, 0, 1));
+        BOOST_CHECK(IsBlockTakeoverDue(BLOCK_REREQUEST_MIN_DELAY + 1, 0, 1));
+        // Not before twice the time the other peer usually takes
+        BOOST_CHECK(!IsBlockTakeoverDue(2000000, 1000000, 100000));
+        BOOST_CHECK(IsBlockTakeoverDue(2000001, 1000000, 100000));
+        // Not to a peer that wouldn't deliver it sooner, or whose speed isn't known
+        BOOST_CHECK(!IsBlockTakeoverDue(2000001, 1000000, 2000001));
+        BOOST_CHECK(!IsBlockTakeoverDue(2000001, 1000000, 0));
+    }
+
+    BOOST_AUTO_TEST_CASE(tx_announce_queue_test)
+    {
+        BOOST_TEST_MESSAGE("Running Tx Announce Queue Test");
+
+        std::atomic<bool> interruptDummy(false);
+
+        // A peer that finished the handshake and trickles on every call, and one that didn't
+        CAddress addr1(ip(0xa0b0c101), NODE_NONE);
+        CNode dummyNode1(id++, NODE_NETWORK, 0, INVALID_SOCKET, addr1, 4, 4, CAddress(), "", true);
+        dummyNode1.SetSendVersion(PROTOCOL_VERSION);
+        peerLogic->InitializeNode(&dummyNode1);
+        dummyNode1.nVersion = 1;
+        dummyNode1.fSuccessfullyConnected = true;
+        dummyNode1.fWhitelisted = true;
+        dummyNode1.fRelayTxes = true;
+
+        CAddress addr2(ip(0xa0b0c102), NODE_NONE);
+        CNode dummyNode2(id++, NODE_NETWORK, 0, INVALID_SOCKET, addr2, 5, 5, CAddress(), "", true);
+        dummyNode2.SetSendVersion(PROTOCOL_VERSION);
+        peerLogic->InitializeNode(&dummyNode2);
+
+        // The first pass after the handshake starts the peer at the end of the queue
+        peerLogic->SendMessages(&dummyNode1, interruptDummy);
+
+        TestMemPoolEntryHelper entry;
+        std::vector<CTransactionRef> vTxs;
+        for (int i = 0; i < 3; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = InsecureRand256();
+            tx.vin[0].scriptSig << OP_1;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = 1 * CENT;
+            tx.vout[0].scriptPubKey = CScript() << OP_1;
+            vTxs.push_back(MakeTransactionRef(tx));
+            mempool.addUnchecked(vTxs.back()->GetHash(), entry.Fee(1000).FromTx(*vTxs.back()));
+            LOCK(cs_main);
+            RelayTransaction(*vTxs.back());
+        }
+
+        // A transaction that left the mempool before its turn isn't announced
+        mempool.removeRecursive(*vTxs[2]);
+        peerLogic->SendMessages(&dummyNode1, interruptDummy);
+        BOOST_CHECK(dummyNode1.filterInventoryKnown.contains(vTxs[0]->GetHash()));
+        BOOST_CHECK(dummyNode1.filterInventoryKnown.contains(vTxs[1]->GetHash()));
+        BOOST_CHECK(!dummyNode1.filterInventoryKnown.contains(vTxs[2]->GetHash()));
+
+        // Nothing is left for either peer, the one in the handshake has no place in the queue yet
+        CNodeStateStats stats;
+        BOOST_CHECK(GetNodeStateStats(dummyNode1.GetId(), stats));
+        BOOST_CHECK_EQUAL(stats.nTxAnnounceBacklog, 0U);
+        BOOST_CHECK(GetNodeStateStats(dummyNode2.GetId(), stats));
+        BOOST_CHECK_EQUAL(stats.nTxAnnounceBacklog, 0U);
+
+        bool dummy;
+        peerLogic->FinalizeNode(dummyNode1.GetId(), dummy);
+        peerLogic->FinalizeNode(dummyNode2.GetId(), dummy);
+        mempool.clear();
+    }
+
     CTransactionRef RandomOrphan()
     {
         std::map<uint256, COrphanTx>::iterator it;
@@ -274,12 +362,90 @@ BOOST_FIXTURE_TEST_SUITE(DoS_tests, TestingSetup)
         }
 
         // Test LimitOrphanTxSize() function:
-        LimitOrphanTxSize(40);
+        LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
         BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-        LimitOrphanTxSize(10);
+        LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
         BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-        LimitOrphanTxSize(0);
+        LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
         BOOST_CHECK(mapOrphanTransactions.empty());
     }
 
+    BOOST_AUTO_TEST_CASE(DoS_maporphans_limits_test)
+    {
+        BOOST_TEST_MESSAGE("Running DoS MapOrphans Limits Test");
+
+        // 20 orphans from peer 1, and 2 from peer 2
+        std::vector<CTransactionRef> vOrphans;
+        for (int i = 0; i < 22; i++)
+        {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.n = 0;
+            tx.vin[0].prevout.hash = InsecureRand256();
+            tx.vin[0].scriptSig << OP_1;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = 1 * CENT;
+            tx.vout[0].scriptPubKey = CScript() << OP_1;
+
+            vOrphans.push_back(MakeTransactionRef(tx));
+            BOOST_CHECK(AddOrphanTx(vOrphans.back(), i < 20 ? 1 : 2));
+        }
+
+        // Peer 1 is over its share of 20 orphans and loses its oldest ones, peer 2 keeps all of its own
+        LimitOrphanTxSize(20, std::numeric_limits<size_t>::max());
+        BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 20 * MAX_ORPHAN_TX_PEER_PERCENT / 100 + 2);
+        for (size_t i = 0; i < vOrphans.size(); i++)
+            BOOST_CHECK_EQUAL(mapOrphanTransactions.count(vOrphans[i]->GetHash()), i >= 20 - 20 * MAX_ORPHAN_TX_PEER_PERCENT / 100);
+
+        // The memory budget limits the whole pool, and the share of each peer
+        size_t nUsage = mapOrphanTransactions.begin()->second.nUsage;
+        LimitOrphanTxSize(20, 3 * nUsage);
+        BOOST_CHECK(mapOrphanTransactions.size() <= 3);
+        LimitOrphanTxSize(20, 0);
+        BOOST_CHECK(mapOrphanTransactions.empty());
+    }
+
+    BOOST_AUTO_TEST_CASE(DoS_maporphans_persist_test)
+    {
+        BOOST_TEST_MESSAGE("Running DoS MapOrphans Persist Test");
+
+        CKey key;
+        key.MakeNewKey(true);
+
+        // 10 orphans from each of two peers, with the pool limited to 20
+        std::vector<CTransactionRef> vOrphans;
+        for (int i = 0; i < 20; i++)
+        {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.n = 0;
+            tx.vin[0].prevout.hash = InsecureRand256();
+            tx.vin[0].scriptSig << OP_1;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = 1 * CENT;
+            tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+            vOrphans.push_back(MakeTransactionRef(tx));
+            BOOST_CHECK(AddOrphanTx(vOrphans.back(), i % 2));
+        }
+        gArgs.ForceSetArg("-maxorphantx", "20");
+
+        BOOST_CHECK(DumpOrphans());
+        EraseOrphansFor(0);
+        EraseOrphansFor(1);
+        BOOST_CHECK(mapOrphanTransactions.empty());
+
+        // All of them come back, restored orphans aren't held to the share of a single peer
+        BOOST_CHECK(LoadOrphans());
+        BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), vOrphans.size());
+        for (const CTransactionRef& tx : vOrphans)
+            BOOST_CHECK_EQUAL(mapOrphanTransactions.count(tx->GetHash()), 1U);
+
+        // The global limit still applies to them
+        LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
+        BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 10U);
+        LimitOrphanTxSize(0, 0);
+        gArgs.ForceSetArg("-maxorphantx", std::to_string(DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
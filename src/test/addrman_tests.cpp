@@ -364,6 +364,97 @@ BOOST_FIXTURE_TEST_SUITE(addrman_tests, BasicTestingSetup)
         BOOST_CHECK(info2 == nullptr);
     }
 
+    BOOST_AUTO_TEST_CASE(addrman_journal_test)
+    {
+        BOOST_TEST_MESSAGE("Running Addrman Journal Test");
+
+        CAddrManTest addrman;
+        CNetAddr source = ResolveIP("252.2.2.2");
+
+        CAddress addr1 = CAddress(ResolveService("250.1.1.1", 8767), NODE_NONE);
+        CAddress addr2 = CAddress(ResolveService("250.1.1.2", 8767), NODE_NONE);
+        CAddress addr3 = CAddress(ResolveService("250.1.1.3", 8767), NODE_NONE);
+        addrman.Add(addr1, source);
+        addrman.Add(addr2, source);
+
+        // Test: a snapshot leaves no changes behind.
+        CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+        ssPeers << addrman;
+        std::vector<CAddrJournalEntry> vChanges;
+        addrman.TakeChanges(vChanges);
+        BOOST_CHECK_EQUAL(vChanges.size(), 2);
+        addrman.TakeChanges(vChanges);
+        BOOST_CHECK(vChanges.empty());
+
+        // Test: an address added and removed again is not journaled at all.
+        int nId;
+        addrman.Create(addr3, source, &nId);
+        addrman.Delete(nId);
+        addrman.TakeChanges(vChanges);
+        BOOST_CHECK(vChanges.empty());
+
+        // Change the table after the snapshot.
+        addrman.Good(addr1);
+        addrman.Attempt(addr2, true, GetAdjustedTime() + 100);
+        addrman.Add(addr3, source);
+        addrman.TakeChanges(vChanges);
+        BOOST_CHECK_EQUAL(vChanges.size(), 3);
+
+        // Test: replaying the changes on the snapshot gives the same table.
+        CAddrManTest addrman2;
+        ssPeers >> addrman2;
+        BOOST_CHECK_EQUAL(addrman2.size(), 2);
+        addrman2.ApplyChanges(vChanges);
+        BOOST_CHECK_EQUAL(addrman2.size(), 3);
+        BOOST_CHECK(addrman2.Find(addr3) != nullptr);
+        // The failed attempt on addr2 came along.
+        BOOST_CHECK(addrman2.Find(addr2)->GetChance() < addrman2.Find(addr3)->GetChance());
+
+        // Test: replaying the changes does not journal them again.
+        addrman2.TakeChanges(vChanges);
+        BOOST_CHECK(vChanges.empty());
+
+        // Test: addr1 was moved to tried, so selecting from new never returns it.
+        std::set<std::string> setSelected;
+        for (int i = 0; i < 20; ++i)
+            setSelected.insert(addrman2.Select(true).ToString());
+        BOOST_CHECK_EQUAL(setSelected.size(), 2);
+        BOOST_CHECK(!setSelected.count(addr1.ToString()));
+    }
+
+    BOOST_AUTO_TEST_CASE(addrman_journal_buckets_test)
+    {
+        BOOST_TEST_MESSAGE("Running Addrman Journal Buckets Test");
+
+        CAddrManTest addrman;
+        CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+        ssPeers << addrman;
+
+        // Announce an address from sources in different groups, which adds it to more "new" buckets.
+        // It is a day old, so the announcements don't refresh its time and keep counting.
+        CAddress addr = CAddress(ResolveService("250.1.1.1", 8767), NODE_NONE);
+        int64_t nTime = GetAdjustedTime() - 2 * 24 * 60 * 60;
+        for (int i = 1; i <= 30; i++) {
+            addr.nTime = nTime + i * 60;
+            addrman.Add(addr, ResolveIP(strprintf("251.%d.1.1", i)));
+        }
+        std::vector<CAddrJournalEntry> vChanges;
+        addrman.TakeChanges(vChanges);
+        BOOST_REQUIRE_EQUAL(vChanges.size(), 1);
+        BOOST_REQUIRE(vChanges[0].vNewBuckets.size() > 1);
+
+        // Test: replaying the change references the address from all of its buckets again.
+        CAddrManTest addrman2;
+        ssPeers >> addrman2;
+        addrman2.ApplyChanges(vChanges);
+        BOOST_CHECK_EQUAL(addrman2.size(), 1);
+        addrman2.Attempt(addr, true);
+        std::vector<CAddrJournalEntry> vChanges2;
+        addrman2.TakeChanges(vChanges2);
+        BOOST_REQUIRE_EQUAL(vChanges2.size(), 1);
+        BOOST_CHECK(vChanges2[0].vNewBuckets == vChanges[0].vNewBuckets);
+    }
+
     BOOST_AUTO_TEST_CASE(addrman_getaddr_test)
     {
         BOOST_TEST_MESSAGE("Running Addrman GetAddr Test");
@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "assets/assets.h"
+#include "assets/assetdb.h"
+#include "validation.h"
+#include <boost/test/unit_test.hpp>
+#include <test/test_raven.h>
+
+BOOST_FIXTURE_TEST_SUITE(asset_holders_tests, TestingSetup)
+
+    static std::vector<std::pair<std::string, CAmount> > GetHolders(const std::string& assetName, const CAssetsCache* pcache, const size_t count = INT_MAX, const size_t start = 0)
+    {
+        std::map<std::string, CAmount> mapUnflushed;
+        if (pcache)
+            GetUnflushedAssetBalances(*pcache, assetName, mapUnflushed);
+
+        std::unique_ptr<CDBIterator> pcursor(passetsdb->NewSnapshotIterator());
+        CAssetHoldersReader reader(*pcursor, assetName, mapUnflushed);
+        std::vector<std::pair<std::string, CAmount> > holders;
+        reader.Next(holders, count, start);
+        return holders;
+    }
+
+    static std::string HoldersToString(const std::vector<std::pair<std::string, CAmount> >& holders)
+    {
+        std::string str;
+        for (const auto& holder : holders)
+            str += strprintf("%s:%d ", holder.first, holder.second / COIN);
+        return str;
+    }
+
+    BOOST_AUTO_TEST_CASE(asset_holders_index_test)
+    {
+        BOOST_TEST_MESSAGE("Running Asset Holders Index Test");
+
+        passetsdb = new CAssetsDB(1 << 20, true);
+        passetsCache = new CLRUCache<std::string, CDatabasedAssetData>(MAX_CACHE_ASSETS_SIZE);
+
+        const std::string assetName = "HOLDERS";
+        CAssetsCache cache;
+
+        // Connect a block issuing the asset and transferring some of it
+        CNewAsset asset(assetName, CAmount(100 * COIN), 8, 1, 0, "");
+        BOOST_CHECK(cache.AddNewAsset(asset, "addressA", 1, uint256()));
+        CAssetTransfer transferB(assetName, CAmount(30 * COIN));
+        COutPoint outB(uint256S("0x01"), 0);
+        BOOST_CHECK(cache.AddTransferAsset(transferB, "addressB", outB, CTxOut()));
+
+        // Before the flush the holders only come from the cache
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, nullptr)), "");
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, &cache)), "addressA:100 addressB:30 ");
+
+        // After it from the balance index
+        BOOST_CHECK(cache.Flush(false, true));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, nullptr)), "addressA:100 addressB:30 ");
+
+        // Balances only read through the cache aren't unflushed
+        BOOST_CHECK(GetBestAssetAddressAmount(cache, assetName, "addressA"));
+        std::map<std::string, CAmount> mapUnflushed;
+        GetUnflushedAssetBalances(cache, assetName, mapUnflushed);
+        BOOST_CHECK(mapUnflushed.empty());
+
+        // Connect another block, its balances are merged in the order of the index
+        CAssetTransfer transferC(assetName, CAmount(50 * COIN));
+        COutPoint outC(uint256S("0x02"), 0);
+        BOOST_CHECK(cache.AddTransferAsset(transferC, "addressC", outC, CTxOut()));
+        CAssetTransfer transferA(assetName, CAmount(10 * COIN));
+        COutPoint outA(uint256S("0x03"), 0);
+        BOOST_CHECK(cache.AddTransferAsset(transferA, "addressA", outA, CTxOut()));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, &cache)), "addressA:110 addressC:50 addressB:30 ");
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, &cache, 1, 1)), "addressC:50 ");
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, &cache, 5, 2)), "addressB:30 ");
+
+        // A changed balance moves its index entry instead of adding one
+        BOOST_CHECK(cache.Flush(false, true));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, nullptr)), "addressA:110 addressC:50 addressB:30 ");
+
+        // Disconnect both blocks, an emptied balance hides the one still in the database
+        BOOST_CHECK(cache.RemoveTransfer(transferA, "addressA", outA));
+        BOOST_CHECK(cache.RemoveTransfer(transferC, "addressC", outC));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, &cache)), "addressA:100 addressB:30 ");
+        BOOST_CHECK(cache.RemoveTransfer(transferB, "addressB", outB));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, &cache)), "addressA:100 ");
+
+        // And its index entry is erased with the balance
+        BOOST_CHECK(cache.Flush(false, true));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, nullptr)), "addressA:100 ");
+
+        // An emptied balance that is written instead of erased isn't listed either
+        BOOST_CHECK(passetsdb->WriteAssetAddressQuantity(assetName, "addressD", 0, 0));
+        BOOST_CHECK_EQUAL(HoldersToString(GetHolders(assetName, nullptr)), "addressA:100 ");
+
+        delete passetsCache;
+        passetsCache = nullptr;
+        delete passetsdb;
+        passetsdb = nullptr;
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
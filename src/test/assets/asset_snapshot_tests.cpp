@@ -0,0 +1,207 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "assets/assets.h"
+#include "assets/assetdb.h"
+#include "assets/assetsnapshot.h"
+#include "chain.h"
+#include "validation.h"
+#include <boost/test/unit_test.hpp>
+#include <test/test_raven.h>
+
+BOOST_FIXTURE_TEST_SUITE(asset_snapshot_tests, TestingSetup)
+
+    BOOST_AUTO_TEST_CASE(asset_snapshot_test)
+    {
+        BOOST_TEST_MESSAGE("Running Asset Snapshot Test");
+
+        passetsdb = new CAssetsDB(1 << 20, true);
+        StartAssetSnapshots();
+
+        const std::string assetName = "SNAPSHOT";
+        const int nHeight = 10;
+
+        // Balances flushed to the database
+        BOOST_CHECK(passetsdb->WriteAssetAddressQuantity(assetName, "addressA", 0, 5 * COIN));
+        BOOST_CHECK(passetsdb->WriteAssetAddressQuantity(assetName, "addressB", 0, 3 * COIN));
+        BOOST_CHECK(passetsdb->WriteAssetAddressQuantity(assetName, "addressC", 0, 1 * COIN));
+        BOOST_CHECK(passetsdb->WriteAssetAddressQuantity("OTHER", "addressA", 0, 9 * COIN));
+
+        // And balances that only changed in memory: one grew, one was emptied and one is new
+        passets->mapAssetsAddressAmount[std::make_pair(assetName, "addressC")] = 7 * COIN;
+        passets->mapAssetsAddressAmount[std::make_pair(assetName, "addressB")] = 0;
+        passets->mapAssetsAddressAmount[std::make_pair(assetName, "addressD")] = 2 * COIN;
+
+        uint256 blockHash = uint256S("0x01");
+        CBlockIndex index;
+        index.nHeight = nHeight;
+        index.phashBlock = &blockHash;
+
+        {
+            LOCK(cs_main);
+            std::string strError;
+            BOOST_CHECK(AddAssetSnapshotRequest(assetName, nHeight, strError));
+
+            // Only the requested height is captured
+            index.nHeight = nHeight - 1;
+            CaptureAssetSnapshots(&index);
+            index.nHeight = nHeight;
+            CaptureAssetSnapshots(&index);
+        }
+
+        // The snapshot is written on its own thread
+        SyncWithAssetSnapshots();
+
+        CAssetSnapshot snapshot;
+        size_t nTotalHolders;
+        BOOST_CHECK(!ReadAssetSnapshot(assetName, nHeight - 1, snapshot, nTotalHolders));
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nHeight, snapshot, nTotalHolders));
+        BOOST_CHECK_EQUAL(snapshot.assetName, assetName);
+        BOOST_CHECK_EQUAL(snapshot.nHeight, nHeight);
+        BOOST_CHECK(snapshot.blockHash == blockHash);
+
+        // Largest balance first, the emptied address and the other asset left out
+        BOOST_CHECK_EQUAL(nTotalHolders, 3);
+        BOOST_REQUIRE_EQUAL(snapshot.vHolders.size(), 3);
+        BOOST_CHECK_EQUAL(snapshot.vHolders[0].first, "addressC");
+        BOOST_CHECK_EQUAL(snapshot.vHolders[0].second, 7 * COIN);
+        BOOST_CHECK_EQUAL(snapshot.vHolders[1].first, "addressA");
+        BOOST_CHECK_EQUAL(snapshot.vHolders[1].second, 5 * COIN);
+        BOOST_CHECK_EQUAL(snapshot.vHolders[2].first, "addressD");
+        BOOST_CHECK_EQUAL(snapshot.vHolders[2].second, 2 * COIN);
+
+        // Pages skip the holders before start, and count the total anyway
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nHeight, snapshot, nTotalHolders, 1, 1));
+        BOOST_CHECK_EQUAL(nTotalHolders, 3);
+        BOOST_REQUIRE_EQUAL(snapshot.vHolders.size(), 1);
+        BOOST_CHECK_EQUAL(snapshot.vHolders[0].first, "addressA");
+
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nHeight, snapshot, nTotalHolders, 5, 2));
+        BOOST_REQUIRE_EQUAL(snapshot.vHolders.size(), 1);
+        BOOST_CHECK_EQUAL(snapshot.vHolders[0].first, "addressD");
+
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nHeight, snapshot, nTotalHolders, 5, 3));
+        BOOST_CHECK(snapshot.vHolders.empty());
+        BOOST_CHECK_EQUAL(snapshot.assetName, assetName);
+
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(RemoveAssetSnapshotRequest(assetName, nHeight));
+        }
+        StopAssetSnapshots();
+        passets->mapAssetsAddressAmount.clear();
+        delete passetsdb;
+        passetsdb = nullptr;
+    }
+
+    BOOST_AUTO_TEST_CASE(asset_snapshot_chunks_test)
+    {
+        BOOST_TEST_MESSAGE("Running Asset Snapshot Chunks Test");
+
+        passetsdb = new CAssetsDB(1 << 20, true);
+        StartAssetSnapshots();
+
+        // More holders than are read at once, every one with a different balance
+        const std::string assetName = "CHUNKS";
+        const int nHeight = 10;
+        const int nHolders = 10050;
+        for (int i = 0; i < nHolders; i++)
+            BOOST_CHECK(passetsdb->WriteAssetAddressQuantity(assetName, strprintf("address%d", i), 0, (i + 1) * COIN));
+
+        uint256 blockHash = uint256S("0x01");
+        CBlockIndex index;
+        index.nHeight = nHeight;
+        index.phashBlock = &blockHash;
+        {
+            LOCK(cs_main);
+            std::string strError;
+            BOOST_CHECK(AddAssetSnapshotRequest(assetName, nHeight, strError));
+            CaptureAssetSnapshots(&index);
+        }
+        SyncWithAssetSnapshots();
+
+        CAssetSnapshot snapshot;
+        size_t nTotalHolders;
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nHeight, snapshot, nTotalHolders));
+        BOOST_CHECK_EQUAL(nTotalHolders, nHolders);
+        BOOST_REQUIRE_EQUAL(snapshot.vHolders.size(), nHolders);
+        for (int i = 0; i < nHolders; i++) {
+            BOOST_CHECK_EQUAL(snapshot.vHolders[i].first, strprintf("address%d", nHolders - 1 - i));
+            BOOST_CHECK_EQUAL(snapshot.vHolders[i].second, (nHolders - i) * COIN);
+        }
+
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(RemoveAssetSnapshotRequest(assetName, nHeight));
+        }
+        StopAssetSnapshots();
+        delete passetsdb;
+        passetsdb = nullptr;
+    }
+
+    BOOST_FIXTURE_TEST_CASE(asset_snapshot_restart_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Asset Snapshot Restart Test");
+
+        passetsdb = new CAssetsDB(1 << 20, true);
+
+        const std::string assetName = "RESTART";
+        const int nTipHeight = chainActive.Height();
+        BOOST_CHECK(passetsdb->WriteAssetAddressQuantity(assetName, "addressA", 0, 5 * COIN));
+
+        // The node went down after connecting the blocks of two requests, before their snapshots were written
+        BOOST_CHECK(passetsdb->WriteSnapshotRequest(assetName, nTipHeight - 1));
+        BOOST_CHECK(passetsdb->WriteSnapshotRequest(assetName, nTipHeight));
+        BOOST_CHECK(passetsdb->WriteSnapshotRequest(assetName, nTipHeight + 1));
+
+        // On start the one at the tip is taken again, the older one can't be anymore
+        StartAssetSnapshots();
+        SyncWithAssetSnapshots();
+
+        CAssetSnapshot snapshot;
+        size_t nTotalHolders;
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nTipHeight, snapshot, nTotalHolders));
+        BOOST_CHECK(snapshot.blockHash == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK_EQUAL(nTotalHolders, 1);
+        BOOST_CHECK(!ReadAssetSnapshot(assetName, nTipHeight - 1, snapshot, nTotalHolders));
+
+        std::set<std::pair<std::string, int> > setRequests;
+        std::set<std::pair<std::string, int> > setFailed;
+        {
+            LOCK(cs_main);
+            GetAssetSnapshotRequests(setRequests, setFailed);
+        }
+        BOOST_CHECK_EQUAL(setRequests.size(), 3);
+        BOOST_CHECK_EQUAL(setFailed.size(), 1);
+        BOOST_CHECK(setFailed.count(std::make_pair(assetName, nTipHeight - 1)));
+
+        // A snapshot queued right before the shutdown is still written
+        StopAssetSnapshots();
+        StartAssetSnapshots();
+        uint256 blockHash = uint256S("0x01");
+        CBlockIndex index;
+        index.nHeight = nTipHeight + 1;
+        index.phashBlock = &blockHash;
+        {
+            LOCK(cs_main);
+            CaptureAssetSnapshots(&index);
+        }
+        StopAssetSnapshots();
+        BOOST_REQUIRE(ReadAssetSnapshot(assetName, nTipHeight + 1, snapshot, nTotalHolders));
+        BOOST_CHECK(snapshot.blockHash == blockHash);
+
+        // The failed mark was kept in the database across the restarts
+        {
+            LOCK(cs_main);
+            GetAssetSnapshotRequests(setRequests, setFailed);
+        }
+        BOOST_CHECK_EQUAL(setFailed.size(), 1);
+        BOOST_CHECK(setFailed.count(std::make_pair(assetName, nTipHeight - 1)));
+
+        StopAssetSnapshots();
+        delete passetsdb;
+        passetsdb = nullptr;
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,8 @@
 #include "assets/assets.h"
 #include <boost/test/unit_test.hpp>
 #include <test/test_raven.h>
+#include <chainparams.h>
+#include <base58.h>
 
 BOOST_FIXTURE_TEST_SUITE(cache_tests, BasicTestingSetup)
 
@@ -37,5 +39,60 @@ BOOST_AUTO_TEST_CASE(cache_test)
 
 }
 
+BOOST_AUTO_TEST_CASE(asset_stats_cache_test)
+{
+    BOOST_TEST_MESSAGE("Running Asset Stats Cache Test");
+
+    SelectParams(CBaseChainParams::MAIN);
+
+    CAssetsCache cache;
+
+    // Issuing the asset starts its aggregates
+    CNewAsset asset("RVNASSET", CAmount(100 * COIN), 8, 1, 0, "");
+    BOOST_CHECK_MESSAGE(cache.AddNewAsset(asset, Params().GlobalBurnAddress(), 5, uint256()), "Failed to add new asset");
+
+    CAssetStats stats = cache.mapAssetStats.at("RVNASSET");
+    BOOST_CHECK_MESSAGE(stats.nHolders == 1, "Issued asset should have one holder");
+    BOOST_CHECK_MESSAGE(stats.nCirculating == CAmount(100 * COIN), "Issued asset circulating supply is wrong");
+    BOOST_CHECK_MESSAGE(stats.nBurned == GetIssueAssetBurnAmount(), "Issued asset burn amount is wrong");
+    BOOST_CHECK_MESSAGE(stats.nLastActivityHeight == 5, "Issued asset last activity height is wrong");
+    BOOST_CHECK_MESSAGE(cache.setChangedAssetStats.count("RVNASSET"), "Issued asset stats weren't marked to be flushed");
+
+    // Stats only read from the database aren't written back
+    cache.mapAssetStats.insert(std::make_pair("OTHERASSET", CAssetStats()));
+    BOOST_CHECK_MESSAGE(!cache.setChangedAssetStats.count("OTHERASSET"), "Read stats were marked to be flushed");
+
+    // A transfer to a new address adds a holder
+    CAssetTransfer transfer("RVNASSET", CAmount(10 * COIN));
+    COutPoint out(uint256S("BF50CB9A63BE0019171456252989A459A7D0A5F494735278290079D22AB704A4"), 1);
+    BOOST_CHECK_MESSAGE(cache.AddTransferAsset(transfer, Params().IssueAssetBurnAddress(), out, CTxOut(), 7), "Failed to add transfer");
+
+    stats = cache.mapAssetStats.at("RVNASSET");
+    BOOST_CHECK_MESSAGE(stats.nHolders == 2, "Transfer to a new address should add a holder");
+    BOOST_CHECK_MESSAGE(stats.nCirculating == CAmount(110 * COIN), "Transfer wasn't added to the circulating supply");
+    BOOST_CHECK_MESSAGE(stats.nLastActivityHeight == 7, "Transfer didn't update the last activity height");
+
+    // Undoing the transfer removes the holder again
+    BOOST_CHECK_MESSAGE(cache.RemoveTransfer(transfer, Params().IssueAssetBurnAddress(), out), "Failed to remove transfer");
+
+    stats = cache.mapAssetStats.at("RVNASSET");
+    BOOST_CHECK_MESSAGE(stats.nHolders == 1, "Undoing the transfer should remove the holder");
+    BOOST_CHECK_MESSAGE(stats.nCirculating == CAmount(100 * COIN), "Undoing the transfer didn't restore the circulating supply");
+
+    // Reissuing adds to the burn, undoing it takes it away
+    CReissueAsset reissue("RVNASSET", CAmount(1 * COIN), 8, 1, "");
+    BOOST_CHECK_MESSAGE(cache.AddReissueAsset(reissue, Params().GlobalBurnAddress(), out, 9), "Failed to add reissue");
+    BOOST_CHECK_MESSAGE(cache.mapAssetStats.at("RVNASSET").nBurned == GetIssueAssetBurnAmount() + GetReissueAssetBurnAmount(), "Reissue burn wasn't added");
+
+    std::vector<std::pair<std::string, CBlockAssetUndo> > undoBlockData;
+    BOOST_CHECK_MESSAGE(cache.RemoveReissueAsset(reissue, Params().GlobalBurnAddress(), out, undoBlockData), "Failed to remove reissue");
+    BOOST_CHECK_MESSAGE(cache.mapAssetStats.at("RVNASSET").nBurned == GetIssueAssetBurnAmount(), "Reissue burn wasn't removed");
+    BOOST_CHECK_MESSAGE(cache.mapAssetStats.at("RVNASSET").nCirculating == CAmount(100 * COIN), "Reissue amount wasn't removed");
+
+    // Removing the asset clears its aggregates so they get erased from the database
+    BOOST_CHECK_MESSAGE(cache.RemoveNewAsset(asset, Params().GlobalBurnAddress()), "Failed to remove new asset");
+    BOOST_CHECK_MESSAGE(cache.mapAssetStats.at("RVNASSET").IsNull(), "Removed asset still has stats");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
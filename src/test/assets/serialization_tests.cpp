@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <assets/assets.h>
+#include <assets/assetdb.h>
 
 #include <test/test_raven.h>
 
@@ -125,4 +126,24 @@ BOOST_FIXTURE_TEST_SUITE(serialization_tests, BasicTestingSetup)
         BOOST_CHECK_MESSAGE(strOwnerName == ownerName.str(), "Asset names weren't equal");
     }
 
+    BOOST_AUTO_TEST_CASE(asset_balance_index_key_serialization_test)
+    {
+        BOOST_TEST_MESSAGE("Running Asset Balance Index Key Serialization Test");
+
+        CDataStream large(SER_DISK, 0), small(SER_DISK, 0), sameSmall(SER_DISK, 0);
+        large << CAssetBalanceIndexKey("SERIALIZATION", 500 * COIN, "mfe7MqgYZgBuXzrT2QTFqZwBXwRDqagHTp");
+        small << CAssetBalanceIndexKey("SERIALIZATION", 2 * COIN, "mfe7MqgYZgBuXzrT2QTFqZwBXwRDqagHTp");
+        sameSmall << CAssetBalanceIndexKey("SERIALIZATION", 2 * COIN, "n1issueAssetXXXXXXXXXXXXXXXXWdnemQ");
+
+        // Larger balances have to sort first, equal balances by address
+        BOOST_CHECK_MESSAGE(large.str() < small.str(), "Larger balance didn't sort before the smaller balance");
+        BOOST_CHECK_MESSAGE(small.str() < sameSmall.str(), "Equal balances weren't sorted by address");
+
+        CAssetBalanceIndexKey key;
+        small >> key;
+        BOOST_CHECK_MESSAGE(key.assetName == "SERIALIZATION", "Asset names weren't equal");
+        BOOST_CHECK_MESSAGE(key.nBalance == 2 * COIN, "Balances weren't equal");
+        BOOST_CHECK_MESSAGE(key.address == "mfe7MqgYZgBuXzrT2QTFqZwBXwRDqagHTp", "Addresses weren't equal");
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
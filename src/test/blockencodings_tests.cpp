@@ -356,4 +356,23 @@ BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, RegtestingSetup)
         BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);
     }
 
+    BOOST_AUTO_TEST_CASE(shortid_index_test)
+    {
+        BOOST_TEST_MESSAGE("Running Short ID Index Test");
+
+        std::vector<uint64_t> shortids;
+        for (int i = 0; i < 1000; i++)
+            shortids.push_back(InsecureRandBits(48));
+
+        ShortIDIndex index(shortids.size());
+        for (size_t i = 0; i < shortids.size(); i++)
+            BOOST_CHECK(index.Insert(shortids[i], i));
+        for (size_t i = 0; i < shortids.size(); i++)
+            BOOST_CHECK_EQUAL(index.Find(shortids[i]), (int)i);
+
+        // Duplicates are refused, and unknown short IDs aren't found
+        BOOST_CHECK(!index.Insert(shortids[0], 0));
+        BOOST_CHECK_EQUAL(index.Find(0x1000000000000ULL), -1);
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
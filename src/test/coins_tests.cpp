@@ -4,7 +4,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "coinsprefetch.h"
+#include "coinswriter.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -945,4 +948,163 @@ BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
                         CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
     }
 
+    //! Wait for the prefetch threads to stage nStaged coins
+    static bool WaitForStaged(const CCoinsViewPrefetch& prefetch, size_t nStaged)
+    {
+        CCoinsPrefetchStats stats;
+        for (int i = 0; i < 1000; i++) {
+            prefetch.GetStats(stats);
+            if (stats.nStaged == nStaged && stats.nQueued == 0)
+                return true;
+            MilliSleep(10);
+        }
+        return false;
+    }
+
+    BOOST_AUTO_TEST_CASE(ccoins_prefetch_test)
+    {
+        BOOST_TEST_MESSAGE("Running cCoins Prefetch Test");
+
+        CCoinsViewTest base;
+        COutPoint outpoint(InsecureRand256(), 0);
+        Coin coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false);
+        {
+            CCoinsViewCache cache(&base);
+            cache.AddCoin(outpoint, Coin(coin), false);
+            cache.Flush();
+        }
+
+        // A block spending the coin, and an output created in the block itself
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vout.resize(1);
+        CMutableTransaction spend;
+        spend.vin.emplace_back(outpoint);
+        spend.vout.resize(1);
+        CMutableTransaction spendInBlock;
+        spendInBlock.vin.emplace_back(COutPoint(spend.GetHash(), 0));
+        spendInBlock.vout.resize(1);
+        CBlock block;
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        block.vtx.push_back(MakeTransactionRef(spend));
+        block.vtx.push_back(MakeTransactionRef(spendInBlock));
+
+        CCoinsViewPrefetch prefetch(&base, 2);
+        CCoinsViewCache tip(&prefetch);
+        CCoinsPrefetchStats stats;
+
+        // Only the coin that exists before the block is staged, and it moves to the cache above on use
+        prefetch.Prefetch(block);
+        BOOST_CHECK(WaitForStaged(prefetch, 1));
+        BOOST_CHECK(tip.AccessCoin(outpoint) == coin);
+        prefetch.GetStats(stats);
+        BOOST_CHECK_EQUAL(stats.nStaged, 0U);
+        BOOST_CHECK_EQUAL(stats.nPrefetched, 1U);
+        BOOST_CHECK_EQUAL(stats.nHits, 1U);
+        BOOST_CHECK_EQUAL(stats.nMisses, 0U);
+
+        // Writing the spent coin back evicts the staged copy
+        prefetch.Prefetch(block);
+        BOOST_CHECK(WaitForStaged(prefetch, 1));
+        BOOST_CHECK(tip.SpendCoin(outpoint));
+        BOOST_CHECK(tip.Flush());
+        prefetch.GetStats(stats);
+        BOOST_CHECK_EQUAL(stats.nStaged, 0U);
+        Coin spent;
+        BOOST_CHECK(!prefetch.GetCoin(outpoint, spent) || spent.IsSpent());
+    }
+
+
+    BOOST_AUTO_TEST_CASE(ccoins_sync_test)
+    {
+        BOOST_TEST_MESSAGE("Running cCoins Sync Test");
+
+        CCoinsViewTest base;
+        CCoinsViewCache cache(&base);
+        uint256 hashBlock = InsecureRand256();
+        cache.SetBestBlock(hashBlock);
+
+        COutPoint kept(InsecureRand256(), 0);
+        COutPoint spent(InsecureRand256(), 0);
+        COutPoint moved(InsecureRand256(), 0);
+        Coin coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false);
+
+        // Modified coins are written, and stay cached as unmodified copies
+        cache.AddCoin(kept, Coin(coin), false);
+        cache.AddCoin(spent, Coin(coin), false);
+        BOOST_CHECK(cache.Sync());
+        BOOST_CHECK(base.GetBestBlock() == hashBlock);
+        BOOST_CHECK(base.HaveCoin(kept));
+        BOOST_CHECK(base.HaveCoin(spent));
+        BOOST_CHECK(cache.HaveCoinInCache(kept));
+        BOOST_CHECK(cache.HaveCoinInCache(spent));
+
+        // Spending a synced coin erases it from the base on the next sync, and from the cache too
+        BOOST_CHECK(cache.SpendCoin(spent));
+        BOOST_CHECK(cache.Sync());
+        Coin coinSpent;
+        BOOST_CHECK(!base.GetCoin(spent, coinSpent) || coinSpent.IsSpent());
+        BOOST_CHECK(!cache.HaveCoinInCache(spent));
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+
+        // Without keeping modified coins, only the unmodified ones stay
+        cache.AddCoin(moved, Coin(coin), false);
+        BOOST_CHECK(cache.Sync(false));
+        BOOST_CHECK(base.HaveCoin(moved));
+        BOOST_CHECK(!cache.HaveCoinInCache(moved));
+        BOOST_CHECK(cache.HaveCoinInCache(kept));
+
+        // Trimming drops unmodified coins, but never modified ones
+        cache.AddCoin(spent, Coin(coin), false);
+        cache.Trim(0);
+        BOOST_CHECK(!cache.HaveCoinInCache(kept));
+        BOOST_CHECK(cache.HaveCoinInCache(spent));
+        BOOST_CHECK(cache.AccessCoin(kept) == coin);
+    }
+
+    BOOST_AUTO_TEST_CASE(ccoins_writer_test)
+    {
+        BOOST_TEST_MESSAGE("Running cCoins Writer Test");
+
+        CCoinsViewDB db(1 << 20, true);
+        CCoinsViewWriter writer(&db);
+        CCoinsViewCache tip(&writer);
+
+        COutPoint outpoint(InsecureRand256(), 0);
+        Coin coin(CTxOut(VALUE1, CScript() << OP_TRUE), 1, false);
+        uint256 hashFirst = InsecureRand256();
+        tip.AddCoin(outpoint, Coin(coin), false);
+        tip.SetBestBlock(hashFirst);
+        BOOST_CHECK(tip.Sync(false));
+
+        // The writer answers for the batch whether it is written yet or not
+        Coin read;
+        BOOST_CHECK(writer.GetCoin(outpoint, read));
+        BOOST_CHECK(read == coin);
+        BOOST_CHECK(writer.GetBestBlock() == hashFirst);
+        BOOST_CHECK(writer.Wait());
+        BOOST_CHECK(db.GetCoin(outpoint, read));
+        BOOST_CHECK(db.GetBestBlock() == hashFirst);
+
+        // Spending it hides the coin until, and after, the erase is written
+        uint256 hashSecond = InsecureRand256();
+        BOOST_CHECK(tip.SpendCoin(outpoint));
+        tip.SetBestBlock(hashSecond);
+        BOOST_CHECK(tip.Sync());
+        BOOST_CHECK(!writer.HaveCoin(outpoint));
+        BOOST_CHECK(writer.GetBestBlock() == hashSecond);
+
+        // Once handed over, the database is either done or marked to be replayed up to the batch
+        std::vector<uint256> vHeads = db.GetHeadBlocks();
+        if (vHeads.empty()) {
+            BOOST_CHECK(db.GetBestBlock() == hashSecond);
+        } else {
+            BOOST_CHECK(vHeads == std::vector<uint256>({hashSecond, hashFirst}));
+        }
+        BOOST_CHECK(writer.Wait());
+        BOOST_CHECK(!writer.Failed());
+        BOOST_CHECK(!db.HaveCoin(outpoint));
+        BOOST_CHECK(db.GetBestBlock() == hashSecond);
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
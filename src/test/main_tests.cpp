@@ -5,7 +5,12 @@
 
 #include "chainparams.h"
 #include "validation.h"
+#include "miner.h"
 #include "net.h"
+#include "pow.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
 
 #include "test/test_raven.h"
 
@@ -87,4 +92,112 @@ BOOST_FIXTURE_TEST_SUITE(main_tests, TestingSetup)
         BOOST_CHECK(Test());
     }
 
+    BOOST_FIXTURE_TEST_CASE(read_raw_block_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Read Raw Block Test");
+
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+        }
+
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
+
+        std::vector<unsigned char> vchBlock;
+        BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pindex, Params().MessageStart()));
+        BOOST_CHECK_MESSAGE(HexStr(vchBlock) == HexStr(ssBlock.begin(), ssBlock.end()), "Raw block doesn't match the serialized block");
+
+        // The wrong network magic is rejected
+        CMessageHeader::MessageStartChars wrongStart = {0, 0, 0, 0};
+        BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex, wrongStart));
+    }
+
+    // Mine a chain of coinbase-only blocks on top of the tip without processing them
+    static std::vector<CBlock> MineBlocksOnTip(int nBlocks)
+    {
+        const CChainParams& chainparams = Params();
+        std::vector<CBlock> vBlocks;
+
+        LOCK(cs_main);
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(CScript() << OP_TRUE);
+        CBlock block = pblocktemplate->block;
+        block.vtx.resize(1);
+        CBlockIndex indexPrev; // Only its height is used, for the coinbase
+        indexPrev.nHeight = chainActive.Height();
+        for (int i = 0; i < nBlocks; i++) {
+            unsigned int nExtraNonce = 0;
+            IncrementExtraNonce(&block, &indexPrev, nExtraNonce);
+            while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+            vBlocks.push_back(block);
+
+            block.hashPrevBlock = block.GetHash();
+            block.nTime++;
+            block.nNonce = 0;
+            indexPrev.nHeight++;
+        }
+        return vBlocks;
+    }
+
+    static void WriteBlockRecord(CAutoFile& file, const CBlock& block, unsigned int nSizeExtra = 0)
+    {
+        unsigned int nSize = GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + nSizeExtra;
+        file << FLATDATA(Params().MessageStart()) << nSize << block;
+    }
+
+    BOOST_FIXTURE_TEST_CASE(load_external_block_file_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Load External Block File Test");
+
+        const CChainParams& chainparams = Params();
+        std::vector<CBlock> vBlocks = MineBlocksOnTip(4);
+        int nHeight = chainActive.Height();
+
+        // Write the blocks as a reindex would find them in a block file of their own:
+        // - the second block before its parent
+        // - a corrupt record, whose size covers the first block, which has to be read again after it
+        // - the third block with a size too large, covering part of the fourth block
+        CDiskBlockPos pos(1, 0);
+        {
+            CAutoFile file(fsbridge::fopen(GetBlockPosFilename(pos, "blk"), "wb"), SER_DISK, CLIENT_VERSION);
+            BOOST_REQUIRE(!file.IsNull());
+            WriteBlockRecord(file, vBlocks[1]);
+
+            // A header of zeroes followed by a transaction count that can't be read
+            std::vector<unsigned char> vCorrupt(80, 0x00);
+            vCorrupt.resize(89, 0xff);
+            unsigned int nSize = vCorrupt.size() + CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int) + GetSerializeSize(vBlocks[0], SER_DISK, CLIENT_VERSION);
+            file << FLATDATA(chainparams.MessageStart()) << nSize;
+            file.write((const char*)vCorrupt.data(), vCorrupt.size());
+            WriteBlockRecord(file, vBlocks[0]);
+
+            WriteBlockRecord(file, vBlocks[2], 20);
+            WriteBlockRecord(file, vBlocks[3]);
+        }
+
+        // The connector connects the blocks while the file is being imported
+        StartImportConnector(chainparams);
+        BOOST_CHECK(LoadExternalBlockFile(chainparams, fsbridge::fopen(GetBlockPosFilename(pos, "blk"), "rb"), &pos));
+        for (int i = 0; i < 1000 && chainActive.Height() < nHeight + 4; i++)
+            MilliSleep(10);
+        StopImportConnector();
+
+        {
+            LOCK(cs_main);
+            BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + 4);
+            BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlocks[3].GetHash());
+            // The out of order block was read back from its position in the file
+            CBlock block;
+            BOOST_CHECK(ReadBlockFromDisk(block, chainActive[nHeight + 2], chainparams.GetConsensus()));
+            BOOST_CHECK(block.GetHash() == vBlocks[1].GetHash());
+        }
+
+        // An idle connector stops right away
+        StartImportConnector(chainparams);
+        StopImportConnector();
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,9 +3,17 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "assets/assets.h"
+#include "base58.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
 #include "policy/policy.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validation.h"
 
 #include "test/test_raven.h"
 
@@ -13,6 +21,10 @@
 #include <list>
 #include <vector>
 
+#include <univalue.h>
+
+extern UniValue CallRPC(std::string args);
+
 BOOST_FIXTURE_TEST_SUITE(mempool_tests, TestingSetup)
 
     BOOST_AUTO_TEST_CASE(mempool_remove_test)
@@ -597,4 +609,221 @@ BOOST_FIXTURE_TEST_SUITE(mempool_tests, TestingSetup)
         SetMockTime(0);
     }
 
+    BOOST_AUTO_TEST_CASE(mempool_asset_index_test)
+    {
+        BOOST_TEST_MESSAGE("Running Mempool Asset Index Test");
+
+        SelectParams(CBaseChainParams::MAIN);
+
+        CTxMemPool pool;
+        TestMemPoolEntryHelper entry;
+
+        CScript scriptPubKey = GetScriptForDestination(DecodeDestination(Params().GlobalBurnAddress()));
+
+        // Issue two unique assets in the same transaction
+        CMutableTransaction txIssue;
+        txIssue.vin.resize(1);
+        txIssue.vin[0].scriptSig = CScript() << OP_11;
+        for (auto name : {"RAVEN#TAG1", "RAVEN#TAG2"}) {
+            CScript script = scriptPubKey;
+            CNewAsset(name, COIN).ConstructTransaction(script);
+            txIssue.vout.emplace_back(CTxOut(0, script));
+        }
+
+        CMutableTransaction txReissue;
+        txReissue.vin.resize(1);
+        txReissue.vin[0].scriptSig = CScript() << OP_12;
+        CScript script = scriptPubKey;
+        CReissueAsset("RAVEN", COIN, 0, 1, "").ConstructTransaction(script);
+        txReissue.vout.emplace_back(CTxOut(0, script));
+
+        pool.addUnchecked(txIssue.GetHash(), entry.FromTx(txIssue));
+        pool.addAssetIndex(entry.FromTx(txIssue));
+        pool.addUnchecked(txReissue.GetHash(), entry.FromTx(txReissue));
+        pool.addAssetIndex(entry.FromTx(txReissue));
+
+        uint256 hash;
+        BOOST_CHECK_MESSAGE(pool.getAssetIssueTx("RAVEN#TAG1", hash) && hash == txIssue.GetHash(), "RAVEN#TAG1 should be issued by txIssue");
+        BOOST_CHECK_MESSAGE(pool.getAssetIssueTx("RAVEN#TAG2", hash) && hash == txIssue.GetHash(), "RAVEN#TAG2 should be issued by txIssue");
+        BOOST_CHECK_MESSAGE(pool.getAssetReissueTx("RAVEN", hash) && hash == txReissue.GetHash(), "RAVEN should be reissued by txReissue");
+        BOOST_CHECK_MESSAGE(!pool.getAssetIssueTx("RAVEN", hash), "RAVEN shouldn't be issued in the mempool");
+
+        // Removing a transaction frees the names it held
+        pool.removeRecursive(txIssue);
+        BOOST_CHECK_MESSAGE(!pool.getAssetIssueTx("RAVEN#TAG1", hash), "RAVEN#TAG1 should have been removed with txIssue");
+        BOOST_CHECK_MESSAGE(!pool.getAssetIssueTx("RAVEN#TAG2", hash), "RAVEN#TAG2 should have been removed with txIssue");
+        BOOST_CHECK_MESSAGE(pool.getAssetReissueTx("RAVEN", hash), "RAVEN reissue shouldn't be affected by removing txIssue");
+
+        pool.clear();
+        BOOST_CHECK_MESSAGE(!pool.getAssetReissueTx("RAVEN", hash), "Clearing the mempool should clear the asset indexes");
+    }
+
+    BOOST_AUTO_TEST_CASE(mempool_address_index_test)
+    {
+        BOOST_TEST_MESSAGE("Running Mempool Address Index Test");
+
+        CTxMemPool pool;
+        TestMemPoolEntryHelper entry;
+
+        CCoinsView view;
+        CCoinsViewCache coins(&view);
+
+        uint160 addressHash = uint160(ParseHex("1122334455667788990011223344556677889900"));
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vout.resize(2);
+        for (int i = 0; i < 2; i++) {
+            tx.vout[i].scriptPubKey = GetScriptForDestination(CKeyID(addressHash));
+            tx.vout[i].nValue = 10 * COIN;
+        }
+
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+        pool.addAddressIndex(entry.FromTx(tx), coins);
+
+        std::vector<std::pair<uint160, int> > addresses;
+        addresses.emplace_back(std::make_pair(addressHash, 1));
+
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+        BOOST_CHECK(pool.getAddressIndex(addresses, results));
+        BOOST_CHECK_MESSAGE(results.size() == 2, "Both outputs should be in the address index");
+        BOOST_CHECK_MESSAGE(results[0].first.asset == "RVN" && results[0].first.index == 0 && results[1].first.index == 1, "Deltas should be ordered by output index");
+
+        results.clear();
+        BOOST_CHECK(pool.getAddressIndex(addresses, "RVN", results));
+        BOOST_CHECK_MESSAGE(results.size() == 2, "Both outputs should be found by asset name");
+
+        results.clear();
+        BOOST_CHECK(pool.getAddressIndex(addresses, "RAVEN", results));
+        BOOST_CHECK_MESSAGE(results.empty(), "No deltas should be found for an asset that isn't used");
+
+        pool.removeRecursive(tx);
+        results.clear();
+        BOOST_CHECK(pool.getAddressIndex(addresses, results));
+        BOOST_CHECK_MESSAGE(results.empty(), "Deltas should be removed with the transaction");
+    }
+
+    BOOST_AUTO_TEST_CASE(mempool_asset_ops_test)
+    {
+        BOOST_TEST_MESSAGE("Running Mempool Asset Ops Test");
+
+        SelectParams(CBaseChainParams::MAIN);
+
+        CTxMemPool pool;
+        TestMemPoolEntryHelper entry;
+
+        CScript scriptPubKey = GetScriptForDestination(DecodeDestination(Params().GlobalBurnAddress()));
+
+        // Issue an asset together with its owner token
+        CMutableTransaction txIssue;
+        txIssue.vin.resize(1);
+        txIssue.vin[0].scriptSig = CScript() << OP_11;
+        CNewAsset asset("RAVEN", COIN);
+        CScript scriptIssue = scriptPubKey;
+        asset.ConstructTransaction(scriptIssue);
+        CScript scriptOwner = scriptPubKey;
+        asset.ConstructOwnerTransaction(scriptOwner);
+        txIssue.vout.emplace_back(CTxOut(0, scriptIssue));
+        txIssue.vout.emplace_back(CTxOut(0, scriptOwner));
+        txIssue.vout.emplace_back(CTxOut(COIN, CScript() << OP_11 << OP_EQUAL));
+
+        // Reissue it in a child transaction, which also burns some of it by transferring it to the burn address
+        CMutableTransaction txReissue;
+        txReissue.vin.resize(1);
+        txReissue.vin[0].prevout = COutPoint(txIssue.GetHash(), 2);
+        txReissue.vin[0].scriptSig = CScript() << OP_11;
+        CScript scriptReissue = scriptPubKey;
+        CReissueAsset("RAVEN", COIN, 0, 1, "").ConstructTransaction(scriptReissue);
+        txReissue.vout.emplace_back(CTxOut(0, scriptReissue));
+        CScript scriptBurn = scriptPubKey;
+        CAssetTransfer("RAVEN", COIN).ConstructTransaction(scriptBurn);
+        txReissue.vout.emplace_back(CTxOut(0, scriptBurn));
+
+        pool.addUnchecked(txIssue.GetHash(), entry.FromTx(txIssue));
+        pool.addUnchecked(txReissue.GetHash(), entry.FromTx(txReissue));
+
+        CTxMemPool::txiter it = pool.mapTx.find(txReissue.GetHash());
+        BOOST_CHECK_MESSAGE(pool.mapTx.find(txIssue.GetHash())->GetAssetOps() == 2, "The issue and owner token should count as two asset ops");
+        BOOST_CHECK_MESSAGE(it->GetAssetOps() == 2, "The reissue and the burn should count as two asset ops");
+        BOOST_CHECK_MESSAGE(it->GetAssetOpsWithAncestors() == 4, "The package should include the asset ops of the parent");
+
+        // Once the parent is confirmed the package only holds the reissue
+        pool.removeForBlock({MakeTransactionRef(txIssue)}, 1);
+        it = pool.mapTx.find(txReissue.GetHash());
+        BOOST_CHECK_MESSAGE(it->GetAssetOpsWithAncestors() == 2, "The asset ops of the confirmed parent should be removed from the package");
+    }
+
+    BOOST_FIXTURE_TEST_CASE(mempool_index_reorg_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Mempool Index Reorg Test");
+
+        fAddressIndex = true;
+        fSpentIndex = true;
+
+        // Spend the mature coinbase to a new key hash address
+        CKey key;
+        key.MakeNewKey(true);
+        CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - CENT;
+        spend.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char) SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+
+        const std::string txid = spend.GetHash().GetHex();
+        const std::string strAddressQuery = "getaddressmempool {\"addresses\":[\"" + EncodeDestination(key.GetPubKey().GetID()) + "\"]}";
+        const std::string strSpentQuery = "getspentinfo {\"txid\":\"" + coinbaseTxns[0].GetHash().GetHex() + "\",\"index\":0}";
+
+        // Accepted to the mempool, its output and the coinbase it spends are indexed there
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spend), nullptr, nullptr, true, 0));
+        }
+        UniValue deltas = CallRPC(strAddressQuery);
+        BOOST_REQUIRE_EQUAL(deltas.size(), 1);
+        BOOST_CHECK_EQUAL(find_value(deltas[0], "txid").get_str(), txid);
+        BOOST_CHECK_EQUAL(find_value(deltas[0], "satoshis").get_int64(), spend.vout[0].nValue);
+        UniValue spent = CallRPC(strSpentQuery);
+        BOOST_CHECK_EQUAL(find_value(spent, "txid").get_str(), txid);
+        BOOST_CHECK_EQUAL(find_value(spent, "height").get_int(), -1);
+
+        // Mined, it leaves the mempool indexes and the spent info comes from the block instead
+        CreateAndProcessBlock({spend}, scriptCoinbase);
+        BOOST_CHECK(!mempool.exists(spend.GetHash()));
+        BOOST_CHECK(CallRPC(strAddressQuery).empty());
+        spent = CallRPC(strSpentQuery);
+        BOOST_CHECK_EQUAL(find_value(spent, "txid").get_str(), txid);
+        BOOST_CHECK_EQUAL(find_value(spent, "height").get_int(), chainActive.Height());
+
+        // Disconnected by a reorg, it returns to the mempool and to its indexes
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_REQUIRE(InvalidateBlock(state, Params(), chainActive.Tip()));
+        }
+        BOOST_CHECK(mempool.exists(spend.GetHash()));
+        deltas = CallRPC(strAddressQuery);
+        BOOST_REQUIRE_EQUAL(deltas.size(), 1);
+        BOOST_CHECK_EQUAL(find_value(deltas[0], "txid").get_str(), txid);
+        spent = CallRPC(strSpentQuery);
+        BOOST_CHECK_EQUAL(find_value(spent, "height").get_int(), -1);
+
+        // Removed from the mempool, it is gone from both indexes
+        mempool.removeRecursive(spend);
+        BOOST_CHECK(CallRPC(strAddressQuery).empty());
+        BOOST_CHECK_THROW(CallRPC(strSpentQuery), std::runtime_error);
+
+        fAddressIndex = false;
+        fSpentIndex = false;
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
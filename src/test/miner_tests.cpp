@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "assets/assets.h"
+#include "base58.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/consensus.h"
@@ -10,9 +12,11 @@
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
 #include "validation.h"
+#include "key.h"
 #include "miner.h"
 #include "policy/policy.h"
 #include "pubkey.h"
+#include "script/sign.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -281,6 +285,65 @@ BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
         BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
     }
 
+    // Test that packages that don't fit into the asset ops budget of the block are
+    // skipped, while the ones after them are still added. Assets aren't active on
+    // this chain, so no asset output may end up in a valid template.
+    void TestAssetOpsBudget(const CChainParams &chainparams, CScript scriptPubKey, std::vector<CTransactionRef> &txFirst)
+    {
+        TestMemPoolEntryHelper entry;
+        CScript scriptBurn = GetScriptForDestination(DecodeDestination(Params().GlobalBurnAddress()));
+
+        // This tx has the highest fee, and issues an asset with its owner token
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+        tx.vin[0].prevout.n = 0;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 5000000000LL - 100000;
+        CNewAsset asset("BUDGET", COIN);
+        CScript scriptIssue = scriptBurn;
+        asset.ConstructTransaction(scriptIssue);
+        CScript scriptOwner = scriptBurn;
+        asset.ConstructOwnerTransaction(scriptOwner);
+        tx.vout.emplace_back(CTxOut(0, scriptOwner));
+        tx.vout.emplace_back(CTxOut(0, scriptIssue));
+        uint256 hashIssueTx = tx.GetHash();
+        mempool.addUnchecked(hashIssueTx, entry.Fee(100000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+        // This tx has a high fee, and transfers an asset
+        tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 5000000000LL - 50000;
+        CScript scriptTransfer = scriptBurn;
+        CAssetTransfer("BUDGET", COIN).ConstructTransaction(scriptTransfer);
+        tx.vout.emplace_back(CTxOut(0, scriptTransfer));
+        uint256 hashTransferTx = tx.GetHash();
+        mempool.addUnchecked(hashTransferTx, entry.Fee(50000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+        // This tx has a low fee and no asset outputs
+        tx.vin[0].prevout.hash = txFirst[2]->GetHash();
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 5000000000LL - 10000;
+        uint256 hashPlainTx = tx.GetHash();
+        mempool.addUnchecked(hashPlainTx, entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+        BOOST_CHECK_EQUAL(mempool.mapTx.find(hashIssueTx)->GetAssetOps(), 2);
+        BOOST_CHECK_EQUAL(mempool.mapTx.find(hashTransferTx)->GetAssetOps(), 1);
+        BOOST_CHECK_EQUAL(mempool.mapTx.find(hashPlainTx)->GetAssetOps(), 0);
+
+        // Without any budget left both asset packages are passed over for the cheaper plain one
+        BlockAssembler::Options options;
+        options.nBlockMaxWeight = MAX_BLOCK_WEIGHT;
+        options.blockMinFeeRate = blockMinFeeRate;
+        options.nBlockMaxAssetOps = 0;
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+        BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2);
+        BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hashPlainTx);
+
+        mempool.clear();
+    }
+
     // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
     BOOST_AUTO_TEST_CASE(createnewblock_validity_test)
     {
@@ -654,7 +717,297 @@ BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
 
         TestPackageSelection(chainparams, scriptPubKey, txFirst);
 
+        mempool.clear();
+        TestAssetOpsBudget(chainparams, scriptPubKey, txFirst);
+
         fCheckpointsEnabled = true;
     }
 
+    // Run the scheduler's queue, and the validation interface callbacks it holds, on this thread until it is empty
+    static void DrainScheduler(CScheduler& scheduler)
+    {
+        scheduler.stop(true);
+        scheduler.serviceQueue();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(blocktemplate_updater_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Block Template Updater Test");
+
+        CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        // Only the first coinbase is mature, the second transaction spends the first
+        std::vector<CTransactionRef> vSpends;
+        for (int i = 0; i < 2; i++) {
+            CMutableTransaction spend;
+            spend.nVersion = 1;
+            spend.vin.resize(1);
+            spend.vin[0].prevout.hash = i == 0 ? coinbaseTxns[0].GetHash() : vSpends[0]->GetHash();
+            spend.vin[0].prevout.n = 0;
+            spend.vout.resize(1);
+            spend.vout[0].nValue = (11 - i) * CENT;
+            spend.vout[0].scriptPubKey = scriptPubKey;
+
+            std::vector<unsigned char> vchSig;
+            uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+            BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+            vchSig.push_back((unsigned char) SIGHASH_ALL);
+            spend.vin[0].scriptSig << vchSig;
+            vSpends.push_back(MakeTransactionRef(spend));
+        }
+        auto addToMempool = [](const CTransactionRef& tx) {
+            LOCK(cs_main);
+            CValidationState state;
+            return AcceptToMemoryPool(mempool, state, tx, nullptr, nullptr, true, 0);
+        };
+
+        int64_t nTime = GetTime();
+        SetMockTime(nTime);
+        DrainScheduler(scheduler);
+        StartBlockTemplateUpdates();
+        const CBlockIndex* pindexTip = chainActive.Tip();
+        bool fWitness = Params().GetConsensus().nSegwitEnabled;
+        uint64_t nUpdates = GetBlockTemplateUpdateCount();
+        unsigned int nTransactionsUpdated;
+
+        // Nothing is built before a template is asked for
+        BOOST_CHECK(addToMempool(vSpends[0]));
+        DrainScheduler(scheduler);
+        SyncWithBlockTemplateUpdates();
+        BOOST_CHECK_EQUAL(GetBlockTemplateUpdateCount(), nUpdates);
+
+        // The first request builds one in the background
+        BOOST_CHECK(!GetUpdatedBlockTemplate(pindexTip, fWitness, nTransactionsUpdated));
+        DrainScheduler(scheduler);
+        SyncWithBlockTemplateUpdates();
+        BOOST_CHECK_EQUAL(GetBlockTemplateUpdateCount(), ++nUpdates);
+        std::unique_ptr<CBlockTemplate> pblocktemplate = GetUpdatedBlockTemplate(pindexTip, fWitness, nTransactionsUpdated);
+        BOOST_CHECK(pblocktemplate);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+        BOOST_CHECK_EQUAL(nTransactionsUpdated, mempool.GetTransactionsUpdated());
+
+        // Nobody asked for a template for a while, a new transaction doesn't rebuild it
+        SetMockTime(nTime += BLOCK_TEMPLATE_IDLE_TIMEOUT + 1);
+        BOOST_CHECK(addToMempool(vSpends[1]));
+        DrainScheduler(scheduler);
+        SyncWithBlockTemplateUpdates();
+        BOOST_CHECK_EQUAL(GetBlockTemplateUpdateCount(), nUpdates);
+
+        // Nor is the stale one served when someone asks again, it is rebuilt instead
+        BOOST_CHECK(!GetUpdatedBlockTemplate(pindexTip, fWitness, nTransactionsUpdated));
+        DrainScheduler(scheduler);
+        SyncWithBlockTemplateUpdates();
+        BOOST_CHECK_EQUAL(GetBlockTemplateUpdateCount(), ++nUpdates);
+        pblocktemplate = GetUpdatedBlockTemplate(pindexTip, fWitness, nTransactionsUpdated);
+        BOOST_CHECK(pblocktemplate);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+
+        // Neither the tip nor the mempool changed, the next request after an idle period doesn't rebuild it
+        SetMockTime(nTime += BLOCK_TEMPLATE_IDLE_TIMEOUT + 1);
+        BOOST_CHECK(!GetUpdatedBlockTemplate(pindexTip, fWitness, nTransactionsUpdated));
+        DrainScheduler(scheduler);
+        SyncWithBlockTemplateUpdates();
+        BOOST_CHECK_EQUAL(GetBlockTemplateUpdateCount(), nUpdates);
+        BOOST_CHECK(GetUpdatedBlockTemplate(pindexTip, fWitness, nTransactionsUpdated));
+
+        StopBlockTemplateUpdates();
+        SetMockTime(0);
+        mempool.clear();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(extend_block_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Extend Block Test");
+
+        CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        // The first spends the mature coinbase into two outputs, the other two spend one each
+        std::vector<CTransactionRef> vSpends;
+        for (int i = 0; i < 3; i++) {
+            CMutableTransaction spend;
+            spend.nVersion = 1;
+            spend.vin.resize(1);
+            spend.vin[0].prevout.hash = i == 0 ? coinbaseTxns[0].GetHash() : vSpends[0]->GetHash();
+            spend.vin[0].prevout.n = i == 0 ? 0 : i - 1;
+            spend.vout.resize(i == 0 ? 2 : 1);
+            for (CTxOut& txout : spend.vout) {
+                txout.nValue = (i == 0 ? 20 : 9) * CENT;
+                txout.scriptPubKey = scriptPubKey;
+            }
+
+            std::vector<unsigned char> vchSig;
+            uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+            BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+            vchSig.push_back((unsigned char) SIGHASH_ALL);
+            spend.vin[0].scriptSig << vchSig;
+            vSpends.push_back(MakeTransactionRef(spend));
+        }
+        auto addToMempool = [](const CTransactionRef& tx) {
+            LOCK(cs_main);
+            CValidationState state;
+            return AcceptToMemoryPool(mempool, state, tx, nullptr, nullptr, true, 0);
+        };
+        const CChainParams& chainparams = Params();
+        CAmount nSubsidy = GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus());
+        CAmount nFirstFee = coinbaseTxns[0].vout[0].nValue - 40 * CENT;
+
+        BOOST_CHECK(addToMempool(vSpends[0]));
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+        BOOST_CHECK(pblocktemplate);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+
+        // New transactions are appended behind the ones already in the template
+        BOOST_CHECK(addToMempool(vSpends[1]));
+        BOOST_CHECK(addToMempool(vSpends[2]));
+        pblocktemplate = BlockAssembler(chainparams).ExtendBlock(*pblocktemplate, scriptPubKey);
+        BOOST_CHECK(pblocktemplate);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+        BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == vSpends[0]->GetHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->vout[0].nValue, nSubsidy + nFirstFee + 22 * CENT);
+
+        // A transaction that left the mempool is dropped, along with its fees
+        mempool.removeRecursive(*vSpends[1]);
+        pblocktemplate = BlockAssembler(chainparams).ExtendBlock(*pblocktemplate, scriptPubKey);
+        BOOST_CHECK(pblocktemplate);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+        BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == vSpends[0]->GetHash());
+        BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == vSpends[2]->GetHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->vout[0].nValue, nSubsidy + nFirstFee + 11 * CENT);
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_CHECK(TestBlockValidity(state, chainparams, pblocktemplate->block, chainActive.Tip(), false, false));
+        }
+
+        // A template built on another tip can't be extended
+        pblocktemplate->block.hashPrevBlock = uint256();
+        BOOST_CHECK(!BlockAssembler(chainparams).ExtendBlock(*pblocktemplate, scriptPubKey));
+
+        mempool.clear();
+    }
+
+    BOOST_FIXTURE_TEST_CASE(miner_shared_template_test, TestChain100Setup)
+    {
+        BOOST_TEST_MESSAGE("Running Miner Shared Template Test");
+
+        CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        CMinerSharedTemplate shared;
+
+        // There is no wallet to take a coinbase script from
+        std::shared_ptr<const CBlockTemplate> ptemplate;
+        const CBlockIndex* pindexPrev;
+        uint64_t nGeneration;
+        shared.coinbaseScript = std::make_shared<CReserveScript>();
+        BOOST_CHECK_THROW(GetSharedTemplate(shared, nullptr, ptemplate, pindexPrev, nGeneration), std::runtime_error);
+        shared.coinbaseScript->reserveScript = scriptPubKey;
+
+        int64_t nTime = GetTime();
+        SetMockTime(nTime);
+
+        // The first thread builds the template, the others get the same one
+        BOOST_CHECK(GetSharedTemplate(shared, nullptr, ptemplate, pindexPrev, nGeneration));
+        BOOST_CHECK_EQUAL(nGeneration, 1U);
+        BOOST_CHECK(pindexPrev == chainActive.Tip());
+        BOOST_CHECK_EQUAL(ptemplate->block.vtx.size(), 1);
+        BOOST_CHECK(ptemplate->block.vtx[0]->vout[0].scriptPubKey == scriptPubKey);
+        std::shared_ptr<const CBlockTemplate> pother;
+        const CBlockIndex* pindexOther;
+        uint64_t nOtherGeneration;
+        BOOST_CHECK(GetSharedTemplate(shared, nullptr, pother, pindexOther, nOtherGeneration));
+        BOOST_CHECK(pother == ptemplate);
+        BOOST_CHECK(pindexOther == pindexPrev);
+        BOOST_CHECK_EQUAL(nOtherGeneration, nGeneration);
+
+        // A new transaction is only picked up once the template is a minute old
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+        spend.vin[0].prevout.n = 0;
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 11 * CENT;
+        spend.vout[0].scriptPubKey = scriptPubKey;
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char) SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spend), nullptr, nullptr, true, 0));
+        }
+
+        BOOST_CHECK(GetSharedTemplate(shared, nullptr, pother, pindexOther, nOtherGeneration));
+        BOOST_CHECK(pother == ptemplate);
+        BOOST_CHECK_EQUAL(nOtherGeneration, 1U);
+
+        SetMockTime(nTime += 61);
+        BOOST_CHECK(GetSharedTemplate(shared, nullptr, pother, pindexOther, nOtherGeneration));
+        BOOST_CHECK(pother != ptemplate);
+        BOOST_CHECK_EQUAL(nOtherGeneration, 2U);
+        BOOST_CHECK_EQUAL(pother->block.vtx.size(), 2);
+        // The thread still holding the first one sees that it is stale
+        BOOST_CHECK(shared.nGeneration != nGeneration);
+        // Its copy is left alone
+        BOOST_CHECK_EQUAL(ptemplate->block.vtx.size(), 1);
+
+        // A new tip rebuilds it right away
+        SetMockTime(0);
+        CreateAndProcessBlock({spend}, scriptPubKey);
+        BOOST_CHECK(GetSharedTemplate(shared, nullptr, ptemplate, pindexPrev, nGeneration));
+        BOOST_CHECK_EQUAL(nGeneration, 3U);
+        BOOST_CHECK(pindexPrev == chainActive.Tip());
+        BOOST_CHECK_EQUAL(ptemplate->block.vtx.size(), 1);
+        BOOST_CHECK(ptemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    }
+
+    BOOST_AUTO_TEST_CASE(miner_extranonce_test)
+    {
+        BOOST_TEST_MESSAGE("Running Miner Extranonce Test");
+
+        // Three threads start on their own extranonces
+        uint64_t nLastGeneration = 0;
+        unsigned int nExtraNonce = GetMinerExtraNonce(0, nLastGeneration, 1, 1, 3);
+        BOOST_CHECK_EQUAL(nExtraNonce, 2U);
+        BOOST_CHECK_EQUAL(nLastGeneration, 1U);
+
+        // Restarting on the same generation continues after the last one searched, instead of starting over
+        nExtraNonce += 3;
+        nExtraNonce = GetMinerExtraNonce(nExtraNonce, nLastGeneration, 1, 1, 3);
+        BOOST_CHECK_EQUAL(nExtraNonce, 8U);
+
+        // A new generation starts over
+        nExtraNonce = GetMinerExtraNonce(nExtraNonce, nLastGeneration, 2, 1, 3);
+        BOOST_CHECK_EQUAL(nExtraNonce, 2U);
+        BOOST_CHECK_EQUAL(nLastGeneration, 2U);
+    }
+
+    BOOST_AUTO_TEST_CASE(miner_thread_info_test)
+    {
+        BOOST_TEST_MESSAGE("Running Miner Thread Info Test");
+
+        std::vector<CMinerThreadInfo> vInfo;
+        GetMinerThreadInfo(vInfo);
+        BOOST_CHECK(vInfo.empty());
+
+        // Without a wallet the threads wait for one, so they don't hash anything
+        GenerateRavens(true, 3, Params());
+        GetMinerThreadInfo(vInfo);
+        BOOST_REQUIRE_EQUAL(vInfo.size(), 3);
+        for (size_t i = 0; i < vInfo.size(); i++) {
+            BOOST_CHECK_EQUAL(vInfo[i].nThread, (int)i);
+            BOOST_CHECK_EQUAL(vInfo[i].nHashesDone, 0U);
+            BOOST_CHECK_EQUAL(vInfo[i].dHashesPerSec, 0);
+        }
+
+        // Restarting with fewer threads replaces the statistics
+        GenerateRavens(true, 1, Params());
+        GetMinerThreadInfo(vInfo);
+        BOOST_REQUIRE_EQUAL(vInfo.size(), 1);
+        BOOST_CHECK_EQUAL(vInfo[0].nThread, 0);
+
+        GenerateRavens(false, 0, Params());
+        GetMinerThreadInfo(vInfo);
+        BOOST_CHECK(vInfo.empty());
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,10 @@
 #include "chainparams.h"
 #include "util.h"
 
+#ifdef USE_EPOLL
+#include <sys/socket.h>
+#endif
+
 class CAddrManSerializationMock : public CAddrMan
 {
 public:
@@ -72,6 +76,90 @@ CDataStream AddrmanToStream(CAddrManSerializationMock &_addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+#ifdef USE_EPOLL
+struct CConnmanTest
+{
+    static bool StartSocketEvents(CConnman& connman)
+    {
+        return connman.StartSocketEvents();
+    }
+
+    static void AddNode(CConnman& connman, CNode* pnode)
+    {
+        LOCK(connman.cs_vNodes);
+        connman.vNodes.push_back(pnode);
+        connman.RegisterNodeEvents(pnode);
+    }
+
+    static void RegisterNodeEvents(CConnman& connman, CNode* pnode)
+    {
+        connman.RegisterNodeEvents(pnode);
+    }
+
+    // The same as the socket thread does for disconnected nodes
+    static void RemoveNode(CConnman& connman, CNode* pnode)
+    {
+        LOCK(connman.cs_vNodes);
+        connman.vNodes.erase(std::remove(connman.vNodes.begin(), connman.vNodes.end(), pnode), connman.vNodes.end());
+        connman.setReceivableNodes.erase(pnode);
+    }
+
+    static void SocketEvents(CConnman& connman)
+    {
+        connman.SocketEventsEpoll();
+    }
+
+    static bool IsReceivable(const CConnman& connman, CNode* pnode)
+    {
+        return connman.setReceivableNodes.count(pnode) != 0;
+    }
+};
+
+//! A node on one end of a socket pair, the test writes to the other end
+static CNode* MakeSocketPairNode(NodeId id, SOCKET& hPeerSocket)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    hPeerSocket = fds[1];
+    return new CNode(id, NODE_NETWORK, 0, fds[0], CAddress(), 0, 0, CAddress(), "", true);
+}
+
+static std::vector<unsigned char> MakeWireMessage(const char* pszCommand, unsigned int nPayloadSize)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, nPayloadSize);
+    std::vector<unsigned char> vMsg(ss.begin(), ss.end());
+    for (unsigned int i = 0; i < nPayloadSize; i++)
+        vMsg.push_back(i * 7);
+    return vMsg;
+}
+
+static void SendAll(SOCKET hSocket, const std::vector<unsigned char>& vData)
+{
+    size_t nSent = 0;
+    while (nSent < vData.size()) {
+        ssize_t nBytes = send(hSocket, vData.data() + nSent, vData.size() - nSent, MSG_NOSIGNAL);
+        BOOST_REQUIRE(nBytes > 0);
+        nSent += nBytes;
+    }
+}
+
+static size_t ProcessQueueSize(CNode* pnode)
+{
+    LOCK(pnode->cs_vProcessMsg);
+    return pnode->vProcessMsg.size();
+}
+
+static void StartEpollConnman(CConnman& connman)
+{
+    CConnman::Options options;
+    options.socketEventsMode = SOCKETEVENTS_EPOLL;
+    options.nReceiveFloodSize = 5 * 1000 * 1000;
+    connman.Init(options);
+    BOOST_REQUIRE(CConnmanTest::StartSocketEvents(connman));
+}
+#endif
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
     BOOST_AUTO_TEST_CASE(cnode_listen_port_test)
@@ -198,4 +286,207 @@ BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
         BOOST_CHECK(pnode2->fFeeler == false);
     }
 
+    BOOST_AUTO_TEST_CASE(cnetmessage_direct_recv_test)
+    {
+        std::vector<unsigned char> vPayload(300 * 1024);
+        for (unsigned int i = 0; i < vPayload.size(); i++)
+            vPayload[i] = i * 7;
+
+        CMessageHeader hdr(Params().MessageStart(), "block", vPayload.size());
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader << hdr;
+
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+        char* pch = nullptr;
+        unsigned int nSize = 0;
+        BOOST_CHECK(!msg.GetDataBuffer(pch, nSize));
+        BOOST_CHECK_EQUAL(msg.readHeader(ssHeader.data(), ssHeader.size()), (int)ssHeader.size());
+        BOOST_CHECK(msg.in_data);
+
+        // The first bytes go through the copying path
+        BOOST_CHECK_EQUAL(msg.readData((const char*)vPayload.data(), 1000), 1000);
+
+        // The rest is written in place, in parts of at most 256 KiB
+        unsigned int nPos = 1000;
+        while (msg.GetDataBuffer(pch, nSize)) {
+            BOOST_CHECK(nSize <= 256 * 1024U);
+            memcpy(pch, vPayload.data() + nPos, nSize);
+            BOOST_CHECK_EQUAL(msg.readData(pch, nSize), (int)nSize);
+            nPos += nSize;
+        }
+        BOOST_CHECK(!msg.complete());
+        BOOST_CHECK(vPayload.size() - nPos < 64 * 1024U);
+        BOOST_CHECK_EQUAL(msg.readData((const char*)vPayload.data() + nPos, vPayload.size() - nPos), (int)(vPayload.size() - nPos));
+
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK(std::equal(vPayload.begin(), vPayload.end(), (const unsigned char*)msg.vRecv.data()));
+        BOOST_CHECK(msg.GetMessageHash() == Hash(vPayload.begin(), vPayload.end()));
+    }
+
+    BOOST_AUTO_TEST_CASE(cconnman_share_message_test)
+    {
+        CSerializedNetMsg msg;
+        msg.command = "tx";
+        msg.data.assign(1000, 0x42);
+        uint256 hash = Hash(msg.data.begin(), msg.data.end());
+
+        CSharedNetMsg shared = CConnman::ShareMessage(std::move(msg));
+        BOOST_CHECK_EQUAL(shared.command, "tx");
+        BOOST_CHECK(shared.data && shared.data->size() == 1000U);
+        BOOST_CHECK(shared.header && shared.header->size() == (size_t)CMessageHeader::HEADER_SIZE);
+
+        CMessageHeader hdr(Params().MessageStart());
+        CDataStream(*shared.header, SER_NETWORK, PROTOCOL_VERSION) >> hdr;
+        BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+        BOOST_CHECK_EQUAL(hdr.GetCommand(), "tx");
+        BOOST_CHECK_EQUAL(hdr.nMessageSize, 1000U);
+        BOOST_CHECK(memcmp(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE) == 0);
+
+        // Empty messages have no payload buffer to queue
+        CSerializedNetMsg empty;
+        empty.command = "verack";
+        BOOST_CHECK(!CConnman::ShareMessage(std::move(empty)).data);
+    }
+
+    BOOST_AUTO_TEST_CASE(message_timing_stats_test)
+    {
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(0), 0);
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(1), 0);
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(2), 1);
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(3), 2);
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(1024), 10);
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(1025), 11);
+        BOOST_CHECK_EQUAL(CMessageTimingStats::GetBucket(std::numeric_limits<int64_t>::max()), MSG_TIMING_BUCKETS - 1);
+
+        CMessageTimingStats timing;
+        timing.Add(100, 5000, 10, 0);
+        timing.Add(3, 0, 0, 40);
+        BOOST_CHECK_EQUAL(timing.nCount, 2U);
+        BOOST_CHECK_EQUAL(timing.nProcessMicros, 103);
+        BOOST_CHECK_EQUAL(timing.nQueueMicros, 5000);
+        BOOST_CHECK_EQUAL(timing.nLockWaitMicros, 10);
+        BOOST_CHECK_EQUAL(timing.nHashMicros, 40);
+        BOOST_CHECK_EQUAL(timing.vProcessBuckets[7], 1U);
+        BOOST_CHECK_EQUAL(timing.vProcessBuckets[2], 1U);
+        BOOST_CHECK_EQUAL(timing.vQueueBuckets[13], 1U);
+        BOOST_CHECK_EQUAL(timing.vQueueBuckets[0], 1U);
+
+        CMessageTimingStats total;
+        total += timing;
+        total += timing;
+        BOOST_CHECK_EQUAL(total.nCount, 4U);
+        BOOST_CHECK_EQUAL(total.nProcessMicros, 206);
+        BOOST_CHECK_EQUAL(total.vProcessBuckets[7], 2U);
+    }
+
+#ifdef USE_EPOLL
+    BOOST_AUTO_TEST_CASE(epoll_register_test)
+    {
+        CConnman connman(0x1337, 0x1337);
+        StartEpollConnman(connman);
+
+        SOCKET hPeer1, hPeer2;
+        std::unique_ptr<CNode> pnode1(MakeSocketPairNode(1, hPeer1));
+        std::unique_ptr<CNode> pnode2(MakeSocketPairNode(2, hPeer2));
+        CConnmanTest::AddNode(connman, pnode1.get());
+        CConnmanTest::AddNode(connman, pnode2.get());
+        BOOST_CHECK(!pnode1->fDisconnect);
+        BOOST_CHECK(!pnode2->fDisconnect);
+
+        // A socket is only registered once, a failure disconnects the node
+        CConnmanTest::RegisterNodeEvents(connman, pnode1.get());
+        BOOST_CHECK(pnode1->fDisconnect);
+        pnode1->fDisconnect = false;
+
+        // Nodes without a socket are skipped
+        std::unique_ptr<CNode> pnode3(new CNode(3, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(), 0, 0, CAddress(), "", true));
+        CConnmanTest::RegisterNodeEvents(connman, pnode3.get());
+        BOOST_CHECK(!pnode3->fDisconnect);
+
+        // Nothing to read yet
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(!CConnmanTest::IsReceivable(connman, pnode1.get()));
+        BOOST_CHECK(!CConnmanTest::IsReceivable(connman, pnode2.get()));
+
+        // Only the node that was written to is read from, until recv() would block
+        SendAll(hPeer1, MakeWireMessage("ping", 8));
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(CConnmanTest::IsReceivable(connman, pnode1.get()));
+        BOOST_CHECK(!CConnmanTest::IsReceivable(connman, pnode2.get()));
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode1.get()), 1U);
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode2.get()), 0U);
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(!CConnmanTest::IsReceivable(connman, pnode1.get()));
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode1.get()), 1U);
+
+        // Closing the socket of a node with data left unregisters it
+        SendAll(hPeer1, MakeWireMessage("block", 100 * 1000));
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(CConnmanTest::IsReceivable(connman, pnode1.get()));
+        pnode1->CloseSocketDisconnect();
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(!CConnmanTest::IsReceivable(connman, pnode1.get()));
+        CConnmanTest::RemoveNode(connman, pnode1.get());
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode1.get()), 1U);
+
+        // The remaining node still gets its events
+        SendAll(hPeer2, MakeWireMessage("ping", 8));
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(CConnmanTest::IsReceivable(connman, pnode2.get()));
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode2.get()), 1U);
+
+        CConnmanTest::RemoveNode(connman, pnode2.get());
+        CloseSocket(hPeer1);
+        CloseSocket(hPeer2);
+    }
+
+    BOOST_AUTO_TEST_CASE(epoll_partial_read_test)
+    {
+        CConnman connman(0x1337, 0x1337);
+        StartEpollConnman(connman);
+
+        SOCKET hPeer;
+        std::unique_ptr<CNode> pnode(MakeSocketPairNode(1, hPeer));
+        CConnmanTest::AddNode(connman, pnode.get());
+
+        // Larger than one read, but the socket only becomes readable once
+        std::vector<unsigned char> vMsg = MakeWireMessage("block", 100 * 1000);
+        SendAll(hPeer, vMsg);
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(CConnmanTest::IsReceivable(connman, pnode.get()));
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode.get()), 0U);
+        BOOST_CHECK(pnode->nRecvBytes < vMsg.size());
+
+        // The rest is read without another edge
+        int nRounds = 1;
+        while (CConnmanTest::IsReceivable(connman, pnode.get()) && nRounds < 100) {
+            CConnmanTest::SocketEvents(connman);
+            nRounds++;
+        }
+        BOOST_CHECK(nRounds > 2);
+        BOOST_CHECK(!CConnmanTest::IsReceivable(connman, pnode.get()));
+        BOOST_CHECK_EQUAL(pnode->nRecvBytes, vMsg.size());
+        BOOST_REQUIRE_EQUAL(ProcessQueueSize(pnode.get()), 1U);
+        {
+            LOCK(pnode->cs_vProcessMsg);
+            const CNetMessage& msg = pnode->vProcessMsg.front();
+            BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "block");
+            BOOST_CHECK(std::equal(vMsg.begin() + CMessageHeader::HEADER_SIZE, vMsg.end(), (const unsigned char*)msg.vRecv.data()));
+        }
+
+        // A paused node keeps its place, and is read from once it is resumed
+        pnode->fPauseRecv = true;
+        SendAll(hPeer, MakeWireMessage("ping", 8));
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK(CConnmanTest::IsReceivable(connman, pnode.get()));
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode.get()), 1U);
+        pnode->fPauseRecv = false;
+        CConnmanTest::SocketEvents(connman);
+        BOOST_CHECK_EQUAL(ProcessQueueSize(pnode.get()), 2U);
+
+        CConnmanTest::RemoveNode(connman, pnode.get());
+        CloseSocket(hPeer);
+    }
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "streams.h"
 #include "support/allocators/zeroafterfree.h"
 #include "test/test_raven.h"
@@ -125,4 +126,35 @@ BOOST_FIXTURE_TEST_SUITE(streams_tests, BasicTestingSetup)
                 std::string(ds.begin(), ds.end()));
     }
 
+    BOOST_AUTO_TEST_CASE(streams_buffer_reader_test)
+    {
+        BOOST_TEST_MESSAGE("Running Streams Buffer Reader Test");
+
+        const unsigned char data[] = {0xf9, 0xbe, 0xb4, 0xd9, 0x02, 0x00, 0x00, 0x00, 0x11, 0x22};
+
+        // Start reading past the magic
+        CBufferReader reader(SER_DISK, CLIENT_VERSION, data, sizeof(data), 4);
+        BOOST_CHECK_EQUAL(reader.size(), 6U);
+
+        unsigned int nSize;
+        reader >> nSize;
+        BOOST_CHECK_EQUAL(nSize, 2U);
+
+        unsigned char a, b;
+        reader >> a >> b;
+        BOOST_CHECK_EQUAL(a, 0x11);
+        BOOST_CHECK_EQUAL(b, 0x22);
+        BOOST_CHECK(reader.empty());
+
+        // Reading past the end of the buffer throws
+        BOOST_CHECK_THROW(reader >> a, std::ios_base::failure);
+        BOOST_CHECK_THROW(CBufferReader(SER_DISK, CLIENT_VERSION, data, sizeof(data), sizeof(data) + 1), std::ios_base::failure);
+
+        CBufferReader reader2(SER_DISK, CLIENT_VERSION, data, sizeof(data), 8);
+        BOOST_CHECK_THROW(reader2 >> nSize, std::ios_base::failure);
+        // A failed read doesn't move the position
+        reader2 >> a;
+        BOOST_CHECK_EQUAL(a, 0x11);
+    }
+
 BOOST_AUTO_TEST_SUITE_END()
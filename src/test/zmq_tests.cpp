@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The Raven Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/common.h"
+#include "zmq/zmqpublishnotifier.h"
+
+#include "test/test_raven.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(zmq_tests, BasicTestingSetup)
+
+    static CZMQPublishMessage MakeMessage(uint32_t nSequence, size_t nSize)
+    {
+        CZMQPublishMessage message;
+        message.command = "test";
+        message.data.assign(nSize, (unsigned char)nSequence);
+        message.nSequence = nSequence;
+        return message;
+    }
+
+    //! Receive the three parts of a queued message
+    static bool ReceiveMessage(void *psocket, CZMQPublishMessage &message)
+    {
+        std::vector<std::vector<unsigned char> > parts;
+        int more = 1;
+        while (more) {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            if (zmq_msg_recv(&msg, psocket, 0) == -1) {
+                zmq_msg_close(&msg);
+                return false;
+            }
+            const unsigned char *data = (const unsigned char *)zmq_msg_data(&msg);
+            parts.emplace_back(data, data + zmq_msg_size(&msg));
+            more = zmq_msg_more(&msg);
+            zmq_msg_close(&msg);
+        }
+        if (parts.size() != 3 || parts[2].size() != sizeof(uint32_t))
+            return false;
+
+        message.command.assign(parts[0].begin(), parts[0].end());
+        message.data = parts[1];
+        message.nSequence = ReadLE32(parts[2].data());
+        return true;
+    }
+
+    BOOST_AUTO_TEST_CASE(zmq_publish_queue_test)
+    {
+        BOOST_TEST_MESSAGE("Running ZMQ Publish Queue Test");
+
+        const std::string address = "inproc://zmq_publish_queue_test";
+        void *pcontext = zmq_ctx_new();
+        BOOST_REQUIRE(pcontext);
+
+        // A PUSH socket without a peer blocks the sending thread on its first
+        // message, so the following ones stay in the queue
+        void *psocket = zmq_socket(pcontext, ZMQ_PUSH);
+        BOOST_REQUIRE(psocket);
+        BOOST_REQUIRE_EQUAL(zmq_bind(psocket, address.c_str()), 0);
+
+        void *preceiver = zmq_socket(pcontext, ZMQ_PULL);
+        BOOST_REQUIRE(preceiver);
+        int timeout = 10000;
+        zmq_setsockopt(preceiver, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+
+        {
+            const size_t nMessageSize = MakeMessage(0, 100).GetSize();
+            CZMQPublishQueue queue(psocket, address, 10 * nMessageSize);
+
+            // Only as many messages as fit into the byte limit are kept, plus the one being sent
+            std::vector<uint32_t> vAccepted;
+            for (uint32_t nSequence = 0; nSequence < 30; nSequence++) {
+                if (queue.Push(MakeMessage(nSequence, 100)))
+                    vAccepted.push_back(nSequence);
+            }
+            BOOST_CHECK(vAccepted.size() >= 10 && vAccepted.size() <= 11);
+            BOOST_CHECK_EQUAL(vAccepted.front(), 0U);
+
+            // Once a peer connects, the accepted messages are sent in order
+            BOOST_REQUIRE_EQUAL(zmq_connect(preceiver, address.c_str()), 0);
+            for (uint32_t nSequence : vAccepted) {
+                CZMQPublishMessage message;
+                BOOST_REQUIRE(ReceiveMessage(preceiver, message));
+                BOOST_CHECK_EQUAL(message.command, "test");
+                BOOST_CHECK_EQUAL(message.nSequence, nSequence);
+                BOOST_CHECK(message.data == MakeMessage(nSequence, 100).data);
+            }
+
+            // The queue is empty again, so even a message above the limit is taken
+            BOOST_CHECK(queue.Push(MakeMessage(100, 20 * nMessageSize)));
+            CZMQPublishMessage message;
+            BOOST_REQUIRE(ReceiveMessage(preceiver, message));
+            BOOST_CHECK_EQUAL(message.nSequence, 100U);
+            BOOST_CHECK_EQUAL(message.data.size(), 20 * nMessageSize);
+        }
+
+        zmq_close(preceiver);
+        zmq_ctx_destroy(pcontext);
+    }
+
+BOOST_AUTO_TEST_SUITE_END()
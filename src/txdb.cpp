@@ -88,14 +88,26 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
+//! Move past a written entry. The caller's cache is freed as it goes, a shared batch is left alone.
+static CCoinsMap::const_iterator NextWrittenCoin(CCoinsMap &mapCoins, CCoinsMap::const_iterator it) {
+    return mapCoins.erase(it);
+}
+
+static CCoinsMap::const_iterator NextWrittenCoin(const CCoinsMap &mapCoins, CCoinsMap::const_iterator it) {
+    return std::next(it);
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
-    size_t count = 0;
-    size_t changed = 0;
-    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
-    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
-    assert(!hashBlock.IsNull());
+    bool ret = WriteCoinsImpl(mapCoins, hashBlock, false);
+    mapCoins.clear();
+    return ret;
+}
 
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteCoinsImpl(mapCoins, hashBlock, true);
+}
+
+uint256 CCoinsViewDB::GetTransitionBase(const uint256 &hashBlock) const {
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
@@ -105,6 +117,27 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             old_tip = old_heads[1];
         }
     }
+    return old_tip;
+}
+
+bool CCoinsViewDB::BeginWrite(const uint256 &hashBlock) {
+    assert(!hashBlock.IsNull());
+    CDBBatch batch(db);
+    batch.Erase(DB_BEST_BLOCK);
+    batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, GetTransitionBase(hashBlock)});
+    return db.WriteBatch(batch, true);
+}
+
+template <typename Map>
+bool CCoinsViewDB::WriteCoinsImpl(Map &mapCoins, const uint256 &hashBlock, bool fSync) {
+    CDBBatch batch(db);
+    size_t count = 0;
+    size_t changed = 0;
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+    assert(!hashBlock.IsNull());
+
+    uint256 old_tip = GetTransitionBase(hashBlock);
 
     // In the first batch, mark the database as being in the middle of a
     // transition from old_tip to hashBlock.
@@ -113,7 +146,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -123,8 +156,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        it = NextWrittenCoin(mapCoins, it);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -144,7 +176,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Write(DB_BEST_BLOCK, hashBlock);
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
-    bool ret = db.WriteBatch(batch);
+    bool ret = db.WriteBatch(batch, fSync);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
@@ -351,20 +383,25 @@ bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKe
     return WriteBatch(batch);
 }
 
+static void SeekAddressIndex(CDBIterator& cursor, const uint160& addressHash, int type, const std::string& assetName,
+                             int start, int end) {
+    if (!assetName.empty() && start > 0 && end > 0) {
+        cursor.Seek(std::make_pair(DB_ADDRESSINDEX,
+                                   CAddressIndexIteratorHeightKey(type, addressHash, assetName, start)));
+    } else if (!assetName.empty()) {
+        cursor.Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorAssetKey(type, addressHash, assetName)));
+    } else {
+        cursor.Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type, std::string assetName,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (!assetName.empty() && start > 0 && end > 0) {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX,
-                                     CAddressIndexIteratorHeightKey(type, addressHash, assetName, start)));
-    } else if (!assetName.empty()) {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorAssetKey(type, addressHash, assetName)));
-    } else {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
-    }
+    SeekAddressIndex(*pcursor, addressHash, type, assetName, start, end);
 
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
@@ -396,6 +433,32 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     return CBlockTreeDB::ReadAddressIndex(addressHash, type, "", addressIndex, start, end);
 }
 
+CAddressIndexReader::CAddressIndexReader(CDBIterator& cursorIn, const uint160& addressHashIn, int type, const std::string& assetNameIn,
+                                         int start, int endIn)
+    : cursor(cursorIn), addressHash(addressHashIn), assetName(assetNameIn), end(endIn)
+{
+    SeekAddressIndex(cursor, addressHash, type, assetName, start, end);
+}
+
+bool CAddressIndexReader::Next(std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex, const size_t count)
+{
+    for (size_t nAdded = 0; nAdded < count; nAdded++) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        if (!cursor.Valid() || !cursor.GetKey(key) || key.first != DB_ADDRESSINDEX || key.second.hashBytes != addressHash
+                || (!assetName.empty() && key.second.asset != assetName) || (end > 0 && key.second.blockHeight > end))
+            return false;
+
+        CAmount nValue;
+        if (!cursor.GetValue(nValue))
+            return error("%s: failed to get address index value", __func__);
+        addressIndex.push_back(std::make_pair(key.second, nValue));
+        cursor.Next();
+    }
+
+    return true;
+}
+
 bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
     CDBBatch batch(*this);
     batch.Write(std::make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
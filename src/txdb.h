@@ -72,6 +72,12 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    //! The tip a write to hashBlock starts from, also while a previous write is still being replayed
+    uint256 GetTransitionBase(const uint256 &hashBlock) const;
+    //! Shared by BatchWrite and WriteCoins, entries are erased as they are written if mapCoins is mutable
+    template <typename Map>
+    bool WriteCoinsImpl(Map &mapCoins, const uint256 &hashBlock, bool fSync);
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -80,6 +86,11 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    //! Durably mark the database as moving to hashBlock, so a crash before the write finishes is replayed on startup
+    bool BeginWrite(const uint256 &hashBlock);
+    //! Write the dirty entries of mapCoins like BatchWrite, but leave the map untouched. The best block is only
+    //! committed, in a synced final batch, after all of them are written.
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
@@ -149,4 +160,23 @@ public:
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
+/**
+ * Reads the address index entries of an address a page at a time, with the same selection as
+ * CBlockTreeDB::ReadAddressIndex. Use a snapshot cursor so the pages fit together while blocks are connected.
+ */
+class CAddressIndexReader
+{
+private:
+    CDBIterator& cursor;
+    const uint160 addressHash;
+    const std::string assetName;
+    const int end;
+
+public:
+    CAddressIndexReader(CDBIterator& cursorIn, const uint160& addressHashIn, int type, const std::string& assetNameIn, int start = 0, int endIn = 0);
+
+    //! Append the next count entries to addressIndex, returns false once there are none left
+    bool Next(std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex, const size_t count);
+};
+
 #endif // RAVEN_TXDB_H
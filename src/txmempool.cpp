@@ -9,6 +9,7 @@
 #include "consensus/consensus.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
+#include "assets/assets.h"
 #include "validation.h"
 #include "policy/policy.h"
 #include "policy/fees.h"
@@ -20,6 +21,20 @@
 #include "utiltime.h"
 #include "hash.h"
 
+/** RVN START */
+// Every asset output, be it an issue, owner token, reissue, transfer or burn, touches the asset cache
+// and database when the block is connected
+static int64_t GetTransactionAssetOps(const CTransaction& tx)
+{
+    int64_t nAssetOps = 0;
+    for (const auto& out : tx.vout) {
+        if (out.scriptPubKey.IsAssetScript())
+            nAssetOps++;
+    }
+    return nAssetOps;
+}
+/** RVN END */
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
@@ -28,6 +43,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
 {
     nTxWeight = GetTransactionWeight(*tx);
     nUsageSize = RecursiveDynamicUsage(tx);
+    nAssetOps = GetTransactionAssetOps(*tx);
 
     nCountWithDescendants = 1;
     nSizeWithDescendants = GetTxSize();
@@ -39,6 +55,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+    nAssetOpsWithAncestors = nAssetOps;
 }
 
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
@@ -97,7 +114,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
             modifyCount++;
             cachedDescendants[updateIt].insert(cit);
             // Update ancestor state for each descendant
-            mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
+            mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost(), updateIt->GetAssetOps()));
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
@@ -236,12 +253,14 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
     int64_t updateSize = 0;
     CAmount updateFee = 0;
     int64_t updateSigOpsCost = 0;
+    int64_t updateAssetOps = 0;
     for (txiter ancestorIt : setAncestors) {
         updateSize += ancestorIt->GetTxSize();
         updateFee += ancestorIt->GetModifiedFee();
         updateSigOpsCost += ancestorIt->GetSigOpCost();
+        updateAssetOps += ancestorIt->GetAssetOps();
     }
-    mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOpsCost));
+    mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOpsCost, updateAssetOps));
 }
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
@@ -271,8 +290,9 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
             int64_t modifySize = -((int64_t)removeIt->GetTxSize());
             CAmount modifyFee = -removeIt->GetModifiedFee();
             int modifySigOps = -removeIt->GetSigOpCost();
+            int64_t modifyAssetOps = -removeIt->GetAssetOps();
             for (txiter dit : setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps, modifyAssetOps));
             }
         }
     }
@@ -319,7 +339,7 @@ void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFe
     assert(int64_t(nCountWithDescendants) > 0);
 }
 
-void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps)
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps, int64_t modifyAssetOps)
 {
     nSizeWithAncestors += modifySize;
     assert(int64_t(nSizeWithAncestors) > 0);
@@ -328,6 +348,8 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     assert(int64_t(nCountWithAncestors) > 0);
     nSigOpCostWithAncestors += modifySigOps;
     assert(int(nSigOpCostWithAncestors) >= 0);
+    nAssetOpsWithAncestors += modifyAssetOps;
+    assert(nAssetOpsWithAncestors >= 0);
 }
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
@@ -418,11 +440,31 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     return true;
 }
 
+const std::string* CTxMemPool::InternAddressAssetName(const std::string& assetName)
+{
+    auto it = mapAddressAssetNames.emplace(assetName, 0).first;
+    it->second++;
+    return &it->first;
+}
+
+void CTxMemPool::ReleaseAddressAssetName(const std::string* assetName)
+{
+    auto it = mapAddressAssetNames.find(*assetName);
+    if (it != mapAddressAssetNames.end() && --it->second == 0)
+        mapAddressAssetNames.erase(it);
+}
+
+void CTxMemPool::addAddressDelta(int type, const uint160& addressBytes, const std::string& assetName, const uint256& txhash, unsigned int index, int spending, const CMempoolAddressDelta& delta)
+{
+    const std::string* asset = InternAddressAssetName(assetName);
+    if (!mapAddress.insert(CMempoolAddressIndexEntry(type, addressBytes, asset, txhash, index, spending, delta)).second)
+        ReleaseAddressAssetName(asset);
+}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
-    std::vector<CMempoolAddressDeltaKey> inserted;
 
     uint256 txhash = tx.GetHash();
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
@@ -430,22 +472,16 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         const CTxOut &prevout = view.AccessCoin(input.prevout).out;
         if (prevout.scriptPubKey.IsPayToScriptHash()) {
             std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22);
-            CMempoolAddressDeltaKey key(2, uint160(hashBytes), RVN, txhash, j, 1);
             CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-            mapAddress.insert(std::make_pair(key, delta));
-            inserted.push_back(key);
+            addAddressDelta(2, uint160(hashBytes), RVN, txhash, j, 1, delta);
         } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
             std::vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23);
-            CMempoolAddressDeltaKey key(1, uint160(hashBytes), RVN, txhash, j, 1);
             CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-            mapAddress.insert(std::make_pair(key, delta));
-            inserted.push_back(key);
+            addAddressDelta(1, uint160(hashBytes), RVN, txhash, j, 1, delta);
         } else if (prevout.scriptPubKey.IsPayToPublicKey()) {
             uint160 hashBytes(Hash160(prevout.scriptPubKey.begin()+1, prevout.scriptPubKey.end()-1));
-            CMempoolAddressDeltaKey key(1, hashBytes, RVN, txhash, j, 1);
             CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-            mapAddress.insert(std::make_pair(key, delta));
-            inserted.push_back(key);
+            addAddressDelta(1, hashBytes, RVN, txhash, j, 1, delta);
         } else {
             /** RVN START */
             if (AreAssetsDeployed()) {
@@ -453,10 +489,8 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
                 std::string assetName;
                 CAmount assetAmount;
                 if (ParseAssetScript(prevout.scriptPubKey, hashBytes, assetName, assetAmount)) {
-                    CMempoolAddressDeltaKey key(1, hashBytes, assetName, txhash, j, 1);
                     CMempoolAddressDelta delta(entry.GetTime(), assetAmount * -1, input.prevout.hash, input.prevout.n);
-                    mapAddress.insert(std::make_pair(key, delta));
-                    inserted.push_back(key);
+                    addAddressDelta(1, hashBytes, assetName, txhash, j, 1, delta);
                 }
             }
             /** RVN END */
@@ -467,21 +501,13 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         const CTxOut &out = tx.vout[k];
         if (out.scriptPubKey.IsPayToScriptHash()) {
             std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-            CMempoolAddressDeltaKey key(2, uint160(hashBytes), RVN, txhash, k, 0);
-            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-            inserted.push_back(key);
+            addAddressDelta(2, uint160(hashBytes), RVN, txhash, k, 0, CMempoolAddressDelta(entry.GetTime(), out.nValue));
         } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
             std::vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-            std::pair<addressDeltaMap::iterator,bool> ret;
-            CMempoolAddressDeltaKey key(1, uint160(hashBytes), RVN, txhash, k, 0);
-            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-            inserted.push_back(key);
+            addAddressDelta(1, uint160(hashBytes), RVN, txhash, k, 0, CMempoolAddressDelta(entry.GetTime(), out.nValue));
         } else if (out.scriptPubKey.IsPayToPublicKey()) {
             uint160 hashBytes(Hash160(out.scriptPubKey.begin()+1, out.scriptPubKey.end()-1));
-            std::pair<addressDeltaMap::iterator,bool> ret;
-            CMempoolAddressDeltaKey key(1, hashBytes, RVN, txhash, k, 0);
-            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-            inserted.push_back(key);
+            addAddressDelta(1, hashBytes, RVN, txhash, k, 0, CMempoolAddressDelta(entry.GetTime(), out.nValue));
         } else {
             /** RVN START */
             if (AreAssetsDeployed()) {
@@ -489,29 +515,28 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
                 std::string assetName;
                 CAmount assetAmount;
                 if (ParseAssetScript(out.scriptPubKey, hashBytes, assetName, assetAmount)) {
-                    std::pair<addressDeltaMap::iterator, bool> ret;
-                    CMempoolAddressDeltaKey key(1, hashBytes, assetName, txhash, k, 0);
-                    mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(entry.GetTime(), assetAmount)));
-                    inserted.push_back(key);
+                    addAddressDelta(1, hashBytes, assetName, txhash, k, 0, CMempoolAddressDelta(entry.GetTime(), assetAmount));
                 }
             }
             /** RVN END */
         }
     }
-
-    mapAddressInserted.insert(std::make_pair(txhash, inserted));
 }
 
 bool CTxMemPool::getAddressIndex(std::vector<std::pair<uint160, int> > &addresses, std::string assetName,
                                  std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results)
 {
     LOCK(cs);
+    auto name = mapAddressAssetNames.find(assetName);
+    if (name == mapAddressAssetNames.end())
+        return true;
+
+    const std::string* asset = &name->first;
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        addressDeltaMap::iterator ait = mapAddress.lower_bound(CMempoolAddressDeltaKey((*it).second, (*it).first,
-                                                                                       assetName));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == (*it).first && (*ait).first.type == (*it).second
-                && (*ait).first.asset == assetName) {
-            results.push_back(*ait);
+        auto ait = mapAddress.lower_bound(CMempoolAddressIndexEntry((*it).second, (*it).first, asset, uint256(), 0, 0, CMempoolAddressDelta(0, 0)));
+        while (ait != mapAddress.end() && (*ait).addressBytes == (*it).first && (*ait).type == (*it).second
+                && (*ait).asset == asset) {
+            results.push_back(std::make_pair(CMempoolAddressDeltaKey(ait->type, ait->addressBytes, *ait->asset, ait->txhash, ait->index, ait->spending), ait->delta));
             ait++;
         }
     }
@@ -522,10 +547,11 @@ bool CTxMemPool::getAddressIndex(std::vector<std::pair<uint160, int> > &addresse
                                  std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > &results)
 {
     LOCK(cs);
+    static const std::string strEmpty;
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        addressDeltaMap::iterator ait = mapAddress.lower_bound(CMempoolAddressDeltaKey((*it).second, (*it).first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == (*it).first && (*ait).first.type == (*it).second) {
-            results.push_back(*ait);
+        auto ait = mapAddress.lower_bound(CMempoolAddressIndexEntry((*it).second, (*it).first, &strEmpty, uint256(), 0, 0, CMempoolAddressDelta(0, 0)));
+        while (ait != mapAddress.end() && (*ait).addressBytes == (*it).first && (*ait).type == (*it).second) {
+            results.push_back(std::make_pair(CMempoolAddressDeltaKey(ait->type, ait->addressBytes, *ait->asset, ait->txhash, ait->index, ait->spending), ait->delta));
             ait++;
         }
     }
@@ -535,14 +561,12 @@ bool CTxMemPool::getAddressIndex(std::vector<std::pair<uint160, int> > &addresse
 bool CTxMemPool::removeAddressIndex(const uint256 txhash)
 {
     LOCK(cs);
-    addressDeltaMapInserted::iterator it = mapAddressInserted.find(txhash);
+    auto& index = mapAddress.get<address_txid>();
+    auto range = index.equal_range(txhash);
 
-    if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = (*it).second;
-        for (std::vector<CMempoolAddressDeltaKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapAddress.erase(*mit);
-        }
-        mapAddressInserted.erase(it);
+    for (auto it = range.first; it != range.second; ) {
+        ReleaseAddressAssetName(it->asset);
+        it = index.erase(it);
     }
 
     return true;
@@ -553,7 +577,6 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
     LOCK(cs);
 
     const CTransaction& tx = entry.GetTx();
-    std::vector<CSpentIndexKey> inserted;
 
     uint256 txhash = tx.GetHash();
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
@@ -576,25 +599,19 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
             addressType = 0;
         }
 
-        CSpentIndexKey key = CSpentIndexKey(input.prevout.hash, input.prevout.n);
         CSpentIndexValue value = CSpentIndexValue(txhash, j, -1, prevout.nValue, addressType, addressHash);
 
-        mapSpent.insert(std::make_pair(key, value));
-        inserted.push_back(key);
-
+        mapSpent.insert(CMempoolSpentIndexEntry(input.prevout, value));
     }
-
-    mapSpentInserted.insert(std::make_pair(txhash, inserted));
 }
 
 bool CTxMemPool::getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
     LOCK(cs);
-    mapSpentIndex::iterator it;
 
-    it = mapSpent.find(key);
+    auto it = mapSpent.find(COutPoint(key.txid, key.outputIndex));
     if (it != mapSpent.end()) {
-        value = it->second;
+        value = it->value;
         return true;
     }
     return false;
@@ -603,19 +620,71 @@ bool CTxMemPool::getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 bool CTxMemPool::removeSpentIndex(const uint256 txhash)
 {
     LOCK(cs);
-    mapSpentIndexInserted::iterator it = mapSpentInserted.find(txhash);
+    mapSpent.get<spent_txid>().erase(txhash);
+
+    return true;
+}
+
+/** RVN START */
+void CTxMemPool::addAssetIndex(const CTxMemPoolEntry &entry)
+{
+    LOCK(cs);
+    txiter it = mapTx.find(entry.GetTx().GetHash());
+    if (it == mapTx.end())
+        return;
+
+    for (const auto& out : it->GetTx().vout) {
+        if (!out.scriptPubKey.IsAssetScript())
+            continue;
 
-    if (it != mapSpentInserted.end()) {
-        std::vector<CSpentIndexKey> keys = (*it).second;
-        for (std::vector<CSpentIndexKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapSpent.erase(*mit);
+        std::string strAddress;
+        if (IsScriptNewAsset(out.scriptPubKey)) {
+            CNewAsset asset;
+            if (AssetFromScript(out.scriptPubKey, asset, strAddress))
+                mapAssetIssues.insert(CMempoolAssetEntry(asset.strName, it));
+        } else if (IsScriptReissueAsset(out.scriptPubKey)) {
+            CReissueAsset reissue;
+            if (ReissueAssetFromScript(out.scriptPubKey, reissue, strAddress))
+                mapAssetReissues.insert(CMempoolAssetEntry(reissue.strName, it));
         }
-        mapSpentInserted.erase(it);
     }
+}
+
+bool CTxMemPool::getAssetIssueTx(const std::string& assetName, uint256& txhash) const
+{
+    LOCK(cs);
+    auto it = mapAssetIssues.find(assetName);
+    if (it == mapAssetIssues.end())
+        return false;
+
+    txhash = it->entry->GetTx().GetHash();
+    return true;
+}
+
+bool CTxMemPool::getAssetReissueTx(const std::string& assetName, uint256& txhash) const
+{
+    LOCK(cs);
+    auto it = mapAssetReissues.find(assetName);
+    if (it == mapAssetReissues.end())
+        return false;
 
+    txhash = it->entry->GetTx().GetHash();
     return true;
 }
 
+void CTxMemPool::removeAssetIndex(indexed_asset_set& assets, const uint256& txhash)
+{
+    assets.get<asset_txid>().erase(txhash);
+}
+
+void CTxMemPool::removeAssetIndex(const uint256& txhash)
+{
+    LOCK(cs);
+    removeAssetIndex(mapAssetIssues, txhash);
+    removeAssetIndex(mapAssetReissues, txhash);
+}
+/** RVN END */
+
 void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 {
     NotifyEntryRemoved(it->GetSharedTx(), reason);
@@ -636,27 +705,17 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     cachedInnerUsage -= it->DynamicMemoryUsage();
     cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
     mapLinks.erase(it);
+    /** RVN START */
+    // The asset indexes refer to the entry, drop them before it is erased. This also frees the reissue it was locking
+    removeAssetIndex(mapAssetIssues, hash);
+    removeAssetIndex(mapAssetReissues, hash);
+    /** RVN END */
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
     removeAddressIndex(hash);
     removeSpentIndex(hash);
 
-    /** RVN START */
-    // If the transaction being removed from the mempool is locking other reissues. Free them
-    if (mapReissuedTx.count(hash)) {
-        if (mapReissuedAssets.count(mapReissuedTx.at(hash))) {
-            mapReissuedAssets.erase(mapReissuedTx.at((hash)));
-            mapReissuedTx.erase(hash);
-        }
-    }
-
-    // Erase from the asset mempool maps if they match txid
-    if (mapHashToAsset.count(hash)) {
-        mapAssetToHash.erase(mapHashToAsset.at(hash));
-        mapHashToAsset.erase(hash);
-    }
-    /** RVN END */
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -803,13 +862,11 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
     /** RVN START */
     // Get the newly added assets, and make sure they are in the entries
     std::vector<CTransaction> trans;
-    for (auto it : setNewAssets) {
-        if (mapAssetToHash.count(it.asset.strName)) {
-            indexed_transaction_set::iterator i = mapTx.find(mapAssetToHash.at(it.asset.strName));
-            if (i != mapTx.end()) {
-                entries.push_back(&*i);
-                trans.emplace_back(i->GetTx());
-            }
+    for (const auto& it : setNewAssets) {
+        auto asset = mapAssetIssues.find(it.asset.strName);
+        if (asset != mapAssetIssues.end()) {
+            entries.push_back(&*asset->entry);
+            trans.emplace_back(asset->entry->GetTx());
         }
     }
     /** RVN END */
@@ -858,8 +915,11 @@ void CTxMemPool::_clear()
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
-    mapAssetToHash.clear();
-    mapHashToAsset.clear();
+    mapAssetIssues.clear();
+    mapAssetReissues.clear();
+    mapAddress.clear();
+    mapAddressAssetNames.clear();
+    mapSpent.clear();
 }
 
 void CTxMemPool::clear()
@@ -945,16 +1005,19 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         uint64_t nSizeCheck = it->GetTxSize();
         CAmount nFeesCheck = it->GetModifiedFee();
         int64_t nSigOpCheck = it->GetSigOpCost();
+        int64_t nAssetOpsCheck = it->GetAssetOps();
 
         for (txiter ancestorIt : setAncestors) {
             nSizeCheck += ancestorIt->GetTxSize();
             nFeesCheck += ancestorIt->GetModifiedFee();
             nSigOpCheck += ancestorIt->GetSigOpCost();
+            nAssetOpsCheck += ancestorIt->GetAssetOps();
         }
 
         assert(it->GetCountWithAncestors() == nCountCheck);
         assert(it->GetSizeWithAncestors() == nSizeCheck);
         assert(it->GetSigOpCostWithAncestors() == nSigOpCheck);
+        assert(it->GetAssetOpsWithAncestors() == nAssetOpsCheck);
         assert(it->GetModFeesWithAncestors() == nFeesCheck);
 
         // Check children against mapNextTx
@@ -1121,7 +1184,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             CalculateDescendants(it, setDescendants);
             setDescendants.erase(it);
             for (txiter descendantIt : setDescendants) {
-                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0, 0));
             }
             ++nTransactionsUpdated;
         }
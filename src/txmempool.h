@@ -13,6 +13,7 @@
 #include <vector>
 #include <utility>
 #include <string>
+#include <unordered_map>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -26,6 +27,7 @@
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/signals2/signal.hpp>
@@ -76,6 +78,7 @@ private:
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
+    int64_t nAssetOps;         //!< Number of asset outputs, they are more expensive to validate
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
 
     // Information about descendants of this transaction that are in the
@@ -90,6 +93,7 @@ private:
     uint64_t nSizeWithAncestors;
     CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
+    int64_t nAssetOpsWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
@@ -106,13 +110,14 @@ public:
     unsigned int GetHeight() const { return entryHeight; }
     int64_t GetSigOpCost() const { return sigOpCost; }
     int64_t GetModifiedFee() const { return nFee + feeDelta; }
+    int64_t GetAssetOps() const { return nAssetOps; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
 
     // Adjusts the descendant state.
     void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
     // Adjusts the ancestor state
-    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps);
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps, int64_t modifyAssetOps);
     // Updates the fee delta used for mining priority score, and the
     // modified fees with descendants.
     void UpdateFeeDelta(int64_t feeDelta);
@@ -129,6 +134,7 @@ public:
     uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
+    int64_t GetAssetOpsWithAncestors() const { return nAssetOpsWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
 };
@@ -151,18 +157,19 @@ struct update_descendant_state
 
 struct update_ancestor_state
 {
-    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount, int64_t _modifySigOpsCost) :
-        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount), modifySigOpsCost(_modifySigOpsCost)
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount, int64_t _modifySigOpsCost, int64_t _modifyAssetOps) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount), modifySigOpsCost(_modifySigOpsCost), modifyAssetOps(_modifyAssetOps)
     {}
 
     void operator() (CTxMemPoolEntry &e)
-        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount, modifySigOpsCost); }
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount, modifySigOpsCost, modifyAssetOps); }
 
     private:
         int64_t modifySize;
         CAmount modifyFee;
         int64_t modifyCount;
         int64_t modifySigOpsCost;
+        int64_t modifyAssetOps;
 };
 
 struct update_fee_delta
@@ -292,6 +299,9 @@ struct descendant_score {};
 struct entry_time {};
 struct mining_score {};
 struct ancestor_score {};
+struct asset_txid {};
+struct address_txid {};
+struct spent_txid {};
 
 class CBlockPolicyEstimator;
 
@@ -467,9 +477,6 @@ public:
     mutable CCriticalSection cs;
     indexed_transaction_set mapTx;
 
-    std::map<std::string, uint256> mapAssetToHash;
-    std::map<uint256, std::string> mapHashToAsset;
-
     typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
     std::vector<std::pair<uint256, txiter> > vTxHashes; //!< All tx witness hashes/entries in mapTx, in random order
 
@@ -493,17 +500,147 @@ private:
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
-    typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
-    addressDeltaMap mapAddress;
+    //! An address index delta. The asset name points into mapAddressAssetNames so every delta doesn't carry its own copy
+    struct CMempoolAddressIndexEntry
+    {
+        int type;
+        uint160 addressBytes;
+        const std::string* asset;
+        uint256 txhash;
+        unsigned int index;
+        int spending;
+        CMempoolAddressDelta delta;
+
+        CMempoolAddressIndexEntry(int type, const uint160& addressBytes, const std::string* asset, const uint256& txhash, unsigned int index, int spending, const CMempoolAddressDelta& delta) :
+                type(type), addressBytes(addressBytes), asset(asset), txhash(txhash), index(index), spending(spending), delta(delta) {}
+    };
+
+    // Same order as CMempoolAddressDeltaKeyCompare, interned names are only compared when they are different
+    struct CompareMempoolAddressIndexEntry
+    {
+        bool operator()(const CMempoolAddressIndexEntry& a, const CMempoolAddressIndexEntry& b) const
+        {
+            if (a.type != b.type)
+                return a.type < b.type;
+            if (a.addressBytes != b.addressBytes)
+                return a.addressBytes < b.addressBytes;
+            if (a.asset != b.asset) {
+                int cmp = a.asset->compare(*b.asset);
+                if (cmp != 0)
+                    return cmp < 0;
+            }
+            if (a.txhash != b.txhash)
+                return a.txhash < b.txhash;
+            if (a.index != b.index)
+                return a.index < b.index;
+            return a.spending < b.spending;
+        }
+    };
+
+    typedef boost::multi_index_container<
+        CMempoolAddressIndexEntry,
+        boost::multi_index::indexed_by<
+            // sorted by address, for the range scans of getaddressmempool
+            boost::multi_index::ordered_unique<
+                boost::multi_index::identity<CMempoolAddressIndexEntry>,
+                CompareMempoolAddressIndexEntry
+            >,
+            // hashed by txid, so a transaction's deltas can be removed without keeping a copy of their keys
+            boost::multi_index::hashed_non_unique<
+                boost::multi_index::tag<address_txid>,
+                boost::multi_index::member<CMempoolAddressIndexEntry, uint256, &CMempoolAddressIndexEntry::txhash>,
+                SaltedTxidHasher
+            >
+        >
+    > indexed_address_delta_set;
+    indexed_address_delta_set mapAddress;
+
+    //! Asset names used by mapAddress, with the number of deltas that use them
+    std::unordered_map<std::string, unsigned int> mapAddressAssetNames;
+
+    const std::string* InternAddressAssetName(const std::string& assetName);
+    void ReleaseAddressAssetName(const std::string* assetName);
+    void addAddressDelta(int type, const uint160& addressBytes, const std::string& assetName, const uint256& txhash, unsigned int index, int spending, const CMempoolAddressDelta& delta);
+
+    //! A spent index value, keyed by the outpoint it spends
+    struct CMempoolSpentIndexEntry
+    {
+        COutPoint outpoint;
+        CSpentIndexValue value;
+
+        CMempoolSpentIndexEntry(const COutPoint& outpoint, const CSpentIndexValue& value) : outpoint(outpoint), value(value) {}
+    };
+
+    // extracts the hash of the transaction doing the spending
+    struct mempoolspent_txid
+    {
+        typedef uint256 result_type;
+        result_type operator() (const CMempoolSpentIndexEntry& spent) const
+        {
+            return spent.value.txid;
+        }
+    };
+
+    typedef boost::multi_index_container<
+        CMempoolSpentIndexEntry,
+        boost::multi_index::indexed_by<
+            // hashed by spent outpoint
+            boost::multi_index::hashed_unique<
+                boost::multi_index::member<CMempoolSpentIndexEntry, COutPoint, &CMempoolSpentIndexEntry::outpoint>,
+                SaltedOutpointHasher
+            >,
+            // hashed by spending txid
+            boost::multi_index::hashed_non_unique<
+                boost::multi_index::tag<spent_txid>,
+                mempoolspent_txid,
+                SaltedTxidHasher
+            >
+        >
+    > indexed_spent_set;
+    indexed_spent_set mapSpent;
 
-    typedef std::map<uint256, std::vector<CMempoolAddressDeltaKey> > addressDeltaMapInserted;
-    addressDeltaMapInserted mapAddressInserted;
+    /** RVN START */
+    //! An asset name that a transaction in mapTx issues or reissues
+    struct CMempoolAssetEntry
+    {
+        std::string assetName;
+        txiter entry;
 
-    typedef std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpentIndex;
-    mapSpentIndex mapSpent;
+        CMempoolAssetEntry(const std::string& assetName, txiter entry) : assetName(assetName), entry(entry) {}
+    };
 
-    typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
-    mapSpentIndexInserted mapSpentInserted;
+    // extracts the hash of the transaction the asset name belongs to
+    struct mempoolasset_txid
+    {
+        typedef uint256 result_type;
+        result_type operator() (const CMempoolAssetEntry& asset) const
+        {
+            return asset.entry->GetTx().GetHash();
+        }
+    };
+
+    // A transaction can issue several unique assets, so the names are kept next to mapTx rather than as keys of it
+    typedef boost::multi_index_container<
+        CMempoolAssetEntry,
+        boost::multi_index::indexed_by<
+            // hashed by asset name
+            boost::multi_index::hashed_unique<
+                boost::multi_index::member<CMempoolAssetEntry, std::string, &CMempoolAssetEntry::assetName>
+            >,
+            // hashed by txid
+            boost::multi_index::hashed_non_unique<
+                boost::multi_index::tag<asset_txid>,
+                mempoolasset_txid,
+                SaltedTxidHasher
+            >
+        >
+    > indexed_asset_set;
+
+    indexed_asset_set mapAssetIssues; //!< Names of the assets issued by transactions in mapTx
+    indexed_asset_set mapAssetReissues; //!< Names of the assets reissued by transactions in mapTx
+
+    void removeAssetIndex(indexed_asset_set& assets, const uint256& txhash);
+    /** RVN END */
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
@@ -545,6 +682,13 @@ public:
     bool getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool removeSpentIndex(const uint256 txhash);
 
+    /** RVN START */
+    void addAssetIndex(const CTxMemPoolEntry &entry);
+    bool getAssetIssueTx(const std::string& assetName, uint256& txhash) const;
+    bool getAssetReissueTx(const std::string& assetName, uint256& txhash) const;
+    void removeAssetIndex(const uint256& txhash);
+    /** RVN END */
+
     void removeRecursive(const CTransaction &tx, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx);
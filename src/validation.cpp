@@ -7,10 +7,13 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blockfilemap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
+#include "coinswriter.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
@@ -45,7 +48,11 @@
 #include "net.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -55,6 +62,7 @@
 
 #include "assets/assets.h"
 #include "assets/assetdb.h"
+#include "assets/assetsnapshot.h"
 
 #if defined(NDEBUG)
 # error "Raven cannot be compiled without assertions."
@@ -76,6 +84,7 @@ CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nImportThreads = 1;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fTxIndex = false;
@@ -146,6 +155,13 @@ namespace {
      */
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
+    /**
+     * ActivateBestChain releases cs_main between its steps, and several message
+     * handler threads may call it at once. Only one of them runs it at a time.
+     * Must be taken before cs_main.
+     */
+    CCriticalSection cs_activatebestchain;
+
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
@@ -911,31 +927,19 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             pool.addSpentIndex(entry, view);
         }
 
+        /** RVN START */
+        // Add the assets issued and reissued by the transaction, the index goes away with the entry if it gets trimmed
+        if (AreAssetsDeployed()) {
+            pool.addAssetIndex(entry);
+        }
+        /** RVN END */
+
         // trim mempool and check if tx was trimmed
         if (!bypass_limits) {
             LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
             if (!pool.exists(hash))
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
         }
-
-        for (auto out : vReissueAssets) {
-            mapReissuedAssets.insert(out);
-            mapReissuedTx.insert(std::make_pair(out.second, out.first));
-        }
-
-        if (AreAssetsDeployed()) {
-            for (auto out : tx.vout) {
-                if (out.scriptPubKey.IsAssetScript()) {
-                    CAssetOutputEntry data;
-                    if (!GetAssetData(out.scriptPubKey, data))
-                        continue;
-                    if (data.type == TX_NEW_ASSET && !IsAssetNameAnOwner(data.assetName)) {
-                        pool.mapAssetToHash[data.assetName] = hash;
-                        pool.mapHashToAsset[hash] = data.assetName;
-                    }
-                }
-            }
-        }
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -1142,21 +1146,58 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/**
+ * Deserialize from the mapping of a blk/rev file with read, when -mmapblockfiles is set.
+ * Returns false when the file isn't mapped or the data doesn't fit in the mapping, the
+ * caller then reads the file as usual and reports any error.
+ */
+template <typename F>
+static bool ReadFromMappedBlockFile(const CDiskBlockPos& pos, const char* prefix, F read)
 {
-    block.SetNull();
+    if (!pmappedblockfiles)
+        return false;
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    {
+        // The last file is still appended to, and truncated when it is finalized
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile >= nLastBlockFile)
+            return false;
+    }
+
+    std::shared_ptr<const CMappedBlockFile> mapped = pmappedblockfiles->Get(pos, prefix);
+    if (!mapped)
+        return false;
 
-    // Read block
     try {
-        filein >> block;
+        CBufferReader reader(SER_DISK, CLIENT_VERSION, mapped->data, mapped->size, pos.nPos);
+        read(reader);
     }
     catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        return false;
+    }
+
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    block.SetNull();
+
+    if (!ReadFromMappedBlockFile(pos, "blk", [&block](CBufferReader& reader) { reader >> block; })) {
+        block.SetNull();
+
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1176,6 +1217,58 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+/** Read the magic, size and serialized block that follow a block file header */
+template <typename Stream>
+static void ReadRawBlock(Stream& stream, std::vector<unsigned char>& block, CMessageHeader::MessageStartChars& blockStart)
+{
+    unsigned int nSize;
+    stream >> FLATDATA(blockStart) >> nSize;
+    if (nSize > MAX_BLOCK_SERIALIZED_SIZE_RIP2)
+        throw std::ios_base::failure(strprintf("block data is larger than maximum deserialization size: %u", nSize));
+    block.resize(nSize);
+    stream.read((char*)block.data(), nSize);
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // The block is preceded by the index header written in WriteBlockToDisk: message start and block size
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    hpos.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CMessageHeader::MessageStartChars blockStart;
+    if (!ReadFromMappedBlockFile(hpos, "blk", [&block, &blockStart](CBufferReader& reader) { ReadRawBlock(reader, block, blockStart); })) {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+        try {
+            ReadRawBlock(filein, block, blockStart);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Read from block file failed - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    if (memcmp(blockStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+        return error("%s: Block magic mismatch for %s", __func__, pos.ToString());
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetBlockPos();
+    }
+
+    return ReadRawBlockFromDisk(block, pos, messageStart);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1520,27 +1613,40 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+/** Read undo data and its checksum, hashData is set to the hash the checksum has to match */
+template <typename Stream>
+static void ReadUndo(Stream& stream, CBlockUndo& blockundo, const uint256& hashBlock, uint256& hashChecksum, uint256& hashData)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+    CHashVerifier<Stream> verifier(&stream); // We need a CHashVerifier as reserializing may lose data
+    verifier << hashBlock;
+    verifier >> blockundo;
+    stream >> hashChecksum;
+    hashData = verifier.GetHash();
+}
 
-    // Read block
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+{
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
-    try {
-        verifier << hashBlock;
-        verifier >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    uint256 hashData;
+    if (!ReadFromMappedBlockFile(pos, "rev", [&](CBufferReader& reader) { ReadUndo(reader, blockundo, hashBlock, hashChecksum, hashData); })) {
+        blockundo = CBlockUndo();
+
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenUndoFile failed", __func__);
+
+        // Read block
+        try {
+            ReadUndo(filein, blockundo, hashBlock, hashChecksum, hashData);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
-    if (hashChecksum != verifier.GetHash())
+    if (hashChecksum != hashData)
         return error("%s: Checksum mismatch", __func__);
 
     return true;
@@ -2583,6 +2689,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
     bool fDoFullFlush = false;
     int64_t nNow = 0;
     try {
+    // A background write that failed left the database behind the cache
+    if (pcoinswriter && pcoinswriter->Failed())
+        return AbortNode(state, "Failed to write to coin database");
     {
         LOCK(cs_LastBlockFile);
         if (fPruneMode && (fCheckForPruning || nManualPruneHeight > 0) && !fReindex) {
@@ -2675,23 +2784,32 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                 return state.Error("out of disk space");
 
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // With -asyncflush the modified coins are written in the background.
+            // Unless the cache is over its limit, they stay cached so validation
+            // doesn't have to read them back, otherwise the cache is cut down to
+            // half its size.
+            bool fKeepModified = !fCacheLarge && !fCacheCritical;
+            if (!pcoinsTip->Sync(fKeepModified))
                 return AbortNode(state, "Failed to write to coin database");
+            if (!fKeepModified)
+                pcoinsTip->Trim(nTotalSpace / 2);
 
             /** RVN START */
             // Flush the assetstate
             if (AreAssetsDeployed()) {
-                // Flush the assetstate
+                // Flush the assetstate. The coins batch may still be on its way to disk, but
+                // its head blocks marker is not, so a crash replays the coins up to this block.
                 if (passets) {
                     if (!passets->Flush(false, true))
                         return AbortNode(state, "Failed to write to asset database");
                 }
             }
-            // Write the reissue mempool data to database
-            if (passetsdb)
-                passetsdb->WriteReissuedMempoolState();
             /** RVN END */
 
+            // Callers flushing on purpose expect the chainstate to be on disk when this returns
+            if (mode == FLUSH_STATE_ALWAYS && pcoinswriter && !pcoinswriter->Wait())
+                return AbortNode(state, "Failed to write to coin database");
+
             nLastFlush = nNow;
         }
     }
@@ -2970,14 +3088,6 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
             if (afterNewAsset.count(it))
                 afterNewAsset.erase(it);
         }
-
-        for (auto tx : blockConnecting.vtx) {
-            uint256 txHash = tx->GetHash();
-            if (mapReissuedTx.count(txHash)) {
-                mapReissuedAssets.erase(mapReissuedTx.at(txHash));
-                mapReissuedTx.erase(txHash);
-            }
-        }
         /** RVN END */
 
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
@@ -2988,6 +3098,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         /** RVN START */
         bool assetFlushed = assetCache.Flush(true);
         assert(assetFlushed);
+
+        CaptureAssetSnapshots(pindexNew);
         /** RVN END */
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
@@ -3197,6 +3309,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
     // far from a guarantee. Things in the P2P/RPC will often end up calling
     // us in the middle of ProcessNewBlock - do not assume pblock is set
     // sanely for performance or correctness!
+    LOCK(cs_activatebestchain);
 
     CBlockIndex *pindexMostWork = nullptr;
     CBlockIndex *pindexNewTip = nullptr;
@@ -3370,10 +3483,9 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -3404,6 +3516,11 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     return pindexNew;
 }
 
+static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+{
+    return AddToBlockIndex(block, block.GetHash());
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 static bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
@@ -3541,14 +3658,19 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+static bool CheckBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const Consensus::Params& consensusParams)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
+    if (!CheckProofOfWork(hash, block.nBits, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
     return true;
 }
 
+static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+{
+    return !fCheckPOW || CheckBlockHeader(block, block.GetHash(), state, consensusParams);
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckAssetDuplicate, bool fForceDuplicateCheck)
 {
     // These are checks that are independent of context.
@@ -3844,11 +3966,11 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+/** hash has to be block.GetHash(), it is passed in by callers that already computed it */
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3863,7 +3985,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, hash, state, chainparams.GetConsensus()))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3878,7 +4000,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
     if (pindex == nullptr)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3889,13 +4011,15 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 }
 
 // Exposed wrapper for AcceptBlockHeader
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, const std::vector<uint256>* pvHashes)
 {
+    assert(!pvHashes || pvHashes->size() == headers.size());
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!AcceptBlockHeader(header, pvHashes ? (*pvHashes)[i] : header.GetHash(), state, chainparams, &pindex)) {
                 return false;
             }
             if (ppindex) {
@@ -3907,10 +4031,12 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
     return true;
 }
 
-/** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
-static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+/** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk.
+ *  If phash is non-nullptr it points to the already computed block hash */
+static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const uint256* phash = nullptr)
 {
     const CBlock& block = *pblock;
+    const uint256 hash = phash ? *phash : block.GetHash();
 
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -3918,7 +4044,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, hash, state, chainparams, &pindex))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3955,7 +4081,8 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     if (fNewBlock) *fNewBlock = true;
 
     // Dont force the CheckBLock asset duplciates when checking from this state
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), true, true, true, false) ||
+    // The proof of work was already checked against hash when the header was accepted
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), false, true, true, false) ||
         !ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindex->pprev, passets)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3988,6 +4115,10 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
         return AbortNode(state, std::string("System error: ") + e.what());
     }
 
+    // Start loading the coins the block spends while it waits to be connected
+    if (pcoinsprefetch && IsInitialBlockDownload())
+        pcoinsprefetch->Prefetch(block);
+
     if (fCheckForPruning)
         FlushStateToDisk(chainparams, state, FLUSH_STATE_NONE); // we just allocated more disk space for block files
 
@@ -4109,6 +4240,8 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        if (pmappedblockfiles)
+            pmappedblockfiles->Remove(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4800,6 +4933,319 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return true;
 }
 
+namespace {
+
+/** Maximum size of the serialized blocks that are read ahead of the block being accepted */
+static const size_t MAX_IMPORT_QUEUE_BYTES = 64 << 20;
+/** Maximum number of blocks that are read ahead of the block being accepted */
+static const size_t MAX_IMPORT_QUEUE_BLOCKS = 4096;
+
+/** A block found in an imported file, deserialized and hashed by the import workers */
+struct CImportBlock
+{
+    uint64_t nHeaderPos = 0;        //!< Position of the message start in front of the block
+    uint64_t nBlockPos = 0;         //!< Position of the serialized block
+    unsigned int nSize = 0;         //!< Block size given in the file
+    std::vector<char> vData;        //!< Serialized block, released once deserialized
+    std::shared_ptr<CBlock> pblock; //!< nullptr if the block couldn't be deserialized
+    uint256 hash;
+    uint64_t nRead = 0;             //!< Number of bytes the block actually took
+    std::string strError;
+    bool fDone = false;
+};
+
+/**
+ * Imports the blocks of one file in stages: a reader thread locates the blocks and reads
+ * their data, a pool of workers deserializes and hashes them, and the importing thread
+ * gets them back from Next() in file order to accept them.
+ */
+class CBlockImportPipeline
+{
+private:
+    CBufferedFile& blkdat;
+    const CChainParams& chainparams;
+
+    std::mutex cs;
+    std::condition_variable condReader;
+    std::condition_variable condWorker;
+    std::condition_variable condImporter;
+
+    std::deque<std::shared_ptr<CImportBlock>> queueBlocks; //!< In file order
+    size_t nNextWork = 0;                                  //!< Index of the first block in queueBlocks no worker took yet
+    size_t nQueuedBytes = 0;
+    bool fReaderDone = false;
+    bool fRewind = false;
+    uint64_t nRewindPos = 0;
+    bool fStop = false;
+
+    std::thread threadReader;
+    std::vector<std::thread> vWorkers;
+
+    bool ReadNextBlock(uint64_t& nRewind, CImportBlock& block);
+    void ThreadReader();
+    void ThreadWorker();
+
+public:
+    CBlockImportPipeline(CBufferedFile& blkdatIn, const CChainParams& chainparamsIn, int nWorkers);
+    ~CBlockImportPipeline();
+
+    /** Wait for the next block in file order, returns nullptr at the end of the file */
+    std::shared_ptr<CImportBlock> Next();
+    /** Drop the blocks after the last one returned by Next() and go on reading from nPos */
+    void Rewind(uint64_t nPos);
+};
+
+CBlockImportPipeline::CBlockImportPipeline(CBufferedFile& blkdatIn, const CChainParams& chainparamsIn, int nWorkers) : blkdat(blkdatIn), chainparams(chainparamsIn)
+{
+    threadReader = std::thread(&TraceThread<std::function<void()> >, "loadread", std::function<void()>(std::bind(&CBlockImportPipeline::ThreadReader, this)));
+    for (int i = 0; i < std::max(nWorkers, 1); i++)
+        vWorkers.emplace_back(&TraceThread<std::function<void()> >, "loadwork", std::function<void()>(std::bind(&CBlockImportPipeline::ThreadWorker, this)));
+}
+
+CBlockImportPipeline::~CBlockImportPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    condReader.notify_all();
+    condWorker.notify_all();
+
+    threadReader.join();
+    for (std::thread& worker : vWorkers)
+        worker.join();
+}
+
+/** Locate the next block from nRewind on and read its data, returns false at the end of the file */
+bool CBlockImportPipeline::ReadNextBlock(uint64_t& nRewind, CImportBlock& block)
+{
+    while (!blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > GetMaxBlockSerializedSize())
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            return false;
+        }
+        try {
+            // read block, in pieces as the buffer only guarantees room for one block next to the rewind margin
+            block.nHeaderPos = nRewind - 1;
+            block.nBlockPos = blkdat.GetPos();
+            block.nSize = nSize;
+            block.vData.resize(nSize);
+            for (unsigned int nDone = 0; nDone < nSize; ) {
+                unsigned int nNow = std::min<unsigned int>(nSize - nDone, 1 << 20);
+                blkdat.read(block.vData.data() + nDone, nNow);
+                nDone += nNow;
+            }
+            nRewind = blkdat.GetPos();
+            return true;
+        } catch (const std::exception& e) {
+            LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", e.what());
+        }
+    }
+    return false;
+}
+
+void CBlockImportPipeline::ThreadReader()
+{
+    uint64_t nRewind = blkdat.GetPos();
+
+    std::unique_lock<std::mutex> lock(cs);
+    while (!fStop) {
+        if (fRewind) {
+            // Data before the buffered range has to be read again from the file
+            if (!blkdat.SetPos(nRewindPos) && !blkdat.Seek(nRewindPos)) {
+                LogPrintf("LoadExternalBlockFile: Failed to seek to %u\n", nRewindPos);
+                fReaderDone = true;
+            }
+            nRewind = nRewindPos;
+            fRewind = false;
+            condImporter.notify_all();
+        }
+        if (fReaderDone || queueBlocks.size() >= MAX_IMPORT_QUEUE_BLOCKS || nQueuedBytes >= MAX_IMPORT_QUEUE_BYTES) {
+            condReader.wait(lock);
+            continue;
+        }
+
+        std::shared_ptr<CImportBlock> pimport = std::make_shared<CImportBlock>();
+        lock.unlock();
+        bool fFound = ReadNextBlock(nRewind, *pimport);
+        lock.lock();
+
+        // Whatever was read after the rewind position is read again
+        if (fRewind)
+            continue;
+
+        if (!fFound) {
+            fReaderDone = true;
+            condImporter.notify_all();
+            continue;
+        }
+
+        nQueuedBytes += pimport->nSize;
+        queueBlocks.push_back(pimport);
+        condWorker.notify_one();
+    }
+}
+
+void CBlockImportPipeline::ThreadWorker()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        condWorker.wait(lock, [this] { return fStop || nNextWork < queueBlocks.size(); });
+        if (fStop)
+            return;
+
+        std::shared_ptr<CImportBlock> pimport = queueBlocks[nNextWork++];
+        lock.unlock();
+
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            CBufferReader reader(SER_DISK, CLIENT_VERSION, (const unsigned char*)pimport->vData.data(), pimport->vData.size(), 0);
+            reader >> *pblock;
+            pimport->nRead = pimport->vData.size() - reader.size();
+            pimport->hash = pblock->GetHash();
+            pimport->pblock = pblock;
+        } catch (const std::exception& e) {
+            pimport->strError = e.what();
+        }
+        std::vector<char>().swap(pimport->vData);
+
+        lock.lock();
+        pimport->fDone = true;
+        if (!queueBlocks.empty() && queueBlocks.front() == pimport)
+            condImporter.notify_all();
+    }
+}
+
+std::shared_ptr<CImportBlock> CBlockImportPipeline::Next()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (queueBlocks.empty() || !queueBlocks.front()->fDone) {
+        if (queueBlocks.empty() && fReaderDone && !fRewind)
+            return nullptr;
+        boost::this_thread::interruption_point();
+        condImporter.wait_for(lock, std::chrono::milliseconds(100));
+    }
+
+    std::shared_ptr<CImportBlock> pimport = queueBlocks.front();
+    queueBlocks.pop_front();
+    nNextWork--;
+    nQueuedBytes -= pimport->nSize;
+    condReader.notify_one();
+
+    return pimport;
+}
+
+void CBlockImportPipeline::Rewind(uint64_t nPos)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        // Workers finish the blocks they took and drop them
+        queueBlocks.clear();
+        nNextWork = 0;
+        nQueuedBytes = 0;
+        fReaderDone = false;
+        fRewind = true;
+        nRewindPos = nPos;
+    }
+    condReader.notify_one();
+}
+
+/** Connects the blocks LoadExternalBlockFile accepts while the rest of the import is read */
+class CImportConnector
+{
+private:
+    const CChainParams& chainparams;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    bool fAccepted = false;
+    bool fStop = false;
+
+    //! A boost::thread, so ActivateBestChain's interruption points stop it like the import thread
+    boost::thread thread;
+
+    void ThreadConnect()
+    {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && !fAccepted)
+                    cond.wait(lock);
+                if (fStop)
+                    return;
+                fAccepted = false;
+            }
+
+            CValidationState state;
+            if (!ActivateBestChain(state, chainparams)) {
+                // The import thread connects what is left when it is done
+                LogPrintf("%s: Failed to connect imported blocks: %s\n", __func__, FormatStateMessage(state));
+                return;
+            }
+        }
+    }
+
+public:
+    explicit CImportConnector(const CChainParams& chainparamsIn) : chainparams(chainparamsIn)
+    {
+        thread = boost::thread(&TraceThread<std::function<void()> >, "loadconn", std::function<void()>(std::bind(&CImportConnector::ThreadConnect, this)));
+    }
+
+    ~CImportConnector()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        // Don't wait for a long ActivateBestChain: ThreadImport connects what is left once the import is done,
+        // and on shutdown nothing more has to be connected
+        thread.interrupt();
+        cond.notify_all();
+        thread.join();
+    }
+
+    void BlocksAccepted()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(cs);
+            fAccepted = true;
+        }
+        cond.notify_one();
+    }
+};
+
+//! Only used by the import thread
+std::unique_ptr<CImportConnector> pimportconnector;
+
+} // anon namespace
+
+void StartImportConnector(const CChainParams& chainparams)
+{
+    assert(!pimportconnector);
+    pimportconnector.reset(new CImportConnector(chainparams));
+}
+
+void StopImportConnector()
+{
+    pimportconnector.reset();
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4810,44 +5256,29 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*GetMaxBlockSerializedSize(), GetMaxBlockSerializedSize()+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // Blocks are read, deserialized and hashed ahead on other threads, and accepted here in file order
+        CBlockImportPipeline pipeline(blkdat, chainparams, nImportThreads);
+        std::shared_ptr<CImportBlock> pimport;
+        while ((pimport = pipeline.Next())) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > GetMaxBlockSerializedSize())
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (!pimport->pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, pimport->strError);
+                // look for a header again one byte further, in case the size was corrupted
+                pipeline.Rewind(pimport->nHeaderPos + 1);
+                continue;
             }
+            if (pimport->nRead < pimport->nSize)
+                pipeline.Rewind(pimport->nBlockPos + pimport->nRead);
+
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                    dbp->nPos = pimport->nBlockPos;
+                std::shared_ptr<CBlock> pblock = pimport->pblock;
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
+                const uint256& hash = pimport->hash;
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
@@ -4860,7 +5291,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     LOCK(cs_main);
                     CValidationState state;
-                    if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+                    if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr, &hash)) {
                         nLoaded++;
                     }
                     if (state.IsError())
@@ -4891,14 +5322,15 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                         std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
                         if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
                         {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                            const uint256 hashrecursive = pblockrecursive->GetHash();
+                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, hashrecursive.ToString(),
                                     head.ToString());
                             LOCK(cs_main);
                             CValidationState dummy;
-                            if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                            if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr, &hashrecursive))
                             {
                                 nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
+                                queue.push_back(hashrecursive);
                             }
                         }
                         range.first++;
@@ -4906,6 +5338,9 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                         NotifyHeaderTip();
                     }
                 }
+
+                if (pimportconnector && nLoaded > 0)
+                    pimportconnector->BlocksAccepted();
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
@@ -12,7 +12,7 @@ CZMQAbstractNotifier::~CZMQAbstractNotifier()
     assert(!psocket);
 }
 
-bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
+bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/, const CBlock * /*CBlock*/)
 {
     return true;
 }
@@ -21,3 +21,8 @@ bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyBlockTransaction(const CTransaction &transaction, const CBlockIndex * /*pindex*/, bool /*fConnected*/)
+{
+    return NotifyTransaction(transaction);
+}
@@ -33,8 +33,11 @@ public:
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
+    //! pblock is the block of pindex when it is still in memory, nullptr if it has to be read from disk
+    virtual bool NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    //! A transaction of a block that was connected or disconnected, by default notified like a mempool transaction
+    virtual bool NotifyBlockTransaction(const CTransaction &transaction, const CBlockIndex *pindex, bool fConnected);
 
 protected:
     void *psocket;
@@ -10,10 +10,14 @@
 #include <string>
 #include <map>
 #include <list>
+#include <memory>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
 
+/** Default for -zmqqueuesize, the megabytes of messages waiting to be sent on a socket before new ones are dropped */
+static const unsigned int DEFAULT_ZMQ_QUEUE_SIZE = 100;
+
 class CZMQNotificationInterface final : public CValidationInterface
 {
 public:
@@ -34,8 +38,16 @@ protected:
 private:
     CZMQNotificationInterface();
 
+    //! Call func on every notifier, and shut down and remove the ones it fails for
+    template <typename Function>
+    void TryForEachAndRemoveFailed(const Function& func);
+
     void *pcontext;
     std::list<CZMQAbstractNotifier*> notifiers;
+
+    // The last connected block, so the tip can be published without reading it back from disk
+    std::shared_ptr<const CBlock> pblockLastConnected;
+    const CBlockIndex *pindexLastConnected;
 };
 
 #endif // RAVEN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
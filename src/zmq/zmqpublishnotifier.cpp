@@ -5,11 +5,14 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "core_io.h"
 #include "streams.h"
+#include "zmqnotificationinterface.h"
 #include "zmqpublishnotifier.h"
 #include "validation.h"
 #include "util.h"
 #include "rpc/server.h"
+#include "assets/assets.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
@@ -17,6 +20,10 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_ASSETISSUE    = "assetissue";
+static const char *MSG_ASSETREISSUE  = "assetreissue";
+static const char *MSG_ASSETTRANSFER = "assettransfer";
+static const char *MSG_ASSETOWNER    = "assetowner";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -61,6 +68,65 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+CZMQPublishQueue::CZMQPublishQueue(void *psocketIn, const std::string &addressIn, size_t nMaxBytesIn) :
+    psocket(psocketIn), address(addressIn), nMaxBytes(nMaxBytesIn), nQueuedBytes(0), fStop(false)
+{
+    thread = std::thread(&TraceThread<std::function<void()> >, "zmqpub", std::function<void()>(std::bind(&CZMQPublishQueue::ThreadSend, this)));
+}
+
+CZMQPublishQueue::~CZMQPublishQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_one();
+    thread.join();
+
+    LogPrint(BCLog::ZMQ, "Close socket at address %s\n", address);
+    int linger = 0;
+    zmq_setsockopt(psocket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(psocket);
+}
+
+bool CZMQPublishQueue::Push(CZMQPublishMessage &&message)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t nSize = message.GetSize();
+        if (!queue.empty() && nQueuedBytes + nSize > nMaxBytes)
+            return false;
+        nQueuedBytes += nSize;
+        queue.push_back(std::move(message));
+    }
+    cond.notify_one();
+    return true;
+}
+
+void CZMQPublishQueue::ThreadSend()
+{
+    while (true)
+    {
+        CZMQPublishMessage message;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return fStop || !queue.empty(); });
+            if (fStop)
+                return;
+
+            message = std::move(queue.front());
+            queue.pop_front();
+            nQueuedBytes -= message.GetSize();
+        }
+
+        /* send three parts, command & data & a LE 4byte sequence number */
+        unsigned char msgseq[sizeof(uint32_t)];
+        WriteLE32(&msgseq[0], message.nSequence);
+        if (zmq_send_multipart(psocket, message.command.data(), message.command.size(), message.data.data(), message.data.size(), msgseq, (size_t)sizeof(uint32_t), nullptr) != 0)
+            LogPrintf("zmq: Failed to send %s %u to %s: %s\n", message.command, message.nSequence, address, zmq_strerror(errno));
+    }
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -82,9 +148,13 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
         {
             zmqError("Failed to bind address");
             zmq_close(psocket);
+            psocket = nullptr;
             return false;
         }
 
+        // From here on the socket is only used by the queue's thread
+        pqueue = std::make_shared<CZMQPublishQueue>(psocket, address, std::max<int64_t>(gArgs.GetArg("-zmqqueuesize", DEFAULT_ZMQ_QUEUE_SIZE), 1) * 1000000);
+
         // register this notifier for the address, so it can be reused for other publish notifier
         mapPublishNotifiers.insert(std::make_pair(address, this));
         return true;
@@ -94,6 +164,7 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
         LogPrint(BCLog::ZMQ, "zmq: Reusing socket for address %s\n", address);
 
         psocket = i->second->psocket;
+        pqueue = i->second->pqueue;
         mapPublishNotifiers.insert(std::make_pair(address, this));
 
         return true;
@@ -104,8 +175,6 @@ void CZMQAbstractPublishNotifier::Shutdown()
 {
     assert(psocket);
 
-    int count = mapPublishNotifiers.count(address);
-
     // remove this notifier from the list of publishers using this address
     typedef std::multimap<std::string, CZMQAbstractPublishNotifier*>::iterator iterator;
     std::pair<iterator, iterator> iterpair = mapPublishNotifiers.equal_range(address);
@@ -119,14 +188,8 @@ void CZMQAbstractPublishNotifier::Shutdown()
         }
     }
 
-    if (count == 1)
-    {
-        LogPrint(BCLog::ZMQ, "Close socket at address %s\n", address);
-        int linger = 0;
-        zmq_setsockopt(psocket, ZMQ_LINGER, &linger, sizeof(linger));
-        zmq_close(psocket);
-    }
-
+    // The last notifier using the socket stops its thread and closes it
+    pqueue.reset();
     psocket = nullptr;
 }
 
@@ -134,20 +197,21 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
 {
     assert(psocket);
 
-    /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), nullptr);
-    if (rc == -1)
-        return false;
+    CZMQPublishMessage message;
+    message.command = command;
+    message.data.assign((const unsigned char*)data, (const unsigned char*)data + size);
+    message.nSequence = nSequence;
+
+    if (!pqueue->Push(std::move(message)))
+        LogPrint(BCLog::ZMQ, "zmq: Send queue of %s is full, dropped %s %u\n", address, command, nSequence);
 
-    /* increment memory only sequence number after sending */
+    /* increment memory only sequence number even when the message was dropped, so subscribers notice */
     nSequence++;
 
     return true;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CBlock * /*pblock*/)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint(BCLog::ZMQ, "zmq: Publish hashblock %s\n", hash.GetHex());
@@ -167,12 +231,35 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &t
     return SendMessage(MSG_HASHTX, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock)
 {
     LogPrint(BCLog::ZMQ, "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    if (pblock)
+    {
+        ss << *pblock;
+    }
+    else if (RPCSerializationFlags() == 0)
+    {
+        // Publish the block as it is stored, without deserializing it. Validation can still
+        // move it, so only its position is read under cs_main.
+        CDiskBlockPos pos;
+        {
+            LOCK(cs_main);
+            pos = pindex->GetBlockPos();
+        }
+        std::vector<unsigned char> vchBlock;
+        if (!ReadRawBlockFromDisk(vchBlock, pos, Params().MessageStart()))
+        {
+            zmqError("Can't read block from disk");
+            return false;
+        }
+
+        return SendMessage(MSG_RAWBLOCK, vchBlock.data(), vchBlock.size());
+    }
+    else
     {
         LOCK(cs_main);
         CBlock block;
@@ -196,3 +283,155 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+/** RVN START */
+bool CZMQAbstractPublishAssetNotifier::NotifyTransaction(const CTransaction &transaction)
+{
+    return PublishOutputs(transaction, nullptr, false);
+}
+
+bool CZMQAbstractPublishAssetNotifier::NotifyBlockTransaction(const CTransaction &transaction, const CBlockIndex *pindex, bool fConnected)
+{
+    return PublishOutputs(transaction, pindex, fConnected);
+}
+
+bool CZMQAbstractPublishAssetNotifier::PublishOutputs(const CTransaction &transaction, const CBlockIndex *pindex, bool fConnected)
+{
+    for (unsigned int n = 0; n < transaction.vout.size(); n++)
+    {
+        const CScript& scriptPubKey = transaction.vout[n].scriptPubKey;
+
+        int nType = 0;
+        bool fIsOwner = false;
+        if (!scriptPubKey.IsAssetScript(nType, fIsOwner))
+            continue;
+
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", transaction.GetHash().GetHex());
+        entry.pushKV("vout", (int)n);
+        if (!DecodeOutput(scriptPubKey, nType, fIsOwner, entry))
+            continue;
+
+        // Without a block the output was accepted to the mempool. Disconnected ones are unconfirmed again.
+        entry.pushKV("confirmed", fConnected);
+        if (pindex) {
+            entry.pushKV("blockhash", pindex->GetBlockHash().GetHex());
+            entry.pushKV("height", pindex->nHeight);
+        }
+
+        LogPrint(BCLog::ZMQ, "zmq: Publish %s %s:%u\n", GetCommand(), transaction.GetHash().GetHex(), n);
+        std::string data = entry.write();
+        if (!SendMessage(GetCommand(), data.data(), data.size()))
+            return false;
+    }
+
+    return true;
+}
+
+const char *CZMQPublishAssetIssueNotifier::GetCommand() const
+{
+    return MSG_ASSETISSUE;
+}
+
+bool CZMQPublishAssetIssueNotifier::DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const
+{
+    if (nType != TX_NEW_ASSET || fIsOwner)
+        return false;
+
+    CNewAsset asset;
+    std::string strAddress;
+    if (!AssetFromScript(scriptPubKey, asset, strAddress))
+        return false;
+
+    entry.pushKV("name", asset.strName);
+    entry.pushKV("amount", ValueFromAmount(asset.nAmount));
+    entry.pushKV("units", asset.units);
+    entry.pushKV("reissuable", asset.nReissuable > 0);
+    if (asset.nHasIPFS > 0)
+        entry.pushKV("ipfs_hash", EncodeIPFS(asset.strIPFSHash));
+    entry.pushKV("address", strAddress);
+    return true;
+}
+
+const char *CZMQPublishAssetReissueNotifier::GetCommand() const
+{
+    return MSG_ASSETREISSUE;
+}
+
+bool CZMQPublishAssetReissueNotifier::DecodeOutput(const CScript &scriptPubKey, int nType, bool /*fIsOwner*/, UniValue &entry) const
+{
+    if (nType != TX_REISSUE_ASSET)
+        return false;
+
+    CReissueAsset reissue;
+    std::string strAddress;
+    if (!ReissueAssetFromScript(scriptPubKey, reissue, strAddress))
+        return false;
+
+    entry.pushKV("name", reissue.strName);
+    entry.pushKV("amount", ValueFromAmount(reissue.nAmount));
+    if (reissue.nUnits >= 0)
+        entry.pushKV("units", reissue.nUnits);
+    entry.pushKV("reissuable", reissue.nReissuable > 0);
+    if (!reissue.strIPFSHash.empty())
+        entry.pushKV("ipfs_hash", EncodeIPFS(reissue.strIPFSHash));
+    entry.pushKV("address", strAddress);
+    return true;
+}
+
+const char *CZMQPublishAssetTransferNotifier::GetCommand() const
+{
+    return MSG_ASSETTRANSFER;
+}
+
+bool CZMQPublishAssetTransferNotifier::DecodeOutput(const CScript &scriptPubKey, int nType, bool /*fIsOwner*/, UniValue &entry) const
+{
+    if (nType != TX_TRANSFER_ASSET)
+        return false;
+
+    CAssetTransfer transfer;
+    std::string strAddress;
+    if (!TransferAssetFromScript(scriptPubKey, transfer, strAddress))
+        return false;
+
+    // Owner tokens changing hands are published by pubassetowner
+    if (IsAssetNameAnOwner(transfer.strName))
+        return false;
+
+    entry.pushKV("name", transfer.strName);
+    entry.pushKV("amount", ValueFromAmount(transfer.nAmount));
+    entry.pushKV("address", strAddress);
+    return true;
+}
+
+const char *CZMQPublishAssetOwnerNotifier::GetCommand() const
+{
+    return MSG_ASSETOWNER;
+}
+
+bool CZMQPublishAssetOwnerNotifier::DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const
+{
+    std::string strName;
+    std::string strAddress;
+    bool fNew;
+
+    if (nType == TX_NEW_ASSET && fIsOwner) {
+        if (!OwnerAssetFromScript(scriptPubKey, strName, strAddress))
+            return false;
+        fNew = true;
+    } else if (nType == TX_TRANSFER_ASSET) {
+        CAssetTransfer transfer;
+        if (!TransferAssetFromScript(scriptPubKey, transfer, strAddress) || !IsAssetNameAnOwner(transfer.strName))
+            return false;
+        strName = transfer.strName;
+        fNew = false;
+    } else {
+        return false;
+    }
+
+    entry.pushKV("name", strName);
+    entry.pushKV("new", fNew);
+    entry.pushKV("address", strAddress);
+    return true;
+}
+/** RVN END */
@@ -8,16 +8,70 @@
 
 #include "zmqabstractnotifier.h"
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 class CBlockIndex;
+class CScript;
+class UniValue;
+
+struct CZMQPublishMessage
+{
+    std::string command;
+    std::vector<unsigned char> data;
+    uint32_t nSequence;
+
+    size_t GetSize() const { return command.size() + data.size() + sizeof(nSequence); }
+};
+
+/**
+ * Owns a socket and sends the messages queued for it on its own thread, so
+ * validation callbacks never wait on zmq. When the waiting messages would take
+ * more than nMaxBytes new ones are dropped, subscribers see the gap in the
+ * sequence numbers. A message is always accepted into an empty queue.
+ */
+class CZMQPublishQueue
+{
+private:
+    void *psocket;
+    const std::string address;
+    const size_t nMaxBytes;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<CZMQPublishMessage> queue;
+    size_t nQueuedBytes;
+    bool fStop;
+    std::thread thread;
+
+    void ThreadSend();
+
+public:
+    CZMQPublishQueue(void *psocketIn, const std::string &addressIn, size_t nMaxBytesIn);
+    //! Stops the thread once the message it is sending is out, and closes the socket
+    ~CZMQPublishQueue();
+
+    void *GetSocket() const { return psocket; }
+    //! Returns false if the message was dropped because the queue is full
+    bool Push(CZMQPublishMessage &&message);
+};
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //!< upcounting per message sequence number
+    std::shared_ptr<CZMQPublishQueue> pqueue; //!< Shared by all the notifiers publishing on the same address
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0) { }
 
-    /* send zmq multipart message
+
+    /* queue zmq multipart message, it is sent on the socket's own thread
        parts:
           * command
           * data
@@ -32,7 +86,7 @@ public:
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock) override;
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -44,7 +98,7 @@ public:
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock) override;
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -53,4 +107,55 @@ public:
     bool NotifyTransaction(const CTransaction &transaction) override;
 };
 
+/** RVN START */
+/**
+ * Publishes one message per asset output of a transaction, with the output decoded as JSON.
+ * Outputs are published when their transaction enters the mempool and again when it is
+ * connected or disconnected in a block, the message says which of these it is.
+ */
+class CZMQAbstractPublishAssetNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    //! pindex is the block the transaction was connected or disconnected in, nullptr for the mempool
+    bool PublishOutputs(const CTransaction &transaction, const CBlockIndex *pindex, bool fConnected);
+
+public:
+    bool NotifyTransaction(const CTransaction &transaction) override;
+    bool NotifyBlockTransaction(const CTransaction &transaction, const CBlockIndex *pindex, bool fConnected) override;
+
+protected:
+    virtual const char *GetCommand() const = 0;
+    //! Add the decoded output to entry, return false if the output isn't published by this notifier
+    virtual bool DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const = 0;
+};
+
+class CZMQPublishAssetIssueNotifier : public CZMQAbstractPublishAssetNotifier
+{
+protected:
+    const char *GetCommand() const override;
+    bool DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const override;
+};
+
+class CZMQPublishAssetReissueNotifier : public CZMQAbstractPublishAssetNotifier
+{
+protected:
+    const char *GetCommand() const override;
+    bool DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const override;
+};
+
+class CZMQPublishAssetTransferNotifier : public CZMQAbstractPublishAssetNotifier
+{
+protected:
+    const char *GetCommand() const override;
+    bool DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const override;
+};
+
+class CZMQPublishAssetOwnerNotifier : public CZMQAbstractPublishAssetNotifier
+{
+protected:
+    const char *GetCommand() const override;
+    bool DecodeOutput(const CScript &scriptPubKey, int nType, bool fIsOwner, UniValue &entry) const override;
+};
+/** RVN END */
+
 #endif // RAVEN_ZMQ_ZMQPUBLISHNOTIFIER_H
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017-2018 The Raven Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the asset lists of the REST API."""
+
+from test_framework.test_framework import RavenTestFramework
+from test_framework.util import *
+from test_framework.mininode import COIN, deser_string
+from io import BytesIO
+from struct import unpack
+
+import http.client
+import urllib.parse
+
+def http_get_call(host, port, path):
+    conn = http.client.HTTPConnection(host, port)
+    conn.request('GET', path)
+    response = conn.getresponse()
+    assert_equal(response.status, 200)
+    return response.read()
+
+def deser_holders(data):
+    f = BytesIO(data)
+    holders = []
+    while f.tell() < len(data):
+        address = deser_string(f).decode('utf-8')
+        balance = unpack("<q", f.read(8))[0]
+        holders.append((address, balance))
+    return holders
+
+class RESTAssetsTest(RavenTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def run_test(self):
+        n0, n1 = self.nodes[0], self.nodes[1]
+        url = urllib.parse.urlparse(n0.url)
+
+        self.log.info("Activating assets...")
+        n0.generate(432)
+        self.sync_all()
+        assert_equal("active", n0.getblockchaininfo()['bip9_softforks']['assets']['status'])
+
+        self.log.info("Issuing and transferring an asset...")
+        address0 = n0.getnewaddress()
+        address1 = n1.getnewaddress()
+        n0.issue(asset_name="REST_ASSET", qty=1000, to_address=address0, change_address="", units=2)
+        n0.generate(1)
+        self.sync_all()
+        n0.transfer(asset_name="REST_ASSET", qty=200.5, to_address=address1)
+        n0.generate(1)
+        self.sync_all()
+
+        # The balances of the last blocks weren't flushed to the asset database, they are listed anyway
+        self.log.info("Checking /rest/assetholders...")
+        holders = json.loads(http_get_call(url.hostname, url.port, '/rest/assetholders/REST_ASSET.json').decode('utf-8'), parse_float=Decimal)
+        assert_equal(holders, n0.listassetholders("REST_ASSET"))
+        assert_equal(len(holders), 2)
+        assert_equal(holders[0]['balance'], Decimal('799.50'))
+        assert_equal(holders[1], {"address": address1, "balance": Decimal('200.50')})
+
+        bin_holders = deser_holders(http_get_call(url.hostname, url.port, '/rest/assetholders/REST_ASSET.bin'))
+        assert_equal(bin_holders, [(holder['address'], int(holder['balance'] * COIN)) for holder in holders])
+
+        hex_holders = http_get_call(url.hostname, url.port, '/rest/assetholders/REST_ASSET.hex').decode('utf-8').strip()
+        assert_equal(deser_holders(hex_str_to_bytes(hex_holders)), bin_holders)
+
+        self.log.info("Checking /rest/addressassets...")
+        balances = json.loads(http_get_call(url.hostname, url.port, '/rest/addressassets/' + address1 + '.json').decode('utf-8'), parse_float=Decimal)
+        assert_equal(balances, [{"name": "REST_ASSET", "balance": Decimal('200.50')}])
+
+        # A client that goes away before its list is sent doesn't hold up the others
+        self.log.info("Checking an abandoned request...")
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/assetholders/REST_ASSET.json')
+        conn.close()
+        assert_equal(json.loads(http_get_call(url.hostname, url.port, '/rest/assetholders/REST_ASSET.json').decode('utf-8'), parse_float=Decimal), holders)
+
+if __name__ == '__main__':
+    RESTAssetsTest().main()
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017-2018 The Raven Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the ZMQ asset notifications.
+
+- An asset output is published when its transaction enters the mempool, without block context.
+- It is published again when the transaction is connected, with the block hash and height.
+- Disconnecting the block publishes it as unconfirmed, with the disconnected block.
+"""
+import configparser
+import json
+import os
+import struct
+
+from test_framework.test_framework import RavenTestFramework, SkipTest
+from test_framework.util import assert_equal, sync_blocks
+
+class ZMQSubscriber:
+    def __init__(self, context, address, topic):
+        import zmq
+        self.sequence = 0
+        self.topic = topic
+        self.socket = context.socket(zmq.SUB)
+        self.socket.set(zmq.RCVTIMEO, 60000)
+        self.socket.connect(address)
+        self.socket.setsockopt(zmq.SUBSCRIBE, self.topic)
+
+    def receive(self):
+        topic, body, seq = self.socket.recv_multipart()
+        assert_equal(topic, self.topic)
+        assert_equal(struct.unpack('<I', seq)[-1], self.sequence)
+        self.sequence += 1
+        return json.loads(body.decode('utf-8'))
+
+class ZMQAssetsTest(RavenTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_nodes(self):
+        try:
+            import zmq
+        except ImportError:
+            raise SkipTest("python3-zmq module not available.")
+
+        config = configparser.ConfigParser()
+        if not self.options.configfile:
+            self.options.configfile = os.path.abspath(os.path.join(os.path.dirname(__file__), "../config.ini"))
+        config.read_file(open(self.options.configfile))
+
+        if not config["components"].getboolean("ENABLE_ZMQ"):
+            raise SkipTest("ravend has not been built with zmq enabled.")
+
+        # One socket per topic, so the order of the outputs within a transaction doesn't matter
+        address = "tcp://127.0.0.1:28767"
+        self.zmq_context = zmq.Context()
+        self.assetissue = ZMQSubscriber(self.zmq_context, address, b"assetissue")
+        self.assetowner = ZMQSubscriber(self.zmq_context, address, b"assetowner")
+        self.assettransfer = ZMQSubscriber(self.zmq_context, address, b"assettransfer")
+
+        self.extra_args = [["-zmqpub%s=%s" % (sub.topic.decode(), address) for sub in [self.assetissue, self.assetowner, self.assettransfer]], []]
+        self.add_nodes(self.num_nodes, self.extra_args)
+        self.start_nodes()
+
+    def run_test(self):
+        try:
+            self._zmq_test()
+        finally:
+            self.log.debug("Destroying ZMQ context")
+            self.zmq_context.destroy(linger=None)
+
+    def _zmq_test(self):
+        n0, n1 = self.nodes[0], self.nodes[1]
+
+        self.log.info("Activating assets")
+        n0.generate(432)
+        self.sync_all()
+        assert_equal("active", n0.getblockchaininfo()['bip9_softforks']['assets']['status'])
+
+        self.log.info("Issuing an asset")
+        address0 = n0.getnewaddress()
+        txid = n0.issue(asset_name="ZMQ_ASSET", qty=1000, to_address=address0)[0]
+
+        issue = self.assetissue.receive()
+        assert_equal(issue["txid"], txid)
+        assert_equal(issue["name"], "ZMQ_ASSET")
+        assert_equal(issue["amount"], 1000)
+        assert_equal(issue["address"], address0)
+        assert_equal(issue["confirmed"], False)
+        assert "blockhash" not in issue and "height" not in issue
+
+        owner = self.assetowner.receive()
+        assert_equal(owner["txid"], txid)
+        assert_equal(owner["name"], "ZMQ_ASSET!")
+        assert_equal(owner["new"], True)
+        assert_equal(owner["confirmed"], False)
+
+        blockhash = n0.generate(1)[0]
+        for message in [self.assetissue.receive(), self.assetowner.receive()]:
+            assert_equal(message["txid"], txid)
+            assert_equal(message["confirmed"], True)
+            assert_equal(message["blockhash"], blockhash)
+            assert_equal(message["height"], 433)
+
+        self.log.info("Transferring it")
+        address1 = n1.getnewaddress()
+        txid = n0.transfer(asset_name="ZMQ_ASSET", qty=10, to_address=address1)[0]
+        transfers = [self.assettransfer.receive(), self.assettransfer.receive()]
+        # The asset sent and the change
+        assert address1 in [t["address"] for t in transfers]
+        for transfer in transfers:
+            assert_equal(transfer["txid"], txid)
+            assert_equal(transfer["confirmed"], False)
+            assert "blockhash" not in transfer
+
+        blockhash = n0.generate(1)[0]
+        sync_blocks(self.nodes)
+        for transfer in [self.assettransfer.receive(), self.assettransfer.receive()]:
+            assert_equal(transfer["txid"], txid)
+            assert_equal(transfer["confirmed"], True)
+            assert_equal(transfer["blockhash"], blockhash)
+            assert_equal(transfer["height"], 434)
+
+        self.log.info("Disconnecting the block of the transfer")
+        n0.invalidateblock(blockhash)
+        # The disconnected block's outputs, and the transaction returning to the mempool
+        messages = [self.assettransfer.receive() for _ in range(4)]
+        disconnected = [m for m in messages if "blockhash" in m]
+        readded = [m for m in messages if "blockhash" not in m]
+        assert_equal(len(disconnected), 2)
+        assert_equal(len(readded), 2)
+        for message in messages:
+            assert_equal(message["txid"], txid)
+            assert_equal(message["confirmed"], False)
+        for message in disconnected:
+            assert_equal(message["blockhash"], blockhash)
+            assert_equal(message["height"], 434)
+
+if __name__ == '__main__':
+    ZMQAssetsTest().main()
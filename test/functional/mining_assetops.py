@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017-2018 The Raven Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the asset ops budget of the blocks the node creates.
+
+- Start a node with -blockmaxassetops=4.
+- Issue three assets, each with its owner token, so every issue has two asset outputs.
+- Only two of them fit into the next block, the third is left in the mempool
+  and mined in the block after.
+"""
+
+from test_framework.test_framework import RavenTestFramework
+from test_framework.util import assert_equal
+
+class AssetOpsBudgetTest(RavenTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+        self.extra_args = [["-blockmaxassetops=4"]]
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        self.log.info("Activating assets")
+        node.generate(432)
+        assert_equal("active", node.getblockchaininfo()['bip9_softforks']['assets']['status'])
+
+        self.log.info("Issuing three assets")
+        txids = [node.issue(asset_name="BUDGET_%d" % i, qty=1000)[0] for i in range(3)]
+        assert_equal(sorted(node.getrawmempool()), sorted(txids))
+
+        self.log.info("Mining a block with room for two issues")
+        block = node.getblock(node.generate(1)[0])
+        mined = [txid for txid in txids if txid in block['tx']]
+        assert_equal(len(mined), 2)
+        assert_equal(len(block['tx']), 3)
+        left = [txid for txid in txids if txid not in mined]
+        assert_equal(node.getrawmempool(), left)
+
+        self.log.info("Mining the last one in the next block")
+        block = node.getblock(node.generate(1)[0])
+        assert left[0] in block['tx']
+        assert_equal(node.getrawmempool(), [])
+
+if __name__ == '__main__':
+    AssetOpsBudgetTest().main()
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017-2018 The Raven Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test relaying blocks between nodes that process messages on several threads.
+
+- Start four nodes with -msghandlerthreads=4, each connected to all others.
+- Split the network and mine competing chains on both halves.
+- Join it again, so every node receives the other chain from several peers at
+  once and reorganizes while blocks keep arriving. All nodes must end up on the
+  same tip.
+"""
+
+from test_framework.test_framework import RavenTestFramework
+from test_framework.util import assert_equal, connect_nodes_bi, disconnect_nodes, sync_blocks
+
+class MsgHandlerThreadsTest(RavenTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 4
+        self.extra_args = [["-msghandlerthreads=4"]] * self.num_nodes
+
+    def setup_network(self):
+        self.setup_nodes()
+        for a in range(self.num_nodes):
+            for b in range(a + 1, self.num_nodes):
+                connect_nodes_bi(self.nodes, a, b)
+        self.sync_all()
+
+    def split(self):
+        for a in range(2):
+            for b in range(2, self.num_nodes):
+                disconnect_nodes(self.nodes[a], b)
+                disconnect_nodes(self.nodes[b], a)
+
+    def join(self):
+        for a in range(2):
+            for b in range(2, self.num_nodes):
+                connect_nodes_bi(self.nodes, a, b)
+
+    def run_test(self):
+        self.log.info("Mining on all nodes in turn")
+        for i in range(20):
+            self.nodes[i % self.num_nodes].generate(1)
+        self.sync_all()
+        assert_equal(self.nodes[0].getblockcount(), 20)
+
+        for round in range(3):
+            self.log.info("Reorganizing onto competing chains, round %d" % round)
+            self.split()
+            self.nodes[0].generate(5 + round)
+            self.nodes[2].generate(10 + round)
+            sync_blocks(self.nodes[:2])
+            sync_blocks(self.nodes[2:])
+            self.join()
+            # Blocks on both sides of the join, so the handlers connect some while they reorganize
+            self.nodes[1].generate(2)
+            self.nodes[3].generate(2)
+            self.sync_all()
+
+            tip = self.nodes[0].getbestblockhash()
+            for node in self.nodes:
+                assert_equal(node.getbestblockhash(), tip)
+                assert_equal(len([t for t in node.getchaintips() if t['status'] == 'active']), 1)
+
+if __name__ == '__main__':
+    MsgHandlerThreadsTest().main()
@@ -85,6 +85,7 @@ BASE_SCRIPTS= [
     'feature_assets_reorg.py',
     'feature_assets_mempool.py',
     'mining_prioritisetransaction.py',
+    'mining_assetops.py',
     'feature_maxreorgdepth.py 4 --height=60 --tip_age=0 --should_reorg=0',      # Don't Reorg
     'feature_maxreorgdepth.py 3 --height=60 --tip_age=0 --should_reorg=1',      # Reorg (low peer count)
     'feature_maxreorgdepth.py 4 --height=60 --tip_age=43400 --should_reorg=1',  # Reorg (not caught up)
@@ -97,12 +98,14 @@ BASE_SCRIPTS= [
     'rpc_timestampindex.py',
     'wallet_listreceivedby.py',
     'interface_rest.py',
+    'interface_rest_assets.py',
     'wallet_keypool_topup.py',
     'wallet_import_rescan.py',
     'wallet_abandonconflict.py',
     'rpc_blockchain.py',
     'p2p_feefilter.py',
     'p2p_leak.py',
+    'p2p_msghandlerthreads.py',
     'p2p_versionbits.py',
     'rpc_spentindex.py',
     'feature_rawassettransactions.py',
@@ -122,6 +125,7 @@ BASE_SCRIPTS= [
     'wallet_zapwallettxes.py',
     'wallet_multiwallet.py',
     'interface_zmq.py',
+    'interface_zmq_assets.py',
     'rpc_invalidateblock.py',
     # vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv Tests less than 3s vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv
     'rpc_getchaintips.py',